@@ -0,0 +1,348 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+#include <resynth.h>
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+// for command-line argument parsing
+#include "kyaa.h"
+#include "kyaa_extra.h"
+
+/*
+Benchmark of the hot paths: fixed workloads (generated, or cut from an image) run across thread counts,
+patch sizes and probe counts, reported as JSON: pixels per second, time per pass, peak RSS.
+Results are seeded: the hash of each result tells whether a change changed the output, not only its speed.
+Peak RSS is the process's high-water mark so far, so cases run in order of size, roughly.
+*/
+
+#define MAX_LIST 16
+
+typedef enum {
+    WORKLOAD_HEAL,      // a hole in the middle, surrounded by its source
+    WORKLOAD_TEXTURE,   // all of the image, tileable
+    WORKLOAD_OUTPAINT   // a band around the border, from the middle
+} workload_kind_t;
+
+typedef struct {
+    const char* name;
+    workload_kind_t kind;
+    int size;           // width and height
+    int quick_size;     // with --quick
+    int hole;           // edge, or width of the band when outpainting
+    int match_context;
+} workload_t;
+
+static const workload_t workloads[] = {
+    {"heal_small",      WORKLOAD_HEAL,     128,  96,  32, 2},
+    {"heal_large",      WORKLOAD_HEAL,     512, 256, 160, 2},
+    {"texture_tile",    WORKLOAD_TEXTURE,  192, 128,   0, 0},
+    {"outpaint_ctx2",   WORKLOAD_OUTPAINT, 192, 128,  32, 2},
+    {"outpaint_ctx3",   WORKLOAD_OUTPAINT, 192, 128,  32, 3},
+    {"outpaint_ctx4",   WORKLOAD_OUTPAINT, 192, 128,  32, 4},
+    {"outpaint_ctx5",   WORKLOAD_OUTPAINT, 192, 128,  32, 5},
+    {"outpaint_ctx6",   WORKLOAD_OUTPAINT, 192, 128,  32, 6},
+    {"outpaint_ctx7",   WORKLOAD_OUTPAINT, 192, 128,  32, 7},
+    {"outpaint_ctx8",   WORKLOAD_OUTPAINT, 192, 128,  32, 8},
+    {"outpaint_ctx9",   WORKLOAD_OUTPAINT, 192, 128,  32, 9},
+    {"outpaint_ctx10",  WORKLOAD_OUTPAINT, 192, 128,  32, 10},
+};
+
+typedef struct {
+    long values[MAX_LIST];
+    int count;
+} list_t;
+
+static double now_seconds(void) {
+    struct timespec t;
+    timespec_get(&t, TIME_UTC);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static long peak_rss_bytes(void) {
+#ifndef _WIN32
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+    return usage.ru_maxrss;
+#else
+    return usage.ru_maxrss * 1024L;
+#endif
+#else
+    return 0;
+#endif
+}
+
+// comma separated longs, e.g. "1,2,4"
+static bool parse_list(const char* text, list_t* list) {
+    list->count = 0;
+    while (*text != '\0') {
+        char* end;
+        long value = strtol(text, &end, 10);
+        if (end == text || list->count == MAX_LIST) return false;
+        list->values[list->count++] = value;
+        text = (*end == ',') ? end + 1 : end;
+        if (*end != ',' && *end != '\0') return false;
+    }
+    return list->count > 0;
+}
+
+static int compare_doubles(const void* a, const void* b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+// A deterministic image with structure at a few scales: stripes, checkers and noise
+static uint8_t* generate_image(int size) {
+    uint8_t* pixels = malloc((size_t)size * size * 3);
+    uint32_t noise = 2463534242u;
+    for (int y = 0; y < size; ++y) {
+        for (int x = 0; x < size; ++x) {
+            uint8_t* pixel = pixels + ((size_t)y * size + x) * 3;
+            noise ^= noise << 13; noise ^= noise >> 17; noise ^= noise << 5;
+            pixel[0] = (uint8_t)((x * 7 + y * 3) % 256);
+            pixel[1] = (uint8_t)(((x / 8 + y / 8) % 2) * 160 + (noise & 63));
+            pixel[2] = (uint8_t)((x * x + y) % 97 * 2);
+        }
+    }
+    return pixels;
+}
+
+typedef struct {
+    uint8_t* pixels;    // RGB
+    size_t width, height;
+} loaded_image_t;
+
+// Binary PPM (P6, maxval 255): simple enough to read here, e.g. converted from anything by ImageMagick
+static bool load_ppm(const char* fn, loaded_image_t* image) {
+    FILE* file = fopen(fn, "rb");
+    int maxval = 0;
+    bool ok = file != NULL
+        && fscanf(file, "P6 %zu %zu %d", &image->width, &image->height, &maxval) == 3
+        && maxval == 255 && fgetc(file) != EOF && image->width > 0 && image->height > 0;
+    if (ok) {
+        size_t bytes = image->width * image->height * 3;
+        image->pixels = malloc(bytes);
+        ok = fread(image->pixels, 1, bytes, file) == bytes;
+    }
+    if (file != NULL) fclose(file);
+    return ok;
+}
+
+// The middle of the loaded image, scaled to size by nearest neighbor when smaller
+static uint8_t* cut_image(const loaded_image_t* loaded, int size) {
+    size_t width = loaded->width, height = loaded->height;
+    const uint8_t* source = loaded->pixels;
+    uint8_t* pixels = malloc((size_t)size * size * 3);
+    for (int y = 0; y < size; ++y) {
+        for (int x = 0; x < size; ++x) {
+            size_t sx = width >= (size_t)size ? (width - size) / 2 + x : x * width / size;
+            size_t sy = height >= (size_t)size ? (height - size) / 2 + y : y * height / size;
+            memcpy(pixels + ((size_t)y * size + x) * 3, source + (sy * width + sx) * 3, 3);
+        }
+    }
+    return pixels;
+}
+
+// Target mask of a workload, or NULL for all of the image. Counts target pixels.
+static uint8_t* make_target_mask(const workload_t* workload, int size, size_t* target_count) {
+    if (workload->kind == WORKLOAD_TEXTURE) {
+        *target_count = (size_t)size * size;
+        return NULL;
+    }
+    uint8_t* mask = calloc((size_t)size * size, 1);
+    int hole = workload->hole * size / workload->size;
+    int low = (size - hole) / 2, high = low + hole;
+    *target_count = 0;
+    for (int y = 0; y < size; ++y) {
+        for (int x = 0; x < size; ++x) {
+            bool inside = x >= low && x < high && y >= low && y < high;
+            bool border = x < hole || y < hole || x >= size - hole || y >= size - hole;
+            bool target = workload->kind == WORKLOAD_HEAL ? inside : border;
+            mask[(size_t)y * size + x] = target ? 255 : 0;
+            *target_count += target;
+        }
+    }
+    return mask;
+}
+
+static uint64_t hash_pixels(const uint8_t* pixels, size_t count) {
+    uint64_t hash = 1469598103934665603ULL;
+    for (size_t i = 0; i < count; ++i) hash = (hash ^ pixels[i]) * 1099511628211ULL;
+    return hash;
+}
+
+static void run_case(FILE* out, bool* first, const workload_t* workload, int size, const uint8_t* image,
+                     long threads, long neighbors, long tries, int repeats) {
+    size_t target_count;
+    uint8_t* mask = make_target_mask(workload, size, &target_count);
+    uint8_t* source_mask = NULL;
+    double seconds[64];
+    resynth_metrics_t metrics = {0};
+    uint64_t hash = 0;
+
+    resynth_state_t state = resynth_state_create_from_memory((uint8_t*)image, size, size, 3, 1);
+    resynth_parameters_t params = resynth_parameters_create();
+    if (workload->kind == WORKLOAD_TEXTURE) {
+        resynth_parameters_operation(params, RESYNTH_OPERATION_TEXTURE);
+        resynth_parameters_h_tile(params, true);
+        resynth_parameters_v_tile(params, true);
+    } else {
+        resynth_parameters_operation(params, RESYNTH_OPERATION_HEAL);
+        source_mask = malloc((size_t)size * size);
+        for (size_t i = 0; i < (size_t)size * size; ++i) source_mask[i] = 255 - mask[i];
+        resynth_parameters_mask(params, mask, size, size, RESYNTH_MASK_TARGET);
+        resynth_parameters_mask(params, source_mask, size, size, RESYNTH_MASK_SOURCE);
+    }
+    resynth_parameters_match_context(params, workload->match_context);
+    resynth_parameters_threads(params, (int)threads);
+    resynth_parameters_neighbors(params, (int)neighbors);
+    resynth_parameters_tries(params, (int)tries);
+    resynth_parameters_random_seed(params, 1198472);
+
+    for (int repeat = 0; repeat < repeats; ++repeat) {
+        double start = now_seconds();
+        resynth_result_t result = resynth_run(state, params);
+        seconds[repeat] = now_seconds() - start;
+        if (repeat == 0) {
+            // The first run's passes and hash: the same for every run only when single threaded
+            metrics = resynth_result_metrics(result);
+            hash = hash_pixels(resynth_result_pixels(result), (size_t)size * size * 3);
+        }
+        resynth_free_result(result);
+    }
+    qsort(seconds, repeats, sizeof(double), compare_doubles);
+    double median = seconds[repeats / 2];
+
+    fprintf(out, "%s\n    {\"workload\": \"%s\", \"width\": %d, \"height\": %d, \"target_pixels\": %zu, "
+            "\"match_context\": %d, \"threads\": %ld, \"neighbors\": %ld, \"tries\": %ld,\n"
+            "     \"seconds_min\": %.6f, \"seconds_median\": %.6f, \"pixels_per_second\": %.1f, "
+            "\"peak_rss_bytes\": %ld, \"hash\": \"%016llx\",\n     \"passes\": [",
+            *first ? "" : ",", workload->name, size, size, target_count, workload->match_context,
+            threads, neighbors, tries, seconds[0], median, median > 0 ? target_count / median : 0.0,
+            peak_rss_bytes(), (unsigned long long)hash);
+    for (size_t pass = 0; pass < metrics.pass_count; ++pass) {
+        const resynth_pass_metrics_t* p = &metrics.passes[pass];
+        fprintf(out, "%s{\"seconds\": %.6f, \"targets\": %llu, \"probes\": %llu, \"early_outs\": %llu, "
+                "\"betters\": %llu}", pass ? ", " : "", p->seconds, (unsigned long long)p->targets,
+                (unsigned long long)p->probes, (unsigned long long)p->early_outs, (unsigned long long)p->betters);
+    }
+    fprintf(out, "]}");
+    fflush(out);
+    *first = false;
+
+    resynth_free_parameters(params);
+    resynth_free_state(state);
+    free(source_mask);
+    free(mask);
+}
+
+
+int main(int argc, char** argv) {
+    list_t threads = {{1, 0}, 2};
+    list_t neighbors = {{9, 29}, 2};
+    list_t tries = {{64, 192}, 2};
+    int repeats = 3;
+    bool quick = false;
+    const char* only = NULL;
+    const char* image_fn = NULL;
+    const char* out_fn = NULL;
+
+    KYAA_LOOP {
+        KYAA_BEGIN
+
+        KYAA_FLAG_ARG('T', "threads",
+"        comma separated counts of threads, 0 for all processors\n"
+"                            default: 1,0")
+            if (!parse_list(kyaa_etc, &threads)) {
+                fprintf(stderr, "fatal error: bad list: %s\n", kyaa_etc);
+                return 1;
+            }
+
+        KYAA_FLAG_ARG('N', "neighbors",
+"        comma separated patch sizes\n"
+"                            default: 9,29")
+            if (!parse_list(kyaa_etc, &neighbors)) {
+                fprintf(stderr, "fatal error: bad list: %s\n", kyaa_etc);
+                return 1;
+            }
+
+        KYAA_FLAG_ARG('M', "tries",
+"        comma separated counts of random probes\n"
+"                            default: 64,192")
+            if (!parse_list(kyaa_etc, &tries)) {
+                fprintf(stderr, "fatal error: bad list: %s\n", kyaa_etc);
+                return 1;
+            }
+
+        KYAA_FLAG_LONG('r', "repeats",
+"        runs of each case, the median is reported\n"
+"        range: [1,64];      default: 3")
+            repeats = kyaa_long_value < 1 ? 1 : kyaa_long_value > 64 ? 64 : (int)kyaa_long_value;
+
+        KYAA_FLAG('q', "quick",
+"        smaller images, e.g. for a smoke test")
+            quick = true;
+
+        KYAA_FLAG_ARG('w', "workload",
+"        run only the workloads whose name starts with this\n"
+"                            default: [all]")
+            only = kyaa_etc;
+
+        KYAA_FLAG_ARG('i', "image",
+"        cut workloads from this binary PPM (P6) image instead of generating them\n"
+"                            default: [generated]")
+            image_fn = kyaa_etc;
+
+        KYAA_FLAG_ARG('o', "output",
+"        file to write the JSON report to\n"
+"                            default: [stdout]")
+            out_fn = kyaa_etc;
+
+        KYAA_HELP("")
+
+        KYAA_END
+
+        fprintf(stderr, "fatal error: unexpected argument: %s\n", kyaa_arg);
+        return 1;
+    }
+
+    loaded_image_t loaded = {NULL, 0, 0};
+    if (image_fn != NULL && !load_ppm(image_fn, &loaded)) {
+        fprintf(stderr, "fatal error: not a binary PPM: %s\n", image_fn);
+        return 1;
+    }
+
+    FILE* out = out_fn ? fopen(out_fn, "w") : stdout;
+    if (out == NULL) {
+        fprintf(stderr, "fatal error: cannot write: %s\n", out_fn);
+        return 1;
+    }
+
+    fprintf(out, "{\"benchmark\": \"resynth_bench\", \"repeats\": %d, \"quick\": %s, \"source\": \"%s\",\n"
+            " \"results\": [", repeats, quick ? "true" : "false", image_fn ? image_fn : "generated");
+    bool first = true;
+    for (size_t w = 0; w < sizeof(workloads) / sizeof(workloads[0]); ++w) {
+        const workload_t* workload = &workloads[w];
+        if (only != NULL && strncmp(workload->name, only, strlen(only)) != 0) continue;
+
+        int size = quick ? workload->quick_size : workload->size;
+        uint8_t* image = loaded.pixels ? cut_image(&loaded, size) : generate_image(size);
+        for (int t = 0; t < threads.count; ++t)
+            for (int n = 0; n < neighbors.count; ++n)
+                for (int m = 0; m < tries.count; ++m)
+                    run_case(out, &first, workload, size, image,
+                             threads.values[t], neighbors.values[n], tries.values[m], repeats);
+        free(image);
+    }
+    fprintf(out, "\n ]}\n");
+
+    if (out != stdout) fclose(out);
+    free(loaded.pixels);
+    return 0;
+}
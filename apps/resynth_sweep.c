@@ -0,0 +1,491 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <math.h>
+#include <time.h>
+#include <dlfcn.h>
+#include <resynth.h>
+
+// for command-line argument parsing
+#include "kyaa.h"
+#include "kyaa_extra.h"
+
+/*
+Quality versus time of both backends, over a grid of parameters, to choose the cheapest settings good enough.
+
+Both backends export the same API, so each is a module loaded at run time (see src/CMakeLists.txt),
+called through a table of its functions. Each synthesizes a tileable texture of every input, for every
+point of the grid, and the result is scored:
+  patch_nn_error: for patches of the result, the RMS pixelel difference to the nearest patch of the input.
+                  Low when the result is made of the input's texture, high for smears and noise.
+  seam_energy:    squared differences across the edges where the result wraps around, relative to those
+                  between neighbors inside it. About 1 when tiles join unseen.
+Reported as JSON: every point, then per input the Pareto frontier of seconds against each score
+(settings no other setting beats on both), and the cheapest point meeting the quality bars, if given.
+*/
+
+#define MAX_LIST 16
+#define MAX_INPUTS 8
+#define MAX_POINTS 4096
+#define NN_RADIUS 2     // patches of 5 x 5 pixels
+
+typedef struct {
+    const char* name;
+    void* module;
+    resynth_state_t (*state_create_from_memory)(uint8_t*, size_t, size_t, size_t, int);
+    resynth_parameters_t (*parameters_create)(void);
+    void (*parameters_h_tile)(resynth_parameters_t, bool);
+    void (*parameters_v_tile)(resynth_parameters_t, bool);
+    void (*parameters_neighbors)(resynth_parameters_t, int);
+    void (*parameters_tries)(resynth_parameters_t, int);
+    void (*parameters_magic)(resynth_parameters_t, int);
+    void (*parameters_random_seed)(resynth_parameters_t, unsigned long);
+    void (*parameters_threads)(resynth_parameters_t, int);
+    resynth_result_t (*run)(resynth_state_t, resynth_parameters_t);
+    bool (*result_valid)(resynth_result_t);
+    uint8_t* (*result_pixels)(resynth_result_t);
+    void (*free_result)(resynth_result_t);
+    void (*free_parameters)(resynth_parameters_t);
+    void (*free_state)(resynth_state_t);
+    bool has_magic;     // whether magic is a parameter, else it is not swept
+} backend_t;
+
+typedef struct {
+    long values[MAX_LIST];
+    int count;
+} list_t;
+
+typedef struct {
+    const char* name;
+    uint8_t* pixels;    // RGB, size x size
+} input_t;
+
+typedef struct {
+    int input;
+    const char* backend;
+    long neighbors, tries, magic, threads;
+    double seconds;
+    double nn_error;
+    double seam_energy;
+    bool valid;
+} point_t;
+
+static point_t points[MAX_POINTS];
+static int point_count = 0;
+
+#define LOAD(backend, field) \
+    (*(void**)(&(backend)->field) = dlsym((backend)->module, "resynth_" #field)) != NULL
+
+static bool load_backend(backend_t* backend, const char* name, const char* path, bool has_magic) {
+    memset(backend, 0, sizeof(backend_t));
+    backend->name = name;
+    backend->has_magic = has_magic;
+    backend->module = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    if (backend->module == NULL) {
+        fprintf(stderr, "cannot load the %s backend: %s\n", name, dlerror());
+        return false;
+    }
+    if (LOAD(backend, state_create_from_memory) && LOAD(backend, parameters_create)
+        && LOAD(backend, parameters_h_tile) && LOAD(backend, parameters_v_tile)
+        && LOAD(backend, parameters_neighbors) && LOAD(backend, parameters_tries)
+        && LOAD(backend, parameters_magic) && LOAD(backend, parameters_random_seed)
+        && LOAD(backend, parameters_threads) && LOAD(backend, run)
+        && LOAD(backend, result_valid) && LOAD(backend, result_pixels) && LOAD(backend, free_result)
+        && LOAD(backend, free_parameters) && LOAD(backend, free_state)) {
+        return true;
+    }
+    fprintf(stderr, "the %s backend lacks a function: %s\n", name, dlerror());
+    dlclose(backend->module);
+    backend->module = NULL;
+    return false;
+}
+
+static double now_seconds(void) {
+    struct timespec t;
+    timespec_get(&t, TIME_UTC);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+// comma separated longs, e.g. "1,2,4"
+static bool parse_list(const char* text, list_t* list) {
+    list->count = 0;
+    while (*text != '\0') {
+        char* end;
+        long value = strtol(text, &end, 10);
+        if (end == text || list->count == MAX_LIST) return false;
+        list->values[list->count++] = value;
+        text = (*end == ',') ? end + 1 : end;
+        if (*end != ',' && *end != '\0') return false;
+    }
+    return list->count > 0;
+}
+
+// Deterministic textures: stripes and checkers with noise, and soft blobs
+static uint8_t* generate_image(int kind, int size) {
+    uint8_t* pixels = malloc((size_t)size * size * 3);
+    uint32_t noise = 2463534242u;
+    for (int y = 0; y < size; ++y) {
+        for (int x = 0; x < size; ++x) {
+            uint8_t* pixel = pixels + ((size_t)y * size + x) * 3;
+            noise ^= noise << 13; noise ^= noise >> 17; noise ^= noise << 5;
+            if (kind == 0) {
+                pixel[0] = (uint8_t)((x * 7 + y * 3) % 256);
+                pixel[1] = (uint8_t)(((x / 8 + y / 8) % 2) * 160 + (noise & 63));
+                pixel[2] = (uint8_t)((x * x + y) % 97 * 2);
+            } else {
+                double v = sin(x * 0.31) * cos(y * 0.23) + sin((x + y) * 0.11);
+                pixel[0] = (uint8_t)(128 + 60 * v + (noise & 15));
+                pixel[1] = (uint8_t)(100 + 50 * sin(v * 3));
+                pixel[2] = (uint8_t)(90 + 40 * v * v);
+            }
+        }
+    }
+    return pixels;
+}
+
+// Binary PPM (P6, maxval 255), its middle cut to size, scaled by nearest neighbor if smaller
+static uint8_t* load_ppm(const char* fn, int size) {
+    FILE* file = fopen(fn, "rb");
+    size_t width = 0, height = 0;
+    int maxval = 0;
+    uint8_t* image = NULL;
+    uint8_t* pixels = NULL;
+    if (file != NULL && fscanf(file, "P6 %zu %zu %d", &width, &height, &maxval) == 3
+        && maxval == 255 && fgetc(file) != EOF && width > 0 && height > 0) {
+        image = malloc(width * height * 3);
+        if (fread(image, 1, width * height * 3, file) == width * height * 3) {
+            pixels = malloc((size_t)size * size * 3);
+            for (int y = 0; y < size; ++y) {
+                for (int x = 0; x < size; ++x) {
+                    size_t sx = width >= (size_t)size ? (width - size) / 2 + x : x * width / size;
+                    size_t sy = height >= (size_t)size ? (height - size) / 2 + y : y * height / size;
+                    memcpy(pixels + ((size_t)y * size + x) * 3, image + (sy * width + sx) * 3, 3);
+                }
+            }
+        }
+    }
+    if (file != NULL) fclose(file);
+    free(image);
+    return pixels;
+}
+
+/*
+Mean over patches of the result (centered every stride pixels, wrapping around: the result tiles)
+of the RMS difference to the nearest patch wholly inside the input. Exhaustive, with early outs.
+*/
+static double patch_nn_error(const uint8_t* result, const uint8_t* input, int size, int stride) {
+    const int side = 2 * NN_RADIUS + 1;
+    const long pixelels = side * side * 3;
+    double total = 0;
+    int samples = 0;
+    uint8_t patch[(2 * NN_RADIUS + 1) * (2 * NN_RADIUS + 1) * 3];
+
+    for (int y = 0; y < size; y += stride) {
+        for (int x = 0; x < size; x += stride) {
+            for (int dy = 0; dy < side; ++dy)
+                for (int dx = 0; dx < side; ++dx)
+                    memcpy(patch + (dy * side + dx) * 3,
+                           result + ((size_t)((y + dy - NN_RADIUS + size) % size) * size
+                                     + (x + dx - NN_RADIUS + size) % size) * 3, 3);
+            long best = LONG_MAX;
+            for (int cy = 0; cy + side <= size && best > 0; ++cy) {
+                for (int cx = 0; cx + side <= size && best > 0; ++cx) {
+                    long sum = 0;
+                    for (int dy = 0; dy < side && sum < best; ++dy) {
+                        const uint8_t* row = input + ((size_t)(cy + dy) * size + cx) * 3;
+                        const uint8_t* mine = patch + dy * side * 3;
+                        for (int i = 0; i < side * 3; ++i) {
+                            long d = (long)row[i] - mine[i];
+                            sum += d * d;
+                        }
+                    }
+                    if (sum < best) best = sum;
+                }
+            }
+            total += sqrt((double)best / pixelels);
+            samples++;
+        }
+    }
+    return samples ? total / samples : 0;
+}
+
+// Mean squared difference across the wrap-around edges, over that between neighbors inside
+static double seam_energy(const uint8_t* result, int size) {
+    double seam = 0, inside = 0;
+    long seam_count = 0, inside_count = 0;
+    for (int y = 0; y < size; ++y) {
+        for (int x = 0; x < size; ++x) {
+            const uint8_t* pixel = result + ((size_t)y * size + x) * 3;
+            const uint8_t* right = result + ((size_t)y * size + (x + 1) % size) * 3;
+            const uint8_t* below = result + ((size_t)((y + 1) % size) * size + x) * 3;
+            for (int c = 0; c < 3; ++c) {
+                double dr = (double)pixel[c] - right[c], db = (double)pixel[c] - below[c];
+                if (x == size - 1) { seam += dr * dr; seam_count++; } else { inside += dr * dr; inside_count++; }
+                if (y == size - 1) { seam += db * db; seam_count++; } else { inside += db * db; inside_count++; }
+            }
+        }
+    }
+    inside /= inside_count;
+    return inside > 0 ? (seam / seam_count) / inside : 0;
+}
+
+static int compare_doubles(const void* a, const void* b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+static void run_point(const backend_t* backend, int input_index, const input_t* input, int size,
+                      long neighbors, long tries, long magic, long threads, int repeats, int stride) {
+    double seconds[64];
+    point_t* point = &points[point_count++];
+
+    point->input = input_index;
+    point->backend = backend->name;
+    point->neighbors = neighbors;
+    point->tries = tries;
+    point->magic = magic;
+    point->threads = threads;
+    point->valid = true;
+
+    for (int repeat = 0; repeat < repeats; ++repeat) {
+        // A state per run: a backend may synthesize into it
+        resynth_state_t state = backend->state_create_from_memory(input->pixels, size, size, 3, 1);
+        resynth_parameters_t params = backend->parameters_create();
+        backend->parameters_h_tile(params, true);
+        backend->parameters_v_tile(params, true);
+        backend->parameters_neighbors(params, (int)neighbors);
+        backend->parameters_tries(params, (int)tries);
+        if (backend->has_magic) backend->parameters_magic(params, (int)magic);
+        backend->parameters_random_seed(params, 1198472);
+        backend->parameters_threads(params, (int)threads);
+
+        double start = now_seconds();
+        resynth_result_t result = backend->run(state, params);
+        seconds[repeat] = now_seconds() - start;
+
+        if (repeat == 0) {
+            point->valid = backend->result_valid(result);
+            point->nn_error = patch_nn_error(backend->result_pixels(result), input->pixels, size, stride);
+            point->seam_energy = seam_energy(backend->result_pixels(result), size);
+        }
+        backend->free_result(result);
+        backend->free_parameters(params);
+        backend->free_state(state);
+    }
+    qsort(seconds, repeats, sizeof(double), compare_doubles);
+    point->seconds = seconds[repeats / 2];
+}
+
+static double score(const point_t* point, int metric) {
+    return metric == 0 ? point->nn_error : point->seam_energy;
+}
+
+// Points of the input no other point beats on both seconds and the score, by seconds
+static void write_frontier(FILE* out, int input, int metric) {
+    int frontier[MAX_POINTS];
+    int count = 0;
+    for (int i = 0; i < point_count; ++i) {
+        const point_t* p = &points[i];
+        bool dominated = false;
+        if (p->input != input || !p->valid) continue;
+        for (int j = 0; j < point_count && !dominated; ++j) {
+            const point_t* q = &points[j];
+            if (j == i || q->input != input || !q->valid) continue;
+            dominated = q->seconds <= p->seconds && score(q, metric) <= score(p, metric)
+                && (q->seconds < p->seconds || score(q, metric) < score(p, metric));
+        }
+        if (dominated) continue;
+        // Insertion by seconds: frontiers are short
+        int k = count++;
+        while (k > 0 && points[frontier[k - 1]].seconds > p->seconds) {
+            frontier[k] = frontier[k - 1];
+            k--;
+        }
+        frontier[k] = i;
+    }
+    for (int k = 0; k < count; ++k) fprintf(out, "%s%d", k ? ", " : "", frontier[k]);
+}
+
+int main(int argc, char** argv) {
+    list_t neighbors = {{9, 16, 29, 49}, 4};
+    list_t tries = {{32, 64, 128, 192}, 4};
+    list_t magic = {{64, 128, 192}, 3};
+    list_t threads = {{1}, 1};
+    int size = 96;
+    int repeats = 1;
+    int stride = 3;
+    double max_nn_error = -1, max_seam_energy = -1;
+    const char* backends = "gimp,notwa";
+    const char* out_fn = NULL;
+    input_t inputs[MAX_INPUTS];
+    int input_count = 0;
+
+    KYAA_LOOP {
+        KYAA_BEGIN
+
+        KYAA_FLAG_ARG('N', "neighbors",
+"        comma separated patch sizes\n"
+"                            default: 9,16,29,49")
+            if (!parse_list(kyaa_etc, &neighbors)) {
+                fprintf(stderr, "fatal error: bad list: %s\n", kyaa_etc);
+                return 1;
+            }
+
+        KYAA_FLAG_ARG('M', "tries",
+"        comma separated counts of random probes\n"
+"                            default: 32,64,128,192")
+            if (!parse_list(kyaa_etc, &tries)) {
+                fprintf(stderr, "fatal error: bad list: %s\n", kyaa_etc);
+                return 1;
+            }
+
+        KYAA_FLAG_ARG('m', "magic",
+"        comma separated magic constants, for backends that have one\n"
+"                            default: 64,128,192")
+            if (!parse_list(kyaa_etc, &magic)) {
+                fprintf(stderr, "fatal error: bad list: %s\n", kyaa_etc);
+                return 1;
+            }
+
+        KYAA_FLAG_ARG('T', "threads",
+"        comma separated counts of threads, 0 for all processors\n"
+"                            default: 1")
+            if (!parse_list(kyaa_etc, &threads)) {
+                fprintf(stderr, "fatal error: bad list: %s\n", kyaa_etc);
+                return 1;
+            }
+
+        KYAA_FLAG_ARG('b', "backends",
+"        comma separated backends to compare\n"
+"                            default: gimp,notwa")
+            backends = kyaa_etc;
+
+        KYAA_FLAG_LONG('s', "size",
+"        edge of inputs and results, in pixels\n"
+"        range: [16,1024];   default: 96")
+            size = kyaa_long_value < 16 ? 16 : kyaa_long_value > 1024 ? 1024 : (int)kyaa_long_value;
+
+        KYAA_FLAG_LONG('r', "repeats",
+"        runs of each point, the median time is reported\n"
+"        range: [1,64];      default: 1")
+            repeats = kyaa_long_value < 1 ? 1 : kyaa_long_value > 64 ? 64 : (int)kyaa_long_value;
+
+        KYAA_FLAG_LONG('S', "stride",
+"        pixels between patches scored for patch_nn_error\n"
+"        range: [1,64];      default: 3")
+            stride = kyaa_long_value < 1 ? 1 : kyaa_long_value > 64 ? 64 : (int)kyaa_long_value;
+
+        KYAA_FLAG_ARG('e', "max-nn-error",
+"        quality bar of patch_nn_error, for the cheapest point meeting it\n"
+"                            default: [none]")
+            max_nn_error = atof(kyaa_etc);
+
+        KYAA_FLAG_ARG('E', "max-seam-energy",
+"        quality bar of seam_energy, for the cheapest point meeting it\n"
+"                            default: [none]")
+            max_seam_energy = atof(kyaa_etc);
+
+        KYAA_FLAG_ARG('o', "output",
+"        file to write the JSON report to\n"
+"                            default: [stdout]")
+            out_fn = kyaa_etc;
+
+        KYAA_HELP("  {files...}\n"
+"        binary PPM (P6) inputs, their middles cut to size\n"
+"                            default: [two generated textures]")
+
+        KYAA_END
+
+        if (input_count == MAX_INPUTS) {
+            fprintf(stderr, "fatal error: more than %d inputs\n", MAX_INPUTS);
+            return 1;
+        }
+        inputs[input_count].name = kyaa_arg;
+        inputs[input_count].pixels = load_ppm(kyaa_arg, size);
+        if (inputs[input_count].pixels == NULL) {
+            fprintf(stderr, "fatal error: not a binary PPM: %s\n", kyaa_arg);
+            return 1;
+        }
+        input_count++;
+    }
+    if (input_count == 0) {
+        inputs[0] = (input_t){"generated_stripes", generate_image(0, size)};
+        inputs[1] = (input_t){"generated_blobs", generate_image(1, size)};
+        input_count = 2;
+    }
+
+    backend_t loaded[2];
+    int backend_count = 0;
+    if (strstr(backends, "gimp") && load_backend(&loaded[backend_count], "gimp", RESYNTH_BACKEND_GIMP, false))
+        backend_count++;
+    if (strstr(backends, "notwa") && load_backend(&loaded[backend_count], "notwa", RESYNTH_BACKEND_NOTWA, true))
+        backend_count++;
+    if (backend_count == 0) {
+        fprintf(stderr, "fatal error: no backend\n");
+        return 1;
+    }
+
+    for (int i = 0; i < input_count; ++i)
+        for (int b = 0; b < backend_count; ++b)
+            for (int t = 0; t < threads.count; ++t)
+                for (int n = 0; n < neighbors.count; ++n)
+                    for (int m = 0; m < tries.count; ++m)
+                        for (int g = 0; g < (loaded[b].has_magic ? magic.count : 1); ++g) {
+                            if (point_count == MAX_POINTS) {
+                                fprintf(stderr, "fatal error: more than %d points\n", MAX_POINTS);
+                                return 1;
+                            }
+                            run_point(&loaded[b], i, &inputs[i], size, neighbors.values[n], tries.values[m],
+                                      loaded[b].has_magic ? magic.values[g] : -1, threads.values[t],
+                                      repeats, stride);
+                        }
+
+    FILE* out = out_fn ? fopen(out_fn, "w") : stdout;
+    if (out == NULL) {
+        fprintf(stderr, "fatal error: cannot write: %s\n", out_fn);
+        return 1;
+    }
+    fprintf(out, "{\"tool\": \"resynth_sweep\", \"size\": %d, \"repeats\": %d,\n \"points\": [", size, repeats);
+    for (int i = 0; i < point_count; ++i) {
+        const point_t* p = &points[i];
+        fprintf(out, "%s\n    {\"id\": %d, \"input\": \"%s\", \"backend\": \"%s\", \"neighbors\": %ld, "
+                "\"tries\": %ld, ", i ? "," : "", i, inputs[p->input].name, p->backend, p->neighbors, p->tries);
+        if (p->magic >= 0) fprintf(out, "\"magic\": %ld, ", p->magic);
+        else fprintf(out, "\"magic\": null, ");
+        fprintf(out, "\"threads\": %ld, \"valid\": %s, \"seconds\": %.6f, \"patch_nn_error\": %.4f, "
+                "\"seam_energy\": %.4f}", p->threads, p->valid ? "true" : "false", p->seconds, p->nn_error,
+                p->seam_energy);
+    }
+    fprintf(out, "\n ],\n \"frontiers\": [");
+    for (int i = 0; i < input_count; ++i) {
+        for (int metric = 0; metric < 2; ++metric) {
+            fprintf(out, "%s\n    {\"input\": \"%s\", \"metric\": \"%s\", \"points\": [", (i || metric) ? "," : "",
+                    inputs[i].name, metric == 0 ? "patch_nn_error" : "seam_energy");
+            write_frontier(out, i, metric);
+            fprintf(out, "]}");
+        }
+    }
+    fprintf(out, "\n ],\n \"cheapest\": [");
+    for (int i = 0; i < input_count; ++i) {
+        int cheapest = -1;
+        for (int j = 0; j < point_count; ++j) {
+            const point_t* p = &points[j];
+            if (p->input != i || !p->valid) continue;
+            if (max_nn_error >= 0 && p->nn_error > max_nn_error) continue;
+            if (max_seam_energy >= 0 && p->seam_energy > max_seam_energy) continue;
+            if (cheapest < 0 || p->seconds < points[cheapest].seconds) cheapest = j;
+        }
+        fprintf(out, "%s\n    {\"input\": \"%s\", \"point\": ", i ? "," : "", inputs[i].name);
+        if (cheapest >= 0) fprintf(out, "%d}", cheapest);
+        else fprintf(out, "null}");
+    }
+    fprintf(out, "\n ]}\n");
+
+    if (out != stdout) fclose(out);
+    for (int b = 0; b < backend_count; ++b) dlclose(loaded[b].module);
+    for (int i = 0; i < input_count; ++i) free(inputs[i].pixels);
+    return 0;
+}
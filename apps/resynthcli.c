@@ -1,8 +1,14 @@
 #include <stdio.h>
 #include <stdbool.h>
+#include <stdlib.h>
 #include <string.h>
 #include <limits.h>
+#include <time.h>
 #include <resynth.h>
+#ifndef _WIN32
+#include <pthread.h>
+#include <unistd.h>
+#endif
 
 // for command-line argument parsing
 #include "kyaa.h"
@@ -40,6 +46,451 @@ static char *manipulate_filename(const char *fn,
 }
 
 
+// the flags in effect for a file: those before it on the command line
+typedef struct {
+    int autism;
+    int neighbors;
+    int tries;
+    int magic;
+    unsigned long seed;
+    int threads;    // per image, 0: all cores
+    int tile_size;  // streamed in tiles of this size, 0: whole
+    const char *corpus_fn;  // streamed: the source, NULL: the image itself
+} options_t;
+
+// a file through the stages of a run: decode, synthesize, encode
+typedef struct {
+    const char *fn;
+    options_t options;
+    resynth_state_t state;
+    resynth_parameters_t params;
+    resynth_job_t job;              // batch mode, set when synthesized
+    struct pipeline_s *pipeline;    // batch mode
+    double decode_seconds;
+    double synth_seconds;
+    double encode_seconds;
+    bool ok;
+} item_t;
+
+static double now_seconds(void) {
+    struct timespec t;
+    timespec_get(&t, TIME_UTC);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static void decode_item(item_t *item) {
+    double start = now_seconds();
+    item->state = resynth_state_create_from_image(item->fn, 3, 1);
+    item->decode_seconds = now_seconds() - start;
+}
+
+static resynth_parameters_t create_parameters(const options_t *options) {
+    resynth_parameters_t params = resynth_parameters_create();
+    resynth_parameters_outlier_sensitivity(params, options->autism);
+    resynth_parameters_neighbors(params, options->neighbors);
+    resynth_parameters_magic(params, options->magic);
+    resynth_parameters_tries(params, options->tries);
+    resynth_parameters_random_seed(params, options->seed);
+    resynth_parameters_threads(params, options->threads);
+    return params;
+}
+
+// writes the result and frees the item's state and parameters: the item keeps its name and timings
+static void encode_item(item_t *item, resynth_result_t result) {
+    double start = now_seconds();
+    char *out_fn = manipulate_filename(item->fn, ".resynth.png");
+    puts(out_fn);
+    item->ok = resynth_result_valid(result)
+            && stbi_write_png(out_fn,
+                              resynth_result_width(result),
+                              resynth_result_height(result),
+                              resynth_result_channels(result),
+                              resynth_result_pixels(result),
+                              0);
+    if (!item->ok) {
+        fprintf(stderr, "failed to write: %s\n", out_fn);
+    }
+    item->synth_seconds = resynth_result_metrics(result).seconds;
+    item->encode_seconds = now_seconds() - start;
+
+    free(out_fn);
+    resynth_free_result(result);
+    resynth_free_parameters(item->params);
+    resynth_free_state(item->state);
+    item->params = NULL;
+    item->state = NULL;
+}
+
+static void failed_to_read(item_t *item) {
+    fprintf(stderr, "failed to read: %s\n", item->fn);
+    item->ok = false;
+}
+
+/*
+Streamed mode: the image maps in place where it is a binary PPM or PAM (else it is decoded),
+and synthesizes in square tiles, in raster order, through resynth_run_tiled(). The output is a row-streamed
+PPM (PAM with alpha): only the band of tiles being synthesized, and the halo of rows above it that its tiles
+read as context, are held. Each band is written once all its tiles are, so memory is in proportion to the
+width of the image, not its size; the source is the image itself, or a smaller exemplar given by --corpus.
+*/
+#define STREAM_HALO 32
+typedef struct {
+    const uint8_t *in;      // the input, read in place
+    size_t in_stride;
+    size_t width;
+    size_t height;
+    size_t channels;
+    size_t tile_size;
+    size_t band_top;        // rows of the band of tiles being synthesized
+    size_t band_end;
+    size_t kept_top;        // the first row held, a halo above the band
+    uint8_t *rows;          // rows [kept_top, band_end)
+    FILE *out;
+    double write_seconds;
+} stream_t;
+
+static uint8_t *stream_row(stream_t *stream, size_t y) {
+    return stream->rows + (y - stream->kept_top) * stream->width * stream->channels;
+}
+
+// writes the band, which is finished, and holds the next, from the input, under the halo of this one
+static bool stream_next_band(stream_t *stream) {
+    size_t row_bytes = stream->width * stream->channels;
+    size_t band_rows = stream->band_end - stream->band_top;
+    double start = now_seconds();
+    bool ok = fwrite(stream_row(stream, stream->band_top), row_bytes, band_rows, stream->out) == band_rows;
+    stream->write_seconds += now_seconds() - start;
+
+    size_t kept_top = stream->band_end > STREAM_HALO ? stream->band_end - STREAM_HALO : 0;
+    if (kept_top < stream->kept_top) kept_top = stream->kept_top;
+    memmove(stream->rows, stream_row(stream, kept_top), (stream->band_end - kept_top) * row_bytes);
+    stream->kept_top = kept_top;
+    stream->band_top = stream->band_end;
+    stream->band_end += stream->tile_size;
+    if (stream->band_end > stream->height) stream->band_end = stream->height;
+    for (size_t y = stream->band_top; y < stream->band_end; y++) {
+        memcpy(stream_row(stream, y), stream->in + y * stream->in_stride, row_bytes);
+    }
+    return ok;
+}
+
+// rows below the band are the input's; those above the halo are written, and never read again
+static bool stream_read(void *userdata, size_t x, size_t y, size_t width, size_t height,
+                        uint8_t *pixels, size_t stride) {
+    stream_t *stream = userdata;
+    if (y < stream->kept_top) return false;
+    for (size_t row = 0; row < height; row++) {
+        const uint8_t *from = y + row < stream->band_end ? stream_row(stream, y + row)
+                                                          : stream->in + (y + row) * stream->in_stride;
+        memcpy(pixels + row * stride, from + x * stream->channels, width * stream->channels);
+    }
+    return true;
+}
+
+static bool stream_write(void *userdata, size_t x, size_t y, size_t width, size_t height,
+                         uint8_t *pixels, size_t stride) {
+    stream_t *stream = userdata;
+    // tiles come in raster order: the first of a band below finishes the one held
+    while (y >= stream->band_end) {
+        if (!stream_next_band(stream)) return false;
+    }
+    if (y < stream->band_top) return false;
+    for (size_t row = 0; row < height; row++) {
+        memcpy(stream_row(stream, y + row) + x * stream->channels, pixels + row * stride, width * stream->channels);
+    }
+    return true;
+}
+
+static resynth_state_t open_streamed(const char *fn, int channels) {
+    resynth_state_t state = resynth_state_create_from_mapped(fn);
+    return state ? state : resynth_state_create_from_image(fn, channels, 1);
+}
+
+static void stream_item(item_t *item) {
+    double start = now_seconds();
+    const uint8_t *pixels;
+    stream_t stream = {0};
+    resynth_state_t corpus = NULL;
+
+    item->state = open_streamed(item->fn, 3);
+    if (item->state == NULL) {
+        failed_to_read(item);
+        return;
+    }
+    pixels = resynth_state_pixels(item->state, &stream.width, &stream.height, &stream.channels, &stream.in_stride);
+    if (item->options.corpus_fn) {
+        size_t width, height, channels = 0, stride;
+        corpus = open_streamed(item->options.corpus_fn, (int)stream.channels);
+        if (corpus) resynth_state_pixels(corpus, &width, &height, &channels, &stride);
+        if (channels != stream.channels) {
+            if (corpus) resynth_free_state(corpus);
+            fprintf(stderr, "failed to read a corpus of %d channels: %s\n",
+                    (int)stream.channels, item->options.corpus_fn);
+            resynth_free_state(item->state);
+            item->state = NULL;
+            item->ok = false;
+            return;
+        }
+    }
+    item->decode_seconds = now_seconds() - start;
+
+    char *out_fn = manipulate_filename(item->fn, stream.channels == 4 ? ".resynth.pam" : ".resynth.ppm");
+    puts(out_fn);
+    stream.in = pixels;
+    stream.tile_size = item->options.tile_size;
+    stream.band_end = stream.tile_size < stream.height ? stream.tile_size : stream.height;
+    stream.rows = malloc((stream.tile_size + STREAM_HALO) * stream.width * stream.channels);
+    stream.out = fopen(out_fn, "wb");
+    item->ok = stream.rows != NULL && stream.out != NULL;
+    if (item->ok) {
+        if (stream.channels == 4) {
+            fprintf(stream.out, "P7\nWIDTH %zu\nHEIGHT %zu\nDEPTH 4\nMAXVAL 255\nTUPLTYPE RGB_ALPHA\nENDHDR\n",
+                    stream.width, stream.height);
+        } else {
+            fprintf(stream.out, "P6\n%zu %zu\n255\n", stream.width, stream.height);
+        }
+        for (size_t y = 0; y < stream.band_end; y++) {
+            memcpy(stream_row(&stream, y), pixels + y * stream.in_stride, stream.width * stream.channels);
+        }
+
+        start = now_seconds();
+        item->params = create_parameters(&item->options);
+        item->ok = resynth_run_tiled(item->params, stream.width, stream.height, stream.channels,
+                                     stream_read, NULL, stream_write, &stream,
+                                     corpus ? corpus : item->state, stream.tile_size, STREAM_HALO);
+        // the bands after the last tile written
+        while (item->ok && stream.band_top < stream.height) {
+            item->ok = stream_next_band(&stream);
+        }
+        item->synth_seconds = now_seconds() - start - stream.write_seconds;
+    }
+    if (stream.out != NULL && fclose(stream.out) != 0) {
+        item->ok = false;
+    }
+    if (!item->ok) {
+        fprintf(stderr, "failed to write: %s\n", out_fn);
+    }
+    item->encode_seconds = stream.write_seconds;
+
+    free(out_fn);
+    free(stream.rows);
+    if (item->params) resynth_free_parameters(item->params);
+    if (corpus) resynth_free_state(corpus);
+    resynth_free_state(item->state);
+    item->params = NULL;
+    item->state = NULL;
+}
+
+static void run_sequential(item_t *items, int count) {
+    for (int i = 0; i < count; i++) {
+        item_t *item = &items[i];
+        if (item->options.tile_size > 0) {
+            stream_item(item);
+            continue;
+        }
+        decode_item(item);
+        if (item->state == NULL) {
+            failed_to_read(item);
+            continue;
+        }
+        item->params = create_parameters(&item->options);
+        encode_item(item, resynth_run(item->state, item->params));
+    }
+}
+
+#ifndef _WIN32
+/*
+Batch mode: decoding, synthesis and encoding are stages on threads of their own,
+handing items on through bounded queues, so reading and writing files overlap synthesis.
+Up to jobs images synthesize at once, as jobs of the library's worker pool (resynth_run_async()),
+each on its share of the cores, while the next is decoded and the last encoded: at most jobs + 2 items
+are in flight, from their decoding until they are written. That bounds memory as well as the queues,
+so the callback of a job never waits on a full queue.
+*/
+#define PIPELINE_IO_ITEMS 2
+typedef struct {
+    item_t **items;
+    int capacity;
+    int head;
+    int count;
+    bool closed;
+    pthread_mutex_t mutex;
+    pthread_cond_t changed;
+} queue_t;
+
+static void queue_init(queue_t *queue, int capacity) {
+    queue->items = calloc(capacity, sizeof(item_t *));
+    queue->capacity = capacity;
+    queue->head = 0;
+    queue->count = 0;
+    queue->closed = false;
+    pthread_mutex_init(&queue->mutex, NULL);
+    pthread_cond_init(&queue->changed, NULL);
+}
+
+static void queue_destroy(queue_t *queue) {
+    pthread_cond_destroy(&queue->changed);
+    pthread_mutex_destroy(&queue->mutex);
+    free(queue->items);
+}
+
+static void queue_push(queue_t *queue, item_t *item) {
+    pthread_mutex_lock(&queue->mutex);
+    while (queue->count == queue->capacity) {
+        pthread_cond_wait(&queue->changed, &queue->mutex);
+    }
+    queue->items[(queue->head + queue->count) % queue->capacity] = item;
+    queue->count++;
+    pthread_cond_broadcast(&queue->changed);
+    pthread_mutex_unlock(&queue->mutex);
+}
+
+// the next item, or NULL once the queue is closed and empty
+static item_t *queue_pop(queue_t *queue) {
+    pthread_mutex_lock(&queue->mutex);
+    while (queue->count == 0 && !queue->closed) {
+        pthread_cond_wait(&queue->changed, &queue->mutex);
+    }
+    item_t *item = NULL;
+    if (queue->count > 0) {
+        item = queue->items[queue->head];
+        queue->head = (queue->head + 1) % queue->capacity;
+        queue->count--;
+        pthread_cond_broadcast(&queue->changed);
+    }
+    pthread_mutex_unlock(&queue->mutex);
+    return item;
+}
+
+static void queue_close(queue_t *queue) {
+    pthread_mutex_lock(&queue->mutex);
+    queue->closed = true;
+    pthread_cond_broadcast(&queue->changed);
+    pthread_mutex_unlock(&queue->mutex);
+}
+
+typedef struct pipeline_s {
+    item_t *items;
+    int count;
+    int jobs;
+    int in_flight;      // items decoded or decoding, not yet written
+    int synthesizing;   // of them, submitted and not yet done
+    pthread_mutex_t mutex;
+    pthread_cond_t changed;
+    queue_t decoded;    // to synthesize
+    queue_t finished;   // synthesized, to encode
+} pipeline_t;
+
+static void *decode_stage(void *arg) {
+    pipeline_t *pipeline = arg;
+    for (int i = 0; i < pipeline->count; i++) {
+        pthread_mutex_lock(&pipeline->mutex);
+        while (pipeline->in_flight == pipeline->jobs + PIPELINE_IO_ITEMS) {
+            pthread_cond_wait(&pipeline->changed, &pipeline->mutex);
+        }
+        pipeline->in_flight++;
+        pthread_mutex_unlock(&pipeline->mutex);
+
+        decode_item(&pipeline->items[i]);
+        queue_push(&pipeline->decoded, &pipeline->items[i]);
+    }
+    queue_close(&pipeline->decoded);
+    return NULL;
+}
+
+// on the job's thread, maybe before resynth_run_async() returns: the job is known from here only
+static void synthesized(resynth_job_t job, void *userdata) {
+    item_t *item = userdata;
+    item->job = job;
+    queue_push(&item->pipeline->finished, item);
+}
+
+static void *encode_stage(void *arg) {
+    pipeline_t *pipeline = arg;
+    item_t *item;
+    while ((item = queue_pop(&pipeline->finished)) != NULL) {
+        if (item->job != NULL) {
+            resynth_result_t result = resynth_job_wait(item->job);
+            // the next image synthesizes while this one is encoded
+            pthread_mutex_lock(&pipeline->mutex);
+            pipeline->synthesizing--;
+            pthread_cond_broadcast(&pipeline->changed);
+            pthread_mutex_unlock(&pipeline->mutex);
+            encode_item(item, result);
+            resynth_free_job(item->job);
+            item->job = NULL;
+        }
+        pthread_mutex_lock(&pipeline->mutex);
+        pipeline->in_flight--;
+        pthread_cond_broadcast(&pipeline->changed);
+        pthread_mutex_unlock(&pipeline->mutex);
+    }
+    return NULL;
+}
+
+static void run_pipelined(item_t *items, int count, int jobs) {
+    pipeline_t pipeline = {items, count, jobs, 0, 0};
+    pthread_t decoder;
+    pthread_t encoder;
+    item_t *item;
+
+    pthread_mutex_init(&pipeline.mutex, NULL);
+    pthread_cond_init(&pipeline.changed, NULL);
+    queue_init(&pipeline.decoded, jobs + PIPELINE_IO_ITEMS);
+    queue_init(&pipeline.finished, jobs + PIPELINE_IO_ITEMS);
+    pthread_create(&decoder, NULL, decode_stage, &pipeline);
+    pthread_create(&encoder, NULL, encode_stage, &pipeline);
+
+    // this thread submits the jobs
+    while ((item = queue_pop(&pipeline.decoded)) != NULL) {
+        if (item->state == NULL) {
+            failed_to_read(item);
+            queue_push(&pipeline.finished, item);
+            continue;
+        }
+        pthread_mutex_lock(&pipeline.mutex);
+        while (pipeline.synthesizing == jobs) {
+            pthread_cond_wait(&pipeline.changed, &pipeline.mutex);
+        }
+        pipeline.synthesizing++;
+        pthread_mutex_unlock(&pipeline.mutex);
+        item->params = create_parameters(&item->options);
+        item->pipeline = &pipeline;
+        resynth_run_async(item->state, item->params, synthesized, item);
+    }
+
+    pthread_join(decoder, NULL);
+    // every item decoded is pushed to finished, by this thread or by a job: wait until all are written
+    pthread_mutex_lock(&pipeline.mutex);
+    while (pipeline.in_flight > 0) {
+        pthread_cond_wait(&pipeline.changed, &pipeline.mutex);
+    }
+    pthread_mutex_unlock(&pipeline.mutex);
+    queue_close(&pipeline.finished);
+    pthread_join(encoder, NULL);
+
+    queue_destroy(&pipeline.decoded);
+    queue_destroy(&pipeline.finished);
+    pthread_cond_destroy(&pipeline.changed);
+    pthread_mutex_destroy(&pipeline.mutex);
+}
+#endif
+
+static void report_timings(const item_t *items, int count, double seconds) {
+    double decode = 0, synth = 0, encode = 0;
+    fprintf(stderr, "%-40s %9s %9s %9s\n", "file", "decode", "synth", "encode");
+    for (int i = 0; i < count; i++) {
+        const item_t *item = &items[i];
+        fprintf(stderr, "%-40s %8.3fs %8.3fs %8.3fs%s\n", item->fn,
+                item->decode_seconds, item->synth_seconds, item->encode_seconds, item->ok ? "" : "  failed");
+        decode += item->decode_seconds;
+        synth += item->synth_seconds;
+        encode += item->encode_seconds;
+    }
+    fprintf(stderr, "%-40s %8.3fs %8.3fs %8.3fs\n", "sum", decode, synth, encode);
+    fprintf(stderr, "%d files in %.3fs\n", count, seconds);
+}
+
 int main(int argc, char** argv) {
     int ret = 0;
     int scale = 1;
@@ -48,6 +499,12 @@ int main(int argc, char** argv) {
     int tries = 192;
     int magic = 192;
     unsigned long seed = 0;
+    int jobs = 0;
+    bool timings = false;
+    int tile_size = 0;
+    const char *corpus_fn = NULL;
+    item_t *items = NULL;
+    int count = 0;
 
     KYAA_LOOP {
         KYAA_BEGIN
@@ -82,6 +539,37 @@ int main(int argc, char** argv) {
 "                            default: 0 [time(0)]")
             seed = (unsigned long) kyaa_long_value;
 
+        KYAA_FLAG_LONG('j', "jobs",
+"        images synthesized at once, in a pipeline with decoding and encoding;\n"
+"        0 synthesizes one at a time, with all cores\n"
+"        range: [0,256];     default: 0")
+            if (kyaa_long_value < 0 || kyaa_long_value > 256) {
+                KYAA_ERR("out of range for --jobs: %ld\n", kyaa_long_value);
+                return KYAA_FAIL;
+            }
+            jobs = kyaa_long_value;
+
+        KYAA_FLAG('t', "timings",
+"        report the time of each stage, per file, when done;\n"
+"        always with --jobs")
+            timings = true;
+
+        KYAA_FLAG_LONG('T', "tile",
+"        synthesize streamed, in tiles of this size, with near constant memory:\n"
+"        PPM and PAM files map in place, output is {filename}.resynth.ppm (.pam);\n"
+"        one file at a time, without --jobs; 0 synthesizes whole images\n"
+"        range: [0,65536];   default: 0")
+            if (kyaa_long_value < 0 || kyaa_long_value > 65536) {
+                KYAA_ERR("out of range for --tile: %ld\n", kyaa_long_value);
+                return KYAA_FAIL;
+            }
+            tile_size = kyaa_long_value;
+
+        KYAA_FLAG_ARG('C', "corpus",
+"        source of the streamed files, e.g. a small exemplar of them\n"
+"                            default: [each file itself]")
+            corpus_fn = kyaa_etc;
+
         KYAA_HELP("  {files...}\n"
 "        image files to open, resynthesize, and save as {filename}.resynth.png\n"
 "        required            default: [none]")
@@ -93,36 +581,35 @@ int main(int argc, char** argv) {
             exit(1);
         }
 
-        const char *fn = kyaa_arg;
-
-        resynth_state_t state = resynth_state_create_from_image(fn, 3, 1);
-        resynth_parameters_t params = resynth_parameters_create();
-        resynth_parameters_outlier_sensitivity(params, autism);
-        resynth_parameters_neighbors(params, neighbors);
-        resynth_parameters_magic(params, magic);
-        resynth_parameters_tries(params, tries);
-        resynth_parameters_random_seed(params, seed);
-
-        resynth_result_t result = resynth_run(state, params);
-
-        char *out_fn = manipulate_filename(fn, ".resynth.png");
-        puts(out_fn);
-        int write_result = stbi_write_png(out_fn, 
-                                    resynth_result_width(result), 
-                                    resynth_result_height(result), 
-                                    resynth_result_channels(result), 
-                                    resynth_result_pixels(result), 
-                                    0);
-        if (!write_result) {
-            fprintf(stderr, "failed to write: %s\n", out_fn);
-            ret--;
-        }
+        items = realloc(items, (count + 1) * sizeof(item_t));
+        items[count] = (item_t) {kyaa_arg, {autism, neighbors, tries, magic, seed, 0, tile_size, corpus_fn}};
+        count++;
+    }
 
-        free(out_fn);
-        resynth_free_result(result);
-        resynth_free_parameters(params);
-        resynth_free_state(state);
+    double start = now_seconds();
+#ifndef _WIN32
+    bool streamed = false;
+    for (int i = 0; i < count; i++) {
+        streamed |= items[i].options.tile_size > 0;
     }
+    if (jobs > 0 && count > 1 && !streamed) {
+        // the cores shared by the images synthesizing at once
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        int threads = cores > jobs ? (int)(cores / jobs) : 1;
+        for (int i = 0; i < count; i++) {
+            items[i].options.threads = threads;
+        }
+        run_pipelined(items, count, jobs);
+    } else
+#endif
+    run_sequential(items, count);
 
+    for (int i = 0; i < count; i++) {
+        if (!items[i].ok) ret--;
+    }
+    if (timings || jobs > 0) {
+        report_timings(items, count, now_seconds() - start);
+    }
+    free(items);
     return ret;
 }
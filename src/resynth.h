@@ -25,13 +25,25 @@ extern "C" {
 struct _Resynth_state;
 struct _Parameters;
 struct _Resynth_result;
+struct _Resynth_cache;
+struct _Resynth_corpus;
+struct _Resynth_workspace;
+struct _Resynth_job;
 typedef struct _Resynth_state Resynth_state;
 typedef struct _Parameters Parameters;
 typedef struct _Resynth_result Resynth_result;
+typedef struct _Resynth_cache Resynth_cache;
+typedef struct _Resynth_corpus Resynth_corpus;
+typedef struct _Resynth_workspace Resynth_workspace;
+typedef struct _Resynth_job Resynth_job;
 
 typedef Resynth_result* resynth_result_t;
 typedef Resynth_state* resynth_state_t;
 typedef Parameters* resynth_parameters_t;
+typedef Resynth_cache* resynth_cache_t;
+typedef Resynth_corpus* resynth_corpus_t;
+typedef Resynth_workspace* resynth_workspace_t;
+typedef Resynth_job* resynth_job_t;
 
 typedef enum {
     RESYNTH_OPERATION_TEXTURE,
@@ -43,6 +55,78 @@ typedef enum {
     RESYNTH_MASK_TARGET
 } resynth_mask_type_t;
 
+/* Reports the percent of a run done so far. Called at most once per percent, one call at a time,
+   but possibly on any of the run's threads. See resynth_parameters_progress(). */
+typedef void (*resynth_progress_callback_t)(int percent, void* userdata);
+
+/* Shows a run's image after a pass of refinement: complete (the first pass synthesizes every target pixel), though
+   not yet refined. pixels are where the run writes its result (floats for resynth_run_intof(), else bytes), rows
+   stride bytes apart, readable during the call only. Called on the thread running the engine, which waits.
+   See resynth_parameters_preview(). */
+typedef void (*resynth_preview_callback_t)(int pass, const void* pixels, size_t stride, void* userdata);
+
+/* Reads or writes the pixels of the rectangle (x, y, width, height) of a streamed image, rows stride bytes apart.
+   Returns whether it succeeded. See resynth_run_tiled(). */
+typedef bool (*resynth_tile_callback_t)(void* userdata, size_t x, size_t y, size_t width, size_t height,
+                                        uint8_t* pixels, size_t stride);
+
+/* Counts of a result cache, see resynth_cache_create(). */
+typedef struct {
+    size_t hits;        /* served from memory */
+    size_t disk_hits;   /* served from the directory */
+    size_t misses;
+    size_t evictions;   /* from memory */
+    size_t entries;     /* in memory now */
+    size_t bytes;       /* of pixels in memory now */
+} resynth_cache_stats_t;
+
+/* Passes over the target, at most */
+#define RESYNTH_MAX_PASSES 6
+
+/* Counts of one pass of a run, see resynth_result_metrics(). */
+typedef struct {
+    double seconds;             /* wall time */
+    uint64_t targets;           /* target pixels synthesized */
+    uint64_t probes;            /* source pixels whose patch was compared */
+    uint64_t early_outs;        /* probes given up before the end of the patch, as no better */
+    uint64_t perfect_matches;
+    uint64_t neighbor_wins;     /* targets whose best source was found next to the sources of neighbors */
+    uint64_t index_wins;        /* ... among candidates of the patch index */
+    uint64_t random_wins;       /* ... by random probes */
+    uint64_t betters;           /* targets given a new source: few end the passes */
+    uint64_t gpu_probes;        /* of probes, those compared on a GPU, see resynth_parameters_gpu() */
+    uint64_t cascade_rejects;   /* of early_outs, those given up before their patch, see resynth_parameters_cascade() */
+} resynth_pass_metrics_t;
+
+/* Metrics of a run. Passes of every level of the pyramid add up, by pass. */
+typedef struct {
+    double seconds;             /* wall time of the run */
+    size_t pass_count;          /* 0 when served from the cache */
+    double schedule_done;       /* fraction of the passes and probes scheduled that ran: below 1 if cut by
+                                   resynth_parameters_time_budget() */
+    resynth_pass_metrics_t passes[RESYNTH_MAX_PASSES];
+} resynth_metrics_t;
+
+/* Counts of a workspace, see resynth_workspace_create(). */
+typedef struct {
+    size_t allocations; /* of blocks from the heap */
+    size_t reuses;      /* of blocks freed by earlier allocations */
+    size_t bytes;       /* held */
+} resynth_workspace_stats_t;
+
+/* Of resynth_result_correspondence(), a pixel not synthesized */
+#define RESYNTH_NO_SOURCE 0xFFFFFFFFu
+
+/* A layer (e.g. normals, roughness of a material) remapped by resynth_result_apply(): bytes per pixel channels.
+   Rows are stride bytes apart, not 0. */
+typedef struct {
+    const uint8_t* source;  /* the layer of the run's source: of the state, or of the prepared corpus */
+    size_t source_stride;
+    uint8_t* pixels;        /* OUT of the result, written where synthesized only; not the source, but for heals */
+    size_t stride;
+    size_t channels;
+} resynth_layer_t;
+
 /* Image and Buffer Loading */
 resynth_state_t
 resynth_state_create_from_image(const char* filename, int desired_channels, int scale);
@@ -50,9 +134,31 @@ resynth_state_create_from_image(const char* filename, int desired_channels, int
 resynth_state_t
 resynth_state_create_from_memory(uint8_t* pixels, size_t width, size_t height, size_t channels, int scale);
 
+/* Borrows the pixels instead of copying them: they must outlive the state. Only read, except by resynth_run_into().
+   stride is the bytes from one row to the next, or 0 for rows of width * channels bytes. */
+resynth_state_t
+resynth_state_create_from_buffer(uint8_t* pixels, size_t width, size_t height, size_t channels, size_t stride);
+
 resynth_state_t
 resynth_state_create_from_memoryf(float* pixels, size_t width, size_t height, size_t channels, int scale);
 
+/* Float version of resynth_state_create_from_buffer(): borrows pixels in [0,1], converted as the engine reads them.
+   stride is in bytes, as above, or 0 for rows of width * channels floats. */
+resynth_state_t
+resynth_state_create_from_bufferf(float* pixels, size_t width, size_t height, size_t channels, size_t stride);
+
+/* Maps a binary PPM (P6) or PAM (P7, RGB or RGB_ALPHA) file of 8 bit channels, for the engine to read in place:
+   nothing is decoded nor copied, pages are read as the engine reaches them. Copy on write: resynth_run_into()
+   the state's own pixels never changes the file. Unmapped by resynth_free_state(). NULL if the file is not such
+   an image, or the backend (or platform) does not map files: then resynth_state_create_from_image() decodes it. */
+resynth_state_t
+resynth_state_create_from_mapped(const char* filename);
+
+/* The state's pixels, rows *stride bytes apart, e.g. to stream those of a mapped file to resynth_run_tiled().
+   NULL for a float state. */
+const uint8_t*
+resynth_state_pixels(resynth_state_t state, size_t* width, size_t* height, size_t* channels, size_t* stride);
+
 /* Config */
 resynth_parameters_t
 resynth_parameters_create();
@@ -60,6 +166,14 @@ resynth_parameters_create();
 void
 resynth_parameters_operation(resynth_parameters_t parameters, resynth_operation_t operation);
 
+/* Order in which the target is synthesized, and whether it matches its context. Set by the operation (0 for
+   texture, 2 for heal), so set it after. 0 ignores the context, 1 matches it in random order, 2 inward in bands
+   from the context, 3 and 4 inward horizontally or vertically, 5 to 7 the same outward (e.g. to extend an image),
+   8 in and out at once (e.g. a ring with context on both sides). 9 along a jittered space filling curve, cache
+   friendly (faster for large targets), 10 the same in bands inward. */
+void
+resynth_parameters_match_context(resynth_parameters_t parameters, int type);
+
 void
 resynth_parameters_mask(resynth_parameters_t parameters, uint8_t* pixels, size_t width, size_t height, resynth_mask_type_t type);
 
@@ -84,11 +198,232 @@ resynth_parameters_magic(resynth_parameters_t parameters, int magic);
 void
 resynth_parameters_random_seed(resynth_parameters_t parameters, unsigned long seed);
 
+/* Count of threads synthesizing. 0 (default) uses every processor available to the process,
+   respecting CPU affinity and cgroup CPU quotas. */
+void
+resynth_parameters_threads(resynth_parameters_t parameters, int threads);
+
+/* Schedule threads over square tiles of tile_size pixels, with work stealing between threads,
+   instead of interleaving them pixel by pixel. 0 (default) interleaves. */
+void
+resynth_parameters_tile_scheduling(resynth_parameters_t parameters, int tile_size);
+
+/* Count of levels of resolution, synthesized coarse to fine. 0 or 1 (default) is full resolution only.
+   Faster for large images: finer levels are seeded by coarser ones and need fewer probes. */
+void
+resynth_parameters_pyramid(resynth_parameters_t parameters, int levels);
+
+/* Probe candidates from an index of the source instead of random points. 0 candidates (default) is no index.
+   A larger radius (pixels, default 2) costs more to build the index, but fewer candidates suffice. */
+void
+resynth_parameters_patch_index(resynth_parameters_t parameters, int candidates, int radius);
+
+/* Make the result the same for a seed whatever the count of threads, still in parallel. Off (default): threads
+   race, so threaded results vary from run to run. On is somewhat slower, and ignores tile scheduling. */
+void
+resynth_parameters_deterministic(resynth_parameters_t parameters, bool deterministic);
+
+/* Compare the random probes on a GPU, when there is one (through OpenCL, loaded at run time), many targets at once.
+   Without a GPU, on the CPU: the result is the same. On also turns on resynth_parameters_deterministic(), whose
+   batches of targets the GPU takes, and off leaves it as last set. Moot with a patch index. */
+void
+resynth_parameters_gpu(resynth_parameters_t parameters, bool gpu);
+
+/* Whether resynth_parameters_gpu() finds a GPU. The first call looks for one. */
+bool
+resynth_gpu_present(void);
+
+/* Give up on a random probe before comparing its patch when a bound, from sums of the pixels around it and
+   around the target, shows it no better than the best so far. The bound is exact: the result is the same.
+   Faster mostly for large patches; costs memory per source pixel. Off by default. */
+void
+resynth_parameters_cascade(resynth_parameters_t parameters, bool cascade);
+
+/* Heal only a window around the target: its bounding box widened by margin pixels, whose context is then
+   the whole source. 0 (default) heals from the whole image. Faster for a small target in a large image;
+   pixels outside the window are left as they are. Moot to textures. */
+void
+resynth_parameters_roi(resynth_parameters_t parameters, int margin);
+
+/* Serve runs from the cache when the same image, masks and parameters (but the count of threads) ran before,
+   else cache their results. NULL (default) is no cache. The cache must outlive runs with the parameters.
+   Applies to resynth_run(), resynth_run_into() and resynth_run_intof(), not to streamed runs. */
+void
+resynth_parameters_cache(resynth_parameters_t parameters, resynth_cache_t cache);
+
+/* Synthesize from a prepared corpus instead of from the state: the state's image (any size) is the target
+   where the target mask selects it (default all of it), context elsewhere. Also the corpus of resynth_run_tiled()
+   and resynth_run_region(), instead of their corpus state. NULL (default) is none. The corpus must outlive runs
+   with the parameters. */
+void
+resynth_parameters_corpus(resynth_parameters_t parameters, resynth_corpus_t corpus);
+
+/* Recycle the engine's memory of runs with the parameters from the workspace, instead of the heap.
+   NULL (default) is none. The workspace must outlive runs with the parameters. */
+void
+resynth_parameters_workspace(resynth_parameters_t parameters, resynth_workspace_t workspace);
+
+/* Finish runs with the parameters within about seconds from their start: nearing it, fewer random probes per
+   target, then no more passes but the first (so the target is always complete). 0 (default) is no budget.
+   A run cut short is not cached; see schedule_done of its metrics. Not for streamed runs. */
+void
+resynth_parameters_time_budget(resynth_parameters_t parameters, double seconds);
+
+/* Report the progress of runs with the parameters to callback. NULL (default) is none, at no cost:
+   the library itself never prints progress. */
+void
+resynth_parameters_progress(resynth_parameters_t parameters, resynth_progress_callback_t callback, void* userdata);
+
+/* Preview runs with the parameters: callback after each pass but the last, the first after roughly one pass of the
+   run's time. With resynth_run_async(), refinement goes on in the background meanwhile. NULL (default) is none.
+   Not for runs served from a cache, nor streamed runs. */
+void
+resynth_parameters_preview(resynth_parameters_t parameters, resynth_preview_callback_t callback, void* userdata);
+
+/* Results of resynth_run() and resynth_run_async() with the parameters keep where each pixel came from, see
+   resynth_result_correspondence(). Off by default: 4 bytes per pixel. Runs keeping it skip the cache. */
+void
+resynth_parameters_correspondence(resynth_parameters_t parameters, bool keep);
+
+
+/* Prepared Corpus */
+/* A source prepared once for many runs (other sizes, seeds, masks): adapted, indexed (see
+   resynth_parameters_patch_index()) and downsampled (see resynth_parameters_pyramid()) for the parameters.
+   Runs with other parameters prepare what those change themselves. Only read by runs: shareable by concurrent
+   runs. mask is one byte per pixel of the state, 255 selecting the source, or NULL for all of it. The state is
+   not kept. NULL if the backend does not prepare corpora, or nothing is selected. */
+resynth_corpus_t
+resynth_corpus_create(resynth_state_t source, uint8_t* mask, resynth_parameters_t parameters);
+
+/* A corpus of several sources, e.g. a library of exemplars, for runs to synthesize from all of them as from one:
+   as resynth_corpus_create(), but the sources are packed together, a patch apart, not composited into a padded
+   canvas: random probes and heuristics reach only their pixels, and memory is in proportion to theirs.
+   masks is NULL, or one per source (each NULL for all of it). NULL as for resynth_corpus_create(), or if the
+   sources have not one channel count, or if packed they have 2^32 - 1 pixels or more (see
+   resynth_result_correspondence()), or memory runs out. */
+resynth_corpus_t
+resynth_corpus_create_multi(const resynth_state_t* sources, uint8_t* const* masks, size_t count,
+                            resynth_parameters_t parameters);
+
+/* Where a source of the corpus is packed: its top left corner, e.g. to tell from a correspondence
+   (see resynth_result_correspondence()) which source a pixel came from. Source 0 of resynth_corpus_create()
+   is at 0, 0. False if there is no such source. */
+bool
+resynth_corpus_placement(resynth_corpus_t corpus, size_t index, size_t* x, size_t* y);
+
+/* The size of the corpus, its sources packed: the width is what a correspondence from it indexes by (see
+   resynth_result_correspondence()). False if the backend does not prepare corpora. */
+bool
+resynth_corpus_size(resynth_corpus_t corpus, size_t* width, size_t* height);
+
+
+/* Workspace */
+/* Memory for runs, kept between them: grows to the largest run seen, so that runs of similar size one after
+   another allocate (almost) nothing from the heap. For one run at a time: give concurrent runs their own.
+   NULL if the backend does not recycle memory. */
+resynth_workspace_t
+resynth_workspace_create(void);
+
+resynth_workspace_stats_t
+resynth_workspace_stats(resynth_workspace_t workspace);
+
+
+/* Result Cache */
+/* A cache of results, keyed by a hash of all they depend on, shareable by parameters and threads.
+   Keeps up to max_bytes of results in memory, least recently used evicted first, and if directory is not NULL
+   also one file per result in that existing directory, never pruned here: e.g. to share between processes.
+   NULL if the backend does not cache. Without resynth_parameters_deterministic(), a cached threaded result
+   is one of the results the run could have had. */
+resynth_cache_t
+resynth_cache_create(size_t max_bytes, const char* directory);
+
+resynth_cache_stats_t
+resynth_cache_stats(resynth_cache_t cache);
+
 
 /* Processing and Results */ 
+/* Estimate of the peak bytes resynth_run() will allocate, beyond the state, including the result.
+   An upper bound, roughly. 0 if the backend does not estimate. */
+size_t
+resynth_estimate_memory(resynth_state_t state, resynth_parameters_t parameters);
+
+/* Synthesizes the state's image. Reentrant: runs may go on at once on the caller's threads, without locks.
+   Parameters are only read, so runs may share them. Give each run its own state, unless the backend only reads
+   states (GIMP's does; notwa's synthesizes into the state) or a run synthesizes into it in place. */
 resynth_result_t 
 resynth_run(resynth_state_t state, resynth_parameters_t parameters);
 
+/* Re-heals after the target mask (of the parameters) changed a little since the previous result, from a run of the
+   same state kept with its correspondence (see resynth_parameters_correspondence()): synthesizes only what the new
+   mask adds, and a band a patch wide around every change, in time with the change, not the hole. The rest of the
+   target keeps its previous pixels and sources, as context, unless its source is now in the mask: then it is
+   synthesized too. The result keeps its correspondence, for the next.
+   Otherwise (not a heal, a prepared corpus, no previous correspondence) a full resynth_run(). Skips the cache. */
+resynth_result_t
+resynth_run_incremental(resynth_state_t state, resynth_parameters_t parameters, resynth_result_t previous);
+
+/* Like resynth_run(), but writes the synthesized image (width * height pixels of the state's channels)
+   to the caller's pixels, rows stride bytes apart (0 for packed rows), without allocating a result.
+   The pixels may be the state's own borrowed buffer, to synthesize in place. Returns whether it succeeded. */
+bool
+resynth_run_into(resynth_state_t state, resynth_parameters_t parameters, uint8_t* pixels, size_t stride);
+
+/* Float version of resynth_run_into(): writes pixels in [0,1], rows stride bytes apart (0 for packed rows). */
+bool
+resynth_run_intof(resynth_state_t state, resynth_parameters_t parameters, float* pixels, size_t stride);
+
+/* Synthesizes an image too large to hold, streamed through callbacks in square tiles of tile_size pixels,
+   each with a margin of halo pixels of context around it, so memory is in proportion to the tile, not the image.
+   read_pixels must see the pixels of earlier calls of write_pixels (stream in place), read_mask reads the one
+   byte per pixel target mask, or is NULL to synthesize all of the image. The source is the shared corpus,
+   if not NULL (all of it is used: the parameters' masks are ignored), else the pixels around each tile
+   outside the mask. Tiles with nothing to synthesize are not written. Returns whether it succeeded. */
+bool
+resynth_run_tiled(resynth_parameters_t parameters, size_t width, size_t height, size_t channels,
+                  resynth_tile_callback_t read_pixels, resynth_tile_callback_t read_mask,
+                  resynth_tile_callback_t write_pixels, void* userdata,
+                  resynth_state_t corpus, size_t tile_size, size_t halo);
+
+/* One job of a synthesis split by regions, e.g. across processes or machines: synthesizes the region
+   (x, y, region_width, region_height) of a streamed image as resynth_run_tiled() does one tile, but with the pixels
+   read_finished reads as nonzero (one byte per pixel) as read only context, and writes only the region.
+   The result depends only on the pixels read, the parameters (seed included) and the region: a coordinator can
+   run regions anywhere, in any order, and stitch them. Adjoining regions should not run at the same time
+   (e.g. schedule bands, or tiles in a checkerboard), else neither sees the other. Runs deterministically,
+   see resynth_parameters_deterministic(). */
+bool
+resynth_run_region(resynth_parameters_t parameters, size_t width, size_t height, size_t channels,
+                   resynth_tile_callback_t read_pixels, resynth_tile_callback_t read_mask,
+                   resynth_tile_callback_t read_finished, resynth_tile_callback_t write_pixels, void* userdata,
+                   resynth_state_t corpus, size_t x, size_t y, size_t region_width, size_t region_height,
+                   size_t halo);
+
+/* Called once when a job is done, canceled or not, on the thread that ran it. Must not free the job. */
+typedef void (*resynth_job_callback_t)(resynth_job_t job, void* userdata);
+
+/* Starts resynth_run() in the background, on the library's worker threads, and returns at once.
+   The state and parameters must outlive the job, unchanged. callback (NULL for none) is called when it is done.
+   Many jobs may run at once. A backend without threads runs the job before returning. */
+resynth_job_t
+resynth_run_async(resynth_state_t state, resynth_parameters_t parameters,
+                  resynth_job_callback_t callback, void* userdata);
+
+/* Percent of the job done so far, from any thread */
+int
+resynth_job_progress(resynth_job_t job);
+
+/* Whether the job is done, its callback included: resynth_job_wait() will not block */
+bool
+resynth_job_done(resynth_job_t job);
+
+/* Asks the job to stop soon: its result is then not valid. No effect on a job done. */
+void
+resynth_job_cancel(resynth_job_t job);
+
+/* Waits for the job, then hands over its result, for the caller to free. NULL if already taken. */
+resynth_result_t
+resynth_job_wait(resynth_job_t job);
+
 bool 
 resynth_result_valid(resynth_result_t result);
 
@@ -107,6 +442,22 @@ resynth_result_height(resynth_result_t result);
 size_t
 resynth_result_channels(resynth_result_t result);
 
+/* What the run that made the result did, e.g. to tune parameters. All zero if the backend does not count. */
+resynth_metrics_t
+resynth_result_metrics(resynth_result_t result);
+
+/* Where each pixel of the result came from, width * height of them, row major: the source pixel's index
+   y * width + x, by the width of the source (the state, or the prepared corpus, see resynth_corpus_size()), or
+   RESYNTH_NO_SOURCE where not synthesized. NULL unless kept, see resynth_parameters_correspondence(), and the result is valid. */
+const uint32_t*
+resynth_result_correspondence(resynth_result_t result);
+
+/* Remaps other layers of the source as the result's pixels were, in one pass over the correspondence: synthesizes
+   them at the cost of a copy. Layers scale (1 or more) times the size of the result and source in each dimension
+   take the correspondence upsampled, each pixel a scale x scale block. False without a correspondence. */
+bool
+resynth_result_apply(resynth_result_t result, const resynth_layer_t* layers, size_t layer_count, int scale);
+
 /* Memory Management */ 
 void
 resynth_free_state(resynth_state_t state);
@@ -117,6 +468,19 @@ resynth_free_parameters(resynth_parameters_t parameters);
 void
 resynth_free_result(resynth_result_t result);
 
+void
+resynth_free_cache(resynth_cache_t cache);
+
+void
+resynth_free_corpus(resynth_corpus_t corpus);
+
+void
+resynth_free_workspace(resynth_workspace_t workspace);
+
+/* Waits for the job first, see resynth_job_cancel() not to wait long */
+void
+resynth_free_job(resynth_job_t job);
+
 #if __cplusplus
 }
 #endif
@@ -23,6 +23,13 @@
 #include <string.h> // for file extension mangling
 #include <time.h> // for time(0) as a random seed
 
+// threads synthesize in parallel where POSIX threads are available.
+#ifndef _WIN32
+#define RESYNTH_THREADED
+#include <pthread.h>
+#include <unistd.h> // for sysconf, to count processors
+#endif
+
 // decide which features we want from stb_image.
 // this should cover the most common formats.
 #define STB_IMAGE_IMPLEMENTATION
@@ -48,7 +55,6 @@
 #define RND_U64 uint64_t
 #define RND_IMPLEMENTATION
 #include "rnd.h"
-rnd_pcg_t pcg;
 
 // convenience macros. hopefully these names don't interfere
 // with any defined in the standard library headers on any system.
@@ -87,6 +93,8 @@ struct _Parameters {
     int neighbors, tries;
     int magic;
     int random_seed;
+    int threads; // 0 for every processor
+    bool deterministic; // the same result for a seed: one thread, see count_threads()
 };
 
 struct _Resynth_result {
@@ -95,6 +103,10 @@ struct _Resynth_result {
     size_t width, height, channels;
     bool valid;
 };
+
+struct _Resynth_job {
+    resynth_result_t result;  // until taken by resynth_job_wait()
+};
 typedef struct coord {
     int x, y;
 } Coord;
@@ -122,35 +134,60 @@ typedef union {
     };
 } Pixel32;
 
-typedef struct {
-    bool has_value, has_source;
-    Coord source;
-} Status;
+// where a pixel of the output was copied from, packed in a word
+// so that threads can read and write it whole, without locks:
+// bit 63 is set once the pixel has a source, 62-32 are its y, 31-0 its x.
+// the output pixel itself is always the corpus pixel at its source.
+typedef uint64_t Status;
+
+INLINE Status status_pack(const Coord source) {
+    return (1ULL << 63) | ((uint64_t)(uint32_t)source.y << 32) | (uint32_t)source.x;
+}
+
+INLINE bool status_has_source(const Status status) {
+    return status >> 63;
+}
+
+INLINE Coord status_source(const Status status) {
+    return (Coord){(int)(uint32_t)status, (int)((status >> 32) & 0x7FFFFFFF)};
+}
 
 typedef struct {
     int width, height, depth;
 } Image;
 
-struct _Resynth_state {
-    int input_bytes;
+// what each thread synthesizing needs of its own.
+typedef struct {
+    rnd_pcg_t pcg;
+
     // note that these variables must exist alongside their "_array"s
     // for the image macros to work.
-    Image data, corpus, status;
-    Pixel *data_array, *corpus_array;
-    Status *status_array;
-    Coord *data_points, *corpus_points, *sorted_offsets;
     Image tried;
     int *tried_array;
 
     Coord *neighbors;
     Pixel32 *neighbor_values;
-    Status **neighbor_statuses;
+    Status *neighbor_statuses;
     int n_neighbors;
 
-    int *diff_table; // (might be more efficient to store as uint16_t?)
-
     int best;
     Coord best_point;
+} Resynth_worker;
+
+struct _Resynth_state {
+    int input_bytes;
+    // note that these variables must exist alongside their "_array"s
+    // for the image macros to work.
+    Image data, corpus, status;
+    Pixel *data_array, *corpus_array;
+    Status *status_array;
+    Coord *data_points, *corpus_points, *sorted_offsets;
+    int *round_starts; // where data_points' rounds of polishing start
+
+    Resynth_worker *workers;
+    int n_workers;
+
+    int *diff_table; // (might be more efficient to store as uint16_t?)
 };
 
 // convenience macros to simplify image handling.
@@ -191,18 +228,27 @@ INLINE bool wrap_or_clip(const Parameters parameters, const Image image,
 }
 
 
+static void workers_free(Resynth_state *s) {
+    for (int i = 0; i < s->n_workers; i++) {
+        MEMORY(s->workers[i].neighbors, 0);
+        MEMORY(s->workers[i].neighbor_values, 0);
+        MEMORY(s->workers[i].neighbor_statuses, 0);
+        MEMORY(s->workers[i].tried_array, 0);
+    }
+    MEMORY(s->workers, 0);
+    s->n_workers = 0;
+}
+
 static void state_free(Resynth_state *s) {
     sb_freeset(s->data_points);
     sb_freeset(s->corpus_points);
     sb_freeset(s->sorted_offsets);
+    sb_freeset(s->round_starts);
+    workers_free(s);
     MEMORY(s->diff_table, 0);
-    MEMORY(s->neighbors, 0);
-    MEMORY(s->neighbor_values, 0);
-    MEMORY(s->neighbor_statuses, 0);
     MEMORY(s->data_array, 0);
     MEMORY(s->corpus_array, 0);
     MEMORY(s->status_array, 0);
-    MEMORY(s->tried_array, 0);
 }
 
 static double neglog_cauchy(double x) {
@@ -230,12 +276,13 @@ static void make_offset_list(Resynth_state *s) {
           sizeof(Coord), coord_compare);
 }
 
-INLINE void try_point(Resynth_state *s, const Coord point) {
+INLINE void try_point(const Resynth_state *s, Resynth_worker *w,
+                      const Coord point) {
     // consider a candidate pixel for the best-fit by considering its neighbors.
     int sum = 0;
 
-    for (int i = 0; i < s->n_neighbors; i++) {
-        Coord off_point = coord_add(point, s->neighbors[i]);
+    for (int i = 0; i < w->n_neighbors; i++) {
+        Coord off_point = coord_add(point, w->neighbors[i]);
 
         int diff = 0;
         if (off_point.x < 0 || off_point.y < 0 ||
@@ -244,7 +291,7 @@ INLINE void try_point(Resynth_state *s, const Coord point) {
             diff = s->diff_table[0] * s->input_bytes;
         } else if (i) {
             const Pixel *corpus_pixel = image_atc(s->corpus, off_point);
-            const Pixel *data_pixel = s->neighbor_values[i].v;
+            const Pixel *data_pixel = w->neighbor_values[i].v;
             for (int j = 0; j < s->input_bytes; j++) {
                 diff += s->diff_table[256 + data_pixel[j] - corpus_pixel[j]];
             }
@@ -255,28 +302,46 @@ INLINE void try_point(Resynth_state *s, const Coord point) {
 #else
         if (__builtin_add_overflow(sum, diff, &sum)) {
             fprintf(stderr, "integer overflow at (%i,%i) + (%i,%i)\n",
-                    point.x, point.y, s->neighbors[i].x, s->neighbors[i].y);
+                    point.x, point.y, w->neighbors[i].x, w->neighbors[i].y);
             fprintf(stderr, "diff: %i\n", diff);
             exit(1);
         }
 #endif
-        if (sum >= s->best) return;
+        if (sum >= w->best) return;
     }
 
-    s->best = sum;
-    s->best_point = point;
+    w->best = sum;
+    w->best_point = point;
+}
+
+// threads claim this many data points of a round at a time.
+#define RESYNTH_CHUNK 32
+
+static int count_threads(const Parameters parameters, int data_area) {
+    // as many threads as asked for, or as processors, but not more than
+    // there are chunks of work for. (see resynth__rounds)
+    // threads race for the points of a round and read each other's pixels,
+    // so only one thread synthesizes the same for a seed every run.
+    int threads = 1;
+#ifdef RESYNTH_THREADED
+    if (parameters.deterministic) return 1;
+    threads = parameters.threads;
+    if (threads <= 0) threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    CLAMPV(threads, 1, 1024);
+    CLAMPV(threads, 1, data_area / RESYNTH_CHUNK + 1);
+#endif
+    return threads;
 }
 
 INLINE void resynth__init(Resynth_state *s, Parameters parameters) {
     sb_freeset(s->data_points);
     sb_freeset(s->corpus_points);
     sb_freeset(s->sorted_offsets);
+    sb_freeset(s->round_starts);
+    workers_free(s);
 
     // (iirc i opted to put diff_table on heap to keep Resynth_state small)
     MEMORY(s->diff_table, 512);
-    MEMORY(s->neighbors, parameters.neighbors);
-    MEMORY(s->neighbor_values, parameters.neighbors);
-    MEMORY(s->neighbor_statuses, parameters.neighbors);
 
     IMAGE_RESIZE(s->status, s->data.width, s->data.height, 1);
 
@@ -284,8 +349,7 @@ INLINE void resynth__init(Resynth_state *s, Parameters parameters) {
     for (int y = 0; y < s->status.height; y++) {
         for (int x = 0; x < s->status.width; x++) {
             // (this might be redundant since this memory is calloc'd)
-            image_at(s->status, x, y)->has_source = false;
-            image_at(s->status, x, y)->has_value = false;
+            *image_at(s->status, x, y) = 0;
 
             Coord coord = {x, y};
             sb_push(s->data_points, coord);
@@ -324,6 +388,11 @@ INLINE void resynth__init(Resynth_state *s, Parameters parameters) {
 
     const int data_area = sb_count(s->data_points);
 
+    // the generator is the run's own, not global, so that runs on
+    // different states can go on at once in different threads.
+    rnd_pcg_t pcg;
+    rnd_pcg_seed(&pcg, parameters.random_seed);
+
     // shuffle the data points in-place.
     for (int i = 0; i < data_area; i++) {
         int j = rnd_pcg_range(&pcg, 0, data_area - 1);
@@ -337,87 +406,217 @@ INLINE void resynth__init(Resynth_state *s, Parameters parameters) {
     // this greatly reduces the "sparklies" in the resulting image.
     // this is achieved by appending the first n data points to the end.
     // n is reduced exponentially by "magic" until it's less than 1.
+    // each run of n points is a round: no point occurs twice in one,
+    // so the points of a round can be synthesized in parallel.
+    sb_push(s->round_starts, 0);
     if (parameters.magic) for (int n = data_area; n > 0;) {
         n = n * parameters.magic / 256;
+        if (n > 0) sb_push(s->round_starts, sb_count(s->data_points));
         for (int i = 0; i < n; i++) {
             sb_push(s->data_points, s->data_points[i]);
         }
     }
 
-    // prepare an array of neighbors we've already computed the difference of.
-    // this is a simple optimization and isn't critical to the algorithm.
-    // (tried_array is referred to implicitly by macros)
-    IMAGE_RESIZE(s->tried, s->corpus.width, s->corpus.height, 1);
-    const int corpus_area = s->corpus.width * s->corpus.height;
-    for (int i = 0; i < corpus_area; i++) s->tried_array[i] = -1;
+    // each thread gets its own random numbers, neighbors, and tried array.
+    // the first continues the sequence used to shuffle, and the others
+    // are seeded from it, so that one thread synthesizes as it always has.
+    s->n_workers = count_threads(parameters, data_area);
+    MEMORY(s->workers, s->n_workers);
+    s->workers[0].pcg = pcg;
+    for (int i = 0; i < s->n_workers; i++) {
+        Resynth_worker *w = &s->workers[i];
+        if (i) rnd_pcg_seed(&w->pcg, rnd_pcg_next(&pcg));
+        MEMORY(w->neighbors, parameters.neighbors);
+        MEMORY(w->neighbor_values, parameters.neighbors);
+        MEMORY(w->neighbor_statuses, parameters.neighbors);
+
+        // prepare an array of neighbors we've already computed the difference of.
+        // this is a simple optimization and isn't critical to the algorithm.
+        // (tried_array is referred to implicitly by macros)
+        IMAGE_RESIZE(w->tried, s->corpus.width, s->corpus.height, 1);
+        const int corpus_area = s->corpus.width * s->corpus.height;
+        for (int j = 0; j < corpus_area; j++) w->tried_array[j] = -1;
+    }
 }
 
-static void resynth(Resynth_state *s, Parameters parameters) {
-    // "resynthesize" an output image from a given input image.
-    resynth__init(s, parameters);
-
-    for (int i = sb_count(s->data_points) - 1; i >= 0; i--) {
-        Coord position = s->data_points[i];
-
-        // this point is guaranteed to have a value after this iteration.
-        image_atc(s->status, position)->has_value = true;
-
-        // collect neighboring pixels as candidates for best-fit.
-        // the order we check and collect is relevant, thus "sorted_offsets".
-        s->n_neighbors = 0;
-        const int sorted_offsets_size = sb_count(s->sorted_offsets);
-        for (int j = 0; j < sorted_offsets_size; j++) {
-            Coord point = coord_add(position, s->sorted_offsets[j]);
-
-            if (wrap_or_clip(parameters, s->data, &point) &&
-                image_atc(s->status, point)->has_value) {
-                s->neighbors[s->n_neighbors] = s->sorted_offsets[j];
-                s->neighbor_statuses[s->n_neighbors] =
-                    image_atc(s->status, point);
-                for (int k = 0; k < s->input_bytes; k++) {
-                    s->neighbor_values[s->n_neighbors].v[k] =
-                        image_atc(s->data, point)[k];
-                }
-                s->n_neighbors++;
-                if (s->n_neighbors >= parameters.neighbors) break;
+INLINE void resynth__point(Resynth_state *s, Resynth_worker *w,
+                           const Parameters parameters, int i) {
+    // synthesize the i-th of the data points.
+    // statuses are shared between threads: they are loaded and stored whole.
+    // the data image isn't touched, see resynth.
+    Coord position = s->data_points[i];
+
+    // collect neighboring pixels as candidates for best-fit.
+    // the order we check and collect is relevant, thus "sorted_offsets".
+    // the first offset is the position itself, which is always collected,
+    // since it's guaranteed to have a value after this iteration.
+    // (its value is never compared, see try_point, only its source)
+    w->n_neighbors = 0;
+    const int sorted_offsets_size = sb_count(s->sorted_offsets);
+    for (int j = 0; j < sorted_offsets_size; j++) {
+        Coord point = coord_add(position, s->sorted_offsets[j]);
+        if (!wrap_or_clip(parameters, s->data, &point)) continue;
+
+        Status status = __atomic_load_n(image_atc(s->status, point),
+                                        __ATOMIC_RELAXED);
+        if (j && !status_has_source(status)) continue;
+
+        w->neighbors[w->n_neighbors] = s->sorted_offsets[j];
+        w->neighbor_statuses[w->n_neighbors] = status;
+        if (j) {
+            Coord source = status_source(status);
+            for (int k = 0; k < s->input_bytes; k++) {
+                w->neighbor_values[w->n_neighbors].v[k] =
+                    image_atc(s->corpus, source)[k];
             }
         }
+        w->n_neighbors++;
+        if (w->n_neighbors >= parameters.neighbors) break;
+    }
 
-        s->best = INT_MAX;
-
-        // consider each neighboring pixel collected as a best-fit.
-        for (int j = 0; j < s->n_neighbors && s->best != 0; j++) {
-            if (s->neighbor_statuses[j]->has_source) {
-                Coord point = coord_sub(s->neighbor_statuses[j]->source,
-                                        s->neighbors[j]);
-                if (point.x < 0 || point.y < 0 ||
-                    point.x >= s->corpus.width || point.y >= s->corpus.height) {
-                    continue;
-                }
-                // skip computing differences of points
-                // we've already done this iteration. not mandatory.
-                if (*image_atc(s->tried, point) == i) continue;
-                try_point(s, point);
-                *image_atc(s->tried, point) = i;
+    w->best = INT_MAX;
+
+    // consider each neighboring pixel collected as a best-fit.
+    for (int j = 0; j < w->n_neighbors && w->best != 0; j++) {
+        if (status_has_source(w->neighbor_statuses[j])) {
+            Coord point = coord_sub(status_source(w->neighbor_statuses[j]),
+                                    w->neighbors[j]);
+            if (point.x < 0 || point.y < 0 ||
+                point.x >= s->corpus.width || point.y >= s->corpus.height) {
+                continue;
             }
+            // skip computing differences of points
+            // we've already done this iteration. not mandatory.
+            if (*image_atc(w->tried, point) == i) continue;
+            try_point(s, w, point);
+            *image_atc(w->tried, point) = i;
         }
+    }
+
+    // try some random points in the corpus. this is required for
+    // choosing the first couple pixels, since they have no neighbors.
+    // after that, this step is optional. it can improve subjective quality.
+    for (int j = 0; j < parameters.tries && w->best != 0; j++) {
+        int random = rnd_pcg_range(&w->pcg, 0, sb_count(s->corpus_points) - 1);
+        try_point(s, w, s->corpus_points[random]);
+    }
+
+    // finally, record where the best pixel came from.
+    __atomic_store_n(image_atc(s->status, position), status_pack(w->best_point),
+                     __ATOMIC_RELAXED);
+}
+
+typedef struct {
+    Resynth_state *s;
+    Parameters parameters;
+    int *claims; // per round, data points claimed so far
+#ifdef RESYNTH_THREADED
+    pthread_mutex_t mutex;
+    pthread_cond_t round_done;
+    int n_threads, waiting, round;
+#endif
+} Resynth_rounds;
+
+typedef struct {
+    Resynth_rounds *rounds;
+    Resynth_worker *worker;
+} Resynth_thread;
+
+static void resynth__barrier(Resynth_rounds *r) {
+    // wait for every thread to finish the round.
+#ifdef RESYNTH_THREADED
+    pthread_mutex_lock(&r->mutex);
+    int round = r->round;
+    if (++r->waiting >= r->n_threads) {
+        r->waiting = 0;
+        r->round++;
+        pthread_cond_broadcast(&r->round_done);
+    } else while (r->round == round) {
+        pthread_cond_wait(&r->round_done, &r->mutex);
+    }
+    pthread_mutex_unlock(&r->mutex);
+#endif
+}
 
-        // try some random points in the corpus. this is required for
-        // choosing the first couple pixels, since they have no neighbors.
-        // after that, this step is optional. it can improve subjective quality.
-        for (int j = 0; j < parameters.tries && s->best != 0; j++) {
-            int random = rnd_pcg_range(&pcg, 0, sb_count(s->corpus_points) - 1);
-            try_point(s, s->corpus_points[random]);
+static void *resynth__rounds(void *args) {
+    // synthesize data points from last to first, round by round.
+    // the points of a round are shared out between threads in chunks
+    // and one round is finished before any thread starts the next.
+    Resynth_thread *t = args;
+    Resynth_rounds *r = t->rounds;
+    Resynth_state *s = r->s;
+    const int n_rounds = sb_count(s->round_starts);
+
+    for (int round = n_rounds - 1; round >= 0; round--) {
+        const int start = s->round_starts[round];
+        const int end = round + 1 < n_rounds ? s->round_starts[round + 1]
+                                             : sb_count(s->data_points);
+        for (;;) {
+            int claimed = __atomic_fetch_add(&r->claims[round], RESYNTH_CHUNK,
+                                             __ATOMIC_RELAXED);
+            if (claimed >= end - start) break;
+            const int last = MAX(start, end - claimed - RESYNTH_CHUNK);
+            for (int i = end - claimed - 1; i >= last; i--) {
+                resynth__point(s, t->worker, r->parameters, i);
+            }
         }
+        resynth__barrier(r);
+    }
+    return NULL;
+}
 
-        // finally, copy the best pixel to the output image.
-        for (int j = 0; j < s->input_bytes; j++) {
-            image_atc(s->data, position)[j] =
-                image_atc(s->corpus, s->best_point)[j];
+static void resynth(Resynth_state *s, Parameters parameters) {
+    // "resynthesize" an output image from a given input image.
+    resynth__init(s, parameters);
+    if (!s->n_workers) return;
+
+    Resynth_rounds rounds = {s, parameters, NULL};
+    MEMORY(rounds.claims, sb_count(s->round_starts));
+    Resynth_thread *threads = NULL;
+    MEMORY(threads, s->n_workers);
+    for (int i = 0; i < s->n_workers; i++) {
+        threads[i] = (Resynth_thread){&rounds, &s->workers[i]};
+    }
+
+    // the calling thread is the first to synthesize.
+#ifdef RESYNTH_THREADED
+    pthread_t *handles = NULL;
+    MEMORY(handles, s->n_workers);
+    pthread_mutex_init(&rounds.mutex, NULL);
+    pthread_cond_init(&rounds.round_done, NULL);
+    rounds.n_threads = s->n_workers;
+    int started = 1;
+    for (; started < s->n_workers; started++) {
+        if (pthread_create(&handles[started], NULL, resynth__rounds,
+                           &threads[started])) break;
+    }
+    if (started < s->n_workers) {
+        // with fewer threads than planned, barriers must wait for fewer.
+        pthread_mutex_lock(&rounds.mutex);
+        rounds.n_threads = started;
+        pthread_mutex_unlock(&rounds.mutex);
+    }
+    resynth__rounds(&threads[0]);
+    for (int i = 1; i < started; i++) pthread_join(handles[i], NULL);
+    pthread_cond_destroy(&rounds.round_done);
+    pthread_mutex_destroy(&rounds.mutex);
+    MEMORY(handles, 0);
+#else
+    resynth__rounds(&threads[0]);
+#endif
+
+    // finally, copy the best pixels to the output image.
+    for (int y = 0; y < s->data.height; y++) {
+        for (int x = 0; x < s->data.width; x++) {
+            Coord source = status_source(*image_at(s->status, x, y));
+            for (int j = 0; j < s->input_bytes; j++) {
+                image_at(s->data, x, y)[j] = image_atc(s->corpus, source)[j];
+            }
         }
-        image_atc(s->status, position)->has_source = true;
-        image_atc(s->status, position)->source = s->best_point;
     }
+
+    MEMORY(threads, 0);
+    MEMORY(rounds.claims, 0);
 }
 
 static const int disc00[] = {
@@ -52,6 +52,44 @@ resynth_state_create_from_memory(uint8_t* pixels, size_t width, size_t height, s
     return s;
 }
 
+resynth_state_t
+resynth_state_create_from_buffer(uint8_t* pixels, size_t width, size_t height, size_t channels, size_t stride) {
+    assert(pixels != NULL);
+    assert(width > 0);
+    assert(height > 0);
+    assert(channels >= 3);
+
+    /* This version of resynth copies the pixels, row by row, and synthesizes at their size */
+    resynth_state_t s = calloc(1, sizeof(Resynth_state));
+    size_t row_bytes = width * channels;
+    if (stride == 0) stride = row_bytes;
+
+    IMAGE_RESIZE(s->corpus, width, height, channels);
+    for (size_t y = 0; y < height; ++y) {
+        memcpy(s->corpus_array + y * row_bytes, pixels + y * stride, row_bytes);
+    }
+
+    s->input_bytes = channels;
+    IMAGE_RESIZE(s->data, width, height, s->input_bytes);
+
+    return s;
+}
+
+resynth_state_t
+resynth_state_create_from_mapped(const char* filename) {
+    /* This version of resynth does not map files: resynth_state_create_from_image() decodes them */
+    return NULL;
+}
+
+const uint8_t*
+resynth_state_pixels(resynth_state_t state, size_t* width, size_t* height, size_t* channels, size_t* stride) {
+    *width = state->corpus.width;
+    *height = state->corpus.height;
+    *channels = state->input_bytes;
+    *stride = state->corpus.width * state->input_bytes;
+    return state->corpus_array;
+}
+
 resynth_state_t
 resynth_state_create_from_memoryf(float* pixels, size_t width, size_t height, size_t channels, int scale) {
     size_t size = width * height * channels;
@@ -66,6 +104,32 @@ resynth_state_create_from_memoryf(float* pixels, size_t width, size_t height, si
     return state;
 }
 
+resynth_state_t
+resynth_state_create_from_bufferf(float* pixels, size_t width, size_t height, size_t channels, size_t stride) {
+    assert(pixels != NULL);
+    assert(width > 0);
+    assert(height > 0);
+    assert(channels >= 3);
+
+    /* This version of resynth converts the pixels, row by row, into its own */
+    resynth_state_t s = calloc(1, sizeof(Resynth_state));
+    size_t row_pixelels = width * channels;
+    if (stride == 0) stride = row_pixelels * sizeof(float);
+
+    IMAGE_RESIZE(s->corpus, width, height, channels);
+    for (size_t y = 0; y < height; ++y) {
+        const float* row = (const float*)((const uint8_t*)pixels + y * stride);
+        for (size_t i = 0; i < row_pixelels; ++i) {
+            s->corpus_array[y * row_pixelels + i] = (uint8_t)fmin(255, fmax(0, (row[i] * 255)));
+        }
+    }
+
+    s->input_bytes = channels;
+    IMAGE_RESIZE(s->data, width, height, s->input_bytes);
+
+    return s;
+}
+
 /* Config */
 resynth_parameters_t
 resynth_parameters_create() {
@@ -77,6 +141,8 @@ resynth_parameters_create() {
     parameters->neighbors = 29;      // 30
     parameters->tries = 192;         // 200 (or 80 in the paper)
     parameters->random_seed = time(0);
+    parameters->threads = 0;         // every processor
+    parameters->deterministic = false;
     return parameters;
 }
 
@@ -87,7 +153,12 @@ resynth_parameters_operation(resynth_parameters_t parameters, resynth_operation_
 }
 
 void
-resynth_parameters_mask(resynth_parameters_t parameters, uint8_t* pixels, size_t widht, size_t height) {
+resynth_parameters_match_context(resynth_parameters_t parameters, int type) {
+    /* This version of resynth has no context: it synthesizes all of the image */
+}
+
+void
+resynth_parameters_mask(resynth_parameters_t parameters, uint8_t* pixels, size_t width, size_t height, resynth_mask_type_t type) {
     /* This version of resynth does not support masking */
 }
 
@@ -127,14 +198,152 @@ resynth_parameters_random_seed(resynth_parameters_t parameters, unsigned long se
     parameters->random_seed = seed;
 }
 
+void
+resynth_parameters_threads(resynth_parameters_t parameters, int threads) {
+    /* This version of resynth counts processors online, but not affinity or quotas */
+    parameters->threads = threads > 0 ? threads : 0;
+}
+
+void
+resynth_parameters_tile_scheduling(resynth_parameters_t parameters, int tile_size) {
+    /* This version of resynth shares pixels out between threads in random order only */
+}
+
+void
+resynth_parameters_pyramid(resynth_parameters_t parameters, int levels) {
+    /* This version of resynth synthesizes at full resolution only */
+}
+
+void
+resynth_parameters_patch_index(resynth_parameters_t parameters, int candidates, int radius) {
+    /* This version of resynth probes the source uniformly at random only */
+}
+
+void
+resynth_parameters_deterministic(resynth_parameters_t parameters, bool deterministic) {
+    /* This version of resynth is deterministic for a seed with one thread only: on, it synthesizes with one */
+    parameters->deterministic = deterministic;
+}
+
+void
+resynth_parameters_gpu(resynth_parameters_t parameters, bool gpu) {
+    /* This version of resynth synthesizes on the CPU only */
+}
+
+bool
+resynth_gpu_present(void) {
+    return false;
+}
+
+void
+resynth_parameters_cascade(resynth_parameters_t parameters, bool cascade) {
+    /* This version of resynth compares every probe in full */
+}
+
+void
+resynth_parameters_roi(resynth_parameters_t parameters, int margin) {
+    /* This version of resynth heals from the whole image only */
+}
+
+void
+resynth_parameters_cache(resynth_parameters_t parameters, resynth_cache_t cache) {
+    /* This version of resynth does not cache results */
+}
+
+void
+resynth_parameters_corpus(resynth_parameters_t parameters, resynth_corpus_t corpus) {
+    /* This version of resynth does not prepare corpora */
+}
+
+void
+resynth_parameters_workspace(resynth_parameters_t parameters, resynth_workspace_t workspace) {
+    /* This version of resynth does not recycle memory */
+}
+
+void
+resynth_parameters_progress(resynth_parameters_t parameters, resynth_progress_callback_t callback, void* userdata) {
+    /* This version of resynth does not report progress */
+}
+
+void
+resynth_parameters_time_budget(resynth_parameters_t parameters, double seconds) {
+    /* This version of resynth does not keep to a time budget */
+}
+
+void
+resynth_parameters_preview(resynth_parameters_t parameters, resynth_preview_callback_t callback, void* userdata) {
+    /* This version of resynth does not preview passes */
+}
+
+void
+resynth_parameters_correspondence(resynth_parameters_t parameters, bool keep) {
+    /* This version of resynth does not keep where pixels came from */
+}
+
+/* Prepared Corpus */
+resynth_corpus_t
+resynth_corpus_create(resynth_state_t source, uint8_t* mask, resynth_parameters_t parameters) {
+    /* This version of resynth does not prepare corpora */
+    return NULL;
+}
+
+resynth_corpus_t
+resynth_corpus_create_multi(const resynth_state_t* sources, uint8_t* const* masks, size_t count,
+                            resynth_parameters_t parameters) {
+    /* This version of resynth does not prepare corpora */
+    return NULL;
+}
+
+bool
+resynth_corpus_placement(resynth_corpus_t corpus, size_t index, size_t* x, size_t* y) {
+    /* This version of resynth does not prepare corpora */
+    return false;
+}
+
+bool
+resynth_corpus_size(resynth_corpus_t corpus, size_t* width, size_t* height) {
+    /* This version of resynth does not prepare corpora */
+    return false;
+}
+
+/* Workspace */
+resynth_workspace_t
+resynth_workspace_create(void) {
+    /* This version of resynth does not recycle memory */
+    return NULL;
+}
+
+resynth_workspace_stats_t
+resynth_workspace_stats(resynth_workspace_t workspace) {
+    resynth_workspace_stats_t stats = {0};
+    return stats;
+}
+
+/* Result Cache */
+resynth_cache_t
+resynth_cache_create(size_t max_bytes, const char* directory) {
+    /* This version of resynth does not cache results */
+    return NULL;
+}
+
+resynth_cache_stats_t
+resynth_cache_stats(resynth_cache_t cache) {
+    resynth_cache_stats_t stats = {0};
+    return stats;
+}
+
 /* Processing and Results */ 
+size_t
+resynth_estimate_memory(resynth_state_t state, resynth_parameters_t parameters) {
+    /* This version of resynth does not estimate its memory */
+    return 0;
+}
+
 resynth_result_t 
 resynth_run(resynth_state_t state, resynth_parameters_t parameters) {
     assert(state != NULL);
     assert(parameters != NULL);
 
-    rnd_pcg_seed(&pcg, parameters->random_seed);
-
     resynth_result_t result = calloc(1, sizeof(Resynth_result));
     resynth(state, *parameters);
 
@@ -146,6 +355,100 @@ resynth_run(resynth_state_t state, resynth_parameters_t parameters) {
     return result;
 }
 
+resynth_result_t
+resynth_run_incremental(resynth_state_t state, resynth_parameters_t parameters, resynth_result_t previous) {
+    /* This version of resynth keeps no correspondence: always a full run */
+    return resynth_run(state, parameters);
+}
+
+bool
+resynth_run_into(resynth_state_t state, resynth_parameters_t parameters, uint8_t* pixels, size_t stride) {
+    assert(state != NULL);
+    assert(parameters != NULL);
+    assert(pixels != NULL);
+
+    /* This version of resynth synthesizes into the state, then copies out, row by row */
+    resynth(state, *parameters);
+
+    size_t row_bytes = state->data.width * state->data.depth;
+    if (stride == 0) stride = row_bytes;
+    for (size_t y = 0; y < state->data.height; ++y) {
+        memcpy(pixels + y * stride, state->data_array + y * row_bytes, row_bytes);
+    }
+    return true;
+}
+
+bool
+resynth_run_intof(resynth_state_t state, resynth_parameters_t parameters, float* pixels, size_t stride) {
+    assert(state != NULL);
+    assert(parameters != NULL);
+    assert(pixels != NULL);
+
+    /* This version of resynth synthesizes into the state, then converts out, row by row */
+    resynth(state, *parameters);
+
+    size_t row_pixelels = state->data.width * state->data.depth;
+    if (stride == 0) stride = row_pixelels * sizeof(float);
+    for (size_t y = 0; y < state->data.height; ++y) {
+        float* row = (float*)((uint8_t*)pixels + y * stride);
+        for (size_t i = 0; i < row_pixelels; ++i) {
+            row[i] = (float)(state->data_array[y * row_pixelels + i]) / 255.f;
+        }
+    }
+    return true;
+}
+
+bool
+resynth_run_tiled(resynth_parameters_t parameters, size_t width, size_t height, size_t channels,
+                  resynth_tile_callback_t read_pixels, resynth_tile_callback_t read_mask,
+                  resynth_tile_callback_t write_pixels, void* userdata,
+                  resynth_state_t corpus, size_t tile_size, size_t halo) {
+    /* This version of resynth holds whole images only: it does not stream */
+    return false;
+}
+
+bool
+resynth_run_region(resynth_parameters_t parameters, size_t width, size_t height, size_t channels,
+                   resynth_tile_callback_t read_pixels, resynth_tile_callback_t read_mask,
+                   resynth_tile_callback_t read_finished, resynth_tile_callback_t write_pixels, void* userdata,
+                   resynth_state_t corpus, size_t x, size_t y, size_t region_width, size_t region_height,
+                   size_t halo) {
+    /* This version of resynth holds whole images only: it does not split by regions */
+    return false;
+}
+
+resynth_job_t
+resynth_run_async(resynth_state_t state, resynth_parameters_t parameters,
+                  resynth_job_callback_t callback, void* userdata) {
+    /* This version of resynth has no threads: the job is done on return */
+    resynth_job_t job = calloc(1, sizeof(Resynth_job));
+    job->result = resynth_run(state, parameters);
+    if (callback != NULL)
+        callback(job, userdata);
+    return job;
+}
+
+int
+resynth_job_progress(resynth_job_t job) {
+    return 100;
+}
+
+bool
+resynth_job_done(resynth_job_t job) {
+    return true;
+}
+
+void
+resynth_job_cancel(resynth_job_t job) {
+}
+
+resynth_result_t
+resynth_job_wait(resynth_job_t job) {
+    resynth_result_t result = job->result;
+    job->result = NULL;
+    return result;
+}
+
 bool 
 resynth_result_valid(resynth_result_t result) {
     return result->valid;
@@ -199,6 +502,43 @@ resynth_free_parameters(resynth_parameters_t parameters) {
     free(parameters);
 }
 
+void
+resynth_free_corpus(resynth_corpus_t corpus) {
+}
+
+void
+resynth_free_workspace(resynth_workspace_t workspace) {
+}
+
+void
+resynth_free_cache(resynth_cache_t cache) {
+}
+
+resynth_metrics_t
+resynth_result_metrics(resynth_result_t result) {
+    /* This version of resynth does not count */
+    resynth_metrics_t metrics = {0};
+    metrics.schedule_done = 1.0;  /* nor cut runs short */
+    return metrics;
+}
+
+const uint32_t*
+resynth_result_correspondence(resynth_result_t result) {
+    return NULL;
+}
+
+bool
+resynth_result_apply(resynth_result_t result, const resynth_layer_t* layers, size_t layer_count, int scale) {
+    return false;
+}
+
+void
+resynth_free_job(resynth_job_t job) {
+    if (job->result != NULL)
+        resynth_free_result(job->result);
+    free(job);
+}
+
 void
 resynth_free_result(resynth_result_t result) {
     if (result->pixelsf != NULL)
@@ -332,9 +332,10 @@ static float rnd_internal_float_normalized_from_u32( RND_U32 value )
     {
     RND_U32 exponent = 127;
     RND_U32 mantissa = value >> 9;
-    RND_U32 result = ( exponent << 23 ) | mantissa;
-    float fresult = *(float*)( &result );
-    return fresult - 1.0f;
+    // Through a union, not a cast pointer: strict aliasing
+    union { RND_U32 bits; float value; } result;
+    result.bits = ( exponent << 23 ) | mantissa;
+    return result.value - 1.0f;
     }
 
 
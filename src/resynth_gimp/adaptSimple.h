@@ -34,70 +34,171 @@ will not use static global vars so it is reentrant.
 */
 
 #include <stdlib.h>
+#include <string.h>  // memcpy
+#include "pixelelConvert.h"
+#include "chunkTasks.h"
+
+// Pixels of a row of a float image converted at a time, on the stack
+#define ADAPT_FLOAT_RUN 256
 
 /*
-Adapt pixmap that is row padded to pixmap:
-- NOT row padded
-- optionally offset color pixelels beyond 0th byte (an interleaved mask byte)
-Convert between slightly different pixmap types.
+Fused adaption of an image and masks to pixmaps, one pass over the image, in bands of rows on the worker pool.
+
+A pixmap is NOT row padded, its mask pixelel interleaved before the color pixelels.
+Each row of the image is read once, and written to one pixmap or two (the target and the corpus of the simple API)
+with each its own mask, optionally inverted.
+A float image is converted in runs of a row to bytes, on the stack, once for both pixmaps: no converted copy of the whole image.
+Formerly the image was copied pixelel by pixelel through g_array_index, once per pixmap,
+and each mask interleaved in a pass more.
+*/
+typedef struct adaptBandStruct {
+  const ImageBuffer* image;
+  guint pixelelCount;       // color and alpha pixelels of the image, per pixel
+  guint pixmapCount;        // one or two
+  Map* pixmaps[2];
+  const ImageBuffer* masks[2];
+  Pixelel inversions[2];    // xor'ed with the mask: zero, or all ones to invert
+  guint startRow;
+  guint endRow;
+} TAdaptBand;
 
-!!!! This is not fully general.  Strides should be passed in.
-It just happens to work for now: when we are moving all pixels of the source.
+
+/*
+Interleave a run of mask and colors into a pixmap row.
+Inlined with a constant pixelelCount, see adaptRun(): the copy of a pixel is then a move or two.
 */
+static inline void
+adaptPixels(
+  Pixelel* restrict dest,
+  const Pixelel* restrict colors,
+  const unsigned char* restrict mask,
+  const Pixelel inversion,
+  const guint count,          // pixels
+  const guint pixelelCount
+  )
+{
+  guint i;
+  
+  for (i=0; i<count; i++)
+  {
+    dest[MASK_PIXELEL_INDEX] = mask[i] ^ inversion;
+    memcpy(dest + FIRST_PIXELEL_INDEX, colors, pixelelCount);
+    dest += pixelelCount + 1;
+    colors += pixelelCount;
+  }
+}
+
 static void
-adaptImage(
-  ImageBuffer * image,              // IN image: target or corpus drawable
-  Map          *pixmap,             // OUT NON-rowpadded pixmap
-  guint        offset,              // IN Offset in destination pixel. !!! Can be zero
-  guint        pixelel_count        // IN count pixelels to move
+adaptRun(
+  Pixelel* dest,
+  const Pixelel* colors,
+  const unsigned char* mask,
+  Pixelel inversion,
+  guint count,
+  guint pixelelCount
+  )
+{
+  switch (pixelelCount)
+  {
+    case 1: adaptPixels(dest, colors, mask, inversion, count, 1); break;
+    case 2: adaptPixels(dest, colors, mask, inversion, count, 2); break;
+    case 3: adaptPixels(dest, colors, mask, inversion, count, 3); break;
+    case 4: adaptPixels(dest, colors, mask, inversion, count, 4); break;
+    default: adaptPixels(dest, colors, mask, inversion, count, pixelelCount);
+  }
+}
+
+// Adapt a run of count pixels at (col, row) of the image to every pixmap of the band
+static inline void
+adaptBandRun(
+  const TAdaptBand* band,
+  const Pixelel* colors,
+  guint row,
+  guint col,
+  guint count
   )
 {
+  guint i;
+  
+  for (i=0; i<band->pixmapCount; i++)
+  {
+    Map* pixmap = band->pixmaps[i];
+    Pixelel* dest = &g_array_index(pixmap->data, Pixelel, ((size_t) row * pixmap->width + col) * pixmap->depth);
+    const unsigned char* mask = band->masks[i]->data + row * band->masks[i]->rowBytes + col;
+    adaptRun(dest, colors, mask, band->inversions[i], count, band->pixelelCount);
+  }
+}
+
+static void
+adaptBandTask(void* taskArgs)
+{
+  const TAdaptBand* band = taskArgs;
+  const ImageBuffer* image = band->image;
   guint row;
-  guint col;
-  guint pixelel;
   
-  guint srcPixel;
-  guint destPixel;
-  
-  /* 
-  Copy SOME of the pixels from img sequence to our pixmap (optionally exclude alpha).
-  Allow for row padding in source.
-  OFFSET pixels in destination. 
-  */
-  /* 
-  Note the src and dest pixel indices are incremented differently, ie pixel strides different. 
-  src: row padded: row stride greater than pixels*pixelelsperpixel
-  dest: not row padded 
-  */
-  destPixel = offset; // dest pixel index starts at offset
-  guint srcPixelStride = pixelel_count;
-  guint destPixelStride = pixelel_count + offset; // dest is offset
-  
-  for(row=0; row<image->height; row++) 
-  { 
-    srcPixel = row * image->rowBytes; // srcPixel index computed for START of each row
-    // dest pixel index continues at next byte
-    for(col=0; col<image->width; col++) 
+  for(row=band->startRow; row<band->endRow; row++)
+  {
+    if (image->isFloat)
     {
-      for (pixelel=0; pixelel < pixelel_count; pixelel++)
-        // Copy one pixelel, but possibly offset in destination
-        g_array_index(
-          pixmap->data, 
-          Pixelel, 
-          destPixel+pixelel
-          )
-          = 
-          image->data[srcPixel+pixelel];  // src data is array of uchar
-          
-      srcPixel += srcPixelStride;
-      destPixel += destPixelStride;
+      unsigned char run[ADAPT_FLOAT_RUN * MAX_IMAGE_SYNTH_BPP];
+      const float * srcRow = (const float *) (image->data + row * image->rowBytes);
+      guint col;
+      for(col=0; col<image->width; col+=ADAPT_FLOAT_RUN)
+      {
+        guint runPixels = (image->width - col < ADAPT_FLOAT_RUN) ? image->width - col : ADAPT_FLOAT_RUN;
+        convertFloatsToPixelels(srcRow + col * band->pixelelCount, run, runPixels * band->pixelelCount);
+        adaptBandRun(band, run, row, col, runPixels);
+      }
     }
+    else
+      adaptBandRun(band, image->data + row * image->rowBytes, row, 0, image->width);
   }
 }
 
 
 /*
-Reverse of above: copy from engine existing API pixmap format to external API pixmap format.
+Adapt image to pixmapCount pixmaps, already created of its dimensions, each with its mask of the same dimensions.
+*/
+static void
+adaptImageToPixmaps(
+  const ImageBuffer* image,   // IN row padded, bytes or floats
+  guint pixelelCount,         // IN pixelels of the image per pixel, all moved
+  guint pixmapCount,          // IN one or two
+  Map* pixmaps[],             // OUT
+  const ImageBuffer* masks[], // IN one pixelel per pixel, row padded
+  const gboolean isInverted[],// IN whether to ones complement each mask
+  guint threadCount           // IN 0: all processors
+  )
+{
+  guint rows = chunkBandRows(image->width);
+  guint bandCount = chunkBandCount(image->width, image->height);
+  TAdaptBand* bands;
+  guint i, j;
+  
+  if ( ! bandCount ) return;
+  bands = workspaceCalloc(bandCount, sizeof(TAdaptBand));
+  g_assert(bands);
+  for (i=0; i<bandCount; i++)
+  {
+    bands[i].image = image;
+    bands[i].pixelelCount = pixelelCount;
+    bands[i].pixmapCount = pixmapCount;
+    for (j=0; j<pixmapCount; j++)
+    {
+      bands[i].pixmaps[j] = pixmaps[j];
+      bands[i].masks[j] = masks[j];
+      bands[i].inversions[j] = isInverted[j] ? (Pixelel) ~0 : 0;
+    }
+    bands[i].startRow = i * rows;
+    bands[i].endRow = MIN(bands[i].startRow + rows, image->height);
+  }
+  runChunkTasks(adaptBandTask, bands, sizeof(TAdaptBand), bandCount, threadCount);
+  workspaceFree(bands);
+}
+
+
+/*
+Reverse of adaptImageToPixmaps(): copy from engine existing API pixmap format to external API pixmap format.
 Src is non row padded and offset
 Dest is row padded.
 
@@ -145,6 +246,30 @@ antiAdaptImage(
   guint srcPixelStride = pixelel_count + offset;  
   guint destPixelStride = pixelel_count;
   
+  if (imageBuffer->isFloat)
+  {
+    // Gather runs of a row as bytes, then convert them into the row
+    unsigned char run[ADAPT_FLOAT_RUN * MAX_IMAGE_SYNTH_BPP];
+    
+    for(row=0; row<imageBuffer->height; row++) 
+    {
+      float * destRow = (float *) (imageBuffer->data + row * imageBuffer->rowBytes);
+      for(col=0; col<imageBuffer->width; col+=ADAPT_FLOAT_RUN)
+      {
+        guint runPixels = (imageBuffer->width - col < ADAPT_FLOAT_RUN) ? imageBuffer->width - col : ADAPT_FLOAT_RUN;
+        guint i;
+        for (i=0; i<runPixels; i++)
+        {
+          for (pixelel=0; pixelel < pixelel_count; pixelel++)
+            run[i*destPixelStride+pixelel] = g_array_index(pixmap->data, Pixelel, srcPixel+pixelel);
+          srcPixel += srcPixelStride;
+        }
+        convertPixelelsToFloats(run, destRow + col * pixelel_count, runPixels * pixelel_count);
+      }
+    }
+    return;
+  }
+  
   for(row=0; row<imageBuffer->height; row++) 
   { 
     destPixel = row * imageBuffer->rowBytes; // destPixel index computed for START of each row
@@ -167,6 +292,37 @@ antiAdaptImage(
    }
 }
 
+/*
+Copy a rectangle of pixels between buffers of the same dimensions and pixels, bytes or floats either:
+converted only between bytes and floats, else copied row by row as is.
+Used to copy what a windowed heal does not synthesize, see imageSynthCommon().
+*/
+static void
+copyImageRectangle(
+  const ImageBuffer* source,    // IN
+  ImageBuffer* destination,     // OUT
+  guint         pixelel_count,  // IN pixelels per pixel, all moved
+  guint x, guint y, guint width, guint height
+  )
+{
+  guint sourceSize = source->isFloat ? sizeof(float) : sizeof(Pixelel);
+  guint destinationSize = destination->isFloat ? sizeof(float) : sizeof(Pixelel);
+  guint row;
+  
+  for(row=y; row<y+height; row++)
+  {
+    const unsigned char * src = source->data + row * source->rowBytes + x * pixelel_count * sourceSize;
+    unsigned char * dest = destination->data + row * destination->rowBytes + x * pixelel_count * destinationSize;
+    
+    if (source->isFloat == destination->isFloat)
+      memcpy(dest, src, width * pixelel_count * sourceSize);
+    else if (source->isFloat)
+      convertFloatsToPixelels((const float *) src, dest, width * pixelel_count);
+    else
+      convertPixelelsToFloats(src, (float *) dest, width * pixelel_count);
+  }
+}
+
 /*
 For test purposes, initialize buffer and antiAdapt into the buffer.
 
@@ -216,36 +372,28 @@ initBufferAndAntiAdapt(
 
 
 /*
-Adapt imageBuffer and its mask to our internal pixmap.
-
-Note the mask is kept separately and also interleaved into the pixmap,
-because a preparation step uses the mask separately.
-See prepareTarget.
+Adapt imageBuffer and its mask to our internal pixmap, with the mask interleaved
+(for performance: cache memory locality.)
 */
 void
 adaptImageAndMask(
   ImageBuffer * image,    // IN 
   ImageBuffer *   mask,   // IN 
   Map *imagePixmap,       // OUT our color pixmap of drawable, w/ interleaved mask
-  Map *maskPixmap,        // OUT our selection bytemap (only one channel ie pixelel ie byte ie depth)
-  guint pixelelPerPixel    // IN pixelels in the image e.g. 4 for RGBA
+  gboolean isInverted,    // IN whether to invert the mask
+  guint pixelelPerPixel,  // IN pixelels in the image e.g. 4 for RGBA
+  guint threadCount       // IN 0: all processors
   ) 
 {
-  // Note our internal map includes mask pixelel so +1
+  const ImageBuffer* masks[1] = { mask };
   
-  // Both OUT pixmaps same 2D dimensions.  
-  // imagePixmap includes a mask byte.
+  // Note our internal map includes mask pixelel so +1
   new_pixmap(imagePixmap, image->width, image->height, pixelelPerPixel+1 );
   
   // Get color, alpha channels.  Offset them past mask byte. 4 bytes of RGBA.
-  adaptImage(image, imagePixmap, FIRST_PIXELEL_INDEX, pixelelPerPixel);
-  
-  new_pixmap(maskPixmap, image->width, image->height, 1 );
+  adaptImageToPixmaps(image, pixelelPerPixel, 1, &imagePixmap, masks, &isInverted, threadCount);
   
-  // Get mask channel. Offset by 0 (mask byte first.)  Byte count 1.
-  adaptImage(mask, maskPixmap, 0, 1);
-  
-  // Assert two mallocs need to be freed
+  // Assert one malloc needs to be freed
 }
 
 
@@ -253,8 +401,9 @@ adaptImageAndMask(
 Adapt simpleAPI to existingAPI:
 - Duplicate the single image of the simpleAPI into two images (target and corpus) of existingAPI.
 - Invert the mask of the corpus
-- Interleave the masks into the main pixmap (but keep the mask pixmap also.)
+- Interleave the masks into the pixmaps.
 Inner engine (existingAPI) is more general and wants separate corpus and separate selection masks.
+All in one pass over the image, see adaptImageToPixmaps().
 */
 
 void
@@ -263,45 +412,23 @@ adaptSimpleAPI(
   ImageBuffer * maskBuffer,
   Map * targetMap,
   Map * corpusMap,
-  guint pixelelPerPixel // In imageBuffer
+  guint pixelelPerPixel, // In imageBuffer
+  guint threadCount      // 0: all processors
   )
 {
+  Map* pixmaps[2] = { targetMap, corpusMap };
+  const ImageBuffer* masks[2] = { maskBuffer, maskBuffer };
+  // !!!! For the simple API,  invert corpus mask: corpus is inverse of target selection
+  const gboolean isInverted[2] = { FALSE, TRUE };
+  
   // Assert image and mask are same size, not need to initialize empty mask with a value
   // (as is the case when mask is smaller).
-  Map targetMaskMap;
-  
-  // Copy image and mask to global pixmaps
-  adaptImageAndMask(
-    imageBuffer, 
-    maskBuffer,
-    targetMap, 
-    &targetMaskMap, 
-    pixelelPerPixel
-    );
-  
-  // For performance (cache memory locality), interleave mask into pixmap.
-  interleave_mask(targetMap, &targetMaskMap);  /* Interleave mask byte into our Pixels */
-  free_map(&targetMaskMap);
   
+  new_pixmap(targetMap, imageBuffer->width, imageBuffer->height, pixelelPerPixel+1);
+  new_pixmap(corpusMap, imageBuffer->width, imageBuffer->height, pixelelPerPixel+1);
   
-  // Duplicate image to corpus with inverted mask
-  Map corpusMaskMap;
-  
-  adaptImageAndMask(
-    imageBuffer, 
-    maskBuffer,
-    corpusMap,
-    &corpusMaskMap,
-    pixelelPerPixel
-    );
-  
-  // !!!! 
-  // For the simple API,  invert corpus mask: corpus is inverse of target selection
-  invert_bytemap(&corpusMaskMap);
-  
-  // For performance (cache memory locality), interleave mask into pixmap.
-  interleave_mask(corpusMap, &corpusMaskMap);  /* Interleave mask byte into our Pixels */
-  free_map(&corpusMaskMap);
+  // Copy image and mask to pixmaps, duplicating image to corpus with inverted mask
+  adaptImageToPixmaps(imageBuffer, pixelelPerPixel, 2, pixmaps, masks, isInverted, threadCount);
   
   // assert two mallocs
 }
@@ -313,46 +440,22 @@ adaptSimpleAPI2(
   ImageBuffer * maskBuffer2,
   Map * targetMap,
   Map * corpusMap,
-  guint pixelelPerPixel // In imageBuffer
+  guint pixelelPerPixel, // In imageBuffer
+  guint threadCount      // 0: all processors
   )
 {
+  Map* pixmaps[2] = { targetMap, corpusMap };
+  const ImageBuffer* masks[2] = { maskBuffer, maskBuffer2 };
+  const gboolean isInverted[2] = { FALSE, FALSE };
+  
   // Assert image and mask are same size, not need to initialize empty mask with a value
   // (as is the case when mask is smaller).
-  Map targetMaskMap;
   
-  // Copy image and mask to global pixmaps
-  adaptImageAndMask(
-    imageBuffer, 
-    maskBuffer,
-    targetMap, 
-    &targetMaskMap, 
-    pixelelPerPixel
-    );
+  new_pixmap(targetMap, imageBuffer->width, imageBuffer->height, pixelelPerPixel+1);
+  new_pixmap(corpusMap, imageBuffer->width, imageBuffer->height, pixelelPerPixel+1);
   
-  // For performance (cache memory locality), interleave mask into pixmap.
-  interleave_mask(targetMap, &targetMaskMap);  /* Interleave mask byte into our Pixels */
-  free_map(&targetMaskMap);
-  
-  
-  // Duplicate image to corpus with inverted mask
-  Map corpusMaskMap;
-  
-  adaptImageAndMask(
-    imageBuffer, 
-    maskBuffer2,
-    corpusMap,
-    &corpusMaskMap,
-    pixelelPerPixel
-    );
-  
-  
-  // For performance (cache memory locality), interleave mask into pixmap.
-  interleave_mask(corpusMap, &corpusMaskMap);  /* Interleave mask byte into our Pixels */
-  free_map(&corpusMaskMap);
+  // Copy image and mask to pixmaps, duplicating image to corpus with its own mask
+  adaptImageToPixmaps(imageBuffer, pixelelPerPixel, 2, pixmaps, masks, isInverted, threadCount);
   
   // assert two mallocs
 }
-
-
-
-
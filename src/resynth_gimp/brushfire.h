@@ -11,10 +11,10 @@ See also changes there.
 This change was made to eliminate the static variable max_cartesian_along_ray,
 which caused a bug during threaded execution.
 
-It is complicated by the fact that qsort compare funcs only take two parameters.
-So we create a struct having thing to be sorted (a target point coordinate)
-and having the associated value to be sorted by (proportional distance),
-and pass that to the compare func which sorts on the latter.
+Formerly the proportions were fields of a struct sorted by qsort, whose compare funcs only take two parameters.
+Now they are an array by target point, the keys of a radix sort (see orderTarget.h),
+computed in chunks of points on the worker pool: each chunk's maxima along rays, then each point's proportion.
+The result does not depend on the count of threads.
 
 
 
@@ -45,17 +45,6 @@ dumpTargetPoints(pointVector targetPoints)
       g_printf("%d %d\n", point.x, point.y);
       }
 }
-static void
-dumpSortArray(GArray* sortArray)
-{
-  guint i;
-  g_printf("Sort array:\n");
-  for(i=0; i<sortArray->len; i++)
-      {
-      TSortElementStruct sortElement = g_array_index(sortArray, TSortElementStruct, i) ;
-      g_printf("%d %d %f\n", sortElement.targetPoint.x, sortElement.targetPoint.y, sortElement.proportionToCenter );
-      }
-}
 #endif
 
 /*The grad (radial from 0..400) or angle of this vector (point) */
@@ -68,99 +57,123 @@ grad (Coordinates a)
 
 
 
-/* Array of computed maximum distances over all points along a ray (radius) */
+#include "chunkTasks.h"
+
+/* Points per task: enough that a task outweighs handing it to a worker */
+#define BRUSHFIRE_CHUNK 65536
+#define BRUSHFIRE_RAYS 401
+
+typedef struct brushfireChunkStruct {
+  pointVector targetPoints;
+  Coordinates center;
+  guint start;
+  guint end;
+  guint maxCartesianAlongRay[BRUSHFIRE_RAYS];  // of the chunk's points, then of all
+  const guint* maxOfAll;                        // for the proportions
+  gushort* rays;                                // by target point, by the maxima for the proportions
+  gfloat* proportions;                          // OUT, by target point
+} TBrushfireChunk;
+
+
+/* Maximum distances over the chunk's points along each ray (radius) */
 static void
-prepare_max_cartesian_along_ray(
-    pointVector targetPoints,   // Already offsets from center
-    guint* max_cartesian_along_ray
-    )
+brushfireMaximaTask(void* taskArgs)
 {
+  TBrushfireChunk* chunk = taskArgs;
   guint i;
 
-  for(i=0; i<401; i++)
-    max_cartesian_along_ray[i] = 0;
+  for(i=0; i<BRUSHFIRE_RAYS; i++)
+    chunk->maxCartesianAlongRay[i] = 0;
 
-  for(i=0; i<targetPoints->len; i++)
+  for(i=chunk->start; i<chunk->end; i++)
   {
-    Coordinates point = g_array_index(targetPoints, Coordinates, i);
-    // Assert point is an offset from center
+    Coordinates point = subtract_points(g_array_index(chunk->targetPoints, Coordinates, i), chunk->center);
     guint cartesian = point.x * point.x + point.y * point.y;
     guint ray = grad(point);
-    if ( cartesian > max_cartesian_along_ray[ray] )
-      max_cartesian_along_ray[ray] = cartesian;
+    chunk->rays[i] = ray;
+    if ( cartesian > chunk->maxCartesianAlongRay[ray] )
+      chunk->maxCartesianAlongRay[ray] = cartesian;
   }
-  /*
-   * Not all rays in grad units will have points on them, i.e. may have 0 max cartesian.
-   * But all rays on which some targetPoint falls WILL have non-zero max.
-   * Except for edge case of a single pixel target, which is handled safely in proportion_inward().
-   * We only index into this array by the rays for targetPoints (not every ray.)
-   */
-  /* dump_max_grad(); */
 }
 
 
 /*
-Ratio of this offset's distance from center to max distance of any point along
-the radial through this offset.
+Ratio of each point's distance from center to max distance of any point along
+the radial through it.
 Float in range (0,1] or NaN
-Note a is an offset, i.e. a vector from center, not from the origin.
 */
-static gfloat
-proportion_inward(
-  const Coordinates *a,
-  guint* max_cartesian_along_ray
-  )
+static void
+brushfireProportionsTask(void* taskArgs)
 {
-  guint ray = grad(*a);
-  /*
-   * Note that max_cartesian_along_ray[ray] MAY equal zero, for a target having only one pixel, etc.
-   * Floating division yields NaN which always compares FALSE.
-   */
-  return (gfloat) ((a->y * a->y) + (a->x * a->x)) / max_cartesian_along_ray[ray];
+  TBrushfireChunk* chunk = taskArgs;
+  guint i;
+
+  for(i=chunk->start; i<chunk->end; i++)
+  {
+    Coordinates point = subtract_points(g_array_index(chunk->targetPoints, Coordinates, i), chunk->center);
+    guint ray = chunk->rays[i];
+    /*
+     * Note that the max along a ray MAY equal zero, for a target having only one pixel, etc.
+     * Floating division yields NaN which always compares FALSE.
+     */
+    chunk->proportions[i] = (gfloat) ((point.y * point.y) + (point.x * point.x)) / chunk->maxOfAll[ray];
+  }
 }
 
+
 /*
-Copy targetPoint coordinates to sorting struct.
-Precompute another field to sort on: proportional distance from center.
+Proportional distance from the center of the target to its edge, along the ray through each target point.
+Returns an array by target point, for workspaceFree().
 */
-static GArray*
-targetPointsToSortArray(
-  pointVector targetPoints
+static gfloat*
+prepareProportionsInward(
+  pointVector targetPoints,
+  guint threadCount   // 0: all processors
   )
 {
-  GArray* sortArray = g_array_sized_new (FALSE, TRUE, sizeof(TSortElementStruct), targetPoints->len);
-
-  guint max_cartesian_along_ray[401];
-  prepare_max_cartesian_along_ray(targetPoints, max_cartesian_along_ray);
-
-  guint i;
-  TSortElementStruct sortElement;
-  Coordinates point;
-  for(i=0; i<targetPoints->len; i++)
-    {
-    point = g_array_index(targetPoints, Coordinates, i); // Allocates, but len is zero: no elements
-    sortElement.targetPoint = point;
-    sortElement.proportionToCenter = proportion_inward(&point, max_cartesian_along_ray);
-    g_array_append_val(sortArray, sortElement);
-    // g_printf("%d %d %d\n", sortElement.targetPoint.x, sortElement.targetPoint.y, sortElement.proportionToCenter );
-    }
-  return sortArray;
-}
+  guint chunkCount = (targetPoints->len + BRUSHFIRE_CHUNK - 1) / BRUSHFIRE_CHUNK;
+  TBrushfireChunk* chunks;
+  gfloat* proportions = workspaceCalloc(MAX(targetPoints->len, 1), sizeof(gfloat));
+  gushort* rays;
+  Coordinates center;
+  guint i, ray;
+
+  g_assert(proportions);
+  if ( ! chunkCount )
+    return proportions;
+#ifdef SYNTH_THREADED
+  if ( ! threadCount )
+    threadCount = detectProcessorCount();
+  threadCount = MIN(threadCount, SYNTH_MAX_THREADS);
+#endif
+  center = get_center(targetPoints, targetPoints->len);
+  chunks = workspaceCalloc(chunkCount, sizeof(TBrushfireChunk));
+  rays = workspaceCalloc(targetPoints->len, sizeof(gushort));
+  g_assert(chunks && rays);
+  for(i=0; i<chunkCount; i++)
+  {
+    chunks[i].targetPoints = targetPoints;
+    chunks[i].center = center;
+    chunks[i].start = i * BRUSHFIRE_CHUNK;
+    chunks[i].end = MIN(chunks[i].start + BRUSHFIRE_CHUNK, targetPoints->len);
+    chunks[i].maxOfAll = chunks[0].maxCartesianAlongRay;
+    chunks[i].proportions = proportions;
+    chunks[i].rays = rays;
+  }
 
-// Extract coordinates from sort array, and free the sort array
-static void
-targetPointsFromSortArray(
-    pointVector targetPoints,
-    GArray* sortArray
-  )
-{
-  guint i;
-  for(i=0; i<targetPoints->len; i++)
-    {
-    g_array_index(targetPoints, Coordinates, i) = g_array_index(sortArray, TSortElementStruct, i).targetPoint;
-    }
-  g_array_free(sortArray, TRUE);
+  runChunkTasks(brushfireMaximaTask, chunks, sizeof(TBrushfireChunk), chunkCount, threadCount);
+  /*
+   * Not all rays in grad units will have points on them, i.e. may have 0 max cartesian.
+   * But all rays on which some targetPoint falls WILL have non-zero max.
+   * Except for edge case of a single pixel target, which yields NaN, see brushfireProportionsTask().
+   * We only index into the maxima by the rays for targetPoints (not every ray.)
+   */
+  for(i=1; i<chunkCount; i++)
+    for(ray=0; ray<BRUSHFIRE_RAYS; ray++)
+      chunks[0].maxCartesianAlongRay[ray] = MAX(chunks[0].maxCartesianAlongRay[ray], chunks[i].maxCartesianAlongRay[ray]);
+  runChunkTasks(brushfireProportionsTask, chunks, sizeof(TBrushfireChunk), chunkCount, threadCount);
+
+  workspaceFree(rays);
+  workspaceFree(chunks);
+  return proportions;
 }
-
-
-
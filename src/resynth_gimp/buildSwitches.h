@@ -66,6 +66,15 @@ then run >automake from the top directory.
 // #define SYMMETRIC_METRIC_TABLE
 // #define VECTORIZED
 
+// Scalar only, no AVX2 or AVX-512 kernels chosen at run time, see patchKernel.h
+// #define SYNTH_NO_PATCH_KERNELS
+
+// No GPU: OpenCL is never loaded, and all synthesis is on the CPU, see deviceMatcher.h
+// #define SYNTH_NO_DEVICE
+
+// General code only, not specialized for Gray, GrayA, RGB and RGBA, see synthesize() in synthesize.h
+// #define SYNTH_NO_SPECIALIZED_LAYOUTS
+
 /*
 Threading.
 Requires file refinerThreaded.h
@@ -83,13 +92,16 @@ The latter has not been tested.
 #endif
 // Count threads to start.
 #ifdef SYNTH_THREADED
-  // A reasonable guess that most current processors have no more than 8 cores.
-  // More threads than cores does not seem to hurt performance.
-  // glib doesn't seem to support knowing the count of cores
-  #define THREAD_LIMIT    8
+  /*
+  The count of threads is chosen at run time: parameter threadCount,
+  which defaults to the count of processors available to the process (see detectProcessorCount())
+  Formerly a constant 8, a guess that processors have no more than 8 cores.
+  This is only a sanity limit on the parameter.
+  */
+  #define SYNTH_MAX_THREADS 1024
 #else
-  // This MUST be defined to 1 if not threaded, it affects how synthesize() iterates over target
-  #define THREAD_LIMIT 1
+  // This MUST be 1 if not threaded
+  #define SYNTH_MAX_THREADS 1
 #endif
 
 
@@ -0,0 +1,72 @@
+/*
+Independent tasks over the chunks of a job, on the worker pool.
+
+For the stages before and between synthesis: adapting images into pixmaps,
+preparing point vectors, proportions of the brushfire order, etc.
+A chunk is a record of arguments and results, e.g. a band of rows of an image or a run of points:
+each task writes only its own results (and its own part of shared outputs), so chunks may run in any order.
+Serial when not threaded, or for one chunk.
+
+Included source, not compiled separately.
+*/
+
+#ifndef __SYNTH_CHUNK_TASKS_H__
+#define __SYNTH_CHUNK_TASKS_H__
+
+#include "workerPool.h"
+
+/*
+Pixels per band of rows of an image: enough that a band outweighs handing it to a worker,
+few enough that the bands of a large image keep every thread busy.
+*/
+#define CHUNK_BAND_PIXELS 65536
+
+// Rows of a band of an image of width, at least one
+static inline guint
+chunkBandRows(guint width)
+{
+  return width ? MAX(CHUNK_BAND_PIXELS / width, 1) : 1;
+}
+
+static inline guint
+chunkBandCount(guint width, guint height)
+{
+  guint rows = chunkBandRows(width);
+  return (height + rows - 1) / rows;
+}
+
+
+/*
+Run task on each of chunkCount chunks of chunkSize bytes, using at most threadCount threads.
+Returns when all are done.
+*/
+static void
+runChunkTasks(
+  TWorkerTask task,
+  void* chunks,
+  size_t chunkSize,
+  guint chunkCount,
+  guint threadCount   // 0: all processors
+  )
+{
+#ifdef SYNTH_THREADED
+  if ( ! threadCount )
+    threadCount = detectProcessorCount();
+  threadCount = MIN(threadCount, SYNTH_MAX_THREADS);
+  if (threadCount > 1 && chunkCount > 1)
+  {
+    TWorkerPool* pool = defaultWorkerPool();
+    ensureWorkerPoolThreads(pool, MIN(threadCount, chunkCount) - 1);
+    runWorkerPoolBatch(pool, task, chunks, chunkSize, chunkCount);
+    return;
+  }
+#endif
+  {
+    guint i;
+    (void) threadCount;
+    for(i=0; i<chunkCount; i++)
+      task((char*) chunks + i * chunkSize);
+  }
+}
+
+#endif /* __SYNTH_CHUNK_TASKS_H__ */
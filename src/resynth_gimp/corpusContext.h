@@ -0,0 +1,131 @@
+/*
+Prepared corpus: what the engine derives from a corpus alone, prepared once for many runs.
+
+For callers synthesizing many targets from the same corpus (other sizes, seeds or masks):
+without it, every run adapts the corpus again, and prepares again its points, offsets, guarded copy,
+index (see patchIndex.h), quantized metrics, and the coarser corpora of the pyramid (see pyramid.h.)
+
+Each level of the pyramid has a level here, for as many levels as the parameters ask and the corpus allows.
+Prepared for the parameters given, but a run with other parameters still uses what they don't change
+(e.g. another seed or count of candidates), and prepares the rest itself.
+The offsets are prepared as if the target were no smaller than the corpus (the common case),
+a smaller target prepares its own.
+
+Only read by runs, so shared by concurrent runs without locking.
+Except recentProberMap: written by synthesis, it is one per run.
+*/
+
+#ifndef __SYNTH_CORPUS_CONTEXT_H__
+#define __SYNTH_CORPUS_CONTEXT_H__
+
+typedef struct corpusLevelStruct {
+  Map corpusMap;
+  pointVector corpusPoints;
+  pointVector sortedOffsets;  // for a target no smaller than the corpus
+  gint offsetsXSpan;          // of sortedOffsets, see sortedOffsetsSpans()
+  gint offsetsYSpan;
+  TGuardedCorpus guardedCorpus;
+  gboolean hasPatchIndex;
+  TPatchIndex patchIndex;
+} TCorpusLevel;
+
+struct corpusContextStruct {
+  TImageSynthParameters parameters; // prepared for
+  TCorpusLevel* levels;             // finest first
+  guint levelCount;
+  TPixelelMetricFunc corpusTargetMetric;
+  TMapPixelelMetricFunc mapMetric;
+};
+
+
+// Prepare a level for its corpusMap, already set
+static void
+prepareCorpusLevel(
+  TImageSynthParameters* parameters,
+  TFormatIndices* indices,
+  TCorpusLevel* level   // IN/OUT
+  )
+{
+  gint radius;
+  
+  prepareCorpusPoints(indices, &level->corpusMap, parameters->threadCount, &level->corpusPoints);
+  prepareSortedOffsets(&level->corpusMap, &level->corpusMap, parameters->offsetTableRadius, parameters->patchSize,
+    &level->sortedOffsets);
+  sortedOffsetsSpans(&level->corpusMap, &level->corpusMap, parameters->offsetTableRadius, parameters->patchSize,
+    &radius, &level->offsetsXSpan, &level->offsetsYSpan);
+  prepareGuardedCorpus(&level->corpusMap, guardBandForPatch(level->sortedOffsets, parameters->patchSize),
+    &level->guardedCorpus);
+  // An empty corpus (e.g. a coarse level of a thin one) has no index, engineLevel() fails on it anyway
+  level->hasPatchIndex = parameters->patchIndexCandidates && level->corpusPoints->len;
+  if (level->hasPatchIndex)
+    preparePatchIndex(indices, &level->corpusMap, level->corpusPoints,
+      parameters->patchIndexRadius, parameters->patchIndexCandidates, &level->patchIndex);
+}
+
+
+static void
+free_corpus_level(TCorpusLevel* level)
+{
+  free_map(&level->corpusMap);
+  g_array_free(level->corpusPoints, TRUE);
+  g_array_free(level->sortedOffsets, TRUE);
+  free_guarded_corpus(&level->guardedCorpus);
+  if (level->hasPatchIndex)
+    free_patch_index(&level->patchIndex);
+}
+
+
+// Level of a prepared corpus, or NULL if none prepared (no context, or a level coarser than prepared)
+static inline TCorpusLevel*
+corpusContextLevel(
+  TCorpusContext* context,
+  guint level
+  )
+{
+  return (context && level < context->levelCount) ? &context->levels[level] : NULL;
+}
+
+
+// Whether a run can use the prepared offsets: the same table it would prepare
+static inline gboolean
+isSharedOffsetsFit(
+  const TCorpusContext* context,
+  const TCorpusLevel* level,
+  const TImageSynthParameters* parameters,
+  Map* targetMap
+  )
+{
+  gint radius, xSpan, ySpan;
+  
+  if (parameters->offsetTableRadius != context->parameters.offsetTableRadius
+    || parameters->patchSize != context->parameters.patchSize)
+    return FALSE;
+  sortedOffsetsSpans(targetMap, (Map*) &level->corpusMap, parameters->offsetTableRadius, parameters->patchSize,
+    &radius, &xSpan, &ySpan);
+  return xSpan == level->offsetsXSpan && ySpan == level->offsetsYSpan;
+}
+
+
+// Whether a run can use the prepared index: the same descriptors (the count of candidates is per query)
+static inline gboolean
+isSharedPatchIndexFit(
+  const TCorpusLevel* level,
+  const TImageSynthParameters* parameters
+  )
+{
+  return level->hasPatchIndex
+    && level->patchIndex.radius == (parameters->patchIndexRadius ? parameters->patchIndexRadius : 1);
+}
+
+
+static inline gboolean
+isSharedMetricsFit(
+  const TCorpusContext* context,
+  const TImageSynthParameters* parameters
+  )
+{
+  return parameters->sensitivityToOutliers == context->parameters.sensitivityToOutliers
+    && parameters->mapWeight == context->parameters.mapWeight;
+}
+
+#endif /* __SYNTH_CORPUS_CONTEXT_H__ */
@@ -0,0 +1,146 @@
+/*
+Deterministic mode: the result is the same for any count of threads, and any scheduling of them.
+See isDeterministic in engineParams.h.
+
+Otherwise threads race: a thread reads neighbors that other threads are writing at the same moment,
+probes with its own generator (whose sequence depends on which target points the thread gets),
+and shares recentProberMap.  Here instead:
+
+- A pass is a sequence of batches of its prefix of targetPoints, a wavefront.
+  The bounds of batches depend only on the count of target points, see nextBatchEnd().
+- Within a batch, target points read only what earlier batches wrote:
+  their writes are staged, and committed after the batch (double buffered), see commitDeterministicBatch().
+  So no point sees another of its batch, and the threads of a batch may take its points in any order.
+- Each target point has its own generator, reseeded from the seed of the run, the pass, and its index.
+- Heuristic 2 (recentProberMap, shared) is kept per target point instead: a list of the points it probed.
+
+Batches grow with the count of points before them, so each point still sees nearly all earlier points,
+as if synthesized sequentially: a batch is at least DETERMINISTIC_BATCH_MIN points, else an eighth of those before it.
+Costs a rejoin of threads per batch, and a little quality early in the first pass, for repeatable output.
+
+Included source, not compiled separately.
+*/
+
+#ifndef __SYNTH_DETERMINISTIC_BATCH_H__
+#define __SYNTH_DETERMINISTIC_BATCH_H__
+
+#include <stdlib.h>   // calloc
+#include <string.h>   // memset
+
+#define DETERMINISTIC_BATCH_MIN 256
+#define DETERMINISTIC_BATCH_SHIFT 3   // A batch is at least this fraction (a shift) of the points before it
+
+// The staged write of one target point of a batch
+typedef struct stagedSourceStruct {
+  Coordinates source;
+  gboolean isBettered;  // else the point keeps its source (but gets a value, if it had none)
+} TStagedSource;
+
+typedef struct deterministicBatchStruct {
+  guint seed;     // of the run, from which the generators of target points are reseeded
+  guint pass;
+  guint start;    // target indexes [start, end) of the batch
+  guint end;
+  guint capacity; // most points of any batch
+  TStagedSource* staged;  // by target index minus start
+  /*
+  Best random probe of each point of the batch, by target index minus start, found on a GPU (see deviceBatch.h)
+  or NULL: synthesize() probes at random itself.
+  */
+  const Coordinates* deviceBest;
+} TDeterministicBatch;
+
+
+// End of the batch starting at start, within a pass ending at end
+static inline guint
+nextBatchEnd(
+  guint start,
+  guint end
+  )
+{
+  guint size = start >> DETERMINISTIC_BATCH_SHIFT;
+  
+  if (size < DETERMINISTIC_BATCH_MIN) size = DETERMINISTIC_BATCH_MIN;
+  return (end - start > size) ? start + size : end;
+}
+
+
+static void
+prepareDeterministicBatch(
+  TDeterministicBatch* batch,   // OUT
+  guint seed,
+  guint targetCount
+  )
+{
+  guint size = targetCount >> DETERMINISTIC_BATCH_SHIFT;
+  
+  // No batch is larger than the last, of the whole target
+  if (size < DETERMINISTIC_BATCH_MIN) size = DETERMINISTIC_BATCH_MIN;
+  batch->seed = seed;
+  batch->pass = 0;
+  batch->start = 0;
+  batch->end = 0;
+  batch->capacity = size;
+  batch->staged = workspaceCalloc(size, sizeof(TStagedSource));
+  batch->deviceBest = NULL;
+  g_assert(batch->staged);
+}
+
+
+static void
+free_deterministic_batch(TDeterministicBatch* batch)
+{
+  workspaceFree(batch->staged);
+}
+
+
+// Begin the batch after the current one (or the first of a pass, from start zero), nothing staged yet
+static inline void
+beginDeterministicBatch(
+  TDeterministicBatch* batch,   // IN/OUT
+  guint start,
+  guint end     // of the pass
+  )
+{
+  batch->start = start;
+  batch->end = nextBatchEnd(start, end);
+  batch->deviceBest = NULL;   // Until matched on a device
+  memset(batch->staged, 0, (batch->end - batch->start) * sizeof(TStagedSource));
+}
+
+
+// Seed of the generator of a target point: a hash of the run's seed, the pass, and the index (murmur3 finalizer)
+static inline guint
+deterministicPointSeed(
+  const TDeterministicBatch* batch,
+  guint targetIndex
+  )
+{
+  guint hash = batch->seed ^ (batch->pass * 0x9E3779B9u) ^ targetIndex;
+  
+  hash ^= hash >> 16;
+  hash *= 0x85EBCA6Bu;
+  hash ^= hash >> 13;
+  hash *= 0xC2B2AE35u;
+  hash ^= hash >> 16;
+  return hash;
+}
+
+
+// Whether a target point already probed a corpus point, when synthesizing it this pass (heuristic 2)
+static inline gboolean
+isProbedPoint(
+  const Coordinates probed[],
+  guint count,
+  Coordinates point
+  )
+{
+  guint i;
+  
+  for (i=0; i<count; i++)
+    if (probed[i].x == point.x && probed[i].y == point.y)
+      return TRUE;
+  return FALSE;
+}
+
+#endif /* __SYNTH_DETERMINISTIC_BATCH_H__ */
@@ -0,0 +1,178 @@
+/*
+Random probes of deterministic batches, on a GPU.  See deviceMatcher.h.
+
+Within a deterministic batch (see deterministicBatch.h) no point sees another,
+and each point draws its random probes from its own generator.
+So the patch and the random candidates of every point of a batch are known before any point is synthesized:
+the device compares them all at once, in full, and keeps the best candidate of each point.
+synthesize() then compares only that candidate, instead of looping over random probes,
+and keeps it as the loop would have: the result is the same as without a device.
+
+Heuristic 1 (sources of neighbors, propagation as in PatchMatch) stays on the CPU:
+few probes, whose perfect match skips the random probes.
+Not with a patch index, whose candidates depend on the patch, nor with SYMMETRIC_METRIC_TABLE.
+
+Included source, not compiled separately.
+*/
+
+#ifndef __SYNTH_DEVICE_BATCH_H__
+#define __SYNTH_DEVICE_BATCH_H__
+
+#include <string.h>   // memcpy
+
+#include "deviceMatcher.h"
+
+typedef struct deviceBatchStruct {
+  TDeviceMatcher* matcher;
+  guint chunkCapacity;      // points matched at once
+  guint neighborCapacity;   // per point
+  guint probeCapacity;      // random probes per point
+  GRand* prng;              // reseeded per point, as by synthesize()
+  gboolean isFailed;        // the device failed a batch: the rest are synthesized on the CPU alone
+  // Of a chunk, for the device
+  guint* patchStarts;
+  Coordinates* offsets;
+  Pixelel* pixels;
+  Coordinates* candidates;
+  guint* bestIndexes;
+  // Of a batch, the deviceBest of TDeterministicBatch
+  Coordinates* best;
+} TDeviceBatch;
+
+
+/*
+Prepare to match the batches of batch on a GPU.
+Returns FALSE if there is none (or no memory on it): then batches are synthesized on the CPU alone.
+*/
+static gboolean
+newDeviceBatch(
+  TDeviceBatch* deviceBatch,  // OUT
+  TImageSynthParameters* parameters,
+  const TPixelelLayout layout,
+  Map* corpusMap,
+  TPixelelMetricFunc corpusTargetMetric,
+  TMapPixelelMetricFunc mapsMetric,
+  const TDeterministicBatch* batch
+  )
+{
+#ifdef SYMMETRIC_METRIC_TABLE
+  return FALSE;
+#else
+  guint chunkCapacity = MIN(batch->capacity, IMAGE_SYNTH_DEVICE_CHUNK);
+  // The target point is a neighbor even if patchSize is zero, see prepare_neighbors()
+  guint neighborCapacity = MAX(parameters->patchSize, 1);
+
+  deviceBatch->matcher = newDeviceMatcher(corpusMap, corpusTargetMetric, mapsMetric,
+    layout.colorEndBip, layout.mapStartBip, layout.mapEndBip,
+    chunkCapacity, neighborCapacity, parameters->maxProbeCount);
+  if ( ! deviceBatch->matcher )
+    return FALSE;
+  deviceBatch->chunkCapacity = chunkCapacity;
+  deviceBatch->neighborCapacity = neighborCapacity;
+  deviceBatch->probeCapacity = parameters->maxProbeCount;
+  deviceBatch->prng = g_rand_new_with_seed(0);
+  deviceBatch->isFailed = FALSE;
+  deviceBatch->patchStarts = workspaceCalloc(chunkCapacity + 1, sizeof(guint));
+  deviceBatch->offsets = workspaceCalloc(chunkCapacity * neighborCapacity, sizeof(Coordinates));
+  deviceBatch->pixels = workspaceCalloc(chunkCapacity * neighborCapacity, MAX_IMAGE_SYNTH_BPP);
+  deviceBatch->candidates = workspaceCalloc(chunkCapacity * deviceBatch->probeCapacity, sizeof(Coordinates));
+  deviceBatch->bestIndexes = workspaceCalloc(chunkCapacity, sizeof(guint));
+  deviceBatch->best = workspaceCalloc(batch->capacity, sizeof(Coordinates));
+  g_assert(deviceBatch->patchStarts && deviceBatch->offsets && deviceBatch->pixels
+    && deviceBatch->candidates && deviceBatch->bestIndexes && deviceBatch->best);
+  return TRUE;
+#endif
+}
+
+
+static void
+free_device_batch(TDeviceBatch* deviceBatch)
+{
+  freeDeviceMatcher(deviceBatch->matcher);
+  g_rand_free(deviceBatch->prng);
+  workspaceFree(deviceBatch->patchStarts);
+  workspaceFree(deviceBatch->offsets);
+  workspaceFree(deviceBatch->pixels);
+  workspaceFree(deviceBatch->candidates);
+  workspaceFree(deviceBatch->bestIndexes);
+  workspaceFree(deviceBatch->best);
+}
+
+
+/*
+Match the random probes of the batch just begun, probeCount per point, on the device.
+Sets batch->deviceBest, unless the device fails: then this batch and the rest are probed on the CPU, as without one.
+Same patches and candidates as synthesize() prepares and draws: before the batch, no point of it changes them.
+*/
+static void
+matchBatchOnDevice(
+  TDeviceBatch* deviceBatch,
+  TDeterministicBatch* batch,   // IN/OUT deviceBest
+  TImageSynthParameters* parameters,
+  const TPixelelLayout layout,
+  Map* targetMap,
+  Map* corpusMap,
+  Map* hasValueMap,
+  TValuedGrid* valuedGrid,
+  Map* sourceOfMap,
+  pointVector targetPoints,
+  pointVector corpusPoints,
+  pointVector sortedOffsets,
+  guint probeCount,
+  TPassMetrics* passMetrics   // IN/OUT added to
+  )
+{
+  TNeighbor neighbors[IMAGE_SYNTH_MAX_NEIGHBORS];
+  guint start;
+
+  if (deviceBatch->isFailed || ! probeCount || probeCount > deviceBatch->probeCapacity)
+    return;
+  for (start = batch->start; start < batch->end; start += deviceBatch->chunkCapacity)
+  {
+    guint end = MIN(start + deviceBatch->chunkCapacity, batch->end);
+    guint count = 0;
+    guint target_index;
+
+    for (target_index = start; target_index < end; target_index++)
+    {
+      Coordinates position = g_array_index(targetPoints, Coordinates, target_index);
+      guint patch = target_index - start;
+      guint countNeighbors;
+      guint i;
+
+      countNeighbors = prepare_neighbors(position, parameters, layout,
+        targetMap, corpusMap, hasValueMap, valuedGrid, sourceOfMap, sortedOffsets,
+        neighbors
+        );
+      deviceBatch->patchStarts[patch] = count;
+      for (i=0; i<countNeighbors; i++, count++)
+      {
+        deviceBatch->offsets[count] = neighbors[i].offset;
+        memcpy(&deviceBatch->pixels[count * MAX_IMAGE_SYNTH_BPP], neighbors[i].pixel, MAX_IMAGE_SYNTH_BPP);
+      }
+      // Heuristic 1 draws nothing: these are the first draws of the point's generator, as in synthesize()
+      g_rand_set_seed(deviceBatch->prng, deterministicPointSeed(batch, target_index));
+      for (i=0; i<probeCount; i++)
+        deviceBatch->candidates[patch * probeCount + i] = randomCorpusPoint(corpusPoints, deviceBatch->prng);
+    }
+    deviceBatch->patchStarts[end - start] = count;
+
+    if ( ! deviceBestCandidates(deviceBatch->matcher, end - start, deviceBatch->patchStarts,
+        deviceBatch->offsets, deviceBatch->pixels, probeCount, deviceBatch->candidates, deviceBatch->bestIndexes) )
+    {
+      deviceBatch->isFailed = TRUE;
+      return;
+    }
+    for (target_index = start; target_index < end; target_index++)
+    {
+      guint patch = target_index - start;
+      deviceBatch->best[target_index - batch->start]
+        = deviceBatch->candidates[patch * probeCount + deviceBatch->bestIndexes[patch]];
+    }
+  }
+  batch->deviceBest = deviceBatch->best;
+  passMetrics->probes += (guint64) (batch->end - batch->start) * probeCount;
+  passMetrics->deviceProbes += (guint64) (batch->end - batch->start) * probeCount;
+}
+
+#endif /* __SYNTH_DEVICE_BATCH_H__ */
@@ -0,0 +1,448 @@
+/*
+Patch matching on a GPU, by OpenCL loaded at run time.  See deviceMatcher.h.
+
+Only the few entry points used are declared here, from the OpenCL 1.2 specification,
+so no OpenCL headers are needed to build.
+The kernels are compiled by the device's driver, on first use: their constants are passed as build options.
+*/
+
+// Compiling switch #defines
+#include "buildSwitches.h"
+
+#ifdef SYNTH_USE_GLIB
+  #include "../config.h" // GNU buildtools local configuration
+  #include <glib.h>
+#else
+  #include "glibProxy.h"
+#endif
+
+#include <stdio.h>    // snprintf
+#include <stdlib.h>   // calloc
+#include <stdint.h>   // intptr_t
+
+#include "map.h"
+#include "imageSynthConstants.h"
+#include "deviceMatcher.h"
+
+#if defined(SYNTH_THREADED) && ! defined(SYNTH_NO_DEVICE)
+
+#include <dlfcn.h>
+#include <pthread.h>
+
+typedef int32_t cl_int;
+typedef uint32_t cl_uint;
+typedef uint64_t cl_ulong;
+typedef cl_ulong cl_bitfield;
+typedef struct _cl_platform_id* cl_platform_id;
+typedef struct _cl_device_id* cl_device_id;
+typedef struct _cl_context* cl_context;
+typedef struct _cl_command_queue* cl_command_queue;
+typedef struct _cl_program* cl_program;
+typedef struct _cl_kernel* cl_kernel;
+typedef struct _cl_mem* cl_mem;
+typedef struct _cl_event* cl_event;
+
+#define CL_SUCCESS 0
+#define CL_FALSE 0
+#define CL_TRUE 1
+#define CL_DEVICE_TYPE_GPU (1 << 2)
+#define CL_MEM_WRITE_ONLY (1 << 1)
+#define CL_MEM_READ_ONLY (1 << 2)
+#define CL_MEM_READ_WRITE (1 << 0)
+#define CL_MEM_COPY_HOST_PTR (1 << 5)
+
+#define DEVICE_MAX_PLATFORMS 8
+
+/*
+One work item per candidate of a patch: the sum of computeBestFit() (the loop with clipping) without short circuit.
+Then one per patch: the first candidate of least sum.
+*/
+static const char* deviceKernelSource =
+  "__kernel void patchSums(\n"
+  "  __global const uchar* corpus, int width, int height, int depth,\n"
+  "  __global const ushort* colorMetric, __global const uint* mapMetric,\n"
+  "  int colorEnd, int mapStart, int mapEnd, ulong clippedWeight,\n"
+  "  __global const uint* patchStarts, __global const int2* offsets, __global const uchar* pixels,\n"
+  "  __global const int2* candidates, uint candidateCount, uint patchCount, __global ulong* sums)\n"
+  "{\n"
+  "  uint id = get_global_id(0);\n"
+  "  if (id >= patchCount * candidateCount) return;\n"
+  "  uint patch = id / candidateCount;\n"
+  "  int2 point = candidates[id];\n"
+  "  ulong sum = 0;\n"
+  "  for (uint i = patchStarts[patch]; i < patchStarts[patch + 1]; i++)\n"
+  "  {\n"
+  "    int x = point.x + offsets[i].x;\n"
+  "    int y = point.y + offsets[i].y;\n"
+  "    if (x < 0 || y < 0 || x >= width || y >= height) { sum += clippedWeight; continue; }\n"
+  "    __global const uchar* corpusPixel = corpus + (x + y * width) * depth;\n"
+  "    if (corpusPixel[MASK_PIXELEL_INDEX] != MASK_TOTALLY_SELECTED) { sum += clippedWeight; continue; }\n"
+  "    __global const uchar* pixel = pixels + i * PIXELEL_STRIDE;\n"
+  "    if (i > patchStarts[patch])\n"
+  "      for (int j = FIRST_PIXELEL_INDEX; j < colorEnd; j++)\n"
+  "        sum += colorMetric[256 + pixel[j] - corpusPixel[j]];\n"
+  "    for (int j = mapStart; j < mapEnd; j++)\n"
+  "      sum += mapMetric[256 + pixel[j] - corpusPixel[j]];\n"
+  "  }\n"
+  "  sums[id] = sum;\n"
+  "}\n"
+  "\n"
+  "__kernel void bestCandidates(\n"
+  "  __global const ulong* sums, uint candidateCount, uint patchCount, __global uint* bestIndexes)\n"
+  "{\n"
+  "  uint patch = get_global_id(0);\n"
+  "  if (patch >= patchCount) return;\n"
+  "  __global const ulong* patchSums = sums + patch * candidateCount;\n"
+  "  uint best = 0;\n"
+  "  for (uint c = 1; c < candidateCount; c++)\n"
+  "    if (patchSums[c] < patchSums[best]) best = c;\n"
+  "  bestIndexes[patch] = best;\n"
+  "}\n";
+
+
+// The entry points of OpenCL, the device, and its compiled kernels.  Found once, never freed.
+typedef struct {
+  cl_int (*clGetPlatformIDs)(cl_uint, cl_platform_id*, cl_uint*);
+  cl_int (*clGetDeviceIDs)(cl_platform_id, cl_bitfield, cl_uint, cl_device_id*, cl_uint*);
+  cl_context (*clCreateContext)(const intptr_t*, cl_uint, const cl_device_id*,
+    void (*)(const char*, const void*, size_t, void*), void*, cl_int*);
+  cl_command_queue (*clCreateCommandQueue)(cl_context, cl_device_id, cl_bitfield, cl_int*);
+  cl_program (*clCreateProgramWithSource)(cl_context, cl_uint, const char**, const size_t*, cl_int*);
+  cl_int (*clBuildProgram)(cl_program, cl_uint, const cl_device_id*, const char*, void (*)(cl_program, void*), void*);
+  cl_kernel (*clCreateKernel)(cl_program, const char*, cl_int*);
+  cl_mem (*clCreateBuffer)(cl_context, cl_bitfield, size_t, void*, cl_int*);
+  cl_int (*clSetKernelArg)(cl_kernel, cl_uint, size_t, const void*);
+  cl_int (*clEnqueueWriteBuffer)(cl_command_queue, cl_mem, cl_uint, size_t, size_t, const void*,
+    cl_uint, const cl_event*, cl_event*);
+  cl_int (*clEnqueueReadBuffer)(cl_command_queue, cl_mem, cl_uint, size_t, size_t, void*,
+    cl_uint, const cl_event*, cl_event*);
+  cl_int (*clEnqueueNDRangeKernel)(cl_command_queue, cl_kernel, cl_uint, const size_t*, const size_t*, const size_t*,
+    cl_uint, const cl_event*, cl_event*);
+  cl_int (*clReleaseMemObject)(cl_mem);
+  cl_int (*clReleaseKernel)(cl_kernel);
+  cl_int (*clReleaseCommandQueue)(cl_command_queue);
+
+  cl_device_id device;
+  cl_context context;
+  cl_program program;
+} TDevice;
+
+static TDevice theDevice;
+static gboolean isTheDevicePresent = FALSE;
+static pthread_once_t theDeviceOnce = PTHREAD_ONCE_INIT;
+
+#define LOAD_ENTRY(library, name) \
+    ((*(void**)(&theDevice.name) = dlsym((library), #name)) != NULL)
+
+static gboolean
+loadEntries(void* library)
+{
+  return LOAD_ENTRY(library, clGetPlatformIDs)
+    && LOAD_ENTRY(library, clGetDeviceIDs)
+    && LOAD_ENTRY(library, clCreateContext)
+    && LOAD_ENTRY(library, clCreateCommandQueue)
+    && LOAD_ENTRY(library, clCreateProgramWithSource)
+    && LOAD_ENTRY(library, clBuildProgram)
+    && LOAD_ENTRY(library, clCreateKernel)
+    && LOAD_ENTRY(library, clCreateBuffer)
+    && LOAD_ENTRY(library, clSetKernelArg)
+    && LOAD_ENTRY(library, clEnqueueWriteBuffer)
+    && LOAD_ENTRY(library, clEnqueueReadBuffer)
+    && LOAD_ENTRY(library, clEnqueueNDRangeKernel)
+    && LOAD_ENTRY(library, clReleaseMemObject)
+    && LOAD_ENTRY(library, clReleaseKernel)
+    && LOAD_ENTRY(library, clReleaseCommandQueue);
+}
+
+// The first GPU of any platform
+static gboolean
+findDevice(void)
+{
+  cl_platform_id platforms[DEVICE_MAX_PLATFORMS];
+  cl_uint platformCount = 0;
+  cl_uint i;
+
+  if (theDevice.clGetPlatformIDs(DEVICE_MAX_PLATFORMS, platforms, &platformCount) != CL_SUCCESS)
+    return FALSE;   // e.g. an ICD loader without drivers
+  if (platformCount > DEVICE_MAX_PLATFORMS)
+    platformCount = DEVICE_MAX_PLATFORMS;
+  for (i=0; i<platformCount; i++)
+  {
+    cl_uint deviceCount = 0;
+    if (theDevice.clGetDeviceIDs(platforms[i], CL_DEVICE_TYPE_GPU, 1, &theDevice.device, &deviceCount) == CL_SUCCESS
+        && deviceCount > 0)
+      return TRUE;
+  }
+  return FALSE;
+}
+
+static gboolean
+buildKernels(void)
+{
+  char options[256];
+  cl_int error;
+
+  theDevice.context = theDevice.clCreateContext(NULL, 1, &theDevice.device, NULL, NULL, &error);
+  if (error != CL_SUCCESS) return FALSE;
+  theDevice.program = theDevice.clCreateProgramWithSource(theDevice.context, 1, &deviceKernelSource, NULL, &error);
+  if (error != CL_SUCCESS) return FALSE;
+  snprintf(options, sizeof(options),
+    "-DPIXELEL_STRIDE=%d -DMASK_PIXELEL_INDEX=%d -DMASK_TOTALLY_SELECTED=%d -DFIRST_PIXELEL_INDEX=%d",
+    MAX_IMAGE_SYNTH_BPP, MASK_PIXELEL_INDEX, MASK_TOTALLY_SELECTED, FIRST_PIXELEL_INDEX);
+  return theDevice.clBuildProgram(theDevice.program, 1, &theDevice.device, options, NULL, NULL) == CL_SUCCESS;
+}
+
+static void
+findTheDevice(void)
+{
+  void* library = dlopen("libOpenCL.so.1", RTLD_NOW | RTLD_LOCAL);
+
+  if ( ! library )
+    library = dlopen("libOpenCL.so", RTLD_NOW | RTLD_LOCAL);
+  #ifdef __APPLE__
+  if ( ! library )
+    library = dlopen("/System/Library/Frameworks/OpenCL.framework/OpenCL", RTLD_NOW | RTLD_LOCAL);
+  #endif
+  // The library stays loaded even if not usable: a driver may have started threads
+  isTheDevicePresent = library && loadEntries(library) && findDevice() && buildKernels();
+}
+
+gboolean
+isDevicePresent(void)
+{
+  pthread_once(&theDeviceOnce, findTheDevice);
+  return isTheDevicePresent;
+}
+
+
+struct DeviceMatcherStruct {
+  cl_command_queue queue;   // Its own: concurrent runs do not share kernel arguments
+  cl_kernel sumKernel;
+  cl_kernel bestKernel;
+  // Resident for the life of the matcher
+  cl_mem corpus;
+  cl_mem colorMetric;
+  cl_mem mapMetric;
+  // Written (or read) per batch
+  cl_mem patchStarts;
+  cl_mem offsets;
+  cl_mem pixels;
+  cl_mem candidates;
+  cl_mem sums;
+  cl_mem bestIndexes;
+  guint patchCapacity;
+  guint neighborCapacity;
+  guint candidateCapacity;
+};
+
+static cl_mem
+newDeviceBuffer(cl_bitfield flags, size_t size, const void* hostPixels, gboolean* isFailed)
+{
+  cl_int error;
+  cl_mem buffer = theDevice.clCreateBuffer(theDevice.context,
+    hostPixels ? flags | CL_MEM_COPY_HOST_PTR : flags, size, (void*) hostPixels, &error);
+
+  if (error != CL_SUCCESS)
+  {
+    *isFailed = TRUE;
+    return NULL;
+  }
+  return buffer;
+}
+
+#define SET_ARG(kernel, index, value) \
+    (theDevice.clSetKernelArg((kernel), (index), sizeof(value), &(value)) == CL_SUCCESS)
+
+TDeviceMatcher*
+newDeviceMatcher(
+  const Map* corpusMap,
+  const gushort* corpusTargetMetric,
+  const guint* mapsMetric,
+  guint colorEndBip,
+  guint mapStartBip,
+  guint mapEndBip,
+  guint patchCapacity,
+  guint neighborCapacity,
+  guint candidateCapacity
+  )
+{
+  TDeviceMatcher* matcher;
+  cl_int error;
+  gboolean isFailed = FALSE;
+  size_t candidateTotal = (size_t) patchCapacity * candidateCapacity;
+  cl_int width = corpusMap->width;
+  cl_int height = corpusMap->height;
+  cl_int depth = corpusMap->depth;
+  cl_int colorEnd = colorEndBip;
+  cl_int mapStart = mapStartBip;
+  cl_int mapEnd = mapEndBip;
+  // As computeBestFit() for a neighbor outside the corpus
+  cl_ulong clippedWeight = (cl_ulong) MAX_WEIGHT * (colorEndBip - FIRST_PIXELEL_INDEX)
+    + (cl_ulong) mapsMetric[0] * (mapEndBip - mapStartBip);
+
+  if ( ! isDevicePresent() || ! patchCapacity || ! neighborCapacity || ! candidateCapacity )
+    return NULL;
+  matcher = calloc(1, sizeof(TDeviceMatcher));
+  if ( ! matcher ) return NULL;
+  matcher->patchCapacity = patchCapacity;
+  matcher->neighborCapacity = neighborCapacity;
+  matcher->candidateCapacity = candidateCapacity;
+
+  matcher->queue = theDevice.clCreateCommandQueue(theDevice.context, theDevice.device, 0, &error);
+  if (error != CL_SUCCESS) matcher->queue = NULL;
+  matcher->sumKernel = theDevice.clCreateKernel(theDevice.program, "patchSums", &error);
+  if (error != CL_SUCCESS) matcher->sumKernel = NULL;
+  matcher->bestKernel = theDevice.clCreateKernel(theDevice.program, "bestCandidates", &error);
+  if (error != CL_SUCCESS) matcher->bestKernel = NULL;
+  if ( ! matcher->queue || ! matcher->sumKernel || ! matcher->bestKernel )
+  {
+    freeDeviceMatcher(matcher);
+    return NULL;
+  }
+
+  matcher->corpus = newDeviceBuffer(CL_MEM_READ_ONLY,
+    (size_t) corpusMap->width * corpusMap->height * corpusMap->depth, corpusMap->data->data, &isFailed);
+  matcher->colorMetric = newDeviceBuffer(CL_MEM_READ_ONLY, 512 * sizeof(gushort), corpusTargetMetric, &isFailed);
+  matcher->mapMetric = newDeviceBuffer(CL_MEM_READ_ONLY, 512 * sizeof(guint), mapsMetric, &isFailed);
+  matcher->patchStarts = newDeviceBuffer(CL_MEM_READ_ONLY, (patchCapacity + 1) * sizeof(guint), NULL, &isFailed);
+  matcher->offsets = newDeviceBuffer(CL_MEM_READ_ONLY,
+    (size_t) patchCapacity * neighborCapacity * sizeof(Coordinates), NULL, &isFailed);
+  matcher->pixels = newDeviceBuffer(CL_MEM_READ_ONLY,
+    (size_t) patchCapacity * neighborCapacity * MAX_IMAGE_SYNTH_BPP, NULL, &isFailed);
+  matcher->candidates = newDeviceBuffer(CL_MEM_READ_ONLY, candidateTotal * sizeof(Coordinates), NULL, &isFailed);
+  matcher->sums = newDeviceBuffer(CL_MEM_READ_WRITE, candidateTotal * sizeof(cl_ulong), NULL, &isFailed);
+  matcher->bestIndexes = newDeviceBuffer(CL_MEM_WRITE_ONLY, patchCapacity * sizeof(guint), NULL, &isFailed);
+
+  // Arguments but the counts, set per batch
+  if (isFailed
+    || ! SET_ARG(matcher->sumKernel, 0, matcher->corpus)
+    || ! SET_ARG(matcher->sumKernel, 1, width)
+    || ! SET_ARG(matcher->sumKernel, 2, height)
+    || ! SET_ARG(matcher->sumKernel, 3, depth)
+    || ! SET_ARG(matcher->sumKernel, 4, matcher->colorMetric)
+    || ! SET_ARG(matcher->sumKernel, 5, matcher->mapMetric)
+    || ! SET_ARG(matcher->sumKernel, 6, colorEnd)
+    || ! SET_ARG(matcher->sumKernel, 7, mapStart)
+    || ! SET_ARG(matcher->sumKernel, 8, mapEnd)
+    || ! SET_ARG(matcher->sumKernel, 9, clippedWeight)
+    || ! SET_ARG(matcher->sumKernel, 10, matcher->patchStarts)
+    || ! SET_ARG(matcher->sumKernel, 11, matcher->offsets)
+    || ! SET_ARG(matcher->sumKernel, 12, matcher->pixels)
+    || ! SET_ARG(matcher->sumKernel, 13, matcher->candidates)
+    || ! SET_ARG(matcher->sumKernel, 16, matcher->sums)
+    || ! SET_ARG(matcher->bestKernel, 0, matcher->sums)
+    || ! SET_ARG(matcher->bestKernel, 3, matcher->bestIndexes))
+  {
+    freeDeviceMatcher(matcher);
+    return NULL;
+  }
+  return matcher;
+}
+
+void
+freeDeviceMatcher(TDeviceMatcher* matcher)
+{
+  cl_mem* buffers[] = { &matcher->corpus, &matcher->colorMetric, &matcher->mapMetric, &matcher->patchStarts,
+    &matcher->offsets, &matcher->pixels, &matcher->candidates, &matcher->sums, &matcher->bestIndexes };
+  guint i;
+
+  for (i=0; i<sizeof(buffers)/sizeof(buffers[0]); i++)
+    if (*buffers[i])
+      theDevice.clReleaseMemObject(*buffers[i]);
+  if (matcher->sumKernel) theDevice.clReleaseKernel(matcher->sumKernel);
+  if (matcher->bestKernel) theDevice.clReleaseKernel(matcher->bestKernel);
+  if (matcher->queue) theDevice.clReleaseCommandQueue(matcher->queue);
+  free(matcher);
+}
+
+gboolean
+deviceBestCandidates(
+  TDeviceMatcher* matcher,
+  guint patchCount,
+  const guint* patchStarts,
+  const Coordinates* offsets,
+  const Pixelel* pixels,
+  guint candidateCount,
+  const Coordinates* candidates,
+  guint* bestIndexes
+  )
+{
+  size_t neighborCount = patchStarts[patchCount];
+  size_t sumCount = (size_t) patchCount * candidateCount;
+  size_t bestCount = patchCount;
+  cl_uint candidateArg = candidateCount;
+  cl_uint patchArg = patchCount;
+
+  if ( ! patchCount ) return TRUE;
+  if (patchCount > matcher->patchCapacity || candidateCount > matcher->candidateCapacity
+      || neighborCount > (size_t) matcher->patchCapacity * matcher->neighborCapacity)
+    return FALSE;
+
+  // One in order queue: the writes need not block, the read of results does
+  return SET_ARG(matcher->sumKernel, 14, candidateArg)
+    && SET_ARG(matcher->sumKernel, 15, patchArg)
+    && SET_ARG(matcher->bestKernel, 1, candidateArg)
+    && SET_ARG(matcher->bestKernel, 2, patchArg)
+    && theDevice.clEnqueueWriteBuffer(matcher->queue, matcher->patchStarts, CL_FALSE, 0,
+      (patchCount + 1) * sizeof(guint), patchStarts, 0, NULL, NULL) == CL_SUCCESS
+    && theDevice.clEnqueueWriteBuffer(matcher->queue, matcher->offsets, CL_FALSE, 0,
+      neighborCount * sizeof(Coordinates), offsets, 0, NULL, NULL) == CL_SUCCESS
+    && theDevice.clEnqueueWriteBuffer(matcher->queue, matcher->pixels, CL_FALSE, 0,
+      neighborCount * MAX_IMAGE_SYNTH_BPP, pixels, 0, NULL, NULL) == CL_SUCCESS
+    && theDevice.clEnqueueWriteBuffer(matcher->queue, matcher->candidates, CL_FALSE, 0,
+      sumCount * sizeof(Coordinates), candidates, 0, NULL, NULL) == CL_SUCCESS
+    && theDevice.clEnqueueNDRangeKernel(matcher->queue, matcher->sumKernel, 1, NULL, &sumCount, NULL,
+      0, NULL, NULL) == CL_SUCCESS
+    && theDevice.clEnqueueNDRangeKernel(matcher->queue, matcher->bestKernel, 1, NULL, &bestCount, NULL,
+      0, NULL, NULL) == CL_SUCCESS
+    && theDevice.clEnqueueReadBuffer(matcher->queue, matcher->bestIndexes, CL_TRUE, 0,
+      patchCount * sizeof(guint), bestIndexes, 0, NULL, NULL) == CL_SUCCESS;
+}
+
+#else /* ! SYNTH_THREADED or SYNTH_NO_DEVICE */
+
+// No device: callers synthesize on the CPU
+
+gboolean
+isDevicePresent(void)
+{
+  return FALSE;
+}
+
+TDeviceMatcher*
+newDeviceMatcher(
+  const Map* corpusMap,
+  const gushort* corpusTargetMetric,
+  const guint* mapsMetric,
+  guint colorEndBip,
+  guint mapStartBip,
+  guint mapEndBip,
+  guint patchCapacity,
+  guint neighborCapacity,
+  guint candidateCapacity
+  )
+{
+  return NULL;
+}
+
+void
+freeDeviceMatcher(TDeviceMatcher* matcher)
+{
+}
+
+gboolean
+deviceBestCandidates(
+  TDeviceMatcher* matcher,
+  guint patchCount,
+  const guint* patchStarts,
+  const Coordinates* offsets,
+  const Pixelel* pixels,
+  guint candidateCount,
+  const Coordinates* candidates,
+  guint* bestIndexes
+  )
+{
+  return FALSE;
+}
+
+#endif
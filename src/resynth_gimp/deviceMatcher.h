@@ -0,0 +1,69 @@
+/*
+Patch matching on a GPU.
+
+computeBestFit() compares a patch to one corpus point at a time, short circuiting when no better.
+Here instead a device compares the patches of many target points (a batch) to all their random candidates at once,
+each sum in full, and keeps for each patch its candidate of least sum: the first of them if equal,
+which is the one the loop over random probes in synthesize() would keep.  See deviceBatch.h.
+
+The device is found through OpenCL, loaded at run time (dlopen of its ICD loader):
+no OpenCL is needed to build, nor to run where there is none.
+Then, or when no GPU is found, or its kernels do not build, there is no device and callers synthesize on the CPU.
+The device (context and kernels) is found once per process, see isDevicePresent().
+A matcher keeps the corpus, the metric tables and buffers for batches resident on the device:
+one per run (per level), not shared by threads.
+
+Requires glibProxy.h (or glib.h) and map.h be included first.
+*/
+
+#ifndef __SYNTH_DEVICE_MATCHER_H__
+#define __SYNTH_DEVICE_MATCHER_H__
+
+typedef struct DeviceMatcherStruct TDeviceMatcher;
+
+// Whether a GPU is usable.  The first call loads OpenCL and builds the kernels.
+extern gboolean
+isDevicePresent(void);
+
+/*
+A matcher of patches to corpusMap, or NULL if no device (or it lacks memory.)
+Metric tables are those of matchWeighting.h, of 512 entries, not symmetric.
+Batches are at most patchCapacity patches, of at most neighborCapacity neighbors each,
+with at most candidateCapacity candidates each.
+*/
+extern TDeviceMatcher*
+newDeviceMatcher(
+  const Map* corpusMap,
+  const gushort* corpusTargetMetric,
+  const guint* mapsMetric,
+  guint colorEndBip,
+  guint mapStartBip,
+  guint mapEndBip,    // mapStartBip if no maps
+  guint patchCapacity,
+  guint neighborCapacity,
+  guint candidateCapacity
+  );
+
+extern void
+freeDeviceMatcher(TDeviceMatcher* matcher);
+
+/*
+For each of patchCount patches, the index of its best candidate.
+The neighbors of patch p are [patchStarts[p], patchStarts[p+1]), the first the target point itself:
+their offsets, and their pixels MAX_IMAGE_SYNTH_BPP pixelels apart (as in TNeighbor.)
+Patch p has candidateCount candidates from p * candidateCount on.
+Returns FALSE if the device failed: then the batch is to be matched on the CPU.
+*/
+extern gboolean
+deviceBestCandidates(
+  TDeviceMatcher* matcher,
+  guint patchCount,
+  const guint* patchStarts,   // patchCount + 1 of them
+  const Coordinates* offsets,
+  const Pixelel* pixels,
+  guint candidateCount,
+  const Coordinates* candidates,
+  guint* bestIndexes    // OUT, patchCount of them
+  );
+
+#endif /* __SYNTH_DEVICE_MATCHER_H__ */
@@ -74,6 +74,7 @@ It doesn't make tiles in the target, it makes a target that is suitable as a til
 #include "buildSwitches.h"
 
 #include <math.h>
+#include <string.h> // memset
 
 #ifdef SYNTH_USE_GLIB
   #include "../config.h" // GNU buildtools local configuration
@@ -90,9 +91,12 @@ It doesn't make tiles in the target, it makes a target that is suitable as a til
   /*
   More proxy.  Redefine GRand routines
   On platform Linux, used Glib g_rand
-  On platform OSX (when using stdc but not Glib), proxy calls stdc rand()
+  Otherwise (when not using Glib), proxy uses a PCG generator, see glibProxy.h
   */
   #define g_rand_new_with_seed(s) s_rand_new_with_seed(s)
+  #define g_rand_free(r) s_rand_free(r)
+  #define g_rand_set_seed(r,s) s_rand_set_seed(r,s)
+  #define g_rand_int(r) s_rand_int(r)
   #define g_rand_int_range(r,u,l) s_rand_int_range(r,u,l)
 #endif
 
@@ -106,6 +110,7 @@ It doesn't make tiles in the target, it makes a target that is suitable as a til
 #include "map.h"
 #include "engineParams.h"
 #include "engine.h"
+#include "workspace.h" // engine allocations, see workspaceCalloc()
 
 /* 
 Source not compiled separately. Is separate to reduce file sizes and coupling. 
@@ -117,17 +122,7 @@ Also, some functions are inlined.
 #include "mapOps.h"   // definitions for map.h
 #include "matchWeighting.h"
 #include "orderTarget.h"
-
-
-#ifdef STATS
-/* For development */
-guint countSourceTries = 0;
-guint countTargetTries = 0;
-guint total_targets = 0;  /* Total target attempts over all passes, barring short circuit. */
-
-// remember the most recent kind of corpus point that bettered the previous best
-guint bettermentStats[MAX_BETTERMENT_KIND];
-#endif
+#include "chunkTasks.h"
 
 
 /*
@@ -149,22 +144,61 @@ Would require different wrapOrClipTarget().
 Might affect performance of cache or memory swapping
 */
 
+/*
+A bit per pixel (a byte formerly): it is a large map of a large image.
+Threads set bits of the same word, for different pixels: atomically.
+*/
 static inline void
 setHasValue( Coordinates *coords, guchar value, Map* hasValueMap)
 {
-  *bytemap_index(hasValueMap, *coords) = value;
+  guint bit;
+  guint* word = bitmap_word(hasValueMap, *coords, &bit);
+#ifdef SYNTH_THREADED
+  if (value)
+    __atomic_fetch_or(word, bit, __ATOMIC_RELAXED);
+  else
+    __atomic_fetch_and(word, ~bit, __ATOMIC_RELAXED);
+#else
+  if (value)
+    *word |= bit;
+  else
+    *word &= ~bit;
+#endif
+}
+
+/*
+Set bits of a word of hasValueMap at once, by index of the word: setHasValue() of each, for a run of pixels.
+The words at the ends of a band of rows are shared with the threads of other bands.
+*/
+static inline void
+setHasValueBits(guint wordIndex, guint bits, Map* hasValueMap)
+{
+  guint* word;
+  if ( ! bits ) return;
+  word = &g_array_index(hasValueMap->data, guint, wordIndex);
+#ifdef SYNTH_THREADED
+  __atomic_fetch_or(word, bits, __ATOMIC_RELAXED);
+#else
+  *word |= bits;
+#endif
 }
 
 static inline gboolean
 getHasValue(Coordinates coords, Map* hasValueMap)
 {
-  return (* bytemap_index(hasValueMap, coords));
+  guint bit;
+  guint* word = bitmap_word(hasValueMap, coords, &bit);
+#ifdef SYNTH_THREADED
+  return (__atomic_load_n(word, __ATOMIC_RELAXED) & bit) != 0;
+#else
+  return (*word & bit) != 0;
+#endif
 }
 
 static inline void
 prepareHasValue(Map* targetMap, Map* hasValueMap)
 {
-  new_bytemap(hasValueMap, targetMap->width, targetMap->height);
+  new_bitmap(hasValueMap, targetMap->width, targetMap->height);
 }
 
 
@@ -182,24 +216,58 @@ the source are copied to a dense structure neighbor_sources for the inner search
 */
 
 
+/*
+Sources are packed in a guint (two gints formerly): the index of the corpus point, y * width + x, by the width of the corpus.
+All ones means no source, unpacked as (-1,-1).
+So the corpus is limited to fewer than 2^32 - 1 pixels in all (any shape), see engine().
+Callers pass the width of the corpus the sources are of.
+*/
+#define SOURCE_OF_NONE IMAGE_SYNTH_NO_SOURCE  // All ones, see sources in engineParams.h
+
+static inline gboolean
+isCorpusTooLargeForSourceOf(const Map* corpusMap)
+{
+  return (guint64) corpusMap->width * corpusMap->height >= SOURCE_OF_NONE;
+}
+
+static inline guint
+packSourceOf(Coordinates source, guint corpusWidth)
+{
+  return (source.x == -1) ? SOURCE_OF_NONE : (guint) source.y * corpusWidth + (guint) source.x;
+}
+
+static inline Coordinates
+unpackSourceOf(guint packed, guint corpusWidth)
+{
+  Coordinates source = {-1, -1};
+  if (packed != SOURCE_OF_NONE)
+  {
+    source.x = (gint) (packed % corpusWidth);
+    source.y = (gint) (packed / corpusWidth);
+  }
+  return source;
+}
+
 static inline void
 setSourceOf (
   Coordinates target_point,
   Coordinates source_corpus_point,
-  Map* sourceOfMap
+  Map* sourceOfMap,
+  guint corpusWidth
   )
 {
-  *coordmap_index(sourceOfMap, target_point) = source_corpus_point;
+  *intmap_index(sourceOfMap, target_point) = packSourceOf(source_corpus_point, corpusWidth);
 }
   
 
 static inline Coordinates
 getSourceOf ( 
   Coordinates target_point,
-  Map* sourceOfMap
+  Map* sourceOfMap,
+  guint corpusWidth
   )
 {
-  return *coordmap_index(sourceOfMap, target_point);
+  return unpackSourceOf(*intmap_index(sourceOfMap, target_point), corpusWidth);
 }
   
 
@@ -209,18 +277,11 @@ prepare_target_sources(
   Map* targetMap,
   Map* sourceOfMap)
 {
-  guint x;
-  guint y;
-  Coordinates null_coords = {-1, -1};
+  new_intmap(sourceOfMap, targetMap->width, targetMap->height);
   
-  new_coordmap(sourceOfMap, targetMap->width, targetMap->height);
-  
-  for(y=0; y<targetMap->height; y++)
-    for(x=0; x<targetMap->width; x++) 
-      {
-      Coordinates coords = {x,y}; 
-      setSourceOf(coords, null_coords, sourceOfMap);
-      }
+  // All ones, bytewise
+  memset(intmap_index(sourceOfMap, (Coordinates) {0, 0}), 0xFF,
+    (size_t) targetMap->width * targetMap->height * sizeof(guint));
 }
 
 static inline gboolean
@@ -229,7 +290,7 @@ has_source (
   Map* sourceOfMap
   )
 {
-  return (getSourceOf(target_point, sourceOfMap).x != -1) ;
+  return *intmap_index(sourceOfMap, target_point) != SOURCE_OF_NONE;
 }
 
 
@@ -309,21 +370,160 @@ not_transparent_corpus(
 Array of index of most recent target point that probed this corpus point 
 (recentProberMap[corpus x,y] = target)
 !!! Larger than necessary if the corpus has holes in it.  TODO very minor.
-!!! Note recentProberMap is unsigned, -1 == 0xFFFFFF should not match any target index.
+
+Holds only the low 16 bits of a target index (a guint formerly): it is as large as the corpus.
+Heuristic 2 only skips a probe when the corpus point was probed recently for the same target point,
+so a target index 65536 apart matching by mistake costs at most one skipped probe.
+RECENT_PROBER_NONE is a target index (rarely) but skips at most a probe too.
+*/
+#define RECENT_PROBER_NONE 0xFFFF
+
+static inline gushort
+recentProberKey(guint target_index)
+{
+  return (gushort) target_index;
+}
+
+/*
+Written by synthesis, so one per run, not shared with a prepared corpus (see corpusContext.h.)
+RECENT_PROBER_NONE is all ones: filled bytewise.
 */
 static void
 prepareRecentProber(Map* corpusMap, Map* recentProberMap)
 {
-  guint x;
-  guint y;
+  new_shortmap(recentProberMap, corpusMap->width, corpusMap->height);
+  memset(shortmap_index(recentProberMap, (Coordinates) {0, 0}), 0xFF,
+    (size_t) corpusMap->width * corpusMap->height * sizeof(gushort));
+}
+
+
+/*
+Point vectors of a map, in raster order, in bands of rows on the worker pool: see chunkTasks.h.
+A pass counts the points of each band, then a pass writes each band's points from its offset in the vector,
+and for the target, sets the bits of hasValueMap of the context.
+Each pass reads only the mask (and alpha) pixelels, through pointers that step by pixel.
+Formerly a point was appended at a time, and the corpus vector reserved for every pixel.
+*/
+typedef struct pointBandStruct {
+  Map* map;
+  TFormatIndices* indices;
+  gboolean isCorpus;        // points of the corpus, else of the target
+  Map* hasValueMap;         // of the target for its context, NULL if not using the context or for the corpus
+  guint startRow;
+  guint endRow;
+  guint count;              // points of the band
+  Coordinates* points;      // OUT where the band's points start in the vector
+} TPointBand;
+
+// Whether the pixel is a point of the band's vector, see isSelectedTarget() and isSelectedCorpus()
+static inline gboolean
+isBandPoint(const TPointBand* band, const Pixelel* pixel)
+{
+  if ( ! band->isCorpus )
+    return pixel[MASK_PIXELEL_INDEX] != MASK_UNSELECTED;
+  /* In prior versions, the user's mask was inverted to establish the corpus,
+  I.E. this was "not is_selected"
+  */
+  return pixel[MASK_PIXELEL_INDEX] == MASK_TOTALLY_SELECTED
+    /* Exclude transparent from corpus */
+    && ( ! band->indices->isAlphaSource || pixel[band->indices->alpha_bip] != ALPHA_TOTAL_TRANSPARENCY );
+}
+
+static void
+countPointBandTask(void* taskArgs)
+{
+  TPointBand* band = taskArgs;
+  const guint depth = band->map->depth;
+  const Pixelel* pixel = &g_array_index(band->map->data, Pixelel, (size_t) band->startRow * band->map->width * depth);
+  const Pixelel* end = &g_array_index(band->map->data, Pixelel, (size_t) band->endRow * band->map->width * depth);
+  guint count = 0;
+  
+  for ( ; pixel < end; pixel += depth)
+    count += isBandPoint(band, pixel);
+  band->count = count;
+}
+
+static void
+fillPointBandTask(void* taskArgs)
+{
+  TPointBand* band = taskArgs;
+  Map* map = band->map;
+  const gboolean isAlpha = band->indices->isAlphaTarget;
+  const TPixelelIndex alpha_bip = band->indices->alpha_bip;
+  const Pixelel* pixel = &g_array_index(map->data, Pixelel, (size_t) band->startRow * map->width * map->depth);
+  Coordinates* points = band->points;
+  // Bits of hasValueMap of the current word, set at once, see setHasValueBits()
+  guint wordIndex = band->startRow * map->width >> 5;
+  guint bits = 0;
+  Coordinates coords;
   
-  new_intmap(recentProberMap, corpusMap->width, corpusMap->height);
-  for(y=0; y< (guint) corpusMap->height; y++)
-    for(x=0; x< (guint) corpusMap->width; x++)
+  for (coords.y=band->startRow; coords.y<(gint) band->endRow; coords.y++)
+    for (coords.x=0; coords.x<(gint) map->width; coords.x++, pixel += map->depth)
     {
-      Coordinates coords = {x,y};
-      *intmap_index(recentProberMap, coords) = -1;
-    } 
+      if (isBandPoint(band, pixel))
+        *points++ = coords;
+      /*
+      Remember whether use this image point for matching target neighbors.
+      Initially, no target points have value, and some context points will have value.
+      Later, synthesized target points will have values also.
+      !!! and if the point is not transparent (e.g. background layer) which is arbitrarily black !!!
+      */
+      else if ( band->hasValueMap && ( ! isAlpha || pixel[alpha_bip] != ALPHA_TOTAL_TRANSPARENCY ))
+      {
+        guint index = coords.x + coords.y * map->width;
+        if (index >> 5 != wordIndex)
+        {
+          setHasValueBits(wordIndex, bits, band->hasValueMap);
+          wordIndex = index >> 5;
+          bits = 0;
+        }
+        bits |= 1u << (index & 31);
+      }
+    }
+  setHasValueBits(wordIndex, bits, band->hasValueMap);
+}
+
+// Vector of the points of map: of the target, or of the corpus
+static void
+preparePointVector(
+  Map* map,
+  TFormatIndices* indices,
+  gboolean isCorpus,
+  Map* hasValueMap,       // IN/OUT bits of the context set, if not NULL
+  guint threadCount,      // 0: all processors
+  pointVector* points     // OUT
+  )
+{
+  guint rows = chunkBandRows(map->width);
+  guint bandCount = chunkBandCount(map->width, map->height);
+  TPointBand* bands = workspaceCalloc(MAX(bandCount, 1), sizeof(TPointBand));
+  guint size = 0;
+  guint i;
+  
+  g_assert(bands);
+  for (i=0; i<bandCount; i++)
+  {
+    bands[i].map = map;
+    bands[i].indices = indices;
+    bands[i].isCorpus = isCorpus;
+    bands[i].hasValueMap = hasValueMap;
+    bands[i].startRow = i * rows;
+    bands[i].endRow = MIN(bands[i].startRow + rows, map->height);
+  }
+  runChunkTasks(countPointBandTask, bands, sizeof(TPointBand), bandCount, threadCount);
+  
+  /* Sized exactly */
+  for (i=0; i<bandCount; i++)
+    size += bands[i].count;
+  *points = g_array_sized_new (FALSE, TRUE, sizeof(Coordinates), size); /* reserve */
+  g_array_set_size(*points, size);
+  for (i=0, size=0; i<bandCount; i++)
+  {
+    bands[i].points = &g_array_index(*points, Coordinates, size);
+    size += bands[i].count;
+  }
+  runChunkTasks(fillPointBandTask, bands, sizeof(TPointBand), bandCount, threadCount);
+  workspaceFree(bands);
 }
 
 
@@ -341,53 +541,19 @@ prepareTargetPoints(
   TFormatIndices* indices,
   Map* targetMap,
   Map* hasValueMap,
+  guint threadCount,
   pointVector* targetPoints
   )
 {
-  guint x;
-  guint y;
-  
-  /* Count selected pixels in the image, for sizing a vector */
-  guint size = 0;
-  for(y=0; y<targetMap->height; y++)
-    for(x=0; x<targetMap->width; x++)
-      {
-      Coordinates coords = {x,y};
-      if (isSelectedTarget(coords, targetMap)) 
-        size++;
-      }
-  
-  *targetPoints = g_array_sized_new (FALSE, TRUE, sizeof(Coordinates), size); /* reserve */
-  
   prepareHasValue(targetMap, hasValueMap);  /* reserve, initialize to value: unknown */
   
-  for(y=0; y<targetMap->height; y++)
-    for(x=0; x<targetMap->width; x++) 
-    {
-      Coordinates coords = {x,y};
-      
-      /*
-      Remember whether use this image point for matching target neighbors.
-      Initially, no target points have value, and some context points will have value.
-      Later, synthesized target points will have values also.
-      */
-      setHasValue(&coords,
-        (
-          is_use_context // ie use_border ie match image neighbors outside the selection (the context)
-          && ! isSelectedTarget(coords, targetMap)  // outside the target
-          /* !!! and if the point is not transparent (e.g. background layer) which is arbitrarily black !!! */
-          && not_transparent_image(coords, indices, targetMap)
-        ),
-        hasValueMap);
-      
-      /* 
-      Make vector targetPoints 
-      !!! Note we do NOT exclude transparent.  Will synthesize color (but not alpha)
-      for all selected pixels in target, regardless of transparency.
-      */
-      if (isSelectedTarget(coords, targetMap)) 
-        g_array_append_val(*targetPoints, coords);
-    }
+  /*
+  Make vector targetPoints 
+  !!! Note we do NOT exclude transparent.  Will synthesize color (but not alpha)
+  for all selected pixels in target, regardless of transparency.
+  Context points have value if is_use_context (ie use_border ie match image neighbors outside the selection)
+  */
+  preparePointVector(targetMap, indices, FALSE, is_use_context ? hasValueMap : NULL, threadCount, targetPoints);
 }
 
 
@@ -401,32 +567,11 @@ void
 prepareCorpusPoints (
   TFormatIndices* indices,
   Map* corpusMap,
+  guint threadCount,
   pointVector* corpusPoints
   ) 
 {
-  /* Reserve size of pixmap, but excess, includes unselected. */
-  *corpusPoints = g_array_sized_new (FALSE, TRUE, sizeof(Coordinates),
-   corpusMap->height*corpusMap->width);
-  
-  {
-  guint x;
-  guint y;
-  
-  for(y=0; y<corpusMap->height; y++)
-    for(x=0; x<corpusMap->width; x++)
-    {
-      Coordinates coords = {x, y};
-      /* In prior versions, the user's mask was inverted to establish the corpus,
-      I.E. this was "not is_selected"
-      */
-      if (isSelectedCorpus(coords, corpusMap)
-        && not_transparent_corpus(coords, indices, corpusMap) /* Exclude transparent from corpus */
-        ) 
-      {
-        g_array_append_val(*corpusPoints, coords);
-      }
-    }
-  }
+  preparePointVector(corpusMap, indices, TRUE, NULL, threadCount, corpusPoints);
   // Size is checked by caller. 
 }
 
@@ -450,45 +595,72 @@ Vector of offsets to surrounding points of a point, i.e. to a patch around a poi
 Used as candidates to compute neighbors vector (nearby points that are selected and with values.)
 Which is used in two places: 1) neighbor heuristic 2) try_point.
 
-Sorted ascending on distance from (0,0) (see the < operator for class Coordinates).
+Sorted ascending on distance from (0,0), ties ordered, see lessOffset().
 
 !!! Note that offset 0,0 included, is the first element in sorted vector.
 That makes a point it's own neighbor, i.e. part of the patch for (surrounding) a point.
 
-Spans twice the min of corpus and image (target).
-Why?  So from one corner, the offsets will reach fully across.
+Spans twice the min of corpus and image (target), so from one corner, the offsets could reach fully across,
+but the table is capped to a disc of radius tableRadius: it is all most patches need.
+Formerly it was the whole span, quadratic in image size: hundreds of MB and a long sort for a large image.
+Offsets beyond the disc, within the span, are found by a search, for sparse patches only,
+see prepareFartherNeighbors().
 
-TODO, for uncropping, where the target surrounds the corpus,
-this might be vastly many more offsets than are needed for good synthesis.
-But at worst, if not used they get paged out from virtual memory.
+The table always holds at least patchSize offsets (radius at least the square root of patchSize.)
 */
+
+// Radius and spans of the table, see prepareSortedOffsets()
+static void
+sortedOffsetsSpans(
+  Map* targetMap,
+  Map* corpusMap,
+  guint tableRadius,
+  guint patchSize,
+  gint* radius,   // OUT
+  gint* xSpan,    // OUT
+  gint* ySpan     // OUT
+  )
+{
+  // Minimum().  Use smaller dimension of corpus and target.
+  gint width = (corpusMap->width < targetMap->width ? corpusMap->width : targetMap->width);
+  gint height = (corpusMap->height < targetMap->height ? corpusMap->height : targetMap->height);
+  
+  *radius = (gint) tableRadius;
+  while ((guint) (*radius * *radius) < patchSize) (*radius)++;
+  // eg for width==3, [-2,-1,0,1,2]
+  *xSpan = (*radius < width - 1) ? *radius : width - 1;
+  *ySpan = (*radius < height - 1) ? *radius : height - 1;
+}
+
+
 static void 
 prepareSortedOffsets(
   Map* targetMap,
   Map* corpusMap,
+  guint tableRadius,
+  guint patchSize,
   pointVector* sortedOffsets
   ) 
 {
-  // Minimum().  Use smaller dimension of corpus and target.
-  gint width = (corpusMap->width < targetMap->width ? corpusMap->width : targetMap->width);
-  gint height = (corpusMap->height < targetMap->height ? corpusMap->height : targetMap->height);
-  guint allocatedSize = (2*width-1)*(2*height-1);   // eg for width==3, [-2,-1,0,1,2], size==5
+  gint radius, xSpan, ySpan;
+  
+  sortedOffsetsSpans(targetMap, corpusMap, tableRadius, patchSize, &radius, &xSpan, &ySpan);
   
-  *sortedOffsets = g_array_sized_new (FALSE, TRUE, sizeof(Coordinates), allocatedSize); //Reserve
+  *sortedOffsets = g_array_sized_new (FALSE, TRUE, sizeof(Coordinates), (2*xSpan+1)*(2*ySpan+1)); //Reserve
   
   {
   gint x; // !!! Signed offsets
   gint y;
   
-  for(y=-height+1; y<height; y++)
-    for(x=-width+1; x<width; x++) 
+  for(y=-ySpan; y<=ySpan; y++)
+    for(x=-xSpan; x<=xSpan; x++) 
       {
       Coordinates coords = {x,y};
-      g_array_append_val(*sortedOffsets, coords);
+      if (offsetDistance(coords) <= radius * radius)
+        g_array_append_val(*sortedOffsets, coords);
       }
   }
-  g_assert((*sortedOffsets)->len == allocatedSize);  // Completely filled
-  g_array_sort(*sortedOffsets, (gint (*)(const void*, const void*)) lessCartesian);
+  g_array_sort(*sortedOffsets, (gint (*)(const void*, const void*)) lessOffset);
   
   /* lkk An experiment to sort the offsets in row major order for better memory 
   locality didn't help performance. 
@@ -517,12 +689,53 @@ clippedOrMaskedCorpus(
 }
 
 
+/*
+Context pixels take their fixed sources, see fixedSources in engineParams.h, where those are in the corpus.
+Not target pixels: they are synthesized.
+*/
+static void
+seedFixedSources(
+  const guint* fixedSources,
+  Map* targetMap,
+  Map* corpusMap,
+  Map* hasValueMap,
+  Map* sourceOfMap    // IN/OUT
+  )
+{
+  guint x;
+  guint y;
+  
+  for(y=0; y<targetMap->height; y++)
+    for(x=0; x<targetMap->width; x++)
+    {
+      Coordinates coords = {x,y};
+      guint packed = fixedSources[y * targetMap->width + x];
+      Coordinates source;
+      
+      if (packed == SOURCE_OF_NONE || isSelectedTarget(coords, targetMap) || ! getHasValue(coords, hasValueMap))
+        continue;
+      source = unpackSourceOf(packed, corpusMap->width);
+      if ( ! clippedOrMaskedCorpus(source, corpusMap) )
+        setSourceOf(coords, source, sourceOfMap, corpusMap->width);
+    }
+}
+
+
 // Included source (function declarations, not just definitions.)
 // Descending levels of the engine
 // imageSynth()->engine()->refiner()->synthesize
 #include "passes.h"
 #include "progress.h"
+#include "tileSchedule.h"
+#include "valuedGrid.h"
+#include "guardedCorpus.h"
+#include "patchKernel.h"
+#include "patchIndex.h"
+#include "patchDescriptor.h"
+#include "deterministicBatch.h"
+#include "synthMetrics.h"
 #include "synthesize.h"
+#include "deviceBatch.h"
 // Both files define the same function refiner()
 #ifdef SYNTH_THREADED
   #include "refinerThreaded.h"
@@ -530,24 +743,33 @@ clippedOrMaskedCorpus(
   #include "refiner.h"
 #endif
 
+#include "pyramid.h"
+#include "corpusContext.h"
+
 /*
-The engine.
+The engine, at one level of resolution.
 Independent of platform, calling app, and graphics libraries.
 This is mostly preparation: real work done by refiner() and synthesize().
 */
 
-int
-engine(
+static int
+engineLevel(
   TImageSynthParameters parameters,
   TFormatIndices* indices,
   Map* targetMap,
   Map* corpusMap,
+  TCorpusLevel* sharedCorpus, // IN prepared corpus of corpusMap, only read, or NULL: prepared here
+  const TCorpusContext* corpusContext, // IN context of sharedCorpus
+  Map* coarseSourceOfMap, // IN sources found at the coarser level, or NULL if none
+  guint coarseCorpusWidth, // Of the corpus of coarseSourceOfMap, its sources are packed by it
+  Map* sourceOfMapOut,    // OUT if not NULL, sources found, caller must free
   void (*progressCallback)(int, void*),
   void *contextInfo,
   int *cancelFlag
   )
 {
   // Engine private data. On stack (and heap), not global, so engine is reentrant.
+  // Those of the corpus are shared from sharedCorpus, when it has them.
   
   /*
   A map on the corpus yielding indexes of target points.
@@ -572,6 +794,17 @@ engine(
   (-1,-1) indicates no source.
   */
   Map sourceOfMap;   
+  
+  // Counts of hasValueMap per coarse cell, for finding sparse neighbors, see valuedGrid.h
+  TValuedGrid valuedGrid;
+  
+  // Copy of corpus with a band around it, for matching without clipping, see guardedCorpus.h
+  TGuardedCorpus guardedCorpus;
+  // Index of corpus for the random probes, optional, see patchIndex.h
+  TPatchIndex patchIndex;
+  // Descriptors of corpus for rejecting probes, optional, see patchDescriptor.h
+  TPatchDescriptors patchDescriptors;
+  gboolean isDescriptors;
 
   /* 
   1-D array (vector) of Coordinates.
@@ -587,6 +820,9 @@ engine(
   TPixelelMetricFunc corpusTargetMetric;
   TMapPixelelMetricFunc mapMetric;
   
+  gboolean isSharedOffsets;
+  gboolean isSharedPatchIndex;
+  
   // check parameters in range
   if ( parameters.patchSize > IMAGE_SYNTH_MAX_NEIGHBORS)
     return IMAGE_SYNTH_ERROR_PATCH_SIZE_EXCEEDED;
@@ -594,6 +830,7 @@ engine(
   // target prep
   prepareTargetPoints(parameters.matchContextType, indices, targetMap, 
     &hasValueMap, 
+    parameters.threadCount,
     &targetPoints);
   #ifdef ANIMATE
   clear_target_pixels(indices->color_end_bip);  // For debugging, blacken so new colors sparkle
@@ -609,10 +846,18 @@ engine(
     return IMAGE_SYNTH_ERROR_EMPTY_TARGET;
   }
   prepare_target_sources(targetMap, &sourceOfMap);
+  if (coarseSourceOfMap)
+    seedFromCoarseLevel(indices, targetMap, corpusMap, coarseSourceOfMap, coarseCorpusWidth,
+      targetPoints, &hasValueMap, &sourceOfMap);
+  if (parameters.fixedSources)
+    seedFixedSources(parameters.fixedSources, targetMap, corpusMap, &hasValueMap, &sourceOfMap);
 
   
   // source prep
-  prepareCorpusPoints(indices, corpusMap, &corpusPoints);
+  if (sharedCorpus)
+    corpusPoints = sharedCorpus->corpusPoints;
+  else
+    prepareCorpusPoints(indices, corpusMap, parameters.threadCount, &corpusPoints);
   /* 
   Rare user error: all corpus pixels transparent or not selected (mask empty.) Which means we can't synthesize.
   This error NOT occur in GIMP if selection does not intersect, since then we use the whole drawable.
@@ -622,31 +867,71 @@ engine(
     g_array_free(targetPoints, TRUE);
     free_map(&hasValueMap);
     free_map(&sourceOfMap);
-    g_array_free(corpusPoints, TRUE);
+    if ( ! sharedCorpus )
+      g_array_free(corpusPoints, TRUE);
     return IMAGE_SYNTH_ERROR_EMPTY_CORPUS;
   }
   
   // prep things not images
-  prepareSortedOffsets(targetMap, corpusMap, &sortedOffsets); // Depends on image size
-  quantizeMetricFuncs(
-    parameters.sensitivityToOutliers, 
-    parameters.mapWeight,
-    corpusTargetMetric,
-    mapMetric
-    );
+  isSharedOffsets = sharedCorpus && isSharedOffsetsFit(corpusContext, sharedCorpus, &parameters, targetMap);
+  if (isSharedOffsets)
+    sortedOffsets = sharedCorpus->sortedOffsets;
+  else
+    prepareSortedOffsets(targetMap, corpusMap, parameters.offsetTableRadius, parameters.patchSize, &sortedOffsets);
+  if (corpusContext && isSharedMetricsFit(corpusContext, &parameters))
+  {
+    memcpy(corpusTargetMetric, corpusContext->corpusTargetMetric, sizeof(corpusTargetMetric));
+    memcpy(mapMetric, corpusContext->mapMetric, sizeof(mapMetric));
+  }
+  else
+    quantizeMetricFuncs(
+      parameters.sensitivityToOutliers, 
+      parameters.mapWeight,
+      corpusTargetMetric,
+      mapMetric
+      );
  
   // Now we need a prng, before order_targetPoints
   /* Originally: srand(time(0));   But then testing is non-repeatable. 
-  TODO the seed should be a hash of the input or a user parameter.
-  Then it would be repeatable, but changeable by the user.
+  The seed is a user parameter: repeatable, but changeable by the user.
+  Threads derive their own generators from this one, see refiner().
   */
-  prng = g_rand_new_with_seed(1198472);
+  prng = g_rand_new_with_seed(parameters.randomSeed);
   
   int error = orderTargetPoints(&parameters, targetPoints, prng);
   // A programming error that we don't clean up.
   if (error) return error;
   
   prepareRecentProber(corpusMap, &recentProberMap);  // Must follow prepare_corpus
+  prepareValuedGrid(&hasValueMap, &valuedGrid);  // Must follow seeding
+  // A shared guarded corpus fits any patch: one that doesn't fit its band is matched with clipping
+  if (sharedCorpus)
+    guardedCorpus = sharedCorpus->guardedCorpus;
+  else
+    prepareGuardedCorpus(corpusMap, guardBandForPatch(sortedOffsets, parameters.patchSize), &guardedCorpus);
+  isSharedPatchIndex = sharedCorpus && isSharedPatchIndexFit(sharedCorpus, &parameters);
+  if (parameters.patchIndexCandidates)
+  {
+    if (isSharedPatchIndex)
+    {
+      patchIndex = sharedCorpus->patchIndex;
+      patchIndex.candidates = parameters.patchIndexCandidates;
+    }
+    else
+      preparePatchIndex(indices, corpusMap, corpusPoints,
+        parameters.patchIndexRadius, parameters.patchIndexCandidates, &patchIndex);
+  }
+  // Not in a shared guarded corpus: this copy of it, per level
+  #ifdef SYMMETRIC_METRIC_TABLE
+  isDescriptors = FALSE;
+  #else
+  isDescriptors = parameters.isCascadeRejection && indices->colorEndBip > FIRST_PIXELEL_INDEX;
+  #endif
+  if (isDescriptors)
+  {
+    preparePatchDescriptors(corpusMap, pixelelLayoutOf(indices), corpusTargetMetric, &patchDescriptors);
+    guardedCorpus.descriptors = &patchDescriptors;
+  }
   
   // Preparations done, begin actual synthesis
   print_processor_time();
@@ -658,8 +943,11 @@ engine(
     indices,
     targetMap,
     corpusMap,
+    &guardedCorpus,
+    parameters.patchIndexCandidates ? &patchIndex : NULL,
     &recentProberMap,
     &hasValueMap,
+    &valuedGrid,
     &sourceOfMap,
     targetPoints,
     corpusPoints,
@@ -676,17 +964,288 @@ engine(
   // Caller must free the IN pixmaps since the targetMap holds synthesis results
   free_map(&recentProberMap);
   free_map(&hasValueMap);
-  free_map(&sourceOfMap);
+  free_valued_grid(&valuedGrid);
+  if (sourceOfMapOut)
+    *sourceOfMapOut = sourceOfMap;
+  else
+    free_map(&sourceOfMap);
+  if ( ! sharedCorpus )
+    free_guarded_corpus(&guardedCorpus);
+  if (parameters.patchIndexCandidates && ! isSharedPatchIndex)
+    free_patch_index(&patchIndex);
+  if (isDescriptors)
+    free_patch_descriptors(&patchDescriptors);
   
   g_array_free(targetPoints, TRUE);
-  g_array_free(corpusPoints, TRUE);
-  g_array_free(sortedOffsets, TRUE);
+  if ( ! sharedCorpus )
+    g_array_free(corpusPoints, TRUE);
+  if ( ! isSharedOffsets )
+    g_array_free(sortedOffsets, TRUE);
   
-  #ifdef SYNTH_USE_GLIB
   g_rand_free(prng);
-  #endif
   
   return 0; // Success, even if canceled
 }
 
 
+/*
+Synthesize at a coarser level first, recursively, if levels remain and the images are large enough.
+Only the finest level reports progress, and previews its passes.
+corpusLevel is the level of the corpus in a prepared corpus, if any: coarser levels are prepared too, as far as it goes.
+*/
+static int
+pyramidLevel(
+  TImageSynthParameters parameters,
+  TFormatIndices* indices,
+  Map* targetMap,
+  Map* corpusMap,
+  TCorpusContext* corpusContext,  // IN or NULL
+  guint corpusLevel,
+  guint levels,
+  Map* sourceOfMapOut,    // OUT if not NULL, sources found, caller must free
+  void (*progressCallback)(int, void*),
+  void *contextInfo,
+  int *cancelFlag
+  )
+{
+  TCorpusLevel* sharedCorpus = corpusContextLevel(corpusContext, corpusLevel);
+  TCorpusLevel* coarseSharedCorpus;
+  TImageSynthParameters coarseParameters = parameters;
+  Map coarseTargetMap;
+  Map coarseCorpusMap;
+  Map coarseSourceOfMap;
+  guint coarseCorpusWidth;
+  int coarseError;
+  int error;
+  
+  if (levels <= 1 || isPyramidLevelTooSmall(targetMap, corpusMap))
+    return engineLevel(parameters, indices, targetMap, corpusMap, sharedCorpus, corpusContext, NULL, 0, sourceOfMapOut,
+      progressCallback, contextInfo, cancelFlag);
+  
+  downsamplePixmap(targetMap, &coarseTargetMap, TRUE);
+  coarseSharedCorpus = corpusContextLevel(corpusContext, corpusLevel + 1);
+  if ( ! coarseSharedCorpus )
+    downsamplePixmap(corpusMap, &coarseCorpusMap, FALSE);
+  coarseCorpusWidth = coarseSharedCorpus ? coarseSharedCorpus->corpusMap.width : coarseCorpusMap.width;
+  coarseParameters.passCallback = NULL;  // Nor previews
+  coarseParameters.fixedSources = NULL;  // Of the finest level
+  if (parameters.deadline)
+  {
+    double now = metricsSeconds();
+    if (now < parameters.deadline)
+      coarseParameters.deadline = now + (parameters.deadline - now) * PYRAMID_DEADLINE_SHARE;
+  }
+  coarseError = pyramidLevel(coarseParameters, indices, &coarseTargetMap,
+    coarseSharedCorpus ? &coarseSharedCorpus->corpusMap : &coarseCorpusMap,
+    corpusContext, corpusLevel + 1, levels - 1, &coarseSourceOfMap,
+    NULL, NULL, cancelFlag);
+  free_map(&coarseTargetMap);
+  if ( ! coarseSharedCorpus )
+    free_map(&coarseCorpusMap);
+  
+  if (*cancelFlag)
+  {
+    if ( ! coarseError ) free_map(&coarseSourceOfMap);
+    return 0; // Canceled is not an error
+  }
+  
+  // Seeded: mostly heuristic 1 will find sources, few random probes needed
+  parameters.maxProbeCount = parameters.maxProbeCount / PYRAMID_PROBE_DIVISOR;
+  if (parameters.maxProbeCount < 1) parameters.maxProbeCount = 1;
+  
+  // If the coarse level failed (e.g. the coarse corpus is empty because the corpus is thin) synthesize unseeded
+  error = engineLevel(parameters, indices, targetMap, corpusMap, sharedCorpus, corpusContext,
+    coarseError ? NULL : &coarseSourceOfMap, coarseCorpusWidth, sourceOfMapOut,
+    progressCallback, contextInfo, cancelFlag);
+  if ( ! coarseError ) free_map(&coarseSourceOfMap);
+  return error;
+}
+
+
+/*
+The engine.
+Independent of platform, calling app, and graphics libraries.
+*/
+int
+engine(
+  TImageSynthParameters parameters,
+  TFormatIndices* indices,
+  Map* targetMap,
+  Map* corpusMap,
+  TCorpusContext* corpusContext,
+  void (*progressCallback)(int, void*),
+  void *contextInfo,
+  int *cancelFlag
+  )
+{
+  Map sourceOfMap = {0, 0, 0, NULL};  // Data only if reported, see sources
+  int error;
+  
+  if (corpusContext)
+  {
+    corpusMap = &corpusContext->levels[0].corpusMap;
+    // Prepared for another format
+    if (corpusMap->depth != targetMap->depth)
+      return IMAGE_SYNTH_ERROR_INVALID_IMAGE_FORMAT;
+  }
+  // Sources are packed, see setSourceOf()
+  if (isCorpusTooLargeForSourceOf(corpusMap))
+    return IMAGE_SYNTH_ERROR_CORPUS_TOO_LARGE;
+  error = pyramidLevel(parameters, indices, targetMap, corpusMap, corpusContext, 0, parameters.pyramidLevels,
+    parameters.sources ? &sourceOfMap : NULL,
+    progressCallback, contextInfo, cancelFlag);
+  // Not set when a level fails or is canceled early
+  if (sourceOfMap.data)
+  {
+    if ( ! error && ! *cancelFlag )
+      memcpy(parameters.sources, &g_array_index(sourceOfMap.data, guint, 0),
+        (size_t) targetMap->width * targetMap->height * sizeof(guint));
+    free_map(&sourceOfMap);
+  }
+  return error;
+}
+
+
+/*
+Prepare a corpus for many runs, see corpusContext.h.
+Levels as pyramidLevel() would make them, as far as the corpus alone allows.
+*/
+int
+newCorpusContext(
+  TImageSynthParameters parameters,
+  TFormatIndices* indices,
+  Map* corpusMap,
+  TCorpusContext** corpusContext
+  )
+{
+  TCorpusContext* context;
+  guint levels = parameters.pyramidLevels ? parameters.pyramidLevels : 1;
+  guint i;
+  
+  *corpusContext = NULL;
+  if (isCorpusTooLargeForSourceOf(corpusMap))
+  {
+    free_map(corpusMap);
+    return IMAGE_SYNTH_ERROR_CORPUS_TOO_LARGE;
+  }
+  
+  context = calloc(1, sizeof(TCorpusContext));
+  g_assert(context);
+  context->parameters = parameters;
+  context->levels = calloc(levels, sizeof(TCorpusLevel));
+  g_assert(context->levels);
+  context->levels[0].corpusMap = *corpusMap;
+  context->levelCount = 1;
+  while (context->levelCount < levels)
+  {
+    Map* fineMap = &context->levels[context->levelCount - 1].corpusMap;
+    
+    // As isPyramidLevelTooSmall(), for the corpus
+    if (fineMap->width / 2 < PYRAMID_MIN_SIZE || fineMap->height / 2 < PYRAMID_MIN_SIZE)
+      break;
+    downsamplePixmap(fineMap, &context->levels[context->levelCount].corpusMap, FALSE);
+    context->levelCount++;
+  }
+  for (i=0; i<context->levelCount; i++)
+    prepareCorpusLevel(&parameters, indices, &context->levels[i]);
+  quantizeMetricFuncs(parameters.sensitivityToOutliers, parameters.mapWeight,
+    context->corpusTargetMetric, context->mapMetric);
+  
+  if ( ! context->levels[0].corpusPoints->len )
+  {
+    freeCorpusContext(context);
+    return IMAGE_SYNTH_ERROR_EMPTY_CORPUS;
+  }
+  *corpusContext = context;
+  return IMAGE_SYNTH_SUCCESS;
+}
+
+
+void
+freeCorpusContext(TCorpusContext* corpusContext)
+{
+  guint i;
+  
+  for (i=0; i<corpusContext->levelCount; i++)
+    free_corpus_level(&corpusContext->levels[i]);
+  free(corpusContext->levels);
+  free(corpusContext);
+}
+
+
+/*
+Bookkeeping of one level of engineLevel(), in bytes, excluding the pixmaps passed in.
+An upper bound, roughly: targetPoints is counted as if the whole target were selected.
+*/
+static size_t
+engineLevelMemoryEstimate(
+  const TImageSynthParameters* parameters,
+  size_t targetWidth,
+  size_t targetHeight,
+  size_t corpusWidth,
+  size_t corpusHeight,
+  size_t depth  // Pixelels per pixel of pixmaps, including the mask
+  )
+{
+  size_t targetSize = targetWidth * targetHeight;
+  size_t corpusSize = corpusWidth * corpusHeight;
+  size_t radius = 0;
+  size_t band;
+  size_t tableRadius;
+  size_t bytes = 0;
+  
+  // As prepareSortedOffsets() and guardBandForPatch(), but bounds
+  while (radius * radius < parameters->patchSize) radius++;
+  band = 2 * radius;
+  tableRadius = (parameters->offsetTableRadius > radius) ? parameters->offsetTableRadius : radius;
+  
+  bytes += (targetSize + 31) / 32 * sizeof(guint);  // hasValueMap
+  bytes += targetSize * sizeof(guint);  // sourceOfMap
+  bytes += ((targetWidth + VALUED_GRID_CELL_SIZE - 1) / VALUED_GRID_CELL_SIZE)
+    * ((targetHeight + VALUED_GRID_CELL_SIZE - 1) / VALUED_GRID_CELL_SIZE) * sizeof(guint);  // valuedGrid
+  bytes += corpusSize * sizeof(gushort);  // recentProberMap
+  bytes += (targetSize + corpusSize) * sizeof(Coordinates);  // targetPoints, corpusPoints
+  bytes += (2 * tableRadius + 1) * (2 * tableRadius + 1) * sizeof(Coordinates);  // sortedOffsets
+  bytes += (corpusWidth + 2 * band) * (corpusHeight + 2 * band) * depth;  // guardedCorpus
+  if (parameters->patchIndexCandidates)
+    bytes += corpusSize * sizeof(TPatchIndexEntry);  // patchIndex
+  if (parameters->isCascadeRejection)
+    bytes += corpusSize * depth * sizeof(gshort);  // patchDescriptors, at most a sum per pixelel
+  return bytes;
+}
+
+
+/*
+Estimate of the peak memory the engine allocates, in bytes, excluding the pixmaps passed in.
+For callers to check before a run.
+
+Coarser levels of a pyramid are counted with their pixmaps and sources, as if all held at once (they are not.)
+*/
+size_t
+engineMemoryEstimate(
+  const TImageSynthParameters* parameters,
+  size_t targetWidth,
+  size_t targetHeight,
+  size_t corpusWidth,
+  size_t corpusHeight,
+  size_t depth
+  )
+{
+  size_t bytes = engineLevelMemoryEstimate(parameters, targetWidth, targetHeight, corpusWidth, corpusHeight, depth);
+  guint levels = parameters->pyramidLevels;
+  
+  // As pyramidLevel() and isPyramidLevelTooSmall()
+  while (levels > 1 
+    && targetWidth / 2 >= PYRAMID_MIN_SIZE && targetHeight / 2 >= PYRAMID_MIN_SIZE
+    && corpusWidth / 2 >= PYRAMID_MIN_SIZE && corpusHeight / 2 >= PYRAMID_MIN_SIZE)
+  {
+    targetWidth = (targetWidth + 1) / 2;
+    targetHeight = (targetHeight + 1) / 2;
+    corpusWidth = (corpusWidth + 1) / 2;
+    corpusHeight = (corpusHeight + 1) / 2;
+    bytes += (targetWidth * targetHeight + corpusWidth * corpusHeight) * (depth + 8)  // pixmaps, with padding
+      + targetWidth * targetHeight * sizeof(guint);  // sources
+    levels--;
+  }
+  return bytes;
+}
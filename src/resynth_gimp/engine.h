@@ -5,8 +5,32 @@ engine(
   TImageSynthParameters parameters,
   TFormatIndices* indices,
   Map* targetMap,
-  Map* corpusMap,
+  Map* corpusMap,               // or NULL when corpusContext
+  TCorpusContext* corpusContext, // IN prepared corpus, only read, or NULL: prepared from corpusMap
   void (*progressCallback)(int, void*),   // int percentDone, void *contextInfo
   void *contextInfo,
   int * cancelFlag
   );
+
+// Prepare a corpus for many runs of engine().  Takes corpusMap: freed with the context (or on error.)
+extern int
+newCorpusContext(
+  TImageSynthParameters parameters,
+  TFormatIndices* indices,
+  Map* corpusMap,
+  TCorpusContext** corpusContext  // OUT
+  );
+
+extern void
+freeCorpusContext(TCorpusContext* corpusContext);
+
+// Estimate of peak bytes the engine allocates for a run, beyond the pixmaps passed in
+extern size_t
+engineMemoryEstimate(
+  const TImageSynthParameters* parameters,
+  size_t targetWidth,
+  size_t targetHeight,
+  size_t corpusWidth,
+  size_t corpusHeight,
+  size_t depth  // Pixelels per pixel of pixmaps, including the mask
+  );
@@ -2,6 +2,8 @@
 Parameters of the engine.
 */
 
+#include <stddef.h>  // NULL
+
 #include "engineParams.h"
 
 
@@ -16,5 +18,23 @@ setDefaultParams(
   param->sensitivityToOutliers                = 0.117; // 30/256
   param->patchSize                            = 30;
   param->maxProbeCount                        = 200;
+  param->threadCount                          = 0;   // Detect
+  param->scheduleTileSize                     = 0;   // Interleaved
+  param->randomSeed                           = 1198472;  // Historical constant seed
+  param->pyramidLevels                        = 0;   // Full resolution only
+  param->patchIndexCandidates                 = 0;   // No index
+  param->patchIndexRadius                     = 2;
+  param->offsetTableRadius                    = 32;
+  param->isDeterministic                      = FALSE;
+  param->isDeviceMatching                     = FALSE;
+  param->isCascadeRejection                   = FALSE;
+  param->roiMargin                            = 0;   // Whole image
+  param->deadline                             = 0;   // None
+  param->passCallback                         = NULL;
+  param->passContext                          = NULL;
+  param->workspace                            = NULL;
+  param->sources                              = NULL;
+  param->fixedSources                         = NULL;
+  param->metrics                              = NULL;
 }
 
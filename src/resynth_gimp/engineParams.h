@@ -22,6 +22,8 @@ typedef enum  ImageSynthError
   // IN data errors, user error in making selection? returned by inner engine
   IMAGE_SYNTH_ERROR_EMPTY_TARGET,
   IMAGE_SYNTH_ERROR_EMPTY_CORPUS,
+  IMAGE_SYNTH_ERROR_CORPUS_TOO_LARGE,     // 2^32 - 1 pixels or more, sources are not packable
+  IMAGE_SYNTH_ERROR_TILE_CALLBACK,        // A callback of imageSynthTiled() failed to read or write a tile
   // There are more errors returned by the GIMP adapter
   // There will be more errors returned by a future FullAPI adapter, similar to GIMP adapter errors
   // These are only pertinent for the FullAPI, when more than one image is passed
@@ -47,6 +49,7 @@ typedef struct ImageSynthParametersStruct {
   1 Match context but choose corpus entirely at random
   2 Match context and synthesize randomly but in bands inward (from surrounding context.)
   3 etc. see ...orderTarget()
+  9 and 10 Match context along a jittered Hilbert curve, for cache locality, 10 also in bands inward
   */
   int matchContextType;   
 
@@ -83,8 +86,149 @@ typedef struct ImageSynthParametersStruct {
   Typically in the hundreds.
   */
   unsigned int maxProbeCount;
+
+  /*
+  Count of threads synthesizing.
+  Zero means: as many as processors available to the process,
+  respecting CPU affinity and any cgroup CPU quota (e.g. of a container.)
+  Moot if the engine is not threaded.
+  */
+  unsigned int threadCount;
+
+  /*
+  How threads share the target.
+  Zero: interleaved pixel by pixel over the whole target.
+  Otherwise: the edge length in pixels of square tiles of the target;
+  each thread synthesizes whole tiles, stealing tiles from other threads when it runs out.
+  Tiles have better memory locality and less contention between threads.
+  Moot if the engine is not threaded.
+  */
+  unsigned int scheduleTileSize;
+
+  /*
+  Seed of the pseudo random number generators.
+  Orders the target, and seeds the generators of threads probing the corpus.
+  */
+  unsigned int randomSeed;
+
+  /*
+  Count of levels of resolution, coarse to fine.
+  Zero or one: synthesize only at full resolution.
+  Otherwise: synthesize at half resolution first (recursively), and seed the next finer level with its result,
+  which then needs fewer random probes.  Levels stop short when images get small.
+  */
+  unsigned int pyramidLevels;
+
+  /*
+  Count of candidates from an index of the corpus, probed instead of maxProbeCount random points.
+  Zero: no index, random probes are uniform over the corpus.
+  Otherwise candidates resemble the patch, so fewer suffice, at the cost of building the index once per run.
+  */
+  unsigned int patchIndexCandidates;
+
+  /*
+  Radius of the descriptors of the corpus index, in pixels.
+  Larger costs more to build (as its square) but is more discriminating, needing fewer candidates.
+  Moot if patchIndexCandidates is zero.
+  */
+  unsigned int patchIndexRadius;
+
+  /*
+  Radius in pixels of the table of offsets to neighbors.
+  Patches are found within it, except sparse patches (e.g. early in the first pass), found by a slower search beyond it.
+  A larger table costs memory and startup time as its square.
+  */
+  unsigned int offsetTableRadius;
+
+  /*
+  Whether the result is the same whatever the count of threads (and their scheduling), for a seed.
+  FALSE: threads race (e.g. read pixels others are synthesizing), so results vary from run to run when threaded.
+  TRUE: passes proceed in batches, each reading only what earlier batches wrote, see deterministicBatch.h.
+  Somewhat slower, and differs from (but is as good as) the result of one thread when FALSE.
+  Implies interleaved scheduling: scheduleTileSize is moot.
+  */
+  int isDeterministic;
+
+  /*
+  Whether the random probes of deterministic batches are compared on a GPU, when there is one, see deviceBatch.h.
+  Moot unless isDeterministic, and with a patch index (patchIndexCandidates.)
+  Moot to the result: the same either way, and on the CPU alone when there is no GPU.
+  */
+  int isDeviceMatching;
+
+  /*
+  Whether each random probe is first bounded by descriptors of corpus and patch, rejected if surely no better,
+  before comparing its patch, see patchDescriptor.h.
+  Moot to the result: the bound is exact.  Faster mostly for large patches, at a cost in memory per corpus pixel.
+  */
+  int isCascadeRejection;
+
+  /*
+  Margin in pixels of the window healed, around the bounding box of the target.
+  Zero: the whole image is adapted, and all of its context is the corpus.
+  Otherwise (the SimpleAPI only: no mask2, no prepared corpus) only the window, clipped to the image,
+  is adapted and synthesized, its context the corpus: for a small target in a large image, far less to copy and probe.
+  Pixels outside the window are not written (but copied, when the result is not in place.)
+  */
+  unsigned int roiMargin;
+
+  /*
+  Time (of metricsSeconds(), see synthMetrics.h) by which the engine should be done, or zero: none.
+  Nearing it, fewer random probes per target; past it, passes after the first stop.
+  The first pass always completes, so the target does.  Results then depend on timing.
+  The refiner narrows it to a deadline per pass, in its copy.
+  */
+  double deadline;
+
+  /*
+  Called after each pass of refinement at full resolution but the last, on the thread running the engine,
+  or NULL: none.  Then the target is complete (the first pass synthesizes all of it) though not yet refined:
+  imageSynth writes it to outBuffer first, a preview the caller may read during the call.
+  Moot to the result.
+  */
+  void (*passCallback)(int pass, void *passContext);
+  void *passContext;
+
+  /*
+  Workspace to recycle the engine's allocations from, run to run, or NULL: the heap, see workspace.h.
+  Moot to the result.
+  */
+  struct WorkspaceStruct* workspace;
+
+  /*
+  Sources of the target found, OUT, or NULL: not reported.  One per pixel of the image, row major:
+  the index in the corpus of the source, y * width + x by the width of the corpus, see packSourceOf() in engine.c,
+  or IMAGE_SYNTH_NO_SOURCE for a pixel not synthesized (context, or not selected)
+  but for context given a source by fixedSources.
+  Written by a run that succeeds, not canceled.  Not by imageSynthTiled() nor imageSynthRegion().
+  Moot to the result.
+  */
+  unsigned int* sources;
+
+  /*
+  Sources of the context kept from an earlier run, IN, or NULL: none.  One per pixel of the image, as sources.
+  Context pixels whose source is in the corpus keep it: the target next to them then matches by their sources first,
+  as if they had been synthesized in this run.  Their colors should be those of their sources, as in that run's result.
+  Full resolution only.  For re-synthesizing a little of an earlier result, see resynth_run_incremental().
+  */
+  const unsigned int* fixedSources;
+
+  /*
+  Metrics of the run, added to, or NULL: none reported, see synthMetrics.h.
+  Moot to the result.
+  */
+  struct synthMetricsStruct* metrics;
 } TImageSynthParameters;
 
+// Of sources, a pixel not synthesized
+#define IMAGE_SYNTH_NO_SOURCE 0xFFFFFFFFu
+
+// A corpus prepared once for many runs, opaque but to the engine, see corpusContext.h
+typedef struct corpusContextStruct TCorpusContext;
+
+// Metrics of a run, see synthMetrics.h
+typedef struct synthMetricsStruct TSynthMetrics;
+
 
 
 
@@ -21,12 +21,6 @@ In earlier versions, this was mostly c++ vector and operators on it.
 */
 
 
-typedef struct SortElementStruct {
-  Coordinates   targetPoint;
-  gfloat        proportionToCenter;
-} TSortElementStruct;
-
-
 gboolean 
 equal_points(const Coordinates a, const Coordinates b) 
 {
@@ -79,73 +73,39 @@ lessCartesian(
   return to_sort_result((a->y * a->y) + (a->x * a->x) < (b->y * b->y) + (b->x * b->x));
 }
 
-CompareResult
-moreCartesian(
-  const Coordinates *a,
-  const Coordinates *b
-  ) 
+/* Squared 2D distance from center of an offset */
+static inline gint
+offsetDistance(const Coordinates offset)
 {
-  return to_invert_sort_result(lessCartesian(a,b));
+  return (offset.y * offset.y) + (offset.x * offset.x);
 }
 
-/* 
-less/more proportional distance along ray to the center
-!!! Requires a sort element with that value
+/*
+Total order on offsets: less 2D distance, then less y, then less x.
+Unlike lessCartesian, ties are ordered, so the table of sortedOffsets
+and the search beyond it for sparse patches (see prepareFartherNeighbors()) agree.
 */
 CompareResult
-lessInward(
-  const TSortElementStruct *a,
-  const TSortElementStruct *b
-  ) 
-{
-  return to_sort_result( a->proportionToCenter < b->proportionToCenter );
-}
-
-CompareResult
-moreInward(
-  const TSortElementStruct *a,
-  const TSortElementStruct *b
-  ) 
-{
-  return to_invert_sort_result( lessInward(a,b) );
-}
-
-/* less/more horizontal distance: from center for offsets */
-CompareResult 
-lessHorizontal(
-  const Coordinates *a, 
-  const Coordinates *b
-  ) 
-{
-  return to_sort_result((a->x * a->x) < (b->x * b->x));
-}
-    
-CompareResult
-moreHorizontal(
-  const Coordinates *a, 
-  const Coordinates *b
-  ) 
-{
-  return to_invert_sort_result(lessHorizontal(a,b));
-}
-    
-CompareResult 
-lessVertical(
-  const Coordinates *a, 
+lessOffset(
+  const Coordinates *a,
   const Coordinates *b
-  ) 
+  )
 {
-  /* less vertical distance: from center for offsets */
-  return to_sort_result((a->y * a->y) < (b->y * b->y));
+  gint distanceA = offsetDistance(*a);
+  gint distanceB = offsetDistance(*b);
+
+  if (distanceA != distanceB) return (distanceA < distanceB) ? -1 : 1;
+  if (a->y != b->y) return (a->y < b->y) ? -1 : 1;
+  return (a->x > b->x) - (a->x < b->x);
 }
 
 CompareResult
-moreVertical(
-  const Coordinates *a, 
+moreCartesian(
+  const Coordinates *a,
   const Coordinates *b
   ) 
 {
-  return to_invert_sort_result(lessVertical(a,b));
+  return to_invert_sort_result(lessCartesian(a,b));
 }
 
 /*
@@ -22,30 +22,53 @@ This is a limited subset: only what is used in imageSynth.
 #include <string.h>   // memcpy
 // Redefines some of glib if gimp.h included above
 #include "glibProxy.h"
+#include "workspace.h"  // allocations of arrays and generators, see workspace.h
 
 /*
 PRNG
 */
+#define RND_IMPLEMENTATION
+#include "../resynth_c/rnd.h"
+
 GRand *
 s_rand_new_with_seed(guint seed)
 {
-  srand(seed);
-  return (void*) NULL;  // not used
+  // Padded to a cache line: generators of different threads are written often, don't false-share
+  GRand * prng = workspaceCalloc(1, sizeof(GRand) < 64 ? 64 : sizeof(GRand));
+  rnd_pcg_seed(prng, seed);
+  return prng;
+}
+
+void
+s_rand_free(GRand * prng)
+{
+  workspaceFree(prng);
+}
+
+void
+s_rand_set_seed(GRand * prng, guint seed)
+{
+  rnd_pcg_seed(prng, seed);
+}
+
+guint
+s_rand_int(GRand * prng)
+{
+  return rnd_pcg_next(prng);
 }
 
 guint
 s_rand_int_range(
-  GRand * prng,   // not used
+  GRand * prng,
   guint lowerBound, // Inclusive
   guint upperBound  // !!! Exclusive
   )
 {
-  if (upperBound<1) return 0; // Prevent division by zero when both bounds 0
+  if (upperBound <= lowerBound) return lowerBound; // Empty range, e.g. both bounds 0
   
   // return rand() % upperBound;   // POOR not adequate if upperBound > RAND_MAX, and cyclical
-  upperBound -= 1; // Make it inclusive
-  // Conventional formula for random int in range [lowerBound, upperBound] inclusive
-  return lowerBound + rand() / (RAND_MAX / (upperBound - lowerBound + 1) + 1);
+  // Scale a 32-bit random by the span: uniform (to within 2^-32) for spans up to 2^32, without division
+  return lowerBound + (guint) (((unsigned long long) rnd_pcg_next(prng) * (upperBound - lowerBound)) >> 32);
 }
 
 /*
@@ -59,8 +82,8 @@ s_array_sized_new (
   guint    elt_size,
   guint    reserved_size)
 {
-  GRealArray *array = calloc(1, sizeof(GRealArray));
-  array->data = calloc(reserved_size, elt_size);
+  GRealArray *array = workspaceCalloc(1, sizeof(GRealArray));
+  array->data = workspaceCalloc(reserved_size, elt_size);
   array->len = 0;
   array->alloc = reserved_size;
   array->elt_size = elt_size;
@@ -76,8 +99,8 @@ s_array_free(
   // Ignore cascade: always free both
   assert(array->data);
   assert(array);
-  free(array->data);
-  free(array);  // free GRealArray
+  workspaceFree(array->data);
+  workspaceFree(array);  // free GRealArray
   array = NULL;
 }
 
@@ -101,6 +124,17 @@ s_array_append_vals (
   return array;
 }
 
+GArray*
+s_array_set_size(
+  GArray * array,
+  guint    len
+  )
+{
+  assert(len <= ((GRealArray*) array)->alloc);
+  array->len = len;
+  return array;
+}
+
 void
 s_array_sort (
   GArray *     array,
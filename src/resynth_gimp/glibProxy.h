@@ -11,7 +11,10 @@ This is a limited subset: only what is used in synth.
 #define gint int
 #define gint32 int
 #define gushort short unsigned int
+#define gshort short int
 #define gulong long unsigned int
+#define guint64 long long unsigned int
+#define gint64 long long int
 
 #define gfloat float
 #define gdouble double
@@ -47,23 +50,36 @@ typedef gint (*TCompareFunc) (TConstPointer  a, TConstPointer  b);
 
 /*
 PRNG
-Using ANSI c rand().
-Note GRand type is passed, but not used,
-since rand() keeps its own internal data.
+Formerly using ANSI c rand(), and the GRand type was passed but not used.
+But rand() keeps one internal state for the process, which glibc guards with a lock,
+so all threads probing the corpus at random contended for it, and the seed was process global.
+Now a GRand is the state of a PCG generator (see rnd.h of resynth_c), so each thread can own one.
 */
 
 // When using this proxy with GIMP (for testing the proxy)
 // We can't redefine certain structs (although we can redefine most other things.)
 #ifndef SYNTH_USE_GLIB
-typedef void GRand;
+#define RND_U32 unsigned int
+#define RND_U64 unsigned long long
+#include "../resynth_c/rnd.h"  // shared with the other backend
+typedef rnd_pcg_t GRand;
 #endif
 
 GRand *
 s_rand_new_with_seed(guint seed);
 
+void
+s_rand_free(GRand * prng);
+
+void
+s_rand_set_seed(GRand * prng, guint seed);
+
+guint
+s_rand_int(GRand * prng);
+
 guint
 s_rand_int_range(
-  GRand * prng,   // not used
+  GRand * prng,
   guint lowerBound,
   guint upperBound
   );
@@ -113,6 +129,7 @@ typedef struct _GRealArray
 #define g_array_sized_new(z,c,s,r)  s_array_sized_new (z,c,s,r)
 #define g_array_sort(a,f) s_array_sort (a,f)
 #define g_array_free(p,b) s_array_free(p,b)
+#define g_array_set_size(a,l) s_array_set_size(a,l)
 
 GArray* 
 s_array_sized_new (
@@ -140,6 +157,13 @@ s_array_free(
   int   cascade
   );		   
 
+// Within the reserved size only: the proxy never grows an array
+GArray*
+s_array_set_size(
+  GArray * array,
+  guint    len
+  );
+
 #ifdef SYNTH_THREADED
 // Proxies for thread mutex
 // Redefine glib mutex to use POSIX pthread mutex
@@ -152,4 +176,6 @@ s_array_free(
 #define g_mutex_init(A)      pthread_mutex_init(A, NULL);        // POSIX additional parameter
 #define g_mutex_lock(A)      pthread_mutex_lock(A)
 #define g_mutex_unlock(A)    pthread_mutex_unlock(A)
+#define g_mutex_trylock(A)   (pthread_mutex_trylock(A) == 0)   // TRUE if locked, as glib
+#define g_mutex_clear(A)     pthread_mutex_destroy(A)
 #endif
\ No newline at end of file
@@ -0,0 +1,118 @@
+/*
+Guard banded corpus.
+
+An engine internal copy of the corpus pixmap, padded all around by a band of pixels that are not selected.
+A patch whose offsets all fit within the band, placed at any point of the corpus,
+then needs no clipping: a neighbor outside the corpus lands in the band, which is masked like any unselected pixel.
+The mask is already in the pixel (at MASK_PIXELEL_INDEX), so clipping and masking are one test of one byte.
+And offsets of neighbors are precomputed as deltas of bytes, so finding a neighbor's pixel is just an add.
+
+Patches that don't fit (e.g. the shotgun patches of the first pass, whose nearest synthesized neighbors are far)
+use the clipping arithmetic as before, see computeBestFit().
+
+Costs a copy of the corpus, plus the band.
+*/
+
+#ifndef __SYNTH_GUARDED_CORPUS_H__
+#define __SYNTH_GUARDED_CORPUS_H__
+
+#include <stdlib.h> // abs
+#include <string.h> // memcpy
+
+typedef struct guardedCorpusStruct {
+  Map map;          // Padded copy of the corpus
+  guint band;       // Width in pixels of band on each side
+  gint rowBytes;    // Bytes per row of padded copy
+  Pixelel* origin;  // Pixel (0,0) of corpus, within padded copy
+  // Descriptors of the corpus for cascade rejection, or NULL: none, see patchDescriptor.h.  Not owned
+  const struct patchDescriptorsStruct* descriptors;
+} TGuardedCorpus;
+
+
+/*
+Width of band for a full, contiguous patch: the farthest of the patchSize nearest offsets, in either dimension.
+Doubled, so that patches a little sparse (e.g. at edges of the selection or context) still fit.
+*/
+static guint
+guardBandForPatch(
+  pointVector sortedOffsets,
+  guint patchSize
+  )
+{
+  guint radius = 0;
+  guint i;
+
+  for (i=0; i<patchSize && i<sortedOffsets->len; i++)
+  {
+    Coordinates offset = g_array_index(sortedOffsets, Coordinates, i);
+    guint x = (guint) abs(offset.x);
+    guint y = (guint) abs(offset.y);
+    if (x > radius) radius = x;
+    if (y > radius) radius = y;
+  }
+  return 2 * radius;
+}
+
+
+static void
+prepareGuardedCorpus(
+  Map* corpusMap,            // IN
+  guint band,                // IN
+  TGuardedCorpus* guarded    // OUT
+  )
+{
+  guint y;
+  gint rowBytes = corpusMap->width * corpusMap->depth;
+
+  // Zeroed, so the band is MASK_UNSELECTED
+  new_pixmap(&guarded->map, corpusMap->width + 2*band, corpusMap->height + 2*band, corpusMap->depth);
+  guarded->band = band;
+  guarded->rowBytes = guarded->map.width * guarded->map.depth;
+  guarded->origin = pixmap_index(&guarded->map, (Coordinates) {band, band});
+  guarded->descriptors = NULL;
+
+  for (y=0; y<corpusMap->height; y++)
+    memcpy(guarded->origin + y * guarded->rowBytes,
+      pixmap_index(corpusMap, (Coordinates) {0, y}),
+      rowBytes);
+}
+
+
+static void
+free_guarded_corpus(TGuardedCorpus* guarded)
+{
+  free_map(&guarded->map);
+}
+
+
+// Does the offset of a neighbor stay within the band, from any point in the corpus
+static inline gboolean
+isInGuardBand(
+  const TGuardedCorpus* guarded,
+  Coordinates offset
+  )
+{
+  return (guint) abs(offset.x) <= guarded->band && (guint) abs(offset.y) <= guarded->band;
+}
+
+// Delta of bytes of a neighbor's pixel in the padded copy, from its patch center
+static inline gint
+guardedDelta(
+  const TGuardedCorpus* guarded,
+  Coordinates offset
+  )
+{
+  return offset.x * (gint) guarded->map.depth + offset.y * guarded->rowBytes;
+}
+
+// Pixel of a point in the corpus (not clipped), in the padded copy
+static inline const Pixelel*
+guardedPixel(
+  const TGuardedCorpus* guarded,
+  Coordinates point
+  )
+{
+  return guarded->origin + point.x * (gint) guarded->map.depth + point.y * guarded->rowBytes;
+}
+
+#endif /* __SYNTH_GUARDED_CORPUS_H__ */
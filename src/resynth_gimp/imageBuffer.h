@@ -2,7 +2,7 @@
 A generic data structure for passing images.
 
 Data is a stream of unpadded pixels.
-Interpretation of pixels (order and count of pixelels (unsigned bytes)) is given by a enum of type TImageFormat.
+Interpretation of pixels (order and count of pixelels (unsigned bytes, or floats)) is given by a enum of type TImageFormat.
 Rows padded.
 */
 
@@ -15,9 +15,16 @@ typedef struct _ImageBuffer
   unsigned int width;
   unsigned int height;
   size_t rowBytes;    // Row stride.  unsigned int? doesn't really describe size of a type, but count of bytes in pixmap row
+  int isFloat;        // Nonzero: data is floats in [0,1], converted as adapted (rowBytes still counts bytes)
 }
 ImageBuffer;
 
+/*
+Reads or writes the pixels of the rectangle (x, y, tile->width, tile->height) of an image streamed by tiles,
+to or from tile->data, rows tile->rowBytes apart.  Returns nonzero on success.
+*/
+typedef int (*TImageSynthTileCallback)(void *tileContext, unsigned int x, unsigned int y, ImageBuffer *tile);
+
 // Mask same as image except only one pixelel per pixel (different, or assumed format code of on pixelel per pixel.)
 
 #endif
@@ -57,6 +57,25 @@ typedef struct indicesStruct {
   gboolean isAlphaSource; // Does source have alpha?
 } TFormatIndices;
 
+/*
+The pixelels synthesis reads and compares, copied from TFormatIndices, see pixelelLayoutOf().
+Passed by value: where a caller passes constants, the compiler unrolls the loops over pixelels
+and drops the branches on maps, see synthesize().
+*/
+typedef struct pixelelLayoutStruct {
+  guint colorEndBip;
+  guint mapStartBip;
+  guint mapEndBip;    // mapStartBip if no maps
+  guint totalBpp;
+} TPixelelLayout;
+
+static inline TPixelelLayout
+pixelelLayoutOf(const TFormatIndices* indices)
+{
+  TPixelelLayout layout = {indices->colorEndBip, indices->map_start_bip, indices->map_end_bip, indices->total_bpp};
+  return layout;
+}
+
 extern unsigned int
 countPixelelsPerPixelForFormat(
   TImageFormat format // IN
@@ -35,6 +35,10 @@ To make:
   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 */
 #include <stddef.h>  // size_t
+#include <string.h>  // memset
+
+// Compiling switch #defines, e.g. SYNTH_THREADED for the adaption on the worker pool
+#include "buildSwitches.h"
 
 // Non code defining, true headers: macros, declarations, and static inline functions
 #include "imageBuffer.h"
@@ -49,6 +53,7 @@ To make:
 #include "map.h"  // header for mapOps.h included by engine.c
 #include "engineParams.h" // engineParams.c
 #include "engine.h" // engine.c
+#include "workspace.h" // workspace.c
 
 
 // Code defining, could be compiled separately
@@ -58,29 +63,158 @@ To make:
 
 
 
-extern int
-imageSynth(
-  ImageBuffer * imageBuffer,  // IN/OUT RGBA four Pixelels
-  ImageBuffer * mask,         // IN one mask Pixelel
+/*
+Window of a heal, see roiMargin: the bounding box of the target (mask not unselected) widened by margin,
+clipped to the image, as [left, right) x [top, bottom).
+FALSE if the target is empty or the window is the whole image: then there is nothing to crop.
+*/
+static gboolean
+windowOfTarget(
+  const ImageBuffer * mask,
+  guint margin,
+  guint *left, guint *top, guint *right, guint *bottom
+  )
+{
+  guint x, y;
+  
+  *left = mask->width;
+  *top = mask->height;
+  *right = 0;
+  *bottom = 0;
+  for (y=0; y<mask->height; y++)
+  {
+    const unsigned char * row = mask->data + y * mask->rowBytes;
+    
+    for (x=0; x<mask->width; x++)
+      if (row[x] != MASK_UNSELECTED)
+      {
+        if (x < *left) *left = x;
+        if (x >= *right) *right = x + 1;
+        if (y < *top) *top = y;
+        *bottom = y + 1;
+      }
+  }
+  if (*right == 0) return FALSE;
+  
+  *left = (*left > margin) ? *left - margin : 0;
+  *top = (*top > margin) ? *top - margin : 0;
+  *right = (*right + margin < mask->width) ? *right + margin : mask->width;
+  *bottom = (*bottom + margin < mask->height) ? *bottom + margin : mask->height;
+  return *left > 0 || *top > 0 || *right < mask->width || *bottom < mask->height;
+}
+
+
+// A view, not a copy, of the rectangle [left, right) x [top, bottom) of a buffer
+static ImageBuffer
+windowOfBuffer(
+  const ImageBuffer * buffer,
+  guint pixelelPerPixel,
+  guint left, guint top, guint right, guint bottom
+  )
+{
+  ImageBuffer window = *buffer;
+  
+  window.data = buffer->data + top * buffer->rowBytes
+    + left * pixelelPerPixel * (buffer->isFloat ? sizeof(float) : sizeof(Pixelel));
+  window.width = right - left;
+  window.height = bottom - top;
+  return window;
+}
+
+
+/*
+Sources of a windowed heal, see roiMargin, into sources of the whole image:
+of the window offset by its corner (its corpus is in the window too), the rest IMAGE_SYNTH_NO_SOURCE.
+*/
+static void
+placeWindowSources(
+  const guint * windowSources,
+  guint * sources,    // OUT
+  guint width,        // of the image
+  guint height,
+  guint left, guint top, guint right, guint bottom
+  )
+{
+  guint windowWidth = right - left;  // The window's sources are indices by its width, see packSourceOf() in engine.c
+  guint x, y;
+  
+  for (y=0; y<height; y++)
+    for (x=0; x<width; x++)
+    {
+      guint source = IMAGE_SYNTH_NO_SOURCE;
+      if (x >= left && x < right && y >= top && y < bottom)
+      {
+        source = windowSources[(y - top) * windowWidth + (x - left)];
+        if (source != IMAGE_SYNTH_NO_SOURCE)
+          source = (source / windowWidth + top) * width + source % windowWidth + left;
+      }
+      sources[y * width + x] = source;
+    }
+}
+
+
+/*
+Preview of a pass, see passCallback: the target so far anti adapted into outBuffer, then the caller's callback.
+*/
+typedef struct previewStruct {
+  ImageBuffer * outBuffer;
+  Map * targetMap;
+  guint pixelelPerPixel;
+  void (*passCallback)(int, void*);
+  void *passContext;
+} TPreview;
+
+static void
+previewPass(int pass, void *previewContext)
+{
+  TPreview * preview = previewContext;
+  
+  antiAdaptImage(preview->outBuffer, preview->targetMap, 1, preview->pixelelPerPixel);
+  preview->passCallback(pass, preview->passContext);
+}
+
+
+/*
+Common to the APIs: adapt, run the engine, and anti adapt the result into outBuffer.
+outBuffer may be imageBuffer (in place), or another buffer of the same dimensions and format
+(e.g. the caller's), then imageBuffer is only read.
+With a prepared corpus, only the target is adapted: mask2 is moot.
+A heal with roiMargin is synthesized in a window of the image, the image but the window left as is
+(its sources, if reported, are still of the whole image.)
+With a passCallback, outBuffer is also written after each pass but the last, a preview.
+*/
+static int
+imageSynthCommon(
+  ImageBuffer * imageBuffer,
+  ImageBuffer * mask,
+  ImageBuffer * mask2,
+  ImageBuffer * outBuffer,
   TImageFormat imageFormat,
-  TImageSynthParameters* parameters,  // or NULL to use defaults
-  void (*progressCallback)(int, void*),   // int percentDone, void *contextInfo
+  TImageSynthParameters* parameters,
+  TCorpusContext* corpus,     // or NULL: the corpus is from imageBuffer
+  void (*progressCallback)(int, void*),
   void *contextInfo,
-  int *cancelFlag // flag to check periodically for abort
+  int *cancelFlag
   )
 {
   Map targetMap;
   Map corpusMap;
   TFormatIndices formatIndices;
+  TWorkspace* previousWorkspace;
+  TImageSynthParameters defaultParameters;  // On the stack, not static: runs may be concurrent
+  TImageSynthParameters engineParameters;
+  TPreview preview;
+  guint left, top, right, bottom;  // Of the window of a heal, see roiMargin
   int error;
   
-  // Sanity: mask and imageBuffer same dimensions
-  if (imageBuffer->width != mask->width || imageBuffer->height != mask->height)
+  // Sanity: masks, imageBuffer and outBuffer same dimensions
+  if (imageBuffer->width != mask->width || imageBuffer->height != mask->height
+    || (mask2 && (imageBuffer->width != mask2->width || imageBuffer->height != mask2->height))
+    || imageBuffer->width != outBuffer->width || imageBuffer->height != outBuffer->height)
     return IMAGE_SYNTH_ERROR_IMAGE_MASK_MISMATCH;
   
   // Use defaults if NULL parameters
   if (!parameters) {
-    static TImageSynthParameters defaultParameters;
     setDefaultParams(&defaultParameters);
     parameters = &defaultParameters;
     }
@@ -88,18 +222,84 @@ imageSynth(
   error = prepareImageFormatIndicesFromFormatType(&formatIndices, imageFormat);
   if ( error ) return error;
   
+  // Heal only the window around the target: views of the buffers, the window their whole image
+  if (parameters->roiMargin && ! mask2 && ! corpus
+    && windowOfTarget(mask, parameters->roiMargin, &left, &top, &right, &bottom))
+  {
+    guint pixelelPerPixel = countPixelelsPerPixelForFormat(imageFormat);
+    TImageSynthParameters windowParameters = *parameters;
+    ImageBuffer imageWindow = windowOfBuffer(imageBuffer, pixelelPerPixel, left, top, right, bottom);
+    ImageBuffer maskWindow = windowOfBuffer(mask, 1, left, top, right, bottom);
+    ImageBuffer outWindow = windowOfBuffer(outBuffer, pixelelPerPixel, left, top, right, bottom);
+    
+    // Not in place, what is outside the window is still the image's: first, so previews are whole
+    if (outBuffer->data != imageBuffer->data)
+    {
+      copyImageRectangle(imageBuffer, outBuffer, pixelelPerPixel, 0, 0, imageBuffer->width, top);
+      copyImageRectangle(imageBuffer, outBuffer, pixelelPerPixel, 0, bottom, imageBuffer->width, imageBuffer->height - bottom);
+      copyImageRectangle(imageBuffer, outBuffer, pixelelPerPixel, 0, top, left, bottom - top);
+      copyImageRectangle(imageBuffer, outBuffer, pixelelPerPixel, right, top, imageBuffer->width - right, bottom - top);
+    }
+    windowParameters.roiMargin = 0;
+    if (parameters->sources)
+    {
+      windowParameters.sources = malloc((size_t) (right - left) * (bottom - top) * sizeof(guint));
+      g_assert(windowParameters.sources);
+    }
+    error = imageSynthCommon(&imageWindow, &maskWindow, NULL, &outWindow, imageFormat, &windowParameters, NULL,
+      progressCallback, contextInfo, cancelFlag);
+    if (parameters->sources)
+    {
+      if ( ! error && ! *cancelFlag )
+        placeWindowSources(windowParameters.sources, parameters->sources, imageBuffer->width, imageBuffer->height,
+          left, top, right, bottom);
+      free(windowParameters.sources);
+    }
+    // A window without context (e.g. the margin all target) heals from the whole image instead
+    if (error != IMAGE_SYNTH_ERROR_EMPTY_CORPUS) return error;
+  }
+  
+  // From here, allocations of the run are recycled, if there is a workspace
+  previousWorkspace = bindWorkspace(parameters->workspace);
+  
   // Adapt: put (imageBuffer, mask) into pixmaps etc.
-  adaptSimpleAPI(imageBuffer, mask, 
-    &targetMap,
-    &corpusMap,
-    countPixelelsPerPixelForFormat(imageFormat)
-    );
+  if (corpus)
+    adaptImageAndMask(imageBuffer, mask, &targetMap, FALSE, countPixelelsPerPixelForFormat(imageFormat),
+      parameters->threadCount);
+  else if (mask2)
+    adaptSimpleAPI2(imageBuffer, mask, mask2,
+      &targetMap,
+      &corpusMap,
+      countPixelelsPerPixelForFormat(imageFormat),
+      parameters->threadCount
+      );
+  else
+    adaptSimpleAPI(imageBuffer, mask, 
+      &targetMap,
+      &corpusMap,
+      countPixelelsPerPixelForFormat(imageFormat),
+      parameters->threadCount
+      );
+  
+  // Previews of passes are anti adapted into outBuffer, before the caller's callback
+  engineParameters = *parameters;
+  if (parameters->passCallback)
+  {
+    preview.outBuffer = outBuffer;
+    preview.targetMap = &targetMap;
+    preview.pixelelPerPixel = countPixelelsPerPixelForFormat(imageFormat);
+    preview.passCallback = parameters->passCallback;
+    preview.passContext = parameters->passContext;
+    engineParameters.passCallback = previewPass;
+    engineParameters.passContext = &preview;
+  }
   
   error = engine(
-    *parameters,
+    engineParameters,
     &formatIndices, 
     &targetMap, 
-    &corpusMap,
+    corpus ? NULL : &corpusMap,
+    corpus,
     progressCallback,
     contextInfo,
     cancelFlag
@@ -110,9 +310,9 @@ imageSynth(
     // assert targetMap holds results
     
     // Now the synthesized pixels are in the unmasked portion of the global image pixmap.
-    // Post adapt: in imageBuffer, replace target pixels from global image pixmap
+    // Post adapt: in outBuffer, replace pixels from global image pixmap
     antiAdaptImage(
-      imageBuffer, 
+      outBuffer, 
       &targetMap, // !!! this is the global pixmap named "image"
       1,      // Offset in source pixel (skip the interleaved mask pixelel)
       /*
@@ -129,18 +329,21 @@ imageSynth(
   }
   
   // Cleanup internal malloc's done by adaption
-  // See above, masks already freed
   free_map(&targetMap);
-  free_map(&corpusMap);
-   
+  if ( ! corpus )
+    free_map(&corpusMap);
+  
+  bindWorkspace(previousWorkspace);
   return error;
 }
 
+
 extern int
-imageSynth2(
-  ImageBuffer * imageBuffer,  // IN/OUT RGBA four Pixelels
-  ImageBuffer * mask,         // IN one mask Pixelel
-  ImageBuffer * mask2,         // IN one mask Pixelel
+imageSynthInto(
+  ImageBuffer * imageBuffer,  // IN RGBA Pixels described by imageFormat
+  ImageBuffer * mask,         // IN one mask Pixelel, selects the target
+  ImageBuffer * mask2,        // IN one mask Pixelel, selects the corpus, or NULL: the inverse of mask
+  ImageBuffer * outBuffer,    // OUT all pixels, synthesized in the target
   TImageFormat imageFormat,
   TImageSynthParameters* parameters,  // or NULL to use defaults
   void (*progressCallback)(int, void*),   // int percentDone, void *contextInfo
@@ -148,72 +351,522 @@ imageSynth2(
   int *cancelFlag // flag to check periodically for abort
   )
 {
-  Map targetMap;
-  Map corpusMap;
+  return imageSynthCommon(imageBuffer, mask, mask2, outBuffer, imageFormat, parameters, NULL,
+    progressCallback, contextInfo, cancelFlag);
+}
+
+
+/*
+As imageSynthInto(), but from a corpus prepared by imageSynthCorpus(), of any size:
+the image is the target where mask selects it, else context.
+*/
+extern int
+imageSynthIntoCorpus(
+  ImageBuffer * imageBuffer,  // IN RGBA Pixels described by imageFormat
+  ImageBuffer * mask,         // IN one mask Pixelel, selects the target
+  ImageBuffer * outBuffer,    // OUT all pixels, synthesized in the target
+  TImageFormat imageFormat,
+  TImageSynthParameters* parameters,  // or NULL to use defaults
+  TCorpusContext* corpus,     // IN only read, so may be shared by concurrent calls
+  void (*progressCallback)(int, void*),   // int percentDone, void *contextInfo
+  void *contextInfo,
+  int *cancelFlag // flag to check periodically for abort
+  )
+{
+  return imageSynthCommon(imageBuffer, mask, NULL, outBuffer, imageFormat, parameters, corpus,
+    progressCallback, contextInfo, cancelFlag);
+}
+
+
+/*
+Prepare a corpus for many calls of imageSynthIntoCorpus(), imageSynthTiled() or imageSynthRegion():
+adapted, and the engine's structures of it prepared, once, see corpusContext.h.
+Prepared for the parameters, though calls with others may use it, preparing per call what differs.
+Free with imageSynthFreeCorpus().
+*/
+extern int
+imageSynthCorpus(
+  ImageBuffer * corpus,       // IN RGBA Pixels described by imageFormat, only read
+  ImageBuffer * corpusMask,   // IN one mask Pixelel, selects the corpus, or NULL: all of it
+  TImageFormat imageFormat,
+  TImageSynthParameters* parameters,  // or NULL to use defaults
+  TCorpusContext** corpusContext      // OUT
+  )
+{
+  TImageSynthParameters defaultParameters;
   TFormatIndices formatIndices;
+  ImageBuffer allMask = {NULL, corpus->width, corpus->height, corpus->width, 0};
+  Map corpusMap;
   int error;
   
-  // Sanity: mask and imageBuffer same dimensions
-  if (imageBuffer->width != mask->width || imageBuffer->height != mask->height)
+  *corpusContext = NULL;
+  if (corpusMask && (corpus->width != corpusMask->width || corpus->height != corpusMask->height))
     return IMAGE_SYNTH_ERROR_IMAGE_MASK_MISMATCH;
-  
-  // Use defaults if NULL parameters
   if (!parameters) {
-    static TImageSynthParameters defaultParameters;
     setDefaultParams(&defaultParameters);
     parameters = &defaultParameters;
     }
-  
   error = prepareImageFormatIndicesFromFormatType(&formatIndices, imageFormat);
   if ( error ) return error;
   
-  // Adapt: put (imageBuffer, mask) into pixmaps etc.
-  adaptSimpleAPI2(imageBuffer, mask, mask2,
-    &targetMap,
-    &corpusMap,
-    countPixelelsPerPixelForFormat(imageFormat)
-    );
+  if ( ! corpusMask )
+  {
+    allMask.data = malloc(allMask.rowBytes * allMask.height);
+    g_assert(allMask.data);
+    memset(allMask.data, MASK_TOTALLY_SELECTED, allMask.rowBytes * allMask.height);
+  }
+  adaptImageAndMask(corpus, corpusMask ? corpusMask : &allMask, &corpusMap, FALSE,
+    countPixelelsPerPixelForFormat(imageFormat), parameters->threadCount);
+  free(allMask.data);
+  
+  // The context takes corpusMap
+  return newCorpusContext(*parameters, &formatIndices, &corpusMap, corpusContext);
+}
+
+
+extern void
+imageSynthFreeCorpus(TCorpusContext* corpusContext)
+{
+  freeCorpusContext(corpusContext);
+}
+
+
+extern int
+imageSynth(
+  ImageBuffer * imageBuffer,  // IN/OUT RGBA four Pixelels
+  ImageBuffer * mask,         // IN one mask Pixelel
+  TImageFormat imageFormat,
+  TImageSynthParameters* parameters,  // or NULL to use defaults
+  void (*progressCallback)(int, void*),   // int percentDone, void *contextInfo
+  void *contextInfo,
+  int *cancelFlag // flag to check periodically for abort
+  )
+{
+  return imageSynthInto(imageBuffer, mask, NULL, imageBuffer, imageFormat, parameters,
+    progressCallback, contextInfo, cancelFlag);
+}
+
+extern int
+imageSynth2(
+  ImageBuffer * imageBuffer,  // IN/OUT RGBA four Pixelels
+  ImageBuffer * mask,         // IN one mask Pixelel
+  ImageBuffer * mask2,         // IN one mask Pixelel
+  TImageFormat imageFormat,
+  TImageSynthParameters* parameters,  // or NULL to use defaults
+  void (*progressCallback)(int, void*),   // int percentDone, void *contextInfo
+  void *contextInfo,
+  int *cancelFlag // flag to check periodically for abort
+  )
+{
+  return imageSynthInto(imageBuffer, mask, mask2, imageBuffer, imageFormat, parameters,
+    progressCallback, contextInfo, cancelFlag);
+}
+
+
+
+/*
+Streaming: synthesize an image too large to hold, tile by tile, in raster order.
+
+Each tile is a region synthesized in a window: the region plus a halo around it, clipped to the image,
+read through readImage and readMask.  Only the region is written back, through writeImage.
+The target of a window is its selected pixels not already finished
+(so unfinished selected pixels of the halo are synthesized, then discarded, then synthesized again in their own region.)
+Its context is the rest, including finished pixels as written: readImage must see earlier writes,
+i.e. the caller streams in place.  A halo at least the width of a patch lets matches span the edges of regions.
+Tiles before a tile, in raster order, are finished.
+
+The corpus of a window is the inverse of its mask (as for the simple API), or else a shared corpus,
+prepared once (see imageSynthCorpus()) for all windows.
+A window without corpus (e.g. inside a large selection) is retried with twice the halo.
+
+Memory is in proportion to the square of (tileSize + 2 * halo), plus any shared corpus, not to the image.
+Regions with nothing selected are skipped, without a write.
+*/
+
+typedef struct tiledStreamStruct {
+  unsigned int width;   // of the whole image
+  unsigned int height;
+  unsigned int tileSize;
+  TImageSynthTileCallback readImage;
+  TImageSynthTileCallback readMask;
+  TImageSynthTileCallback readFinished;  // or NULL: finished are the tiles before, in raster order
+  TImageSynthTileCallback writeImage;
+  void *tileContext;
+  TCorpusContext *sharedCorpus; // or NULL: corpus of each window
+  TFormatIndices *indices;
+  guint pixelelPerPixel;
+  TImageSynthParameters parameters;
+  unsigned int randomSeed;  // of the stream, from which each region's is derived
+  void (*progressCallback)(int, void*);
+  void *contextInfo;
+  guint tileIndex;
+  guint tileCount;
+  int *cancelFlag;
+} TTiledStream;
+
+
+// A region of the image, in pixels
+typedef struct regionStruct {
+  guint x;
+  guint y;
+  guint width;
+  guint height;
+} TRegion;
+
+
+// Forward the engine's progress on one tile as progress on all of them
+static void
+forwardTiledProgress(int percent, void *context)
+{
+  TTiledStream *stream = (TTiledStream *) context;
+  
+  stream->progressCallback((int) ((stream->tileIndex * 100 + (guint) percent) / stream->tileCount),
+    stream->contextInfo);
+}
+
+
+// Whether a pixel of the image is in a tile before the tile of a region, in raster order
+static inline gboolean
+isInEarlierTile(
+  const TTiledStream *stream,
+  guint x,
+  guint y,
+  const TRegion *region
+  )
+{
+  guint row = y / stream->tileSize;
+  guint tileRow = region->y / stream->tileSize;
+  
+  return row < tileRow || (row == tileRow && x / stream->tileSize < region->x / stream->tileSize);
+}
+
+
+/*
+Seed of a region: a function of the stream's seed and where the region is only,
+so a region is synthesized the same whatever else is, and in whatever order (e.g. by other processes.)
+*/
+static unsigned int
+regionSeed(
+  unsigned int seed,
+  const TRegion *region
+  )
+{
+  guint hash = seed;
+  
+  // FNV-1a like mix of the coordinates
+  hash = (hash ^ region->x) * 16777619u;
+  hash = (hash ^ region->y) * 16777619u;
+  hash = (hash ^ region->width) * 16777619u;
+  hash = (hash ^ region->height) * 16777619u;
+  return hash;
+}
+
 
+static int
+synthesizeRegion(
+  TTiledStream *stream,
+  const TRegion *region,
+  guint halo
+  )
+{
+  guint regionRight = region->x + region->width;
+  guint regionBottom = region->y + region->height;
+  guint left = (region->x > halo) ? region->x - halo : 0;
+  guint top = (region->y > halo) ? region->y - halo : 0;
+  guint right = (regionRight + halo < stream->width) ? regionRight + halo : stream->width;
+  guint bottom = (regionBottom + halo < stream->height) ? regionBottom + halo : stream->height;
+  guint width = right - left;
+  guint height = bottom - top;
+  ImageBuffer window = {NULL, width, height, (size_t) width * stream->pixelelPerPixel, 0};
+  ImageBuffer mask = {NULL, width, height, width, 0};
+  ImageBuffer target = {NULL, width, height, width, 0};
+  gboolean isTargetInRegion = FALSE;
+  Map targetMap;
+  Map windowCorpusMap;
+  guint x, y;
+  int error = IMAGE_SYNTH_SUCCESS;
+  
+  window.data = workspaceCalloc(window.rowBytes, height);
+  mask.data = workspaceCalloc(mask.rowBytes, height);
+  target.data = workspaceCalloc(target.rowBytes, height);
+  g_assert(window.data && mask.data && target.data);
+  
+  if ( ! stream->readImage(stream->tileContext, left, top, &window) )
+    error = IMAGE_SYNTH_ERROR_TILE_CALLBACK;
+  else if ( ! stream->readMask )
+    memset(mask.data, MASK_TOTALLY_SELECTED, mask.rowBytes * height);
+  else if ( ! stream->readMask(stream->tileContext, left, top, &mask) )
+    error = IMAGE_SYNTH_ERROR_TILE_CALLBACK;
+  // Finished pixels, read into target, overwritten below
+  if ( ! error && stream->readFinished && ! stream->readFinished(stream->tileContext, left, top, &target) )
+    error = IMAGE_SYNTH_ERROR_TILE_CALLBACK;
+  if (error) goto cleanup;
+  
+  // Target: selected, and not already finished
+  for (y=0; y<height; y++)
+    for (x=0; x<width; x++)
+    {
+      unsigned char value = mask.data[y * mask.rowBytes + x];
+      gboolean isFinished = stream->readFinished
+        ? target.data[y * target.rowBytes + x] != 0
+        : isInEarlierTile(stream, left + x, top + y, region);
+      
+      if (value != MASK_UNSELECTED && isFinished)
+        value = MASK_UNSELECTED;
+      target.data[y * target.rowBytes + x] = value;
+      if (value != MASK_UNSELECTED
+        && left + x >= region->x && left + x < regionRight && top + y >= region->y && top + y < regionBottom)
+        isTargetInRegion = TRUE;
+    }
+  if ( ! isTargetInRegion ) goto cleanup;
+  
+  adaptImageAndMask(&window, &target, &targetMap, FALSE, stream->pixelelPerPixel, stream->parameters.threadCount);
+  if ( ! stream->sharedCorpus )
+    adaptImageAndMask(&window, &mask, &windowCorpusMap, TRUE, stream->pixelelPerPixel, stream->parameters.threadCount);
+  
+  stream->parameters.randomSeed = regionSeed(stream->randomSeed, region);
   error = engine(
-    *parameters,
-    &formatIndices, 
-    &targetMap, 
-    &corpusMap,
-    progressCallback,
-    contextInfo,
-    cancelFlag
+    stream->parameters,
+    stream->indices,
+    &targetMap,
+    stream->sharedCorpus ? NULL : &windowCorpusMap,
+    stream->sharedCorpus,
+    stream->progressCallback ? forwardTiledProgress : NULL,
+    stream,
+    stream->cancelFlag
     );
   
-  if (! error && ! (*cancelFlag))
+  if (! error && ! (*stream->cancelFlag))
   {
-    // assert targetMap holds results
+    // Anti adapt the window, then write only the region out of it
+    ImageBuffer regionBuffer = window;
     
-    // Now the synthesized pixels are in the unmasked portion of the global image pixmap.
-    // Post adapt: in imageBuffer, replace target pixels from global image pixmap
-    antiAdaptImage(
-      imageBuffer, 
-      &targetMap, // !!! this is the global pixmap named "image"
-      1,      // Offset in source pixel (skip the interleaved mask pixelel)
-      /*
-      !!! We didn't synthesize an alpha pixelel.
-      But it is still the same in the internal buffer.
-      Go ahead and move it back, simpler than trying to omit alpha from the move.
-      */
-      countPixelelsPerPixelForFormat(imageFormat)       
-      );
-    /*
-    TODO Still a question here whether the alpha still in imageBuffer is correct,
-    if we have changed the color pixels and they are pre-multiplied by alpha.
-    */
+    antiAdaptImage(&window, &targetMap, 1, stream->pixelelPerPixel);
+    regionBuffer.data = window.data + (region->y - top) * window.rowBytes + (region->x - left) * stream->pixelelPerPixel;
+    regionBuffer.width = region->width;
+    regionBuffer.height = region->height;
+    if ( ! stream->writeImage(stream->tileContext, region->x, region->y, &regionBuffer) )
+      error = IMAGE_SYNTH_ERROR_TILE_CALLBACK;
   }
   
-  // Cleanup internal malloc's done by adaption
-  // See above, masks already freed
   free_map(&targetMap);
-  free_map(&corpusMap);
-   
+  if ( ! stream->sharedCorpus )
+    free_map(&windowCorpusMap);
+  
+cleanup:
+  workspaceFree(window.data);
+  workspaceFree(mask.data);
+  workspaceFree(target.data);
+  return error;
+}
+
+
+// Synthesize a region, retrying with a wider halo while a window has no corpus
+static int
+synthesizeRegionWidening(
+  TTiledStream *stream,
+  const TRegion *region,
+  guint halo
+  )
+{
+  int error;
+  
+  for (;;)
+  {
+    error = synthesizeRegion(stream, region, halo);
+    if (error != IMAGE_SYNTH_ERROR_EMPTY_CORPUS || stream->sharedCorpus
+      || (halo >= stream->width && halo >= stream->height))
+      return error;
+    halo = halo ? 2 * halo : stream->tileSize;
+  }
+}
+
+
+// Common to imageSynthTiled() and imageSynthRegion(): all but the tiles
+static int
+prepareTiledStream(
+  TTiledStream *stream,
+  TFormatIndices *formatIndices,
+  unsigned int width,
+  unsigned int height,
+  TImageSynthTileCallback readImage,
+  TImageSynthTileCallback readMask,
+  TImageSynthTileCallback readFinished,
+  TImageSynthTileCallback writeImage,
+  void *tileContext,
+  TCorpusContext * corpus,
+  TImageFormat imageFormat,
+  TImageSynthParameters* parameters,
+  void (*progressCallback)(int, void*),
+  void *contextInfo,
+  int *cancelFlag
+  )
+{
+  int error;
+  
+  // Everything the target and no shared corpus: nothing to synthesize from
+  if ( ! readMask && ! corpus )
+    return IMAGE_SYNTH_ERROR_EMPTY_CORPUS;
+  
+  error = prepareImageFormatIndicesFromFormatType(formatIndices, imageFormat);
+  if ( error ) return error;
+  
+  if (parameters)
+    stream->parameters = *parameters;
+  else
+    setDefaultParams(&stream->parameters);
+  stream->randomSeed = stream->parameters.randomSeed;
+  stream->parameters.passCallback = NULL;  // A window is not the image: no previews
+  stream->parameters.sources = NULL;  // Nor sources
+  stream->width = width;
+  stream->height = height;
+  stream->tileSize = width > height ? width : height;
+  stream->readImage = readImage;
+  stream->readMask = readMask;
+  stream->readFinished = readFinished;
+  stream->writeImage = writeImage;
+  stream->tileContext = tileContext;
+  stream->indices = formatIndices;
+  stream->pixelelPerPixel = countPixelelsPerPixelForFormat(imageFormat);
+  stream->progressCallback = progressCallback;
+  stream->contextInfo = contextInfo;
+  stream->tileIndex = 0;
+  stream->tileCount = 1;
+  stream->cancelFlag = cancelFlag;
+  // A shared corpus is only read by each region
+  stream->sharedCorpus = corpus;
+  return IMAGE_SYNTH_SUCCESS;
+}
+
+
+extern int
+imageSynthTiled(
+  unsigned int width,
+  unsigned int height,
+  TImageSynthTileCallback readImage,
+  TImageSynthTileCallback readMask,
+  TImageSynthTileCallback writeImage,
+  void *tileContext,
+  TCorpusContext * corpus,
+  TImageFormat imageFormat,
+  unsigned int tileSize,
+  unsigned int halo,
+  TImageSynthParameters* parameters,
+  void (*progressCallback)(int, void*),
+  void *contextInfo,
+  int *cancelFlag
+  )
+{
+  TTiledStream stream;
+  TFormatIndices formatIndices;
+  TWorkspace* previousWorkspace;
+  TRegion tile;
+  int error;
+  
+  error = prepareTiledStream(&stream, &formatIndices, width, height,
+    readImage, readMask, NULL, writeImage, tileContext, corpus, imageFormat,
+    parameters, progressCallback, contextInfo, cancelFlag);
+  if ( error ) return error;
+  previousWorkspace = bindWorkspace(stream.parameters.workspace);
+  // Zero: one tile, the whole image
+  if (tileSize)
+    stream.tileSize = tileSize;
+  stream.tileCount = ((width + stream.tileSize - 1) / stream.tileSize) * ((height + stream.tileSize - 1) / stream.tileSize);
+  
+  for (tile.y=0; tile.y<height && ! error; tile.y+=stream.tileSize)
+    for (tile.x=0; tile.x<width && ! error; tile.x+=stream.tileSize)
+    {
+      if (*cancelFlag) break;
+      tile.width = (tile.x + stream.tileSize < width) ? stream.tileSize : width - tile.x;
+      tile.height = (tile.y + stream.tileSize < height) ? stream.tileSize : height - tile.y;
+      error = synthesizeRegionWidening(&stream, &tile, halo);
+      stream.tileIndex++;
+    }
+  bindWorkspace(previousWorkspace);
   return error;
 }
 
 
+/*
+One job of a synthesis split by regions, e.g. across processes or machines:
+synthesize one region (x, y, regionWidth, regionHeight) of a streamed image,
+with the pixels readFinished says are finished (nonzero) as read only context, see imageSynthTiled().
 
+Deterministic: the result depends only on the pixels read, the parameters, the seed and the region,
+not on other jobs, their order or count.  So regions are synthesized deterministically
+(the engine's threads otherwise race, see deterministicBatch.h), whatever the count of threads.
+A coordinator schedules jobs so that a region's neighbors are either finished, or not started,
+e.g. bands, or tiles in a checkerboard: unfinished selected pixels of the halo are only context while synthesized,
+and adjoining regions synthesized concurrently would not see each other, leaving a seam.
+*/
+extern int
+imageSynthRegion(
+  unsigned int width,
+  unsigned int height,
+  unsigned int x,
+  unsigned int y,
+  unsigned int regionWidth,
+  unsigned int regionHeight,
+  TImageSynthTileCallback readImage,
+  TImageSynthTileCallback readMask,
+  TImageSynthTileCallback readFinished,
+  TImageSynthTileCallback writeImage,
+  void *tileContext,
+  TCorpusContext * corpus,
+  TImageFormat imageFormat,
+  unsigned int halo,
+  TImageSynthParameters* parameters,
+  void (*progressCallback)(int, void*),
+  void *contextInfo,
+  int *cancelFlag
+  )
+{
+  TTiledStream stream;
+  TFormatIndices formatIndices;
+  TWorkspace* previousWorkspace;
+  TRegion region = {x, y, regionWidth, regionHeight};
+  int error;
+  
+  if (regionWidth == 0 || regionHeight == 0 || x + regionWidth > width || y + regionHeight > height
+    || ! readFinished)
+    return IMAGE_SYNTH_ERROR_IMAGE_MASK_MISMATCH;
+  
+  error = prepareTiledStream(&stream, &formatIndices, width, height,
+    readImage, readMask, readFinished, writeImage, tileContext, corpus, imageFormat,
+    parameters, progressCallback, contextInfo, cancelFlag);
+  if ( error ) return error;
+  stream.parameters.isDeterministic = TRUE;
+  // For widening the halo from zero
+  stream.tileSize = regionWidth > regionHeight ? regionWidth : regionHeight;
+  
+  previousWorkspace = bindWorkspace(stream.parameters.workspace);
+  error = synthesizeRegionWidening(&stream, &region, halo);
+  bindWorkspace(previousWorkspace);
+  return error;
+}
+
+/*
+Estimate of peak bytes a call of imageSynth() or imageSynth2() allocates, beyond what it is passed:
+the adapted target and corpus pixmaps (each pixel with an interleaved mask pixelel),
+and the engine's bookkeeping, see engineMemoryEstimate().
+*/
+extern size_t
+imageSynthMemoryEstimate(
+  size_t width,
+  size_t height,
+  TImageFormat imageFormat,
+  TImageSynthParameters* parameters  // or NULL for defaults
+  )
+{
+  TImageSynthParameters defaultParameters;
+  size_t depth = countPixelelsPerPixelForFormat(imageFormat) + 1;
+  size_t size = width * height;
+  
+  if (!parameters) {
+    setDefaultParams(&defaultParameters);
+    parameters = &defaultParameters;
+    }
+  
+  return 2 * (size + 8) * depth  // targetMap, corpusMap
+    + engineMemoryEstimate(parameters, width, height, width, height, depth);
+}
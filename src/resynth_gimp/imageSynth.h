@@ -50,3 +50,95 @@ imageSynth2(
   void *contextInfo,	// opaque to engine, passed in progressCallback
   int *cancelFlag		// polled by engine: engine quits if ever becomes True
   );
+
+// Either API, writing the result into outBuffer (which may be imageBuffer.)  mask2 NULL: the simple API
+int
+imageSynthInto(
+  ImageBuffer * imageBuffer,  // IN RGBA Pixels described by imageFormat
+  ImageBuffer * mask,         // IN one mask Pixelel, selects the target
+  ImageBuffer * mask2,        // IN one mask Pixelel, selects the corpus, or NULL: the inverse of mask
+  ImageBuffer * outBuffer,    // OUT same dimensions and format as imageBuffer
+  TImageFormat imageFormat,
+  TImageSynthParameters* parameters,
+  void (*progressCallback)(int, void*),   // int percentDone, void *contextInfo
+  void *contextInfo,	// opaque to engine, passed in progressCallback
+  int *cancelFlag		// polled by engine: engine quits if ever becomes True
+  );
+
+// A corpus prepared once for many calls, see imageSynth.c
+int
+imageSynthCorpus(
+  ImageBuffer * corpus,               // IN RGBA Pixels described by imageFormat, only read
+  ImageBuffer * corpusMask,           // IN one mask Pixelel, selects the corpus, or NULL: all of it
+  TImageFormat imageFormat,
+  TImageSynthParameters* parameters,  // prepared for, or NULL for defaults
+  TCorpusContext** corpusContext      // OUT free with imageSynthFreeCorpus()
+  );
+
+void
+imageSynthFreeCorpus(TCorpusContext* corpusContext);
+
+// imageSynthInto() from a prepared corpus, shared read only by concurrent calls
+int
+imageSynthIntoCorpus(
+  ImageBuffer * imageBuffer,  // IN RGBA Pixels described by imageFormat, any size
+  ImageBuffer * mask,         // IN one mask Pixelel, selects the target, the rest is context
+  ImageBuffer * outBuffer,    // OUT same dimensions and format as imageBuffer
+  TImageFormat imageFormat,
+  TImageSynthParameters* parameters,
+  TCorpusContext* corpus,     // IN same format as imageFormat
+  void (*progressCallback)(int, void*),   // int percentDone, void *contextInfo
+  void *contextInfo,	// opaque to engine, passed in progressCallback
+  int *cancelFlag		// polled by engine: engine quits if ever becomes True
+  );
+
+// Either API on an image streamed by tiles, see imageSynth.c
+int
+imageSynthTiled(
+  unsigned int width,                   // of the whole image
+  unsigned int height,
+  TImageSynthTileCallback readImage,    // IN RGBA Pixels described by imageFormat, as of earlier writes
+  TImageSynthTileCallback readMask,     // IN one mask Pixelel, selects the target, or NULL: all of the image
+  TImageSynthTileCallback writeImage,   // OUT synthesized pixels
+  void *tileContext,                    // opaque to engine, passed to the tile callbacks
+  TCorpusContext * corpus,              // IN shared corpus, see imageSynthCorpus(), or NULL: the window of each tile, outside the mask
+  TImageFormat imageFormat,
+  unsigned int tileSize,
+  unsigned int halo,
+  TImageSynthParameters* parameters,
+  void (*progressCallback)(int, void*),   // int percentDone, void *contextInfo
+  void *contextInfo,	// opaque to engine, passed in progressCallback
+  int *cancelFlag		// polled by engine: engine quits if ever becomes True
+  );
+
+// One region of an image streamed by tiles, deterministically, with finished pixels as context, see imageSynth.c
+int
+imageSynthRegion(
+  unsigned int width,                   // of the whole image
+  unsigned int height,
+  unsigned int x,                       // of the region
+  unsigned int y,
+  unsigned int regionWidth,
+  unsigned int regionHeight,
+  TImageSynthTileCallback readImage,    // IN RGBA Pixels described by imageFormat
+  TImageSynthTileCallback readMask,     // IN one mask Pixelel, selects the target, or NULL: all of the image
+  TImageSynthTileCallback readFinished, // IN one Pixelel, nonzero where the target is finished, read only
+  TImageSynthTileCallback writeImage,   // OUT synthesized pixels of the region
+  void *tileContext,                    // opaque to engine, passed to the tile callbacks
+  TCorpusContext * corpus,              // IN shared corpus, see imageSynthCorpus(), or NULL: the window of the region, outside the mask
+  TImageFormat imageFormat,
+  unsigned int halo,
+  TImageSynthParameters* parameters,
+  void (*progressCallback)(int, void*),   // int percentDone, void *contextInfo
+  void *contextInfo,	// opaque to engine, passed in progressCallback
+  int *cancelFlag		// polled by engine: engine quits if ever becomes True
+  );
+
+// Estimate of peak bytes allocated by imageSynth() or imageSynth2() for an image, beyond what is passed
+size_t
+imageSynthMemoryEstimate(
+  size_t width,
+  size_t height,
+  TImageFormat imageFormat,
+  TImageSynthParameters* parameters  // or NULL for defaults
+  );
@@ -94,7 +94,32 @@ for banded randomization of target points.
 */
 #define IMAGE_SYNTH_BAND_FRACTION 0.1
 
+/*
+Count of consecutive target points shuffled together when ordered along a curve (an area of about this many pixels.)
+Enough to break up the curve's pattern, few enough that the points stay in cache.
+*/
+#define IMAGE_SYNTH_CURVE_JITTER 64
+
+/*
+Most target points of a batch matched at once on a GPU, see deviceBatch.h.
+Larger batches are matched in chunks: the device holds a sum per random probe of each point of a chunk.
+*/
+#define IMAGE_SYNTH_DEVICE_CHUNK 4096
+
+/*
+Random probes of a target drawn at once, and their corpus prefetched, before any is matched.
+Enough to overlap their cache misses on a large corpus, few enough that prefetched lines are not evicted.
+*/
+#define IMAGE_SYNTH_PROBE_BLOCK 8
+
+// Nearest neighbors of a random probe prefetched: most probes short circuit within them
+#define IMAGE_SYNTH_PREFETCH_NEIGHBORS 4
+
 
 // Count of target pixels synthesized per deep progress callback
 // !!! This must in binary all x lower bits ones i.e. 2^12-1
 #define IMAGE_SYNTH_CALLBACK_COUNT 4095
+
+// Count of target pixels synthesized per thread between checks of the clock, with a deadline
+// !!! Also 2^n-1
+#define IMAGE_SYNTH_DEADLINE_COUNT 255
@@ -78,6 +78,20 @@ new_coordmap(
   guint
   );
 
+extern void
+new_shortmap(
+  Map *,
+  guint, 
+  guint
+  );
+
+extern void
+new_bitmap(
+  Map *,
+  guint, 
+  guint
+  );
+
 
 /* Misc map operations. */
 
@@ -83,4 +83,26 @@ bytemap_index(
   return &g_array_index(map->data, guchar, index);
 }
 
+/* Return pointer to gushort at coordinates in map. */
+static inline gushort*
+shortmap_index(
+  Map* map,
+  const Coordinates coords
+  )
+{
+  guint index = coords.x + coords.y * map->width;
+  return &g_array_index(map->data, gushort, index);
+}
 
+/* Return pointer to the word holding the bit at coordinates in a bitmap, and the bit within it. */
+static inline guint*
+bitmap_word(
+  Map* map,
+  const Coordinates coords,
+  guint* bit  // OUT mask of the bit
+  )
+{
+  guint index = coords.x + coords.y * map->width;
+  *bit = 1u << (index & 31);
+  return &g_array_index(map->data, guint, index >> 5);
+}
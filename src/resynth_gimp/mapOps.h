@@ -58,7 +58,11 @@ new_pixmap(
    guint size = width * height * depth;
    map->data = g_array_sized_new (FALSE, TRUE, sizeof(Pixelel), size);
   */
-  map->data = g_array_sized_new (FALSE, TRUE, depth, width * height);
+  /*
+  Reserve a few spare pixels, zeroed, after the last.
+  Vectorized code reads whole words (up to eight bytes) at a pixel, see patchKernel.h.
+  */
+  map->data = g_array_sized_new (FALSE, TRUE, depth, width * height + 8);
 }
 
 
@@ -90,6 +94,34 @@ new_coordmap(
   map->data = g_array_sized_new (FALSE, TRUE, sizeof(Coordinates), width * height);
 }
   
+/* Create dynamic 2-D array of gushort. */
+void
+new_shortmap(
+  Map * map,
+  guint width, 
+  guint height
+  )
+{
+  map->width = width;
+  map->height = height;
+  map->depth = sizeof(gushort);   // Not used
+  map->data = g_array_sized_new (FALSE, TRUE, sizeof(gushort), width * height);
+}
+
+/* Create dynamic 2-D array of bits, zeroed, packed in words of guint. */
+void
+new_bitmap(
+  Map * map,
+  guint width, 
+  guint height
+  )
+{
+  map->width = width;
+  map->height = height;
+  map->depth = 0;   // Not used, less than a byte
+  map->data = g_array_sized_new (FALSE, TRUE, sizeof(guint), (width * height + 31) / 32);
+}
+  
 /* Create dynamic 2-D array of guchar. */
 void
 new_bytemap(
@@ -28,7 +28,18 @@ TODO ordering by a thinning, or brushfire, algorithm, i.e. distance from context
 
 #include "brushfire.h"
 
-extern void swap_vector_elements(pointVector, guint, guint, guint);
+// Unchecked swap_vector_elements(), for shuffles of millions of points
+static inline void
+swapPoints(
+  Coordinates* points,
+  guint i,
+  guint j
+  )
+{
+  Coordinates temp = points[i];
+  points[i] = points[j];
+  points[j] = temp;
+}
 
 /*
 Order vector of target pixels: shuffle randomly
@@ -40,11 +51,12 @@ orderTargetPointsRandom(
   GRand *prng
   ) 
 {
+  Coordinates* points = &g_array_index(targetPoints, Coordinates, 0);
   guint i;
   for(i=0; i<targetPoints->len; i++)
   {
     guint j = g_rand_int_range(prng, 0, targetPoints->len);
-    swap_vector_elements(targetPoints, targetPoints->len, i, j);
+    swapPoints(points, i, j);
   }
 }
 
@@ -56,12 +68,14 @@ instead of shuffling from source anywhere in the vector.
 Note that elements CAN move all the way to the back, but not vice versa: 
 elements can only move the band size forward.
 TODO another method of random bands that is symmetric.
+Sequential, and linear: each swap depends on those before it, so parallel shuffles would change every order.
 */
 static void randomizeBandsTargetPoints(
   pointVector targetPoints,
   GRand *prng
   ) 
 {
+  Coordinates* points = &g_array_index(targetPoints, Coordinates, 0);
   gint last = targetPoints->len - 1;
   gint halfBand = targetPoints->len * IMAGE_SYNTH_BAND_FRACTION;
   gint i;
@@ -76,7 +90,7 @@ static void randomizeBandsTargetPoints(
     gint bandEnd = MIN(i+halfBand, last); // bandEnd in [halfBand, last]
     gint bandSize = bandEnd - bandStart;
     gint j = bandStart + g_rand_int_range(prng, 0, bandSize);
-    swap_vector_elements(targetPoints, targetPoints->len, i, j);
+    swapPoints(points, i, j);
   }
 }
 
@@ -117,46 +131,104 @@ void randomizeBandsTargetPoints2(
 #endif
 
 /*
-Coordinates to and from offsets.
-Add or subtract a point (e.g. a center.)
+A target point with a key to order it by, see sortKeyedPoints().
+*/
+typedef struct keyedPointStruct {
+  guint key;
+  guint tag;    // e.g. the index of the point before sorting
+  Coordinates point;
+} TKeyedPoint;
+
+
+/*
+Sort ascending by key, stably: a radix sort of 8 bit digits, least significant first, in linear time.
+A digit the same in every key takes no pass.  spare is scratch for as many points.
 */
 static void
-targetPoints_to_offsets(
-  Coordinates center,
-  pointVector targetPoints
+sortKeyedPoints(
+  TKeyedPoint* points,    // IN/OUT
+  TKeyedPoint* spare,
+  guint count
   )
 {
-  // Coords => offsets from center
+  guint counts[4][256];
+  TKeyedPoint* from = points;
+  TKeyedPoint* to = spare;
+  guint digit;
   guint i;
-  for(i=0; i<targetPoints->len; i++)
-    // c++ targetPoints[i] = subtract_points(targetPoints[i], center);
-    g_array_index(targetPoints, Coordinates, i) = 
-      subtract_points(g_array_index(targetPoints, Coordinates, i), center);
+
+  if ( ! count ) return;
+  memset(counts, 0, sizeof(counts));
+  for(i=0; i<count; i++)
+    for(digit=0; digit<4; digit++)
+      counts[digit][(points[i].key >> (8 * digit)) & 255]++;
+
+  for(digit=0; digit<4; digit++)
+  {
+    guint shift = 8 * digit;
+    guint* starts = counts[digit];
+    guint start = 0;
+    guint bucket;
+    TKeyedPoint* swap;
+
+    if (starts[(points[0].key >> shift) & 255] == count) continue;
+    for(bucket=0; bucket<256; bucket++)
+    {
+      guint bucketCount = starts[bucket];
+      starts[bucket] = start;
+      start += bucketCount;
+    }
+    for(i=0; i<count; i++)
+      to[starts[(from[i].key >> shift) & 255]++] = from[i];
+    swap = from;
+    from = to;
+    to = swap;
+  }
+  if (from != points)
+    memcpy(points, from, count * sizeof(TKeyedPoint));
 }
 
+
+/*
+Order target points by keys, one per point, ascending or descending.
+Formerly g_array_sort() with compare funcs (see engineTypes.h) which never return 0 (see to_sort_result()):
+for equal keys a "less" func said the first was greater, a "more" func that it was less,
+so glibc's qsort, a merge sort, left ties reversed ascending and in order descending.
+So here ascending sorts the points in reverse, descending by the complement of the keys: the orders are the same.
+*/
 static void
-targetPoints_from_offsets(
-  Coordinates center,
-  pointVector targetPoints
+orderTargetPointsByKeys(
+  pointVector targetPoints,
+  const guint* keys,
+  gboolean isDescending
   )
-  {
+{
+  guint count = targetPoints->len;
+  TKeyedPoint* points = workspaceCalloc(MAX(count, 1) * 2, sizeof(TKeyedPoint));
   guint i;
-  // offsets from center => Coords
-  for(i=0; i<targetPoints->len; i++)
-    g_array_index(targetPoints, Coordinates, i) = 
-      add_points(g_array_index(targetPoints, Coordinates, i), center);
-  }
 
+  g_assert(points);
+  for(i=0; i<count; i++)
+  {
+    guint from = isDescending ? i : count - 1 - i;
+    points[i].key = isDescending ? ~keys[from] : keys[from];
+    points[i].point = g_array_index(targetPoints, Coordinates, from);
+  }
+  sortKeyedPoints(points, points + count, count);
+  for(i=0; i<count; i++)
+    g_array_index(targetPoints, Coordinates, i) = points[i].point;
+  workspaceFree(points);
+}
 
 
 /*
-Order target points by 2D distance from target center, then randomize in bands.
-Note the compare function changes the direction, eg inward, outward, horizontal, vertical, etc.
+Order target points by distance from target center, horizontal or vertical, then randomize in bands.
+Descending is inward (from the far sides), ascending outward.
 */
 static void 
 orderTargetPointsRandomDirectional(
-  // c++ bool (*compare) (const Coordinates, const Coordinates)
-  gint (*compare)(const void*, const void*),
+  gboolean isVertical,
+  gboolean isDescending,
   pointVector targetPoints,
   GRand *prng
   ) 
@@ -168,99 +240,208 @@ orderTargetPointsRandomDirectional(
   and may have different centers.
   */
   Coordinates center = get_center(targetPoints, targetPoints->len);
+  guint* keys = workspaceCalloc(MAX(targetPoints->len, 1), sizeof(guint));
+  guint i;
   
-  targetPoints_to_offsets(center, targetPoints);
-  
-  // ascending or descending, outward or inward, concentric or linear, depending on compare function
-  // c++ sort(targetPoints.begin(), targetPoints.end(), compare);  
-  g_array_sort(targetPoints, compare);
-    
-  targetPoints_from_offsets(center, targetPoints);
+  g_assert(keys);
+  // Squared distances, as the compare funcs compared, unsigned: no overflow
+  for(i=0; i<targetPoints->len; i++)
+  {
+    Coordinates offset = subtract_points(g_array_index(targetPoints, Coordinates, i), center);
+    gint signedDistance = isVertical ? offset.y : offset.x;
+    guint distance = (guint) (signedDistance < 0 ? -signedDistance : signedDistance);
+    keys[i] = distance * distance;
+  }
+  orderTargetPointsByKeys(targetPoints, keys, isDescending);
+  workspaceFree(keys);
   randomizeBandsTargetPoints(targetPoints, prng);
 }
 
 
+// Proportions (see brushfire.h) as keys: the bits of a float not negative order as the float, NaN last
+static guint*
+proportionKeys(const gfloat* proportions, guint count)
+{
+  guint* keys = workspaceCalloc(MAX(count, 1), sizeof(guint));
+  g_assert(keys);
+  memcpy(keys, proportions, count * sizeof(guint));
+  return keys;
+}
 
 
-
+/*
+Order target points by proportional distance from center to edge (see brushfire.h), then randomize in bands.
+Inward (descending) from the edges, or outward (ascending) from the center.
+*/
 static void
 orderTargetPointsRandomBrushfire(
-  // c++ bool (*compare) (const Coordinates, const Coordinates)
-  gint (*compare)(const void*, const void*),
+  gboolean isInward,
   pointVector targetPoints,
-  GRand *prng
+  GRand *prng,
+  guint threadCount
   )
 {
-  Coordinates center = get_center(targetPoints, targetPoints->len);
-  targetPoints_to_offsets(center, targetPoints);
-  // Coordinates are now offsets.
-  GArray* sortArray = targetPointsToSortArray(targetPoints);
-  g_array_sort(sortArray, compare);  // outward or inward  compare function
-  targetPointsFromSortArray(targetPoints, sortArray);
-  targetPoints_from_offsets(center, targetPoints);
+  gfloat* proportions = prepareProportionsInward(targetPoints, threadCount);
+  guint* keys = proportionKeys(proportions, targetPoints->len);
+
+  workspaceFree(proportions);
+  orderTargetPointsByKeys(targetPoints, keys, isInward);
+  workspaceFree(keys);
   randomizeBandsTargetPoints(targetPoints, prng);
 }
 
 
-
-
 /* 
 Random squeeze: order the target points both directions, in and out by distance from center.
 Used if the target is a donut, with context inside and outside.
+Alternately from both ends of the inward order (the edges, and the center), then randomized in bands.
+Formerly it alternated into points then overwritten by the inward order: it ordered as brushfire inward.
 */
 static void orderTargetPointsRandomSqueeze(
   pointVector targetPoints,
-  GRand *prng
+  GRand *prng,
+  guint threadCount
   )
 {
+  guint count = targetPoints->len;
+  gfloat* proportions = prepareProportionsInward(targetPoints, threadCount);
+  guint* keys = proportionKeys(proportions, count);
+  Coordinates* inward = workspaceCalloc(MAX(count, 1), sizeof(Coordinates));
+  guint frontIndex = 0;
+  guint backIndex = count;
   guint i;
-  pointVector target_temp;
-  
-  Coordinates center = get_center(targetPoints, targetPoints->len);
-  
-  targetPoints_to_offsets(center, targetPoints); // Temporarily: Coords => to offsets from center
-  GArray* sortArray = targetPointsToSortArray(targetPoints);
-      
-  // Algorithm: shuffle (one from each end alternatively, not random.)
-  
-  // Sort ascending on distance from center
-  // c++ sort(targetPoints.begin(), targetPoints.end(), lessCartesian);   
-  g_array_sort(sortArray, (gint (*)(const void*, const void*)) moreInward);
-  
-  // Copy targetPoints vector
-  target_temp = g_array_sized_new (FALSE, TRUE, sizeof(Coordinates), targetPoints->len);
+
+  g_assert(inward);
+  workspaceFree(proportions);
+  orderTargetPointsByKeys(targetPoints, keys, TRUE);
+  workspaceFree(keys);
+  memcpy(inward, &g_array_index(targetPoints, Coordinates, 0), count * sizeof(Coordinates));
+  // One from the front, one from the back, until they meet
+  for(i=0; i<count; i++)
+    g_array_index(targetPoints, Coordinates, i) = (i & 1) ? inward[--backIndex] : inward[frontIndex++];
+  workspaceFree(inward);
+  randomizeBandsTargetPoints(targetPoints, prng);
+}
+
+/*
+Order along a space filling curve, for locality: consecutive target points are near each other,
+so they share neighbors (and the cache lines of their patches) and corpus continuations.
+Optionally still in bands from the context inward, then along the curve within each band.
+Jittered (shuffled within short runs of the curve) to avoid the curve's own artifacts.
+*/
+/*
+Index of a point along a Hilbert curve over a square of 2^16 pixels a side, coarsened by shift:
+larger targets (the engine takes sides beyond 2^16, see packSourceOf() in engine.c) index cells of 2^shift pixels a side.
+Unlike a raster or Morton order, the curve never jumps: nearby indices are adjacent pixels (or cells.)
+*/
+static guint
+hilbertIndex(Coordinates point, guint shift)
+{
+  guint x = (guint) point.x >> shift;
+  guint y = (guint) point.y >> shift;
+  guint index = 0;
+  guint s;
   
+  for (s = 1u << 15; s > 0; s >>= 1)
+  {
+    guint rx = (x & s) > 0;
+    guint ry = (y & s) > 0;
+    
+    index += s * s * ((3 * rx) ^ ry);
+    // Rotate the quadrant, so the curve continues across it
+    if (ry == 0)
+    {
+      guint t;
+      if (rx == 1)
+      {
+        x = G_MAXUSHORT - x;
+        y = G_MAXUSHORT - y;
+      }
+      t = x;
+      x = y;
+      y = t;
+    }
+  }
+  return index;
+}
+
+
+// Shuffle within consecutive runs of IMAGE_SYNTH_CURVE_JITTER points: the order stays local
+static void
+jitterTargetPoints(
+  pointVector targetPoints,
+  GRand *prng
+  )
+{
+  Coordinates* points = &g_array_index(targetPoints, Coordinates, 0);
+  guint i;
   for(i=0; i<targetPoints->len; i++)
-    g_array_index(target_temp, Coordinates, i) = g_array_index(targetPoints, Coordinates, i);
-  
-  // Shuffle back into the original
   {
-  guint pointCount = targetPoints->len;
-  gint frontIndex = 0;
-  gint backIndex = pointCount-1;
+    guint runStart = i - i % IMAGE_SYNTH_CURVE_JITTER;
+    guint runEnd = MIN(runStart + IMAGE_SYNTH_CURVE_JITTER, targetPoints->len);
+    guint j = runStart + g_rand_int_range(prng, 0, runEnd - runStart);
+    swapPoints(points, i, j);
+  }
+}
+
+
+/*
+By band (from the edges inward, or none), then index along the curve: two stable radix sorts,
+by index, then by band.  Within 2^16 pixels a side indexes are distinct, so the order is the only one;
+beyond, the points of a cell of the coarsened curve tie, and stay in the order prepared, raster.
+*/
+static void
+orderTargetPointsCurve(
+  gboolean isBanded,
+  pointVector targetPoints,
+  GRand *prng,
+  guint threadCount
+  )
+{
+  guint count = targetPoints->len;
+  TKeyedPoint* points = workspaceCalloc(MAX(count, 1) * 2, sizeof(TKeyedPoint));
+  gfloat* proportions = NULL;
+  guint extent = 0;
+  guint shift = 0;
+  guint i;
   
-  i = 0;
-  while (TRUE) 
+  g_assert(points);
+  // Coarsen the curve until the target fits its 2^16 cells a side
+  for(i=0; i<count; i++)
+  {
+    Coordinates point = g_array_index(targetPoints, Coordinates, i);
+    extent |= (guint) point.x | (guint) point.y;
+  }
+  while ((extent >> shift) > G_MAXUSHORT)
+    shift++;
+  for(i=0; i<count; i++)
+  {
+    points[i].point = g_array_index(targetPoints, Coordinates, i);
+    points[i].key = hilbertIndex(points[i].point, shift);
+    points[i].tag = i;
+  }
+  sortKeyedPoints(points, points + count, count);
+  if (isBanded)
+  {
+    // Bands of equal area, by proportional distance to the edge as for brushfire
+    proportions = prepareProportionsInward(targetPoints, threadCount);
+    for(i=0; i<count; i++)
     {
-    // Copy from front.
-    // c++ targetPoints[i] = targetTemp[frontIndex];
-    g_array_index(targetPoints, Coordinates, i) = g_array_index(target_temp, Coordinates, frontIndex);
-    i++;
-    frontIndex++;
-    if ( i>= pointCount) break;
-    // Copy from back.
-    // c++ targetPoints[i] = targetTemp[backIndex]; // Backwards
-    g_array_index(targetPoints, Coordinates, i) = g_array_index(target_temp, Coordinates, backIndex);
-    i++;
-    backIndex--;
-    if ( i>= pointCount) break;
+      gfloat proportion = proportions[points[i].tag];
+      guint band = 0;
+      // NaN (e.g. a target of one pixel) is the first band
+      if (proportion == proportion && proportion < 1.0)
+        band = MIN((guint) ((1.0 - proportion) / IMAGE_SYNTH_BAND_FRACTION),
+          (guint) (1.0 / IMAGE_SYNTH_BAND_FRACTION) - 1);
+      points[i].key = band;
     }
+    workspaceFree(proportions);
+    sortKeyedPoints(points, points + count, count);
   }
-  
-  targetPointsFromSortArray(targetPoints, sortArray);
-  targetPoints_from_offsets(center, targetPoints); // offsets => coordinates
-  randomizeBandsTargetPoints(targetPoints, prng);
-  g_array_free(target_temp, TRUE);
+  for(i=0; i<count; i++)
+    g_array_index(targetPoints, Coordinates, i) = points[i].point;
+  workspaceFree(points);
+  jitterTargetPoints(targetPoints, prng);
 }
 
 /*
@@ -274,6 +455,8 @@ orderTargetPoints(
   GRand *prng
   ) 
 {
+  guint threadCount = parameters->threadCount;
+
   switch (parameters->matchContextType) 
   {
     case 0: /* Random order, not using context in matches. */
@@ -281,60 +464,41 @@ orderTargetPoints(
         orderTargetPointsRandom(targetPoints, prng);  
         break;
     case 2: /* Randomized bands, concentric, inward */
-        orderTargetPointsRandomBrushfire(
-          (gint (*)(const void*, const void*)) moreInward,
-          targetPoints,
-          prng
-          );
+        orderTargetPointsRandomBrushfire(TRUE, targetPoints, prng, threadCount);
         /* Formerly moreCartesian */
         break;
     case 3:
-        orderTargetPointsRandomDirectional( 
-          (gint (*)(const void*, const void*)) moreHorizontal,
-          targetPoints,
-          prng
-          );
+        orderTargetPointsRandomDirectional(FALSE, TRUE, targetPoints, prng);
         // randomized bands, horizontally, inwards.  IE squeezing from top and bottom
         break;
     case 4:
-        orderTargetPointsRandomDirectional( 
-          (gint (*)(const void*, const void*)) moreVertical,
-          targetPoints,
-          prng
-          );
+        orderTargetPointsRandomDirectional(TRUE, TRUE, targetPoints, prng);
         // randomized bands, vertically, inwards.  IE squeezing from sides.
         break;
     case 5:
-        orderTargetPointsRandomBrushfire(
-          (gint (*)(const void*, const void*)) lessInward,
-          targetPoints,
-          prng
-          );
+        orderTargetPointsRandomBrushfire(FALSE, targetPoints, prng, threadCount);
         // randomized bands, concentric, outward (eg for uncrop)
         break;
     case 6:
-        orderTargetPointsRandomDirectional( 
-          (gint (*)(const void*, const void*)) lessHorizontal,
-          targetPoints,
-          prng
-          );
+        orderTargetPointsRandomDirectional(FALSE, FALSE, targetPoints, prng);
         // randomized bands, horizontally, outwards.   IE expanding to top and bottom
         break;
     case 7:
-        orderTargetPointsRandomDirectional( 
-          (gint (*)(const void*, const void*)) lessVertical,
-          targetPoints,
-          prng
-          );
+        orderTargetPointsRandomDirectional(TRUE, FALSE, targetPoints, prng);
         // randomized bands, vertically, outwards.  IE expanding to sides
         break;
     case 8:
-        orderTargetPointsRandomSqueeze(
-          targetPoints,
-          prng
-          );   
+        orderTargetPointsRandomSqueeze(targetPoints, prng, threadCount);
         // randomized bands, concentric squeezing in and out a donut
         break;
+    case 9:
+        orderTargetPointsCurve(FALSE, targetPoints, prng, threadCount);
+        // jittered Hilbert curve over the target, for locality
+        break;
+    case 10:
+        orderTargetPointsCurve(TRUE, targetPoints, prng, threadCount);
+        // jittered Hilbert curve within bands, concentric, inward
+        break;
     default:
         // no gimp: gimp_message("Parameter use_border out of range."); 
         // Critical, no i18n
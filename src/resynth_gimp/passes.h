@@ -64,6 +64,29 @@ estimatePixelsToSynth(TRepetionParameters repetition_params)
 
 
 
+/*
+With a deadline, see engineParams.h: the deadline of a pass,
+its share (by count of targets) of the time left for the passes from it on.
+*/
+static inline double
+passDeadline(
+  TRepetionParameters repetition_params,
+  guint pass,
+  double now,
+  double deadline
+  )
+{
+  guint later;
+  double remainingTargets = 0;
+
+  for (later=pass; later<MAX_PASSES; later++)
+    remainingTargets += repetition_params[later][1];
+  if (remainingTargets == 0 || now >= deadline)
+    return deadline;
+  return now + (deadline - now) * repetition_params[pass][1] / remainingTargets;
+}
+
+
 static guint
 prepare_repetition_parameters(
   TRepetionParameters repetition_params,
@@ -0,0 +1,178 @@
+/*
+Cascade rejection of probes by patch descriptors.  Optional, see isCascadeRejection in engineParams.h.
+
+The descriptor of a corpus point is, per color pixelel, the sum of its ring:
+the eight pixels around it (not itself, whose color computeBestFit() does not compare.)
+A target patch whose eight nearest neighbors are that ring (usual once the target is filled in) has one too.
+From two descriptors, a lower bound of the patch diff, in one lookup per color pixelel:
+a probe whose bound is no better than the best so far is rejected before reading its patch.
+
+The bound is exact, so rejection changes only the speed, never which probe is best.
+Per color pixelel, the sum over the ring of metric(d) is at least 8 * hull(|mean of d|),
+for hull the lower convex hull of the metric table (made nondecreasing): Jensen's inequality.
+The rest of the patch, clipped neighbors and maps only add to the patch diff.
+The metric table is that of quantizeMetricFuncs(): the bound is computed from it, in front of it.
+
+Not with SYMMETRIC_METRIC_TABLE, whose table is indexed otherwise.
+
+Included source, not compiled separately.
+*/
+
+#ifndef __SYNTH_PATCH_DESCRIPTOR_H__
+#define __SYNTH_PATCH_DESCRIPTOR_H__
+
+#define PATCH_DESCRIPTOR_RING 8
+#define PATCH_DESCRIPTOR_MAX_SUM (PATCH_DESCRIPTOR_RING * 255)
+// First sum of a corpus point whose ring leaves the corpus or its selection: no descriptor, never rejected
+#define PATCH_DESCRIPTOR_NONE -1
+
+typedef struct patchDescriptorsStruct {
+  guint colorCount;
+  guint width;    // of the corpus
+  gshort* sums;   // colorCount per corpus point, row major
+  // Lower bound of the patch diff of the ring, by the difference of the sums of a color pixelel
+  guint bound[PATCH_DESCRIPTOR_MAX_SUM + 1];
+} TPatchDescriptors;
+
+
+/*
+The bound table: for each difference s of sums, 8 * hull(s / 8), rounded down.
+The hull of the metric by |difference| from the lower of both signs, by the monotone chain.
+*/
+static void
+preparePatchDescriptorBound(
+  const TPixelelMetricFunc corpusTargetMetric,
+  guint bound[PATCH_DESCRIPTOR_MAX_SUM + 1]   // OUT
+  )
+{
+  guint metric[256];
+  guint hull[256];  // difference at each vertex
+  guint count = 0;
+  guint x;
+  guint s;
+  guint segment = 0;
+
+  for (x=0; x<256; x++)
+    metric[x] = MIN(corpusTargetMetric[LIMIT_DOMAIN + x], corpusTargetMetric[LIMIT_DOMAIN - x]);
+  for (x=0; x<256; x++)
+  {
+    // Pop vertices above the chord from the one before to x
+    while (count >= 2)
+    {
+      guint a = hull[count - 2];
+      guint b = hull[count - 1];
+      gint64 cross = ((gint64) metric[b] - metric[a]) * (x - a) - ((gint64) metric[x] - metric[a]) * (b - a);
+      if (cross < 0) break;
+      count--;
+    }
+    hull[count++] = x;
+  }
+
+  for (s=0; s<=PATCH_DESCRIPTOR_MAX_SUM; s++)
+  {
+    // Segment of the hull holding s / 8, interpolated in integers: 8 * (metric[a] + slope * (s/8 - a))
+    guint a, b;
+    while (segment + 2 < count && hull[segment + 1] * PATCH_DESCRIPTOR_RING <= s)
+      segment++;
+    a = hull[segment];
+    b = hull[segment + 1];
+    {
+      gint64 numerator = ((gint64) metric[b] - metric[a]) * ((gint64) s - PATCH_DESCRIPTOR_RING * a);
+      gint64 rise = numerator / (gint64) (b - a);
+      if (numerator % (gint64) (b - a) < 0) rise--;   // Rounded down, also where the hull descends
+      bound[s] = (guint) (PATCH_DESCRIPTOR_RING * (gint64) metric[a] + rise);
+    }
+  }
+  // Nondecreasing: a convex hull might first descend, if the metric is not least at zero difference
+  for (s=PATCH_DESCRIPTOR_MAX_SUM; s>0; s--)
+    if (bound[s - 1] > bound[s])
+      bound[s - 1] = bound[s];
+}
+
+
+// Requires color pixelels: a descriptor has one sum per color pixelel
+static void
+preparePatchDescriptors(
+  Map* corpusMap,
+  const TPixelelLayout layout,
+  const TPixelelMetricFunc corpusTargetMetric,
+  TPatchDescriptors* descriptors   // OUT
+  )
+{
+  guint colorCount = layout.colorEndBip - FIRST_PIXELEL_INDEX;
+  Coordinates point;
+
+  descriptors->colorCount = colorCount;
+  descriptors->width = corpusMap->width;
+  descriptors->sums = workspaceCalloc((size_t) corpusMap->width * corpusMap->height * colorCount, sizeof(gshort));
+  g_assert(descriptors->sums);
+  preparePatchDescriptorBound(corpusTargetMetric, descriptors->bound);
+
+  for (point.y=0; point.y<(gint) corpusMap->height; point.y++)
+    for (point.x=0; point.x<(gint) corpusMap->width; point.x++)
+    {
+      gshort* sums = descriptors->sums + ((size_t) point.y * corpusMap->width + point.x) * colorCount;
+      gint sumsOfRing[MAX_IMAGE_SYNTH_BPP] = {0};
+      gboolean isWhole = TRUE;
+      gint dx, dy;
+      guint k;
+
+      for (dy=-1; dy<=1 && isWhole; dy++)
+        for (dx=-1; dx<=1; dx++)
+        {
+          Coordinates neighbor = {point.x + dx, point.y + dy};
+          const Pixelel* pixel;
+          if ( ! dx && ! dy ) continue;
+          if (clippedOrMaskedCorpus(neighbor, corpusMap)) { isWhole = FALSE; break; }
+          pixel = pixmap_index(corpusMap, neighbor);
+          for (k=0; k<colorCount; k++)
+            sumsOfRing[k] += pixel[FIRST_PIXELEL_INDEX + k];
+        }
+      if ( ! isWhole )
+      {
+        sums[0] = PATCH_DESCRIPTOR_NONE;
+        continue;
+      }
+      for (k=0; k<colorCount; k++)
+        sums[k] = (gshort) sumsOfRing[k];
+    }
+}
+
+
+static void
+free_patch_descriptors(TPatchDescriptors* descriptors)
+{
+  workspaceFree(descriptors->sums);
+}
+
+
+static inline const gshort*
+patchDescriptorOfPoint(
+  const TPatchDescriptors* descriptors,
+  const Coordinates point
+  )
+{
+  return descriptors->sums + ((size_t) point.y * descriptors->width + point.x) * descriptors->colorCount;
+}
+
+
+// Whether the patch diff at a corpus point is surely no less than bestPatchDiff
+static inline gboolean
+isRejectedByDescriptor(
+  const TPatchDescriptors* descriptors,
+  const gint descriptor[MAX_IMAGE_SYNTH_BPP],
+  const Coordinates point,
+  const guint bestPatchDiff
+  )
+{
+  const gshort* sums = patchDescriptorOfPoint(descriptors, point);
+  guint bound = 0;
+  guint k;
+
+  if (sums[0] == PATCH_DESCRIPTOR_NONE) return FALSE;
+  for (k=0; k<descriptors->colorCount; k++)
+    bound += descriptors->bound[abs(descriptor[k] - sums[k])];
+  return bound >= bestPatchDiff;
+}
+
+#endif /* __SYNTH_PATCH_DESCRIPTOR_H__ */
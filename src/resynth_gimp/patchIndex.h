@@ -0,0 +1,179 @@
+/*
+Patch index: an approximate nearest neighbor index of the corpus, for the random probe stage of synthesize().
+
+Without it, the random stage probes maxProbeCount points of the whole corpus, uniformly,
+most of which are nothing like the patch: wasted on a large corpus.
+With it, the random stage probes only candidates whose surroundings are roughly the color of the patch's.
+
+The descriptor of a corpus point is the mean color of the selected pixels within a square of some radius around it.
+Each color pixelel of the mean is quantized to a byte, and the bytes (at most four pixelels) are bit interleaved
+into one key: a Z-order curve through color space, so keys near in order are mostly near in color.
+(A locality sensitive hash of sorts, chosen over a kd-tree since it costs one sort, and one binary search per query.)
+
+The descriptor of a target point is the same mean over the neighbors of its patch within the radius.
+A target point with no such neighbors yet (e.g. on the sparse first pass) is not indexed: uniform random probes as before.
+
+A query returns a window of the index around the key of the target,
+from which candidates are drawn at random (so that equal keys, e.g. of a flat color, don't always yield the same points.)
+
+Knobs, see engineParams.h:
+patchIndexCandidates: count of candidates probed, instead of maxProbeCount random probes. Zero: no index.
+patchIndexRadius: radius of the descriptors.  Larger costs more to build (pixels summed grow as its square)
+but is more discriminating, so fewer candidates suffice.
+*/
+
+#ifndef __SYNTH_PATCH_INDEX_H__
+#define __SYNTH_PATCH_INDEX_H__
+
+// Count of color pixelels in a key: a key is one guint of bytes
+#define PATCH_INDEX_MAX_PIXELELS 4
+
+typedef struct patchIndexEntryStruct {
+  guint key;
+  Coordinates point;
+} TPatchIndexEntry;
+
+typedef struct patchIndexStruct {
+  GArray* entries;  // of TPatchIndexEntry, ascending on key, one per corpus point
+  guint radius;     // of descriptors
+  guint candidates; // count of candidates per query
+  TPixelelIndex pixelelCount; // color pixelels in a key
+} TPatchIndex;
+
+
+/*
+Key of a descriptor: interleave the bits of quantized means, most significant bits first.
+sums[k] is the sum of count pixelels of color k.
+*/
+static inline guint
+patchIndexKey(
+  const guint sums[],
+  TPixelelIndex pixelelCount,
+  guint count
+  )
+{
+  guint means[PATCH_INDEX_MAX_PIXELELS];
+  guint key = 0;
+  gint bit;
+  TPixelelIndex k;
+
+  for (k=0; k<pixelelCount; k++)
+    means[k] = (sums[k] + count / 2) / count;
+  for (bit=7; bit>=0; bit--)
+    for (k=0; k<pixelelCount; k++)
+      key = (key << 1) | ((means[k] >> bit) & 1);
+  return key;
+}
+
+
+static gint
+comparePatchIndexEntries(
+  const void* a,
+  const void* b
+  )
+{
+  guint keyA = ((const TPatchIndexEntry*) a)->key;
+  guint keyB = ((const TPatchIndexEntry*) b)->key;
+  return (keyA > keyB) - (keyA < keyB);
+}
+
+
+static void
+preparePatchIndex(
+  TFormatIndices* indices,
+  Map* corpusMap,           // IN
+  pointVector corpusPoints, // IN
+  guint radius,
+  guint candidates,
+  TPatchIndex* patchIndex   // OUT
+  )
+{
+  guint i;
+  gint r;
+
+  // Radius zero would leave target points no neighbors to describe them
+  patchIndex->radius = radius ? radius : 1;
+  patchIndex->candidates = candidates;
+  patchIndex->pixelelCount = indices->colorEndBip - FIRST_PIXELEL_INDEX;
+  if (patchIndex->pixelelCount > PATCH_INDEX_MAX_PIXELELS)
+    patchIndex->pixelelCount = PATCH_INDEX_MAX_PIXELELS;
+  patchIndex->entries = g_array_sized_new(FALSE, TRUE, sizeof(TPatchIndexEntry), corpusPoints->len);
+
+  r = (gint) patchIndex->radius;
+  for (i=0; i<corpusPoints->len; i++)
+  {
+    TPatchIndexEntry entry;
+    guint sums[PATCH_INDEX_MAX_PIXELELS] = {0};
+    guint count = 0;
+    gint dx, dy;
+    TPixelelIndex k;
+
+    entry.point = g_array_index(corpusPoints, Coordinates, i);
+    for (dy=-r; dy<=r; dy++)
+      for (dx=-r; dx<=r; dx++)
+      {
+        Coordinates point = {entry.point.x + dx, entry.point.y + dy};
+        const Pixelel* pixel;
+
+        if (clippedOrMaskedCorpus(point, corpusMap)) continue;
+        pixel = pixmap_index(corpusMap, point);
+        for (k=0; k<patchIndex->pixelelCount; k++)
+          sums[k] += pixel[FIRST_PIXELEL_INDEX + k];
+        count++;
+      }
+    // A corpus point is itself selected, so count is at least one
+    entry.key = patchIndexKey(sums, patchIndex->pixelelCount, count);
+    g_array_append_val(patchIndex->entries, entry);
+  }
+  g_array_sort(patchIndex->entries, comparePatchIndexEntries);
+}
+
+
+static void
+free_patch_index(TPatchIndex* patchIndex)
+{
+  g_array_free(patchIndex->entries, TRUE);
+}
+
+
+/*
+Window of entries [*start, *end) around the key, twice as wide as the count of candidates (less at the ends.)
+*/
+static inline void
+queryPatchIndex(
+  const TPatchIndex* patchIndex,
+  guint key,
+  guint* start,
+  guint* end
+  )
+{
+  const TPatchIndexEntry* entries = (const TPatchIndexEntry*) patchIndex->entries->data;
+  guint low = 0;
+  guint high = patchIndex->entries->len;
+
+  // Lower bound: first entry whose key is not less
+  while (low < high)
+  {
+    guint middle = low + (high - low) / 2;
+    if (entries[middle].key < key)
+      low = middle + 1;
+    else
+      high = middle;
+  }
+  *start = (low > patchIndex->candidates) ? low - patchIndex->candidates : 0;
+  *end = low + patchIndex->candidates;
+  if (*end > patchIndex->entries->len)
+    *end = patchIndex->entries->len;
+}
+
+
+static inline Coordinates
+patchIndexPoint(
+  const TPatchIndex* patchIndex,
+  guint index
+  )
+{
+  return g_array_index(patchIndex->entries, TPatchIndexEntry, index).point;
+}
+
+#endif /* __SYNTH_PATCH_INDEX_H__ */
@@ -0,0 +1,245 @@
+/*
+Vectorized kernels for the patch difference: the innermost loop, see computeBestFit() in synthesize.h.
+
+Compare neighbors of a patch against a candidate corpus point, several neighbors at once,
+using gathers from the corpus and from the lookup tables of the metric functions.
+(The earlier MMX attempt, resynth-vectorized.h, vectorized over pixelels of one pixel,
+of which there are only a few, and still did scalar lookups.)
+
+Kernels for wider instruction sets are compiled by function attribute, without extra compiler flags,
+and the kernel is chosen at run time by what the CPU supports.
+The result is the same as the scalar loop: same metric tables, same sums.
+Only the short circuit is coarser: tested after each group of neighbors instead of each neighbor,
+which can't change the result since the sum only grows.
+
+Only for the default, asymmetric metric tables (not SYMMETRIC_METRIC_TABLE.)
+Only for patches that fit the guard band of the corpus, see guardedCorpus.h: no clipping in vectors.
+Requires the pixmaps be padded after the last pixel, see new_pixmap().
+*/
+
+#ifndef __SYNTH_PATCH_KERNEL_H__
+#define __SYNTH_PATCH_KERNEL_H__
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) \
+  && !defined(SYMMETRIC_METRIC_TABLE) && !defined(VECTORIZED) && !defined(SYNTH_NO_PATCH_KERNELS)
+  #define SYNTH_PATCH_KERNELS
+  #include <immintrin.h>
+#endif
+
+/*
+Most probes are short circuited after a handful of neighbors, too few to fill a vector
+(and gathers are not cheap.)  So the first neighbors are compared by the scalar loop,
+and only the rest of a patch that survives them is vectorized.
+*/
+#define PATCH_SCALAR_PREFIX 8
+
+// Room for the largest patch plus a widest vector, since groups start at any index
+#define PATCH_VECTORS_LANES 16
+#define PATCH_VECTORS_MAX (IMAGE_SYNTH_MAX_NEIGHBORS + PATCH_VECTORS_LANES)
+
+struct PatchVectorsStruct;
+struct patchDescriptorsStruct;
+
+/*
+Continue the sum of weighted differences from neighbor startIndex, given the sum before it.
+Returns the sum, or early some sum not less than bestPatchDiff.
+corpusPixel is the candidate point in the guarded corpus: the patch must fit its band.
+*/
+typedef guint (*TPatchDiffKernel)(
+  const struct PatchVectorsStruct * patch,
+  const Pixelel * corpusPixel,
+  guint startIndex,
+  guint sum,
+  guint bestPatchDiff
+  );
+
+/*
+The patch (neighbors of one target point) as a structure of arrays, for vectors.
+Prepared once per target point, read for every probe of the corpus.
+*/
+typedef struct PatchVectorsStruct {
+  TPatchDiffKernel kernel;
+  guint count;
+  guint colorCount;   // count of color pixelels
+  guint mapCount;     // count of map pixelels
+  guint clippedWeight;  // weight of a neighbor clipped or masked in corpus
+  gboolean isHighWord;  // whether any compared pixelel is at bip 4 or more
+  const gushort * corpusTargetMetric;
+  const guint * mapsMetric;
+  const TGuardedCorpus * guardedCorpus;
+  TPixelelIndex colorBips[MAX_IMAGE_SYNTH_BPP];
+  TPixelelIndex mapBips[MAX_IMAGE_SYNTH_BPP];
+  gboolean isInBand;    // whether all neighbors fit the guard band of the corpus
+  // Cascade rejection, see patchDescriptor.h: descriptors of the corpus or NULL, and whether the patch has one
+  const struct patchDescriptorsStruct * descriptors;
+  gboolean hasDescriptor;
+  gint descriptor[MAX_IMAGE_SYNTH_BPP];
+  gint deltas[PATCH_VECTORS_MAX];  // offsets of neighbors as deltas of bytes, see guardedCorpus.h
+  // Target pixelels of each neighbor, offset by LIMIT_DOMAIN, ready to index a metric table
+  gint colorPixelels[MAX_IMAGE_SYNTH_BPP][PATCH_VECTORS_MAX];
+  gint mapPixelels[MAX_IMAGE_SYNTH_BPP][PATCH_VECTORS_MAX];
+} TPatchVectors;
+
+
+#ifdef SYNTH_PATCH_KERNELS
+
+// Sum of weighted differences of the group of eight neighbors starting at index i (not zero)
+__attribute__((target("avx2")))
+static inline guint
+patchDiffGroup8(
+  const TPatchVectors * patch,
+  const Pixelel * corpusPixel,
+  guint i
+  )
+{
+  const int * corpus = (const int *) corpusPixel;
+  // The short metric table is gathered as ints ending at an entry, so never reads past the table
+  const int * colorMetric = (const int *) (patch->corpusTargetMetric - 1);
+  const int * mapMetric = (const int *) patch->mapsMetric;
+  const __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+  const __m256i byteMask = _mm256_set1_epi32(0xFF);
+  // No clipping: neighbors outside the corpus are in the band, and masked
+  __m256i byteOffset = _mm256_loadu_si256((const __m256i *) &patch->deltas[i]);
+  __m256i isNeighbor = _mm256_cmpgt_epi32(_mm256_set1_epi32(patch->count - i), lane);
+  __m256i lowWord, highWord, isSelected, acc;
+  __m128i half;
+  TPixelelIndex k;
+
+  lowWord = _mm256_mask_i32gather_epi32(_mm256_setzero_si256(), corpus, byteOffset, isNeighbor, 1);
+  highWord = patch->isHighWord
+    ? _mm256_mask_i32gather_epi32(_mm256_setzero_si256(), corpus + 1, byteOffset, isNeighbor, 1)
+    : _mm256_setzero_si256();
+  isSelected = _mm256_and_si256(isNeighbor,
+    _mm256_cmpeq_epi32(_mm256_and_si256(lowWord, byteMask), _mm256_set1_epi32(MASK_TOTALLY_SELECTED)));
+
+  acc = _mm256_setzero_si256();
+  for (k=0; k<patch->colorCount; k++)
+  {
+    TPixelelIndex bip = patch->colorBips[k];
+    __m256i corpusPixelel = _mm256_and_si256(
+      _mm256_srlv_epi32(bip < 4 ? lowWord : highWord, _mm256_set1_epi32(8 * (bip & 3))), byteMask);
+    __m256i index = _mm256_sub_epi32(_mm256_loadu_si256((const __m256i *) &patch->colorPixelels[k][i]), corpusPixelel);
+    __m256i weight = _mm256_mask_i32gather_epi32(_mm256_setzero_si256(), colorMetric, index, isSelected, 2);
+    acc = _mm256_add_epi32(acc, _mm256_srli_epi32(weight, 16));
+  }
+  for (k=0; k<patch->mapCount; k++)
+  {
+    TPixelelIndex bip = patch->mapBips[k];
+    __m256i corpusPixelel = _mm256_and_si256(
+      _mm256_srlv_epi32(bip < 4 ? lowWord : highWord, _mm256_set1_epi32(8 * (bip & 3))), byteMask);
+    __m256i index = _mm256_sub_epi32(_mm256_loadu_si256((const __m256i *) &patch->mapPixelels[k][i]), corpusPixelel);
+    acc = _mm256_add_epi32(acc, _mm256_mask_i32gather_epi32(_mm256_setzero_si256(), mapMetric, index, isSelected, 4));
+  }
+  acc = _mm256_add_epi32(acc, _mm256_and_si256(_mm256_andnot_si256(isSelected, isNeighbor), _mm256_set1_epi32(patch->clippedWeight)));
+
+  half = _mm_add_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+  half = _mm_add_epi32(half, _mm_shuffle_epi32(half, _MM_SHUFFLE(1, 0, 3, 2)));
+  half = _mm_add_epi32(half, _mm_shuffle_epi32(half, _MM_SHUFFLE(2, 3, 0, 1)));
+  return (guint) _mm_cvtsi128_si32(half);
+}
+
+
+// Same for the group of sixteen neighbors starting at index i (not zero)
+__attribute__((target("avx512f")))
+static inline guint
+patchDiffGroup16(
+  const TPatchVectors * patch,
+  const Pixelel * corpusPixel,
+  guint i
+  )
+{
+  const int * corpus = (const int *) corpusPixel;
+  const int * colorMetric = (const int *) (patch->corpusTargetMetric - 1);
+  const int * mapMetric = (const int *) patch->mapsMetric;
+  const __m512i lane = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+  const __m512i byteMask = _mm512_set1_epi32(0xFF);
+  __m512i byteOffset = _mm512_loadu_si512(&patch->deltas[i]);
+  __mmask16 isNeighbor = _mm512_cmpgt_epi32_mask(_mm512_set1_epi32(patch->count - i), lane);
+  __m512i lowWord, highWord, acc;
+  __mmask16 isSelected;
+  TPixelelIndex k;
+
+  lowWord = _mm512_mask_i32gather_epi32(_mm512_setzero_si512(), isNeighbor, byteOffset, corpus, 1);
+  highWord = patch->isHighWord
+    ? _mm512_mask_i32gather_epi32(_mm512_setzero_si512(), isNeighbor, byteOffset, corpus + 1, 1)
+    : _mm512_setzero_si512();
+  isSelected = _mm512_mask_cmpeq_epi32_mask(isNeighbor,
+    _mm512_and_si512(lowWord, byteMask), _mm512_set1_epi32(MASK_TOTALLY_SELECTED));
+
+  acc = _mm512_setzero_si512();
+  for (k=0; k<patch->colorCount; k++)
+  {
+    TPixelelIndex bip = patch->colorBips[k];
+    __m512i corpusPixelel = _mm512_and_si512(
+      _mm512_srlv_epi32(bip < 4 ? lowWord : highWord, _mm512_set1_epi32(8 * (bip & 3))), byteMask);
+    __m512i index = _mm512_sub_epi32(_mm512_loadu_si512(&patch->colorPixelels[k][i]), corpusPixelel);
+    __m512i weight = _mm512_mask_i32gather_epi32(_mm512_setzero_si512(), isSelected, index, colorMetric, 2);
+    acc = _mm512_add_epi32(acc, _mm512_srli_epi32(weight, 16));
+  }
+  for (k=0; k<patch->mapCount; k++)
+  {
+    TPixelelIndex bip = patch->mapBips[k];
+    __m512i corpusPixelel = _mm512_and_si512(
+      _mm512_srlv_epi32(bip < 4 ? lowWord : highWord, _mm512_set1_epi32(8 * (bip & 3))), byteMask);
+    __m512i index = _mm512_sub_epi32(_mm512_loadu_si512(&patch->mapPixelels[k][i]), corpusPixelel);
+    acc = _mm512_add_epi32(acc, _mm512_mask_i32gather_epi32(_mm512_setzero_si512(), isSelected, index, mapMetric, 4));
+  }
+  acc = _mm512_mask_add_epi32(acc, isNeighbor & (__mmask16) ~isSelected, acc, _mm512_set1_epi32(patch->clippedWeight));
+
+  return (guint) _mm512_reduce_add_epi32(acc);
+}
+
+
+__attribute__((target("avx2")))
+static guint
+patchDiffAVX2(
+  const TPatchVectors * patch,
+  const Pixelel * corpusPixel,
+  guint i,
+  guint sum,
+  guint bestPatchDiff
+  )
+{
+  // !!! Short circuit, per group of neighbors
+  for (; i<patch->count && sum < bestPatchDiff; i+=8)
+    sum += patchDiffGroup8(patch, corpusPixel, i);
+  return sum;
+}
+
+
+__attribute__((target("avx512f")))
+static guint
+patchDiffAVX512(
+  const TPatchVectors * patch,
+  const Pixelel * corpusPixel,
+  guint i,
+  guint sum,
+  guint bestPatchDiff
+  )
+{
+  for (; i<patch->count && sum < bestPatchDiff; i+=16)
+    sum += patchDiffGroup16(patch, corpusPixel, i);
+  return sum;
+}
+
+#endif // SYNTH_PATCH_KERNELS
+
+
+/*
+Choose the widest kernel the CPU supports, or NULL for the scalar loop in computeBestFit().
+Cheap: call once per call of synthesize().
+*/
+static TPatchDiffKernel
+selectPatchDiffKernel(void)
+{
+#ifdef SYNTH_PATCH_KERNELS
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f"))
+    return patchDiffAVX512;
+  if (__builtin_cpu_supports("avx2"))
+    return patchDiffAVX2;
+#endif
+  return NULL;
+}
+
+#endif /* __SYNTH_PATCH_KERNEL_H__ */
@@ -0,0 +1,81 @@
+/*
+Conversion of pixelels between floats (in [0,1]) and bytes, for the float API.
+
+Done in runs of contiguous pixelels: a row of an image, or a part of one.
+Vectorized with SSE2 where available (all x86-64), else scalar, with the same results:
+float to byte clamps to [0,1] and truncates (NaN to zero), byte to float divides by 255.
+*/
+
+#ifndef __SYNTH_PIXELEL_CONVERT_H__
+#define __SYNTH_PIXELEL_CONVERT_H__
+
+#include <stddef.h>  // size_t
+
+#if defined(__SSE2__)
+  #include <emmintrin.h>
+#endif
+
+static inline unsigned char
+floatToPixelel(float value)
+{
+  // As fmin(255, fmax(0, value * 255)), written so that NaN is zero
+  float scaled = value * 255.0f;
+  if ( ! (scaled > 0.0f) ) return 0;
+  if (scaled > 255.0f) return 255;
+  return (unsigned char) scaled;
+}
+
+
+static inline void
+convertFloatsToPixelels(
+  const float * src,    // IN
+  unsigned char * dest, // OUT
+  size_t count
+  )
+{
+  size_t i = 0;
+#if defined(__SSE2__)
+  const __m128 zero = _mm_setzero_ps();
+  const __m128 scale = _mm_set1_ps(255.0f);
+  for (; i + 16 <= count; i += 16)
+  {
+    // max with zero first: the result is zero when the value is NaN
+    __m128i a = _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(src + i), scale), zero), scale));
+    __m128i b = _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(src + i + 4), scale), zero), scale));
+    __m128i c = _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(src + i + 8), scale), zero), scale));
+    __m128i d = _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(src + i + 12), scale), zero), scale));
+    _mm_storeu_si128((__m128i *) (dest + i), _mm_packus_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, d)));
+  }
+#endif
+  for (; i < count; i++)
+    dest[i] = floatToPixelel(src[i]);
+}
+
+
+static inline void
+convertPixelelsToFloats(
+  const unsigned char * src,  // IN
+  float * dest,               // OUT
+  size_t count
+  )
+{
+  size_t i = 0;
+#if defined(__SSE2__)
+  const __m128i zero = _mm_setzero_si128();
+  const __m128 scale = _mm_set1_ps(255.0f);
+  for (; i + 16 <= count; i += 16)
+  {
+    __m128i bytes = _mm_loadu_si128((const __m128i *) (src + i));
+    __m128i low = _mm_unpacklo_epi8(bytes, zero);
+    __m128i high = _mm_unpackhi_epi8(bytes, zero);
+    _mm_storeu_ps(dest + i, _mm_div_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(low, zero)), scale));
+    _mm_storeu_ps(dest + i + 4, _mm_div_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(low, zero)), scale));
+    _mm_storeu_ps(dest + i + 8, _mm_div_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(high, zero)), scale));
+    _mm_storeu_ps(dest + i + 12, _mm_div_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(high, zero)), scale));
+  }
+#endif
+  for (; i < count; i++)
+    dest[i] = (float) src[i] / 255.0f;
+}
+
+#endif /* __SYNTH_PIXELEL_CONVERT_H__ */
@@ -53,6 +53,7 @@ initializeProgressRecord(
 void
 deepProgressCallback(ProgressRecordT * progressRecord)
 {
+ if ( ! progressRecord->progressCallback ) return;  // Nobody listens: not even counted
  // !!! Note if estimatedPixelCountToCompletion is small
  // this calls back once for each pass with a percentComplete greater than 100.
  progressRecord->completedPixelCount += IMAGE_SYNTH_CALLBACK_COUNT;
@@ -93,33 +94,35 @@ initializeThreadedProgressRecord(
    
   This function has local variables that are threadsafe, 
   but progressRecord is in the parent thread and must be synchronized.
+
+  Counts are relaxed atomics: no ordering of anything else depends on them.
+  Reports are made by one thread at a time, under mutexProgress:
+  1) calls (in progressCallback()) to the caller, e.g. a GUI, may not be thread safe
+  2) priorReportedPercentComplete only grows, so reports are in order.
+  A thread that finds the mutex taken does not wait: the thread holding it is reporting,
+  and a later percent is reported by a later call.  So no thread blocks on progress.
   */
   void
   deepProgressCallbackThreaded(ProgressRecordT * progressRecord)
   {
     guint percentComplete;
     
-    // Thread-safe increment completedPixelCount
-    (void)__sync_add_and_fetch(&progressRecord->completedPixelCount, IMAGE_SYNTH_CALLBACK_COUNT);
+    if ( ! progressRecord->progressCallback ) return;  // Nobody listens: no shared counts touched
 
-    percentComplete = ((float)progressRecord->completedPixelCount/progressRecord->estimatedPixelCountToCompletion)*100;
-    if ( percentComplete > progressRecord->priorReportedPercentComplete )
+    percentComplete = ((float)__atomic_add_fetch(&progressRecord->completedPixelCount, IMAGE_SYNTH_CALLBACK_COUNT,
+        __ATOMIC_RELAXED) / progressRecord->estimatedPixelCountToCompletion)*100;
+    if ( percentComplete > __atomic_load_n(&progressRecord->priorReportedPercentComplete, __ATOMIC_RELAXED)
+        && g_mutex_trylock(progressRecord->mutexProgress) )
     {
-      // mutex lock for two reasons:
-      // 1) calls (in progressCallback()) to libgmp, gdk, gtk which are thread aware but not thread safe
-      // 2) thread-safe incrementing global variable priorReportedPercentComplete
-      // Note threads can still underreport percent complete but it is inconsequential.
-
-      // pass pointer to mutex
-      g_mutex_lock(progressRecord->mutexProgress);       
-      // Alternatively, use gdk_thread_enter()
-
-      // Forward deep progress callback to calling process
-      progressRecord->progressCallback(
-        (int) percentComplete, 
-        progressRecord->context);
-
-      progressRecord->priorReportedPercentComplete = percentComplete;
+      // Recheck: another thread may have reported it since
+      if ( percentComplete > progressRecord->priorReportedPercentComplete )
+      {
+        // Forward deep progress callback to calling process
+        progressRecord->progressCallback(
+          (int) percentComplete, 
+          progressRecord->context);
+        __atomic_store_n(&progressRecord->priorReportedPercentComplete, percentComplete, __ATOMIC_RELAXED);
+      }
       g_mutex_unlock(progressRecord->mutexProgress);
     }
   }
@@ -14,7 +14,7 @@ struct ProgressRecord {
   guint completedPixelCount;
   guint priorReportedPercentComplete;
 
-  void (*progressCallback)(int, void*);    // callback upstream to caller
+  void (*progressCallback)(int, void*);    // callback upstream to caller, or NULL for none
   void * context;                          // opaque data params to caller
 
 #ifdef SYNTH_THREADED
@@ -0,0 +1,134 @@
+/*
+Coarse to fine synthesis: an image pyramid.
+
+Synthesize a half size target from a half size corpus first (recursively),
+then seed the full size target with the sources found:
+each target pixel takes the corresponding pixel of its coarse parent's source, scaled up.
+The seeded target has values, so the first pass at full size is not the sparse shotgun over an empty target,
+and heuristic 1 (the sources of neighbors) mostly suffices: few random probes are needed at finer levels.
+
+Downsampling is by averaging 2x2 pixels, except the masks:
+a coarse pixel is in the target if any of its fine pixels are,
+and in the corpus only if all its fine pixels are (so a coarse source is never outside the fine corpus.)
+*/
+
+#ifndef __SYNTH_PYRAMID_H__
+#define __SYNTH_PYRAMID_H__
+
+// Don't make levels smaller than this, in pixels, in either dimension, of the target or corpus
+#define PYRAMID_MIN_SIZE 32
+
+// Random probes at finer levels, as a fraction of maxProbeCount (at least one.)
+#define PYRAMID_PROBE_DIVISOR 8
+
+// With a deadline, the coarser levels get this fraction of the time left (a level has a quarter of the targets.)
+#define PYRAMID_DEADLINE_SHARE 0.25
+
+
+static gboolean
+isPyramidLevelTooSmall(
+  Map* targetMap,
+  Map* corpusMap
+  )
+{
+  return targetMap->width / 2 < PYRAMID_MIN_SIZE
+    || targetMap->height / 2 < PYRAMID_MIN_SIZE
+    || corpusMap->width / 2 < PYRAMID_MIN_SIZE
+    || corpusMap->height / 2 < PYRAMID_MIN_SIZE;
+}
+
+
+/*
+Downsample a pixmap by half, rounding dimensions up.
+The mask pixelel: any selected (isTarget) or all totally selected (not isTarget, for a corpus.)
+Other pixelels: the mean.
+*/
+static void
+downsamplePixmap(
+  Map* fineMap,      // IN
+  Map* coarseMap,    // OUT
+  gboolean isTarget  // IN
+  )
+{
+  guint x, y;
+  TPixelelIndex k;
+
+  new_pixmap(coarseMap, (fineMap->width + 1) / 2, (fineMap->height + 1) / 2, fineMap->depth);
+  for(y=0; y<coarseMap->height; y++)
+    for(x=0; x<coarseMap->width; x++)
+    {
+      // Fine pixels of a coarse pixel, clamped at odd edges
+      guint x1 = (2*x+1 < fineMap->width) ? 2*x+1 : 2*x;
+      guint y1 = (2*y+1 < fineMap->height) ? 2*y+1 : 2*y;
+      Pixelel* fine[4];
+      Pixelel* coarse = pixmap_index(coarseMap, (Coordinates) {x, y});
+
+      fine[0] = pixmap_index(fineMap, (Coordinates) {2*x, 2*y});
+      fine[1] = pixmap_index(fineMap, (Coordinates) {x1, 2*y});
+      fine[2] = pixmap_index(fineMap, (Coordinates) {2*x, y1});
+      fine[3] = pixmap_index(fineMap, (Coordinates) {x1, y1});
+
+      if (isTarget)
+        coarse[MASK_PIXELEL_INDEX] =
+          (fine[0][MASK_PIXELEL_INDEX] | fine[1][MASK_PIXELEL_INDEX]
+          | fine[2][MASK_PIXELEL_INDEX] | fine[3][MASK_PIXELEL_INDEX]) ? MASK_TOTALLY_SELECTED : MASK_UNSELECTED;
+      else
+        coarse[MASK_PIXELEL_INDEX] =
+          (fine[0][MASK_PIXELEL_INDEX] == MASK_TOTALLY_SELECTED && fine[1][MASK_PIXELEL_INDEX] == MASK_TOTALLY_SELECTED
+          && fine[2][MASK_PIXELEL_INDEX] == MASK_TOTALLY_SELECTED && fine[3][MASK_PIXELEL_INDEX] == MASK_TOTALLY_SELECTED)
+          ? MASK_TOTALLY_SELECTED : MASK_UNSELECTED;
+
+      for(k=MASK_PIXELEL_INDEX+1; k<fineMap->depth; k++)
+        coarse[k] = (Pixelel) ((fine[0][k] + fine[1][k] + fine[2][k] + fine[3][k] + 2) / 4);
+    }
+}
+
+
+/*
+Seed target points from the sources of a coarse level.
+A seeded target point has a source, its color, and a value.
+Target points whose scaled up source is not in the corpus stay unseeded.
+*/
+static void
+seedFromCoarseLevel(
+  TFormatIndices* indices,
+  Map* targetMap,         // IN/OUT
+  Map* corpusMap,         // IN
+  Map* coarseSourceOfMap, // IN
+  guint coarseCorpusWidth, // Of the corpus of coarseSourceOfMap
+  pointVector targetPoints,
+  Map* hasValueMap,       // IN/OUT
+  Map* sourceOfMap        // IN/OUT
+  )
+{
+  guint i;
+
+  for(i=0; i<targetPoints->len; i++)
+  {
+    Coordinates position = g_array_index(targetPoints, Coordinates, i);
+    Coordinates coarsePosition = {position.x / 2, position.y / 2};
+    Coordinates coarseSource;
+    Coordinates source;
+
+    if ((guint) coarsePosition.x >= coarseSourceOfMap->width || (guint) coarsePosition.y >= coarseSourceOfMap->height)
+      continue;
+    coarseSource = getSourceOf(coarsePosition, coarseSourceOfMap, coarseCorpusWidth);
+    if (coarseSource.x == -1) continue;
+
+    // Same place within the parent pixel, else the first
+    source.x = 2*coarseSource.x + (position.x & 1);
+    source.y = 2*coarseSource.y + (position.y & 1);
+    if (clippedOrMaskedCorpus(source, corpusMap))
+    {
+      source.x = 2*coarseSource.x;
+      source.y = 2*coarseSource.y;
+      if (clippedOrMaskedCorpus(source, corpusMap)) continue;
+    }
+
+    setSourceOf(position, source, sourceOfMap, corpusMap->width);
+    setColor(indices, targetMap, position, corpusMap, source);
+    setHasValue(&position, TRUE, hasValueMap);
+  }
+}
+
+#endif /* __SYNTH_PYRAMID_H__ */
@@ -45,8 +45,11 @@ refiner(
   TFormatIndices* indices,
   Map* targetMap,
   Map* corpusMap,
+  TGuardedCorpus* guardedCorpus,
+  TPatchIndex* patchIndex,
   Map* recentProberMap,
   Map* hasValueMap,
+  TValuedGrid* valuedGrid,
   Map* sourceOfMap,
   pointVector targetPoints,
   pointVector corpusPoints,
@@ -63,6 +66,19 @@ refiner(
   TRepetionParameters repetition_params;
   
   ProgressRecordT progressRecord;
+  double runDeadline = parameters.deadline;  // parameters.deadline becomes that of each pass
+  guint probeCount = parameters.maxProbeCount;  // cut nearing it, see synthesize()
+
+  // Optionally deterministic, see deterministicBatch.h: seeded as by refinerThreaded.h, for the same result
+  TDeterministicBatch batch;
+  gboolean isDeterministic = parameters.isDeterministic;
+  if (isDeterministic)
+    prepareDeterministicBatch(&batch, g_rand_int(prng), targetPoints->len);
+  // Random probes of batches on a GPU, if asked for and present, see deviceBatch.h
+  TDeviceBatch deviceBatch = {0};  // Zeroed: not prepared unless isDevice
+  gboolean isDevice = isDeterministic && parameters.isDeviceMatching && ! patchIndex
+    && newDeviceBatch(&deviceBatch, &parameters, pixelelLayoutOf(indices), corpusMap,
+      corpusTargetMetric, mapsMetric, &batch);
 
   prepare_repetition_parameters(repetition_params, targetPoints->len);
 
@@ -76,17 +92,54 @@ refiner(
   { 
     guint endTargetIndex = repetition_params[pass][1];
     gulong betters = 0; // gulong so can be cast to void *
+    guint startTargetIndex = 0; // Unthreaded synthesis startTargetIndex is 0, unless deterministic
+    TPassMetrics passMetrics = {0};
+    double passStart = metricsSeconds();
+
+    // With a deadline: past it, no passes after the first, else this pass gets its share of the time left
+    if (runDeadline)
+    {
+      double now = metricsSeconds();
+      if (pass > 0 && now >= runDeadline)
+      {
+        recordScheduledPasses(parameters.metrics, repetition_params, pass, MAX_PASSES, parameters.maxProbeCount);
+        break;
+      }
+      parameters.deadline = passDeadline(repetition_params, pass, now, runDeadline);
+    }
+    recordScheduledPasses(parameters.metrics, repetition_params, pass, pass + 1, parameters.maxProbeCount);
     
-    betters = synthesize(
+    // The whole prefix at once, unless deterministic: then batch by batch
+    do
+    {
+    guint batchEndIndex = endTargetIndex;
+    
+    if (isDeterministic)
+    {
+      batch.pass = pass;
+      beginDeterministicBatch(&batch, startTargetIndex, endTargetIndex);
+      batchEndIndex = batch.end;
+      if (isDevice)
+        matchBatchOnDevice(&deviceBatch, &batch, &parameters, pixelelLayoutOf(indices),
+          targetMap, corpusMap, hasValueMap, valuedGrid, sourceOfMap, targetPoints, corpusPoints, sortedOffsets,
+          probeCount, &passMetrics);
+    }
+    betters += synthesize(
         &parameters,
         0,      // Unthreaded synthesis is threadIndex 0
-        0,      // Unthreaded synthesis startTargetIndex is 0
-        endTargetIndex,
+        1,      // of one thread
+        startTargetIndex,
+        batchEndIndex,
+        NULL,   // Unthreaded synthesis is not scheduled in tiles
         indices,
         targetMap,
         corpusMap,
+        guardedCorpus,
+        patchIndex,
+        isDeterministic ? &batch : NULL,
         recentProberMap,
         hasValueMap,
+        valuedGrid,
         sourceOfMap,
         targetPoints,
         corpusPoints,
@@ -96,8 +149,18 @@ refiner(
         mapsMetric,
         deepProgressCallback,
 	&progressRecord,	// parameters to progress callback.  progressRecord is on stack.
-        cancelFlag
+        cancelFlag,
+        &probeCount,
+        &passMetrics
         );
+    if (isDeterministic)
+      commitDeterministicBatch(&batch, indices, targetMap, corpusMap, hasValueMap, valuedGrid, sourceOfMap, targetPoints);
+    startTargetIndex = batchEndIndex;
+    }
+    while (startTargetIndex < endTargetIndex && ! *cancelFlag);
+
+    passMetrics.seconds = metricsSeconds() - passStart;
+    recordPassMetrics(parameters.metrics, pass, &passMetrics);
 
     // nil unless DEBUG
     print_pass_stats(pass, repetition_params[pass][1], betters);
@@ -107,16 +170,28 @@ refiner(
     This is a fraction of total target points, 
     not the possibly smaller count of target attempts this pass.
     Or break on small integral change: if ( targetPoints_size / integralColorChange < 10 ) {
+    A pass cut short by its deadline skipped targets, its few betters are not convergence:
+    the next pass gets the time left, if any.
     */
-    if ( (float) betters / targetPoints->len < (IMAGE_SYNTH_TERMINATE_FRACTION) ) 
+    if ( ! (runDeadline && passMetrics.targets < endTargetIndex && ! *cancelFlag)
+        && (float) betters / targetPoints->len < (IMAGE_SYNTH_TERMINATE_FRACTION) ) 
     {
       // printf("Quitting early after %d passes. Betters %ld\n", pass+1, betters);
       break;
     }
     
+    // A preview of the complete target, as later passes refine it.  Not after the last: then it is the result
+    if (parameters.passCallback && pass + 1 < MAX_PASSES && ! *cancelFlag)
+      parameters.passCallback(pass, parameters.passContext);
+    
     // Simple progress: percent of passes complete.
     // This is not ideal, a maximum of MAX_PASSES callbacks, typically six.
     // And the later passes are much shorter than earlier passes.
     // progressCallback( (int) ((pass+1.0)/(MAX_PASSES+1)*100), contextInfo);
   } // end pass
+  
+  if (isDevice)
+    free_device_batch(&deviceBatch);
+  if (isDeterministic)
+    free_deterministic_batch(&batch);
 }
@@ -36,6 +36,8 @@ Threaded version, using alternative 1.
 
 Alternative 1:
 Each pass divides targetPoints among threads and rejoins before the next pass.
+The threads are workers of a persistent pool (see workerPool.h), not started anew each pass.
+Between passes, workers sleep in the pool; rejoining is completion of the pass batch.
 Here, one thread may be reading pixels that another thread is synthesizing,
 but no two threads are synthesizing the same pixel.
 
@@ -54,29 +56,41 @@ Sept. 2011.  One experiment shows it is no faster, and produces different, grain
   #include <pthread.h>
 #endif
 
+#include <stdlib.h>   // calloc
+#include "workerPool.h"
+
 
 // When synthesize() is threaded, it needs a single argument.
 // Wrapper struct for single arg to synthesize
 typedef struct synthArgsStruct {
   TImageSynthParameters *parameters;  // IN
   guint threadIndex;
+  guint threadCount;
   guint startTargetIndex;
   guint endTargetIndex;  // IN // array pointers
+  TTileSchedule* tileSchedule;  // IN NULL if interleaved
   TFormatIndices* indices;  // IN
   Map * targetMap;      // IN/OUT
   Map* corpusMap;       // IN
+  TGuardedCorpus* guardedCorpus; // IN
+  TPatchIndex* patchIndex; // IN
+  TDeterministicBatch* batch; // IN/OUT NULL unless deterministic
   Map* recentProberMap; // IN/OUT
   Map* hasValueMap;     // IN/OUT
+  TValuedGrid* valuedGrid; // IN/OUT
   Map* sourceOfMap;     // IN/OUT
   pointVector targetPoints; // IN
   pointVector corpusPoints; // IN
   pointVector sortedOffsets; // IN
-  GRand *prng;
+  GRand *prng;  // owned by this thread, no other thread uses it
   gushort * corpusTargetMetric;   // array pointers TPixelelMetricFunc
   guint * mapsMetric;             // TMapPixelelMetricFunc
   void (*deepProgressCallback)();         // void func(void)
   ProgressRecordT *progressRecord;
   int* cancelFlag;  // flag set when canceled
+  guint probeCount; // IN/OUT random probes per target, this thread's, cut nearing a deadline
+  gulong betters;   // OUT count of target points bettered this pass
+  TPassMetrics metrics; // OUT added to, this thread's, merged after each pass
 } SynthArgs;
 
 
@@ -88,13 +102,19 @@ newSynthesisArgs(
   SynthArgs* args,
   TImageSynthParameters *parameters,  // IN
   guint threadIndex,
+  guint threadCount,
   guint startTargetIndex,
   guint endTargetIndex,  // IN
+  TTileSchedule* tileSchedule,  // IN
   TFormatIndices* indices,  // IN
   Map * targetMap,      // IN/OUT
   Map* corpusMap,       // IN
+  TGuardedCorpus* guardedCorpus, // IN
+  TPatchIndex* patchIndex, // IN
+  TDeterministicBatch* batch, // IN/OUT
   Map* recentProberMap, // IN/OUT
   Map* hasValueMap,     // IN/OUT
+  TValuedGrid* valuedGrid, // IN/OUT
   Map* sourceOfMap,     // IN/OUT
   pointVector targetPoints, // IN
   pointVector corpusPoints, // IN
@@ -109,13 +129,19 @@ newSynthesisArgs(
 {
   args->parameters = parameters;
   args->threadIndex = threadIndex;
+  args->threadCount = threadCount;
   args->startTargetIndex = startTargetIndex; 
   args->endTargetIndex = endTargetIndex; 
+  args->tileSchedule = tileSchedule;
   args->indices = indices; 
   args->targetMap = targetMap; 
   args->corpusMap = corpusMap;      
+  args->guardedCorpus = guardedCorpus;
+  args->patchIndex = patchIndex;
+  args->batch = batch;
   args->recentProberMap = recentProberMap;
   args->hasValueMap = hasValueMap;
+  args->valuedGrid = valuedGrid;
   args->sourceOfMap = sourceOfMap;
   args->targetPoints = targetPoints;
   args->corpusPoints = corpusPoints;
@@ -126,6 +152,9 @@ newSynthesisArgs(
   args->deepProgressCallback = deepProgressCallback;
   args->progressRecord = progressRecord;
   args->cancelFlag = cancelFlag;
+  args->probeCount = parameters->maxProbeCount;
+  args->betters = 0;
+  memset(&args->metrics, 0, sizeof(TPassMetrics));
 }
 
 
@@ -138,13 +167,19 @@ synthesisThread(void * uncastArgs)
   // Unpack wrapped args
   TImageSynthParameters * parameters  = args->parameters;
   guint threadIndex                   = args->threadIndex;
+  guint threadCount                   = args->threadCount;
   guint startTargetIndex              = args->startTargetIndex;
   guint endTargetIndex                = args->endTargetIndex;
+  TTileSchedule* tileSchedule         = args->tileSchedule;
   TFormatIndices* indices             = args->indices; 
   Map * targetMap                     = args->targetMap; 
   Map* corpusMap                      = args->corpusMap;      
+  TGuardedCorpus* guardedCorpus       = args->guardedCorpus;
+  TPatchIndex* patchIndex             = args->patchIndex;
+  TDeterministicBatch* batch          = args->batch;
   Map* recentProberMap                = args->recentProberMap;
   Map* hasValueMap                    = args->hasValueMap;
+  TValuedGrid* valuedGrid             = args->valuedGrid;
   Map* sourceOfMap                    = args->sourceOfMap;
   pointVector targetPoints            = args->targetPoints;      
   pointVector corpusPoints            = args->corpusPoints;
@@ -160,13 +195,19 @@ synthesisThread(void * uncastArgs)
   gulong betters = synthesize(  // gulong so can be cast to void *
       parameters,
       threadIndex,
+      threadCount,
       startTargetIndex,
       endTargetIndex,
+      tileSchedule,
       indices,
       targetMap,
       corpusMap,
+      guardedCorpus,
+      patchIndex,
+      batch,
       recentProberMap,
       hasValueMap,
+      valuedGrid,
       sourceOfMap,
       targetPoints,
       corpusPoints,
@@ -176,11 +217,23 @@ synthesisThread(void * uncastArgs)
       mapsMetric,
       deepProgressCallback,
       progressRecord,	// parameters to progress callback.  progressRecord is in stack frame of refinerThreaded().
-      cancelFlag
+      cancelFlag,
+      &args->probeCount,
+      &args->metrics
       );
   return (void*) betters;
 }
 
+// Task run by a worker of the pool: one thread's share of one pass
+static void
+synthesisTask(void * uncastArgs)
+{
+  SynthArgs* args = (SynthArgs *) uncastArgs;
+  args->betters = (gulong) synthesisThread(uncastArgs);
+}
+
+#ifdef SYNTH_THREADED2
+
 static void
 startThread(
   SynthArgs* args,
@@ -196,8 +249,11 @@ startThread(
   TFormatIndices* indices,
   Map* targetMap,
   Map* corpusMap,
+  TGuardedCorpus* guardedCorpus,
+  TPatchIndex* patchIndex,
   Map* recentProberMap,
   Map* hasValueMap,
+  TValuedGrid* valuedGrid,
   Map* sourceOfMap,
   pointVector targetPoints,
   pointVector corpusPoints,
@@ -214,13 +270,19 @@ startThread(
     args,
     parameters,
     threadIndex, // thread specific
+    1,          // Alternative 2 does not split modulo: each thread works on a whole prefix
     start,      // thread specific
     end,        // thread specific
+    NULL,       // interleaved
     indices,
     targetMap,
     corpusMap,
+    guardedCorpus,
+    patchIndex,
+    NULL,       // Alternative 2 is not deterministic
     recentProberMap,
     hasValueMap,
+    valuedGrid,
     sourceOfMap,
     targetPoints,
     corpusPoints,
@@ -249,6 +311,7 @@ startThread(
     pthread_create(thread, NULL, synthesisThread, (void * __restrict__) args);
 #endif
 }
+#endif /* SYNTH_THREADED2 */
 
 
 
@@ -262,8 +325,11 @@ refiner(
   TFormatIndices* indices,
   Map* targetMap,
   Map* corpusMap,
+  TGuardedCorpus* guardedCorpus,
+  TPatchIndex* patchIndex,
   Map* recentProberMap,
   Map* hasValueMap,
+  TValuedGrid* valuedGrid,
   Map* sourceOfMap,
   pointVector targetPoints,
   pointVector corpusPoints,
@@ -282,27 +348,49 @@ refiner(
   // Threaded: use atomic add and mutexProgress when updating progress
   // !!! This is owned by parent, updated by child threads executing callback function deepProgressCallback.
   ProgressRecordT progressRecord;
+  double runDeadline = parameters.deadline;  // parameters.deadline becomes that of each pass, threads read it
   
 
-  // Synthesize in threads.  Note proxies in glibProxy.h for POSIX threads
-#ifdef SYNTH_USE_GLIB_THREADS
-  GThread* threads[THREAD_LIMIT];
-#else
-  pthread_t threads[THREAD_LIMIT];
-#endif
-  // If not using glib proxied to pthread by glibProxy.h
-  g_mutex_init(&mutex);  // defined in synthesize.h
+  // Synthesize in workers of the pool.  Note proxies in glibProxy.h for POSIX threads
+  TWorkerPool* pool = defaultWorkerPool();
 
   
+  // Of this call, not static: refiners of concurrent runs must not share it
 #ifdef SYNTH_USE_GLIB_THREADS
-  static GMutex mutexProgress;
+  GMutex mutexProgress;
 #else
   pthread_mutex_t mutexProgress;
 #endif
   g_mutex_init(&mutexProgress);
 
 
-  SynthArgs synthArgs[THREAD_LIMIT];
+  // Count of threads is chosen at run time
+  guint threadCount = parameters.threadCount ? parameters.threadCount : detectProcessorCount();
+  if (threadCount > SYNTH_MAX_THREADS)
+    threadCount = SYNTH_MAX_THREADS;
+  SynthArgs* synthArgs = workspaceCalloc(threadCount, sizeof(SynthArgs));
+  guint threadIndex;
+
+  // Optionally deterministic, see deterministicBatch.h.
+  // Seeded before the generators of threads, whose count must not matter
+  TDeterministicBatch batch;
+  gboolean isDeterministic = parameters.isDeterministic;
+  if (isDeterministic)
+    prepareDeterministicBatch(&batch, g_rand_int(prng), targetPoints->len);
+  // Random probes of batches on a GPU, if asked for and present, see deviceBatch.h
+  TDeviceBatch deviceBatch = {0};  // Zeroed: not prepared unless isDevice
+  gboolean isDevice = isDeterministic && parameters.isDeviceMatching && ! patchIndex
+    && newDeviceBatch(&deviceBatch, &parameters, pixelelLayoutOf(indices), corpusMap,
+      corpusTargetMetric, mapsMetric, &batch);
+
+  // Optionally schedule threads over tiles of the target rather than interleaved
+  TTileSchedule tileSchedule;
+  gboolean isTiled = parameters.scheduleTileSize > 0 && threadCount > 1 && ! isDeterministic;
+  if (isTiled)
+    prepareTileSchedule(&tileSchedule, targetPoints, targetMap, parameters.scheduleTileSize, threadCount);
+
+  // The thread running batches is one of the threads
+  ensureWorkerPoolThreads(pool, threadCount - 1);
 
   prepare_repetition_parameters(repetition_params, targetPoints->len);
 
@@ -313,50 +401,102 @@ refiner(
     contextInfo,
     &mutexProgress);
 
-  // Assert threading system is init at startup time, after glib 2.32
+  /*
+  Pack args once for all passes.
+  Only the end of the prefix of targetPoints changes from pass to pass.
+  */
+  for (threadIndex=0; threadIndex<threadCount; threadIndex++)
+    newSynthesisArgs(
+      &synthArgs[threadIndex],
+      &parameters,
+      threadIndex,  // thread specific
+      threadCount,
+      0, 0,         // Every thread works on a prefix of targetPoints, splits it modulo threadIndex or by tiles
+      isTiled ? &tileSchedule : NULL,
+      indices,
+      targetMap,
+      corpusMap,
+      guardedCorpus,
+      patchIndex,
+      isDeterministic ? &batch : NULL,
+      recentProberMap,
+      hasValueMap,
+      valuedGrid,
+      sourceOfMap,
+      targetPoints,
+      corpusPoints,
+      sortedOffsets,
+      // Each thread has its own generator, seeded from the run's. No lock, and repeatable for a seed.
+      g_rand_new_with_seed(g_rand_int(prng)),
+      corpusTargetMetric, mapsMetric,
+      deepProgressCallback,
+      &progressRecord,
+      cancelFlag
+      );
   
   for (pass=0; pass<MAX_PASSES; pass++)
   { 
     guint endTargetIndex = repetition_params[pass][1];
     gulong betters = 0;
+    guint startTargetIndex = 0;
+    TPassMetrics passMetrics = {0};
+    double passStart = metricsSeconds();
 
-    guint threadIndex;
-    for (threadIndex=0; threadIndex<THREAD_LIMIT; threadIndex++)
+    // With a deadline: past it, no passes after the first, else this pass gets its share of the time left
+    if (runDeadline)
     {
-      startThread(
-        &synthArgs[threadIndex], &threads[threadIndex], threadIndex, // thread specific
-        0, endTargetIndex,      // Every thread works on a prefix of targetPoints, splits it modulo threadIndex
-        &parameters,
-        indices,
-        targetMap,
-        corpusMap,
-        recentProberMap,
-        hasValueMap,
-        sourceOfMap,
-        targetPoints,
-        corpusPoints,
-        sortedOffsets,
-        prng,
-        corpusTargetMetric, mapsMetric,
-        deepProgressCallback,
-        &progressRecord,
-        cancelFlag
-        );
-   }
-
-   // Wait for threads to complete; rejoin them
-   for (threadIndex=0; threadIndex<THREAD_LIMIT; threadIndex++)
-   {
-     gulong temp;
+      double now = metricsSeconds();
+      if (pass > 0 && now >= runDeadline)
+      {
+        recordScheduledPasses(parameters.metrics, repetition_params, pass, MAX_PASSES, parameters.maxProbeCount);
+        break;
+      }
+      parameters.deadline = passDeadline(repetition_params, pass, now, runDeadline);
+    }
+    recordScheduledPasses(parameters.metrics, repetition_params, pass, pass + 1, parameters.maxProbeCount);
 
-#ifdef SYNTH_USE_GLIB_THREADS
-     temp = (gulong) g_thread_join(threads[threadIndex]);       // cast return value from gpointer to gulong
-#else
-     pthread_join(threads[threadIndex], (void**)&temp);
-#endif
-     betters += temp;
-   }
+    if (isTiled)
+      prepareTileSchedulePass(&tileSchedule, endTargetIndex);
 
+    // The whole prefix at once, unless deterministic: then batch by batch
+    do
+    {
+      guint batchEndIndex = endTargetIndex;
+
+      if (isDeterministic)
+      {
+        batch.pass = pass;
+        beginDeterministicBatch(&batch, startTargetIndex, endTargetIndex);
+        batchEndIndex = batch.end;
+        if (isDevice)
+          matchBatchOnDevice(&deviceBatch, &batch, &parameters, pixelelLayoutOf(indices),
+            targetMap, corpusMap, hasValueMap, valuedGrid, sourceOfMap, targetPoints, corpusPoints, sortedOffsets,
+            synthArgs[0].probeCount, &passMetrics);
+      }
+      for (threadIndex=0; threadIndex<threadCount; threadIndex++)
+      {
+        synthArgs[threadIndex].startTargetIndex = startTargetIndex;
+        synthArgs[threadIndex].endTargetIndex = batchEndIndex;
+      }
+
+      // Returns when every thread's share of the pass (or batch) is done
+      runWorkerPoolBatch(pool, synthesisTask, synthArgs, sizeof(SynthArgs), threadCount);
+
+      for (threadIndex=0; threadIndex<threadCount; threadIndex++)
+        betters += synthArgs[threadIndex].betters;
+      if (isDeterministic)
+        commitDeterministicBatch(&batch, indices, targetMap, corpusMap, hasValueMap, valuedGrid, sourceOfMap, targetPoints);
+      startTargetIndex = batchEndIndex;
+    }
+    while (startTargetIndex < endTargetIndex && ! *cancelFlag);
+
+    for (threadIndex=0; threadIndex<threadCount; threadIndex++)
+    {
+      addPassMetrics(&passMetrics, &synthArgs[threadIndex].metrics);
+      memset(&synthArgs[threadIndex].metrics, 0, sizeof(TPassMetrics));
+    }
+    passMetrics.seconds = metricsSeconds() - passStart;
+    recordPassMetrics(parameters.metrics, pass, &passMetrics);
     
     // nil unless DEBUG
     print_pass_stats(pass, repetition_params[pass][1], betters);
@@ -366,18 +506,36 @@ refiner(
     This is a fraction of total target points, 
     not the possibly smaller count of target attempts this pass.
     Or break on small integral change: if ( targetPoints_size / integralColorChange < 10 ) {
+    A pass cut short by its deadline skipped targets, its few betters are not convergence:
+    the next pass gets the time left, if any.
     */
-    if ( (float) betters / targetPoints->len < (IMAGE_SYNTH_TERMINATE_FRACTION) ) 
+    if ( ! (runDeadline && passMetrics.targets < endTargetIndex && ! *cancelFlag)
+        && (float) betters / targetPoints->len < (IMAGE_SYNTH_TERMINATE_FRACTION) ) 
     {
       // printf("Quitting early after %d passes. Betters %ld\n", pass+1, betters);
       break;
     }
     
+    // A preview of the complete target, as later passes refine it.  Not after the last: then it is the result
+    if (parameters.passCallback && pass + 1 < MAX_PASSES && ! *cancelFlag)
+      parameters.passCallback(pass, parameters.passContext);
+    
     // Simple progress: percent of passes complete.
     // This is not ideal, a maximum of MAX_PASSES callbacks, typically six.
     // And the later passes are much shorter than earlier passes.
     // progressCallback( (int) ((pass+1.0)/(MAX_PASSES+1)*100), contextInfo);
   }
+
+  if (isTiled)
+    free_tile_schedule(&tileSchedule);
+  if (isDevice)
+    free_device_batch(&deviceBatch);
+  if (isDeterministic)
+    free_deterministic_batch(&batch);
+  for (threadIndex=0; threadIndex<threadCount; threadIndex++)
+    g_rand_free(synthArgs[threadIndex].prng);
+  workspaceFree(synthArgs);
+  g_mutex_clear(&mutexProgress);
 }
 
 
@@ -398,8 +556,11 @@ refiner(
   TFormatIndices* indices,
   Map* targetMap,
   Map* corpusMap,
+  TGuardedCorpus* guardedCorpus,
+  TPatchIndex* patchIndex,
   Map* recentProberMap,
   Map* hasValueMap,
+  TValuedGrid* valuedGrid,
   Map* sourceOfMap,
   pointVector targetPoints,
   pointVector corpusPoints,
@@ -417,17 +578,16 @@ refiner(
 
   // Synthesize in threads.  Note proxies in glibProxy.h for POSIX threads
 #ifdef SYNTH_USE_GLIB_THREADS
-  GThread* threads[THREAD_LIMIT];
+  GThread* threads[MAX_PASSES];
 #else
-  pthread_t threads[THREAD_LIMIT];
+  pthread_t threads[MAX_PASSES];
 #endif
   // If not using glib proxied to pthread by glibProxy.h
   GMutex mutexProgress;
-  g_mutex_init(&mutex);  // defined in synthesize.h
   g_mutex_init(&mutexProgress);
 
 
-  SynthArgs synthArgs[THREAD_LIMIT];
+  SynthArgs synthArgs[MAX_PASSES];
 
 
   // For progress
@@ -461,7 +621,6 @@ refiner(
   estimatedPixelCountToCompletion = estimatePixelsToSynth(repetition_params);
 
   // Start one thread for what were formerly passes
-  g_assert(THREAD_LIMIT > MAX_PASSES);
 
   gulong betters = 0;
   guint threadIndex;
@@ -475,8 +634,11 @@ refiner(
       indices,
       targetMap,
       corpusMap,
+      guardedCorpus,
+      patchIndex,
       recentProberMap,
       hasValueMap,
+      valuedGrid,
       sourceOfMap,
       targetPoints,
       corpusPoints,
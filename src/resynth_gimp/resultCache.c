@@ -0,0 +1,449 @@
+/*
+Cache of results.  See resultCache.h.
+
+In memory: a list, most recently used first.  Lookup is linear: a cache holds results of whole images,
+few enough that comparing keys costs nothing beside one synthesis.
+
+On disk: a file per result, named by the key in hex, a header then the pixels.
+Written to a temporary file then renamed, so readers (of this or other processes) never see part of one.
+*/
+
+// Compiling switch #defines
+#include "buildSwitches.h"
+
+#ifdef SYNTH_USE_GLIB
+  #include "../config.h" // GNU buildtools local configuration
+  #include <glib.h>
+#else
+  #include "glibProxy.h"
+#endif
+
+#include <stdlib.h>   // calloc
+#include <string.h>   // memcpy, memcmp
+#include <stdio.h>    // snprintf, rename
+#include <fcntl.h>    // open
+#include <unistd.h>   // close, write, unlink
+#include <sys/mman.h> // mmap
+#include <sys/stat.h> // fstat
+#ifdef SYNTH_THREADED
+  #include <pthread.h>
+#endif
+
+#include "engineParams.h"
+#include "resultCache.h"
+
+#define RESULT_KEY_VERSION 1
+#define RESULT_FILE_MAGIC "RSYNTHR1"
+
+typedef struct ResultEntryStruct {
+  TResultKey key;
+  unsigned char* pixels;
+  size_t size;
+  struct ResultEntryStruct* previous;
+  struct ResultEntryStruct* next;
+} TResultEntry;
+
+// Header of a file of a result, followed by size bytes of pixels
+typedef struct ResultFileHeaderStruct {
+  char magic[8];
+  TResultKey key;
+  unsigned long long size;
+} TResultFileHeader;
+
+struct ResultCacheStruct {
+#ifdef SYNTH_THREADED
+  pthread_mutex_t mutex;  // guards all fields
+#endif
+  size_t maxBytes;
+  char* directory;
+  TResultEntry* head;     // most recently used
+  TResultEntry* tail;     // least recently used
+  TResultCacheStats stats;
+};
+
+#ifdef SYNTH_THREADED
+  #define LOCK_CACHE(cache) pthread_mutex_lock(&(cache)->mutex)
+  #define UNLOCK_CACHE(cache) pthread_mutex_unlock(&(cache)->mutex)
+#else
+  #define LOCK_CACHE(cache)
+  #define UNLOCK_CACHE(cache)
+#endif
+
+
+/*
+Key
+*/
+
+// Finalizer of murmur3, 64 bit
+static unsigned long long
+avalanche(unsigned long long value)
+{
+  value ^= value >> 33;
+  value *= 0xFF51AFD7ED558CCDULL;
+  value ^= value >> 33;
+  value *= 0xC4CEB9FE1A85EC53ULL;
+  value ^= value >> 33;
+  return value;
+}
+
+
+void
+initResultKey(TResultKey* key)
+{
+  key->high = avalanche(RESULT_KEY_VERSION);
+  key->low = avalanche(~ (unsigned long long) RESULT_KEY_VERSION);
+}
+
+
+void
+hashResultKey(
+  TResultKey* key,
+  const void* bytes,
+  size_t count
+  )
+{
+  const unsigned char* from = (const unsigned char*) bytes;
+  unsigned long long high = key->high;
+  unsigned long long low = key->low;
+  unsigned long long tail = 0;
+  size_t i;
+
+  // Two lanes of words, differently multiplied and rotated
+  for (i=0; i+8<=count; i+=8)
+  {
+    unsigned long long word;
+    memcpy(&word, from + i, 8);
+    high = (high ^ word) * 0x9E3779B97F4A7C15ULL;
+    high = (high << 31) | (high >> 33);
+    low = (low ^ word) * 0xC2B2AE3D27D4EB4FULL;
+    low = (low << 29) | (low >> 35);
+    low += high;
+  }
+  memcpy(&tail, from + i, count - i);
+  key->high = avalanche(high ^ tail ^ count);
+  key->low = avalanche(low + tail + count * 0x165667B19E3779F9ULL) ^ key->high;
+}
+
+
+#define HASH_PARAMETER(field) hashResultKey(key, &parameters->field, sizeof(parameters->field))
+
+void
+hashResultKeyParameters(
+  TResultKey* key,
+  const TImageSynthParameters* parameters
+  )
+{
+  // Every field of TImageSynthParameters, but threadCount, isDeviceMatching, isCascadeRejection, deadline, passCallback, workspace, sources, fixedSources and metrics.
+  // Keep in step with engineParams.h.
+  HASH_PARAMETER(isMakeSeamlesslyTileableHorizontally);
+  HASH_PARAMETER(isMakeSeamlesslyTileableVertically);
+  HASH_PARAMETER(matchContextType);
+  HASH_PARAMETER(mapWeight);
+  HASH_PARAMETER(sensitivityToOutliers);
+  HASH_PARAMETER(patchSize);
+  HASH_PARAMETER(maxProbeCount);
+  HASH_PARAMETER(randomSeed);
+  HASH_PARAMETER(pyramidLevels);
+  HASH_PARAMETER(patchIndexCandidates);
+  HASH_PARAMETER(patchIndexRadius);
+  HASH_PARAMETER(offsetTableRadius);
+  HASH_PARAMETER(isDeterministic);
+  HASH_PARAMETER(roiMargin);
+  // Moot when deterministic
+  if ( ! parameters->isDeterministic )
+    HASH_PARAMETER(scheduleTileSize);
+}
+
+
+/*
+Memory
+*/
+
+static void
+unlinkEntry(TResultCache* cache, TResultEntry* entry)
+{
+  if (entry->previous) entry->previous->next = entry->next; else cache->head = entry->next;
+  if (entry->next) entry->next->previous = entry->previous; else cache->tail = entry->previous;
+  entry->previous = entry->next = NULL;
+}
+
+
+static void
+pushEntry(TResultCache* cache, TResultEntry* entry)
+{
+  entry->previous = NULL;
+  entry->next = cache->head;
+  if (cache->head) cache->head->previous = entry; else cache->tail = entry;
+  cache->head = entry;
+}
+
+
+static TResultEntry*
+findEntry(TResultCache* cache, const TResultKey* key)
+{
+  TResultEntry* entry;
+
+  for (entry=cache->head; entry; entry=entry->next)
+    if (entry->key.high == key->high && entry->key.low == key->low)
+      return entry;
+  return NULL;
+}
+
+
+static void
+freeEntry(TResultEntry* entry)
+{
+  free(entry->pixels);
+  free(entry);
+}
+
+
+// Keep a result in memory, evicting least recently used to fit.  Caller holds the lock.
+static void
+keepInMemory(
+  TResultCache* cache,
+  const TResultKey* key,
+  const unsigned char* pixels,
+  size_t size
+  )
+{
+  TResultEntry* entry;
+
+  if (size > cache->maxBytes || findEntry(cache, key)) return;
+  while (cache->stats.bytes + size > cache->maxBytes)
+  {
+    TResultEntry* victim = cache->tail;
+    unlinkEntry(cache, victim);
+    cache->stats.bytes -= victim->size;
+    cache->stats.entries--;
+    cache->stats.evictions++;
+    freeEntry(victim);
+  }
+  entry = calloc(1, sizeof(TResultEntry));
+  if (entry) entry->pixels = malloc(size);
+  if ( ! entry || ! entry->pixels )
+  {
+    free(entry);
+    return; // Not cached, not an error
+  }
+  memcpy(entry->pixels, pixels, size);
+  entry->key = *key;
+  entry->size = size;
+  pushEntry(cache, entry);
+  cache->stats.bytes += size;
+  cache->stats.entries++;
+}
+
+
+/*
+Disk
+*/
+
+static void
+resultFilePath(
+  const TResultCache* cache,
+  const TResultKey* key,
+  char* path,
+  size_t pathSize
+  )
+{
+  snprintf(path, pathSize, "%s/%016llx%016llx.result", cache->directory, key->high, key->low);
+}
+
+
+static int
+readResultFile(
+  TResultCache* cache,
+  const TResultKey* key,
+  unsigned char* pixels,
+  size_t size
+  )
+{
+  char path[4096];
+  struct stat status;
+  const TResultFileHeader* header;
+  void* mapped;
+  int isFound = FALSE;
+  int file;
+
+  resultFilePath(cache, key, path, sizeof(path));
+  file = open(path, O_RDONLY);
+  if (file < 0) return FALSE;
+  if (fstat(file, &status) == 0 && (size_t) status.st_size == sizeof(TResultFileHeader) + size)
+  {
+    mapped = mmap(NULL, status.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+    if (mapped != MAP_FAILED)
+    {
+      header = (const TResultFileHeader*) mapped;
+      if (memcmp(header->magic, RESULT_FILE_MAGIC, sizeof(header->magic)) == 0
+        && header->key.high == key->high && header->key.low == key->low && header->size == size)
+      {
+        memcpy(pixels, (const unsigned char*) mapped + sizeof(TResultFileHeader), size);
+        isFound = TRUE;
+      }
+      munmap(mapped, status.st_size);
+    }
+  }
+  close(file);
+  return isFound;
+}
+
+
+static int
+writeAll(int file, const void* bytes, size_t count)
+{
+  const char* from = (const char*) bytes;
+
+  while (count > 0)
+  {
+    ssize_t written = write(file, from, count);
+    if (written <= 0) return FALSE;
+    from += written;
+    count -= (size_t) written;
+  }
+  return TRUE;
+}
+
+
+// Failing to write is not an error: the result is just not cached on disk
+static void
+writeResultFile(
+  TResultCache* cache,
+  const TResultKey* key,
+  const unsigned char* pixels,
+  size_t size
+  )
+{
+  char path[4096];
+  char temporaryPath[4096 + 8];
+  TResultFileHeader header;
+  int file;
+  int isWritten;
+
+  resultFilePath(cache, key, path, sizeof(path));
+  snprintf(temporaryPath, sizeof(temporaryPath), "%s.XXXXXX", path);
+  file = mkstemp(temporaryPath);
+  if (file < 0) return;
+
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, RESULT_FILE_MAGIC, sizeof(header.magic));
+  header.key = *key;
+  header.size = size;
+  isWritten = writeAll(file, &header, sizeof(header)) && writeAll(file, pixels, size);
+  isWritten = (close(file) == 0) && isWritten;
+  if ( ! isWritten || rename(temporaryPath, path) != 0 )
+    unlink(temporaryPath);
+}
+
+
+/*
+Cache
+*/
+
+TResultCache*
+newResultCache(
+  size_t maxBytes,
+  const char* directory
+  )
+{
+  TResultCache* cache = calloc(1, sizeof(TResultCache));
+
+  g_assert(cache);
+#ifdef SYNTH_THREADED
+  pthread_mutex_init(&cache->mutex, NULL);
+#endif
+  cache->maxBytes = maxBytes;
+  if (directory)
+  {
+    cache->directory = malloc(strlen(directory) + 1);
+    g_assert(cache->directory);
+    strcpy(cache->directory, directory);
+  }
+  return cache;
+}
+
+
+void
+freeResultCache(TResultCache* cache)
+{
+  while (cache->head)
+  {
+    TResultEntry* entry = cache->head;
+    unlinkEntry(cache, entry);
+    freeEntry(entry);
+  }
+#ifdef SYNTH_THREADED
+  pthread_mutex_destroy(&cache->mutex);
+#endif
+  free(cache->directory);
+  free(cache);
+}
+
+
+int
+lookupResult(
+  TResultCache* cache,
+  const TResultKey* key,
+  unsigned char* pixels,
+  size_t size
+  )
+{
+  TResultEntry* entry;
+  int isFound = FALSE;
+
+  LOCK_CACHE(cache);
+  entry = findEntry(cache, key);
+  if (entry && entry->size == size)
+  {
+    memcpy(pixels, entry->pixels, size);
+    unlinkEntry(cache, entry);
+    pushEntry(cache, entry);
+    cache->stats.hits++;
+    isFound = TRUE;
+  }
+  UNLOCK_CACHE(cache);
+  if (isFound) return TRUE;
+
+  // Read the disk without the lock: other runs need not wait on it
+  if (cache->directory && readResultFile(cache, key, pixels, size))
+  {
+    LOCK_CACHE(cache);
+    cache->stats.diskHits++;
+    keepInMemory(cache, key, pixels, size);
+    UNLOCK_CACHE(cache);
+    return TRUE;
+  }
+
+  LOCK_CACHE(cache);
+  cache->stats.misses++;
+  UNLOCK_CACHE(cache);
+  return FALSE;
+}
+
+
+void
+storeResult(
+  TResultCache* cache,
+  const TResultKey* key,
+  const unsigned char* pixels,
+  size_t size
+  )
+{
+  LOCK_CACHE(cache);
+  keepInMemory(cache, key, pixels, size);
+  UNLOCK_CACHE(cache);
+  if (cache->directory)
+    writeResultFile(cache, key, pixels, size);
+}
+
+
+TResultCacheStats
+resultCacheStats(TResultCache* cache)
+{
+  TResultCacheStats stats;
+
+  LOCK_CACHE(cache);
+  stats = cache->stats;
+  UNLOCK_CACHE(cache);
+  return stats;
+}
@@ -0,0 +1,91 @@
+/*
+Cache of results, content addressed: keyed by a hash of everything a result depends on.
+
+For callers asking again for the same synthesis: same image, masks, format and parameters.
+Deterministic for a seed (see isDeterministic), so a cached result is the result.
+
+Two tiers:
+- in memory: most recently used results, up to a count of bytes, least recently used evicted first.
+- optionally on disk: a directory of one file per result, named by key, read by mmap.
+  Unbounded here: the caller owns the directory (prunes it, shares it between processes.)
+A result found on disk is also kept in memory.
+
+Thread safe: runs may look up and store concurrently.
+The key is not cryptographic: 128 bits, collisions are improbable, not impossible for a crafted input.
+*/
+
+#ifndef __SYNTH_RESULT_CACHE_H__
+#define __SYNTH_RESULT_CACHE_H__
+
+#include <stddef.h>   // size_t
+
+typedef struct ResultKeyStruct {
+  unsigned long long high;
+  unsigned long long low;
+} TResultKey;
+
+typedef struct ResultCacheStatsStruct {
+  size_t hits;        // served from memory
+  size_t diskHits;    // served from the directory
+  size_t misses;
+  size_t evictions;   // from memory
+  size_t entries;     // in memory now
+  size_t bytes;       // of pixels in memory now
+} TResultCacheStats;
+
+typedef struct ResultCacheStruct TResultCache;
+
+// Start a key: a version of its layout, so keys change when what goes into them does
+extern void
+initResultKey(TResultKey* key);
+
+/*
+Hash bytes into a key.
+Depends on how bytes are split into calls, not only on their concatenation:
+callers hash the same fields in the same order (e.g. rows of an image, one call each.)
+*/
+extern void
+hashResultKey(
+  TResultKey* key,  // IN/OUT
+  const void* bytes,
+  size_t count
+  );
+
+// Hash the parameters that change a result: all but the count of threads and the workspace
+extern void
+hashResultKeyParameters(
+  TResultKey* key,  // IN/OUT
+  const TImageSynthParameters* parameters
+  );
+
+extern TResultCache*
+newResultCache(
+  size_t maxBytes,        // of pixels in memory, zero: none in memory
+  const char* directory   // existing directory of results on disk, or NULL: none on disk
+  );
+
+extern void
+freeResultCache(TResultCache* cache);
+
+// Copy a result of exactly size bytes into pixels, if cached.  Returns whether it was.
+extern int
+lookupResult(
+  TResultCache* cache,
+  const TResultKey* key,
+  unsigned char* pixels,  // OUT
+  size_t size
+  );
+
+// Cache a copy of a result
+extern void
+storeResult(
+  TResultCache* cache,
+  const TResultKey* key,
+  const unsigned char* pixels,
+  size_t size
+  );
+
+extern TResultCacheStats
+resultCacheStats(TResultCache* cache);
+
+#endif /* __SYNTH_RESULT_CACHE_H__ */
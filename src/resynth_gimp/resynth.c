@@ -1,7 +1,33 @@
 #include "../resynth.h"
+#include "buildSwitches.h"
+#ifndef SYNTH_LIB_ALONE
+  #include <glib.h>
+#else
+  #include "glibProxy.h"
+#endif
 #include "imageSynth.h"
+#include "pixelelConvert.h"
+#include "resultCache.h"
+#include "workspace.h"
+#include "passes.h"
+#include "synthMetrics.h"
+#include "map.h"
+#include "deviceMatcher.h"
+#if RESYNTH_MAX_PASSES != MAX_PASSES
+  #error "RESYNTH_MAX_PASSES of resynth.h must be MAX_PASSES of passes.h"
+#endif
 #include <string.h>
 #include <stdlib.h>
+#ifdef SYNTH_THREADED
+  #include <pthread.h>
+  #include "workerPool.h"
+#endif
+#ifndef _WIN32
+  #include <fcntl.h>
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+  #include <unistd.h>
+#endif
 
 // decide which features we want from stb_image.
 // this should cover the most common formats.
@@ -17,6 +43,9 @@
 struct _Resynth_state {
     ImageBuffer* imageBuffer;
     TImageFormat imageFormat;
+    bool isBorrowed;  // pixels belong to the caller, see resynth_state_create_from_buffer(f)()
+    void* mapping;    // or NULL: the file the pixels are in, see resynth_state_create_from_mapped()
+    size_t mappingBytes;
 };
 
 struct _Parameters {
@@ -24,6 +53,32 @@ struct _Parameters {
     ImageBuffer* mask;
     ImageBuffer* mask2;
     resynth_operation_t op;
+    resynth_cache_t cache;  // borrowed, see resynth_parameters_cache()
+    resynth_corpus_t corpus;  // borrowed, see resynth_parameters_corpus()
+    resynth_progress_callback_t progress;  // or NULL, see resynth_parameters_progress()
+    void* progressUserdata;
+    resynth_preview_callback_t preview;  // or NULL, see resynth_parameters_preview()
+    void* previewUserdata;
+    double timeBudget;  // seconds, or 0: none, see resynth_parameters_time_budget()
+    bool isCorrespondence;  // results keep their sources, see resynth_parameters_correspondence()
+    bool isDeterministic;  // as asked, see resynth_parameters_deterministic(): the engine's is also on for the GPU
+};
+
+struct _Resynth_cache {
+    TResultCache* resultCache;
+};
+
+struct _Resynth_workspace {
+    TWorkspace* workspace;
+};
+
+struct _Resynth_corpus {
+    TCorpusContext* corpusContext;
+    TImageFormat imageFormat;
+    TResultKey key;  // of its pixels and mask, for result keys, see _resynth_result_key()
+    size_t* placements;  // x, y of each source, see resynth_corpus_create_multi()
+    size_t sourceCount;
+    size_t width, height;  // of its pixels, packed, see resynth_corpus_size()
 };
 
 struct _Resynth_result {
@@ -31,42 +86,78 @@ struct _Resynth_result {
     ImageBuffer* imageBufferf;
     TImageFormat imageFormat;
     bool valid;
+    TSynthMetrics metrics;  // of the run that made it
+    guint* sources;  // or NULL, see resynth_result_correspondence()
+    size_t sourceWidth;  // of the source the sources index, the state or the corpus
+};
+
+struct _Resynth_job {
+    resynth_state_t state;            // borrowed, see resynth_run_async()
+    resynth_parameters_t parameters;  // borrowed
+    resynth_result_t result;          // until taken by resynth_job_wait()
+    resynth_job_callback_t callback;
+    void* userdata;
+    int cancelFlag;  // polled by the engine, set by resynth_job_cancel()
+    int progress;    // percent, written by the running job, read by any thread
+    bool isDone;
+#ifdef SYNTH_THREADED
+    pthread_mutex_t mutex;  // guards isDone
+    pthread_cond_t done;    // signaled when isDone becomes true
+#endif
 };
 
 /* Helper functions */
-static void _resynth_progress_callback(int progress, void* userdataptr) {
-    printf("%d\n", progress);
+/* Progress of a job: stored, for resynth_job_progress(), and forwarded to the parameters' callback if any */
+static void _resynth_job_progress_callback(int progress, void* userdataptr) {
+    resynth_job_t job = userdataptr;
+    // The engine's estimate can overshoot at the end
+    if (progress > 100) progress = 100;
+#ifdef SYNTH_THREADED
+    __atomic_store_n(&job->progress, progress, __ATOMIC_RELAXED);
+#else
+    job->progress = progress;
+#endif
+    if (job->parameters->progress != NULL) {
+        job->parameters->progress(progress, job->parameters->progressUserdata);
+    }
 }
 
-void
-_resynth_create_default_masks(resynth_parameters_t parameters, resynth_state_t state) {
-    free(parameters->mask);
-    free(parameters->mask2);
+static size_t _resynth_format_channels(TImageFormat format) {
+    if (format == T_RGB)
+        return 3;
+    if (format == T_RGBA)
+        return 4;
+    if (format == T_Gray)
+        return 1;
+    if (format == T_GrayA)
+        return 2;
+    return 0;
+}
 
+/* Hash the rows of a buffer into a key, one call per row: rows are not contiguous when strided */
+static void
+_resynth_hash_buffer(TResultKey* key, const ImageBuffer* buffer, size_t rowLength) {
+    for (size_t y = 0; y < buffer->height; ++y) {
+        hashResultKey(key, buffer->data + y * buffer->rowBytes, rowLength);
+    }
+}
+
+/* The mask of a run with none set: all selected, of the state's size. A local of the run, for parameters are
+   only read, and may be shared by runs of states of other sizes. Its data is for free(). */
+static ImageBuffer
+_resynth_default_mask(resynth_state_t state) {
     size_t width = state->imageBuffer->width;
     size_t height = state->imageBuffer->height;
+    ImageBuffer mask = {malloc(width * height * sizeof(uint8_t)), width, height, width * sizeof(uint8_t), 0};
 
-    size_t mask_size = state->imageBuffer->width * state->imageBuffer->height;
-
-    parameters->mask = calloc(1, sizeof(ImageBuffer));
-    parameters->mask->width = width;
-    parameters->mask->height = height;
-    parameters->mask->rowBytes = width * sizeof(uint8_t);
-    parameters->mask->data = calloc(mask_size, sizeof(uint8_t));
-    memset(parameters->mask->data, 0xFF, mask_size * sizeof(uint8_t));
-
-    parameters->mask2 = calloc(1, sizeof(ImageBuffer));
-    parameters->mask2->width = width;
-    parameters->mask2->height = height;
-    parameters->mask2->rowBytes = width * sizeof(uint8_t);
-    parameters->mask2->data = calloc(mask_size, sizeof(uint8_t));
-    memset(parameters->mask2->data, 0xFF, mask_size * sizeof(uint8_t));
+    assert(mask.data != NULL);
+    memset(mask.data, 0xFF, width * height * sizeof(uint8_t));
+    return mask;
 }
 
 /* Image and Buffer Loading */
 resynth_state_t
 resynth_state_create_from_image(const char* filename, int desired_channels, int scale) {
-    resynth_state_t state = calloc(1, sizeof(Resynth_state));
     int w, h, d;
     uint8_t *image = stbi_load(filename, &w, &h, &d, desired_channels);
     if (image == NULL) {
@@ -79,27 +170,28 @@ resynth_state_create_from_image(const char* filename, int desired_channels, int
         return NULL;
     }
 
-    if (d == 4) {
+    // stb_image decodes to desired_channels, whatever the file's count d
+    if (desired_channels == 4) {
         for (int i = 0; i < w * h; ++i) {
             image[(i*4)+3] = 255;
         }
     }
 
+    // The decoded pixels become the state's, not copied again: stbi_image_free() is free()
+    resynth_state_t state = calloc(1, sizeof(Resynth_state));
     ImageBuffer* imageBuffer = calloc(1, sizeof(ImageBuffer));
-    imageBuffer->data = calloc(w * h * d, sizeof(uint8_t));
-    memcpy(imageBuffer->data, image, w*h*d*sizeof(uint8_t));
+    imageBuffer->data = image;
     imageBuffer->width = w;
     imageBuffer->height = h;
-    imageBuffer->rowBytes = w * d * sizeof(uint8_t);
+    imageBuffer->rowBytes = w * desired_channels * sizeof(uint8_t);
 
     state->imageBuffer = imageBuffer;
-    if (d == 4) {
+    if (desired_channels == 4) {
         state->imageFormat = T_RGBA;
     } else {
         state->imageFormat = T_RGB;
     }
 
-    stbi_image_free(image);
     return state;
 }
 
@@ -130,18 +222,208 @@ resynth_state_create_from_memory(uint8_t* pixels, size_t width, size_t height, s
     return state;
 }
 
+resynth_state_t
+resynth_state_create_from_buffer(uint8_t* pixels, size_t width, size_t height, size_t channels, size_t stride) {
+    assert(pixels != NULL);
+    assert(width > 0);
+    assert(height > 0);
+    assert(channels >= 3);
+    assert(channels <= 4);
+    assert(stride == 0 || stride >= width * channels);
+
+    resynth_state_t state = calloc(1, sizeof(Resynth_state));
+
+    // Borrowed, not copied: the engine adapts straight from the caller's rows
+    ImageBuffer* imageBuffer = calloc(1, sizeof(ImageBuffer));
+    imageBuffer->data = pixels;
+    imageBuffer->width = width;
+    imageBuffer->height = height;
+    imageBuffer->rowBytes = stride ? stride : width * channels * sizeof(uint8_t);
+
+    state->imageBuffer = imageBuffer;
+    state->isBorrowed = true;
+    if (channels == 4) {
+        state->imageFormat = T_RGBA;
+    } else {
+        state->imageFormat = T_RGB;
+    }
+
+    return state;
+}
+
+#ifndef _WIN32
+// The next word of a netpbm header, past whitespace and comments: false at the end of the bytes
+static bool
+_resynth_netpbm_word(const uint8_t* bytes, size_t size, size_t* at, char* word, size_t capacity) {
+    size_t length = 0;
+    while (*at < size) {
+        if (bytes[*at] == '#') {
+            while (*at < size && bytes[*at] != '\n') (*at)++;
+        } else if (bytes[*at] == ' ' || bytes[*at] == '\t' || bytes[*at] == '\n' || bytes[*at] == '\r') {
+            (*at)++;
+        } else {
+            break;
+        }
+    }
+    while (*at < size && bytes[*at] > ' ' && bytes[*at] != '#') {
+        if (length + 1 < capacity) word[length++] = (char)bytes[*at];
+        (*at)++;
+    }
+    word[length] = '\0';
+    return length > 0;
+}
+
+// The next decimal number of a netpbm header, or 0
+static size_t
+_resynth_netpbm_number(const uint8_t* bytes, size_t size, size_t* at) {
+    char word[16];
+    size_t value = 0;
+    if (!_resynth_netpbm_word(bytes, size, at, word, sizeof(word))) return 0;
+    for (const char* digit = word; *digit; ++digit) {
+        if (*digit < '0' || *digit > '9' || value > 100000000) return 0;
+        value = value * 10 + (size_t)(*digit - '0');
+    }
+    return value;
+}
+
+// The offset of the pixels of a binary PPM or PAM of 8 bit RGB(A) pixels, or 0 if it is not one
+static size_t
+_resynth_netpbm_header(const uint8_t* bytes, size_t size, size_t* width, size_t* height, size_t* channels) {
+    size_t at = 2;
+    size_t maxval = 0;
+    char word[16];
+
+    *width = *height = *channels = 0;
+    if (size < 2 || bytes[0] != 'P') return 0;
+    if (bytes[1] == '6') {
+        *width = _resynth_netpbm_number(bytes, size, &at);
+        *height = _resynth_netpbm_number(bytes, size, &at);
+        maxval = _resynth_netpbm_number(bytes, size, &at);
+        *channels = 3;
+        at++;   // one whitespace, then the pixels
+    } else if (bytes[1] == '7') {
+        for (;;) {
+            if (!_resynth_netpbm_word(bytes, size, &at, word, sizeof(word))) return 0;
+            if (strcmp(word, "ENDHDR") == 0) break;
+            if (strcmp(word, "WIDTH") == 0) *width = _resynth_netpbm_number(bytes, size, &at);
+            else if (strcmp(word, "HEIGHT") == 0) *height = _resynth_netpbm_number(bytes, size, &at);
+            else if (strcmp(word, "DEPTH") == 0) *channels = _resynth_netpbm_number(bytes, size, &at);
+            else if (strcmp(word, "MAXVAL") == 0) maxval = _resynth_netpbm_number(bytes, size, &at);
+            else if (strcmp(word, "TUPLTYPE") == 0) _resynth_netpbm_word(bytes, size, &at, word, sizeof(word));
+            else return 0;
+        }
+        while (at < size && bytes[at] != '\n') at++;
+        at++;
+    } else {
+        return 0;
+    }
+    if (maxval != 255 || *width == 0 || *height == 0 || *channels < 3 || *channels > 4) return 0;
+    if (at >= size || (size - at) / *width / *height < *channels) return 0;
+    return at;
+}
+#endif
+
+resynth_state_t
+resynth_state_create_from_mapped(const char* filename) {
+#ifdef _WIN32
+    (void)filename;
+    return NULL;
+#else
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+    struct stat info;
+    void* mapping = MAP_FAILED;
+    if (fstat(fd, &info) == 0 && info.st_size > 0) {
+        // Private: writes in place are the state's, never the file's
+        mapping = mmap(NULL, (size_t)info.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);  // the mapping keeps the file open
+    if (mapping == MAP_FAILED) {
+        return NULL;
+    }
+
+    size_t width, height, channels;
+    size_t offset = _resynth_netpbm_header(mapping, (size_t)info.st_size, &width, &height, &channels);
+    if (offset == 0) {
+        munmap(mapping, (size_t)info.st_size);
+        return NULL;
+    }
+    // The engine adapts the pixels in one pass, in order
+    posix_madvise(mapping, (size_t)info.st_size, POSIX_MADV_SEQUENTIAL);
+
+    resynth_state_t state = resynth_state_create_from_buffer((uint8_t*)mapping + offset, width, height, channels, 0);
+    state->mapping = mapping;
+    state->mappingBytes = (size_t)info.st_size;
+    return state;
+#endif
+}
+
+const uint8_t*
+resynth_state_pixels(resynth_state_t state, size_t* width, size_t* height, size_t* channels, size_t* stride) {
+    *width = state->imageBuffer->width;
+    *height = state->imageBuffer->height;
+    *channels = (state->imageFormat == T_RGBA) ? 4 : 3;
+    *stride = state->imageBuffer->rowBytes;
+    return state->imageBuffer->isFloat ? NULL : state->imageBuffer->data;
+}
+
 resynth_state_t
 resynth_state_create_from_memoryf(float* pixels, size_t width, size_t height, size_t channels, int scale) {
-    size_t size = width * height * channels;
-    uint8_t* pixels_u8 = calloc(size, sizeof(uint8_t));
+    assert(pixels != NULL);
+    assert(width > 0);
+    assert(height > 0);
+    assert(channels >= 3);
+    assert(channels <= 4);
 
-    for (size_t i = 0; i < size; ++i) {
-        pixels_u8[i] = (uint8_t)fmin(255, fmax(0, (pixels[i] * 255)));
+    resynth_state_t state = calloc(1, sizeof(Resynth_state));
+
+    // Converted straight into the state's pixels, no intermediate copy
+    ImageBuffer* imageBuffer = calloc(1, sizeof(ImageBuffer));
+    imageBuffer->data = calloc(width * height * channels, sizeof(uint8_t));
+    convertFloatsToPixelels(pixels, imageBuffer->data, width * height * channels);
+    imageBuffer->width = width;
+    imageBuffer->height = height;
+    imageBuffer->rowBytes = width * channels * sizeof(uint8_t);
+
+    state->imageBuffer = imageBuffer;
+    if (channels == 4) {
+        state->imageFormat = T_RGBA;
+    } else {
+        state->imageFormat = T_RGB;
     }
 
-    resynth_state_t state = resynth_state_create_from_memory(pixels_u8, width, height, channels, scale);
+    return state;
+}
+
+resynth_state_t
+resynth_state_create_from_bufferf(float* pixels, size_t width, size_t height, size_t channels, size_t stride) {
+    assert(pixels != NULL);
+    assert(width > 0);
+    assert(height > 0);
+    assert(channels >= 3);
+    assert(channels <= 4);
+    assert(stride == 0 || stride >= width * channels * sizeof(float));
+
+    resynth_state_t state = calloc(1, sizeof(Resynth_state));
+
+    // Borrowed, not copied: the engine converts as it adapts from the caller's rows
+    ImageBuffer* imageBuffer = calloc(1, sizeof(ImageBuffer));
+    imageBuffer->data = (unsigned char*)pixels;
+    imageBuffer->width = width;
+    imageBuffer->height = height;
+    imageBuffer->rowBytes = stride ? stride : width * channels * sizeof(float);
+    imageBuffer->isFloat = 1;
+
+    state->imageBuffer = imageBuffer;
+    state->isBorrowed = true;
+    if (channels == 4) {
+        state->imageFormat = T_RGBA;
+    } else {
+        state->imageFormat = T_RGB;
+    }
 
-    free(pixels_u8);
     return state;
 }
 
@@ -168,6 +450,12 @@ resynth_parameters_operation(resynth_parameters_t parameters, resynth_operation_
     }
 }
 
+void
+resynth_parameters_match_context(resynth_parameters_t parameters, int type) {
+    assert(type >= 0 && type <= 10);
+    parameters->parameters->matchContextType = type;
+}
+
 void
 resynth_parameters_mask(resynth_parameters_t parameters, uint8_t* pixels, size_t width, size_t height, resynth_mask_type_t type) {
 
@@ -228,62 +516,955 @@ resynth_parameters_magic(resynth_parameters_t parameters, int magic) {
 
 void
 resynth_parameters_random_seed(resynth_parameters_t parameters, unsigned long seed) {
-    /* gimp version of resynth takes care of random seeds */
+    parameters->parameters->randomSeed = (unsigned int) seed;
+}
+
+void
+resynth_parameters_threads(resynth_parameters_t parameters, int threads) {
+    parameters->parameters->threadCount = threads > 0 ? threads : 0;
+}
+
+void
+resynth_parameters_tile_scheduling(resynth_parameters_t parameters, int tile_size) {
+    parameters->parameters->scheduleTileSize = tile_size > 0 ? tile_size : 0;
+}
+
+void
+resynth_parameters_pyramid(resynth_parameters_t parameters, int levels) {
+    parameters->parameters->pyramidLevels = levels > 0 ? levels : 0;
+}
+
+void
+resynth_parameters_patch_index(resynth_parameters_t parameters, int candidates, int radius) {
+    parameters->parameters->patchIndexCandidates = candidates > 0 ? candidates : 0;
+    parameters->parameters->patchIndexRadius = radius > 0 ? radius : 1;
+}
+
+void
+resynth_parameters_deterministic(resynth_parameters_t parameters, bool deterministic) {
+    parameters->isDeterministic = deterministic;
+    parameters->parameters->isDeterministic = deterministic || parameters->parameters->isDeviceMatching;
+}
+
+void
+resynth_parameters_gpu(resynth_parameters_t parameters, bool gpu) {
+    // The GPU takes batches of the deterministic mode: on while it is, then as the caller asked
+    parameters->parameters->isDeviceMatching = gpu;
+    parameters->parameters->isDeterministic = gpu || parameters->isDeterministic;
+}
+
+bool
+resynth_gpu_present(void) {
+    return isDevicePresent();
+}
+
+void
+resynth_parameters_cascade(resynth_parameters_t parameters, bool cascade) {
+    parameters->parameters->isCascadeRejection = cascade;
+}
+
+void
+resynth_parameters_roi(resynth_parameters_t parameters, int margin) {
+    parameters->parameters->roiMargin = margin > 0 ? margin : 0;
+}
+
+void
+resynth_parameters_cache(resynth_parameters_t parameters, resynth_cache_t cache) {
+    parameters->cache = cache;
+}
+
+void
+resynth_parameters_corpus(resynth_parameters_t parameters, resynth_corpus_t corpus) {
+    parameters->corpus = corpus;
+}
+
+void
+resynth_parameters_workspace(resynth_parameters_t parameters, resynth_workspace_t workspace) {
+    parameters->parameters->workspace = workspace ? workspace->workspace : NULL;
+}
+
+void
+resynth_parameters_progress(resynth_parameters_t parameters, resynth_progress_callback_t callback, void* userdata) {
+    parameters->progress = callback;
+    parameters->progressUserdata = userdata;
+}
+
+void
+resynth_parameters_time_budget(resynth_parameters_t parameters, double seconds) {
+    parameters->timeBudget = seconds > 0 ? seconds : 0;
+}
+
+void
+resynth_parameters_preview(resynth_parameters_t parameters, resynth_preview_callback_t callback, void* userdata) {
+    parameters->preview = callback;
+    parameters->previewUserdata = userdata;
+}
+
+void
+resynth_parameters_correspondence(resynth_parameters_t parameters, bool keep) {
+    parameters->isCorrespondence = keep;
+}
+
+/* Prepared Corpus */
+// Of resynth_corpus_create(f)(): prepared from one image, of source pixels selected by mask (or all)
+static resynth_corpus_t
+_resynth_prepare_corpus(ImageBuffer* image, ImageBuffer* mask, TImageFormat format,
+                        resynth_parameters_t parameters) {
+    size_t channels = _resynth_format_channels(format);
+    size_t pixelelSize = image->isFloat ? sizeof(float) : sizeof(uint8_t);
+    resynth_corpus_t corpus = calloc(1, sizeof(Resynth_corpus));
+
+    TImageSynthError result = imageSynthCorpus(image, mask, format, parameters->parameters, &corpus->corpusContext);
+    if (result != IMAGE_SYNTH_SUCCESS) {
+        fprintf(stderr, "Error preparing corpus: err(%d)\n", result);
+        free(corpus);
+        return NULL;
+    }
+    corpus->imageFormat = format;
+    corpus->width = image->width;
+    corpus->height = image->height;
+
+    unsigned int dimensions[4] = {format, image->isFloat, image->width, image->height};
+    initResultKey(&corpus->key);
+    hashResultKey(&corpus->key, dimensions, sizeof(dimensions));
+    _resynth_hash_buffer(&corpus->key, image, image->width * channels * pixelelSize);
+    if (mask != NULL) {
+        _resynth_hash_buffer(&corpus->key, mask, mask->width);
+    }
+    return corpus;
+}
+
+resynth_corpus_t
+resynth_corpus_create(resynth_state_t source, uint8_t* mask, resynth_parameters_t parameters) {
+    ImageBuffer maskBuffer = {mask, source->imageBuffer->width, source->imageBuffer->height,
+                              source->imageBuffer->width, 0};
+    resynth_corpus_t corpus = _resynth_prepare_corpus(source->imageBuffer, mask ? &maskBuffer : NULL,
+                                                      source->imageFormat, parameters);
+    if (corpus != NULL) {
+        corpus->placements = calloc(2, sizeof(size_t));
+        corpus->sourceCount = 1;
+    }
+    return corpus;
+}
+
+resynth_corpus_t
+resynth_corpus_create_multi(const resynth_state_t* sources, uint8_t* const* masks, size_t count,
+                            resynth_parameters_t parameters) {
+    if (sources == NULL || count == 0) {
+        return NULL;
+    }
+    TImageFormat format = sources[0]->imageFormat;
+    for (size_t i = 1; i < count; ++i) {
+        if (sources[i]->imageFormat != format) {
+            fprintf(stderr, "Error preparing corpus: source %zu has another channel count\n", i);
+            return NULL;
+        }
+    }
+
+    size_t channels = _resynth_format_channels(format);
+    size_t* placements = calloc(2 * count, sizeof(size_t));
+    size_t* byHeight = malloc(count * sizeof(size_t));
+    size_t gap = 1;
+    size_t area = 0;
+    size_t shelfWidth = 0;
+    if (placements == NULL || byHeight == NULL) {
+        free(placements);
+        free(byHeight);
+        return NULL;
+    }
+
+    // A patch apart: no patch of the corpus reaches from one source into another
+    while ((2 * gap + 1) * (2 * gap + 1) < (size_t)parameters->parameters->patchSize) {
+        ++gap;
+    }
+    for (size_t i = 0; i < count; ++i) {
+        area += (sources[i]->imageBuffer->width + gap) * (sources[i]->imageBuffer->height + gap);
+        shelfWidth = MAX(shelfWidth, sources[i]->imageBuffer->width);
+        // Tallest first, so shelves waste little under their shorter sources
+        size_t k = i;
+        for (; k > 0 && sources[byHeight[k - 1]]->imageBuffer->height < sources[i]->imageBuffer->height; --k) {
+            byHeight[k] = byHeight[k - 1];
+        }
+        byHeight[k] = i;
+    }
+    // Shelves about as wide as the packing is tall
+    while (shelfWidth * shelfWidth < area) {
+        ++shelfWidth;
+    }
+
+    size_t width = 0, height = 0;
+    size_t x = 0, y = 0, shelfHeight = 0;
+    for (size_t k = 0; k < count; ++k) {
+        const ImageBuffer* image = sources[byHeight[k]]->imageBuffer;
+        if (x > 0 && x + image->width > shelfWidth) {
+            y += shelfHeight + gap;
+            x = 0;
+            shelfHeight = 0;
+        }
+        placements[2 * byHeight[k]] = x;
+        placements[2 * byHeight[k] + 1] = y;
+        width = MAX(width, x + image->width);
+        height = MAX(height, y + image->height);
+        shelfHeight = MAX(shelfHeight, image->height);
+        x += image->width + gap;
+    }
+    free(byHeight);
+    // Sources are indexed in 32 bits, see resynth_result_correspondence(): checked before allocating
+    if ((uint64_t)width * height >= RESYNTH_NO_SOURCE || width * height > SIZE_MAX / channels) {
+        fprintf(stderr, "Error preparing corpus: %zux%zu packed, 2^32 - 1 pixels or more\n", width, height);
+        free(placements);
+        return NULL;
+    }
+
+    // The gaps are masked out, the sources copied in (floats converted) with their masks
+    ImageBuffer packed = {calloc(width * height * channels, sizeof(uint8_t)), width, height, width * channels, 0};
+    ImageBuffer mask = {calloc(width * height, sizeof(uint8_t)), width, height, width, 0};
+    if (packed.data == NULL || mask.data == NULL) {
+        free(packed.data);
+        free(mask.data);
+        free(placements);
+        return NULL;
+    }
+    for (size_t i = 0; i < count; ++i) {
+        const ImageBuffer* image = sources[i]->imageBuffer;
+        for (size_t row = 0; row < image->height; ++row) {
+            uint8_t* to = packed.data + (placements[2 * i + 1] + row) * packed.rowBytes + placements[2 * i] * channels;
+            uint8_t* toMask = mask.data + (placements[2 * i + 1] + row) * mask.rowBytes + placements[2 * i];
+            if (image->isFloat) {
+                convertFloatsToPixelels((const float*)(image->data + row * image->rowBytes), to, image->width * channels);
+            } else {
+                memcpy(to, image->data + row * image->rowBytes, image->width * channels);
+            }
+            if (masks != NULL && masks[i] != NULL) {
+                memcpy(toMask, masks[i] + row * image->width, image->width);
+            } else {
+                memset(toMask, 255, image->width);
+            }
+        }
+    }
+
+    resynth_corpus_t corpus = _resynth_prepare_corpus(&packed, &mask, format, parameters);
+    free(packed.data);
+    free(mask.data);
+    if (corpus == NULL) {
+        free(placements);
+        return NULL;
+    }
+    corpus->placements = placements;
+    corpus->sourceCount = count;
+    return corpus;
+}
+
+bool
+resynth_corpus_placement(resynth_corpus_t corpus, size_t index, size_t* x, size_t* y) {
+    if (index >= corpus->sourceCount) {
+        return false;
+    }
+    *x = corpus->placements[2 * index];
+    *y = corpus->placements[2 * index + 1];
+    return true;
+}
+
+bool
+resynth_corpus_size(resynth_corpus_t corpus, size_t* width, size_t* height) {
+    *width = corpus->width;
+    *height = corpus->height;
+    return true;
+}
+
+/* Workspace */
+resynth_workspace_t
+resynth_workspace_create(void) {
+    resynth_workspace_t workspace = calloc(1, sizeof(Resynth_workspace));
+    workspace->workspace = newWorkspace();
+    return workspace;
+}
+
+resynth_workspace_stats_t
+resynth_workspace_stats(resynth_workspace_t workspace) {
+    TWorkspaceStats stats = workspaceStats(workspace->workspace);
+    resynth_workspace_stats_t result;
+
+    result.allocations = stats.allocations;
+    result.reuses = stats.reuses;
+    result.bytes = stats.bytes;
+    return result;
+}
+
+/* Result Cache */
+resynth_cache_t
+resynth_cache_create(size_t max_bytes, const char* directory) {
+    resynth_cache_t cache = calloc(1, sizeof(Resynth_cache));
+    cache->resultCache = newResultCache(max_bytes, directory);
+    return cache;
+}
+
+resynth_cache_stats_t
+resynth_cache_stats(resynth_cache_t cache) {
+    TResultCacheStats stats = resultCacheStats(cache->resultCache);
+    resynth_cache_stats_t result;
+
+    result.hits = stats.hits;
+    result.disk_hits = stats.diskHits;
+    result.misses = stats.misses;
+    result.evictions = stats.evictions;
+    result.entries = stats.entries;
+    result.bytes = stats.bytes;
+    return result;
 }
 
 
 /* Processing and Results */ 
-resynth_result_t 
-resynth_run(resynth_state_t state, resynth_parameters_t parameters) {
+size_t
+resynth_estimate_memory(resynth_state_t state, resynth_parameters_t parameters) {
+    size_t width = state->imageBuffer->width;
+    size_t height = state->imageBuffer->height;
+    size_t bytes = imageSynthMemoryEstimate(width, height, state->imageFormat, parameters->parameters);
 
-    // Make sure we have a valid mask
+    // Result copied from the state
+    bytes += state->imageBuffer->rowBytes * height;
+    // Default mask, if none set
     if (parameters->mask == NULL) {
-        _resynth_create_default_masks(parameters, state);
+        bytes += width * height;
+    }
+    return bytes;
+}
+
+/* Key of a run: everything its result depends on */
+static void
+_resynth_result_key(resynth_state_t state, resynth_parameters_t parameters,
+                    const ImageBuffer* mask, const ImageBuffer* mask2, TResultKey* key) {
+    size_t channels = _resynth_format_channels(state->imageFormat);
+    size_t pixelelSize = state->imageBuffer->isFloat ? sizeof(float) : sizeof(uint8_t);
+    unsigned int dimensions[5] = {
+        parameters->op, state->imageFormat, state->imageBuffer->isFloat,
+        state->imageBuffer->width, state->imageBuffer->height
+    };
+
+    initResultKey(key);
+    hashResultKey(key, dimensions, sizeof(dimensions));
+    _resynth_hash_buffer(key, state->imageBuffer, state->imageBuffer->width * channels * pixelelSize);
+    hashResultKey(key, &mask->width, sizeof(mask->width));
+    _resynth_hash_buffer(key, mask, mask->width);
+    if (parameters->corpus != NULL) {
+        hashResultKey(key, &parameters->corpus->key, sizeof(parameters->corpus->key));
+    // Healing takes its source from outside the target mask, not from mask2
+    } else if (parameters->op == RESYNTH_OPERATION_TEXTURE && mask2 != NULL) {
+        hashResultKey(key, &mask2->width, sizeof(mask2->width));
+        _resynth_hash_buffer(key, mask2, mask2->width);
+    }
+    hashResultKeyParameters(key, parameters->parameters);
+}
+
+/* Between a buffer (of bytes or floats, strided) and the packed bytes a cache keeps */
+static void
+_resynth_pack_result(const ImageBuffer* buffer, size_t channels, uint8_t* packed) {
+    size_t rowLength = buffer->width * channels;
+
+    for (size_t y = 0; y < buffer->height; ++y) {
+        const unsigned char* row = buffer->data + y * buffer->rowBytes;
+        if (buffer->isFloat) {
+            // Round, not truncate: the engine's floats are its bytes divided by 255
+            for (size_t i = 0; i < rowLength; ++i) {
+                packed[y * rowLength + i] = (uint8_t)(((const float*)row)[i] * 255.0f + 0.5f);
+            }
+        } else {
+            memcpy(packed + y * rowLength, row, rowLength);
+        }
+    }
+}
+
+static void
+_resynth_unpack_result(const uint8_t* packed, size_t channels, ImageBuffer* buffer) {
+    size_t rowLength = buffer->width * channels;
+
+    for (size_t y = 0; y < buffer->height; ++y) {
+        unsigned char* row = buffer->data + y * buffer->rowBytes;
+        if (buffer->isFloat) {
+            convertPixelelsToFloats(packed + y * rowLength, (float*)row, rowLength);
+        } else {
+            memcpy(row, packed + y * rowLength, rowLength);
+        }
+    }
+}
+
+/* Fraction of the schedule (passes, and probes per target) a run did: less than 1 if cut for a time budget */
+static double
+_resynth_schedule_done(const TSynthMetrics* metrics) {
+    guint64 quota = 0;
+
+    for (guint pass = 0; pass < metrics->passCount; ++pass) {
+        quota += metrics->passes[pass].probeQuota;
+    }
+    if (metrics->scheduledQuota == 0 || quota >= metrics->scheduledQuota) {
+        return 1.0;
+    }
+    return (double)quota / metrics->scheduledQuota;
+}
+
+/* A preview of a pass, see resynth_parameters_preview(): the engine has written it to outBuffer */
+typedef struct {
+    resynth_parameters_t parameters;
+    const ImageBuffer* outBuffer;
+} _Resynth_preview;
+
+static void
+_resynth_preview_pass(int pass, void* context) {
+    _Resynth_preview* preview = context;
+    preview->parameters->preview(pass, preview->outBuffer->data, preview->outBuffer->rowBytes,
+            preview->parameters->previewUserdata);
+}
+
+/* Run the operation, with the synthesized image written to outBuffer. The state is only read.
+   A canceled run (*cancelFlag set) returns success, with the image unfinished. Metrics are added to, if not NULL.
+   Sources, if not NULL, are written, one per pixel: then the cache is not used, it keeps pixels only. */
+static TImageSynthError
+_resynth_run_into_buffer(resynth_state_t state, resynth_parameters_t parameters, ImageBuffer* outBuffer,
+                         void (*progressCallback)(int, void*), void* progressContext, int* cancelFlag,
+                         TSynthMetrics* metrics, guint* sources) {
+    TImageSynthError result = IMAGE_SYNTH_SUCCESS;
+    double start = metricsSeconds();
+    // A copy, not to write the run's metrics into parameters other runs may share
+    TImageSynthParameters runParameters = *parameters->parameters;
+    TResultCache* cache = (parameters->cache && sources == NULL) ? parameters->cache->resultCache : NULL;
+    size_t channels = _resynth_format_channels(state->imageFormat);
+    size_t packedSize = outBuffer->width * outBuffer->height * channels;
+    uint8_t* packed = NULL;
+    TResultKey key;
+    _Resynth_preview preview = {parameters, outBuffer};
+    TSynthMetrics budgetMetrics = {0};  // to tell whether a budget cut the run, if the caller has no metrics
+
+    if (parameters->timeBudget > 0) {
+        runParameters.deadline = start + parameters->timeBudget;
+        if (metrics == NULL) {
+            metrics = &budgetMetrics;
+        }
+    }
+    runParameters.metrics = metrics;
+    runParameters.sources = sources;
+    if (parameters->preview != NULL) {
+        runParameters.passCallback = _resynth_preview_pass;
+        runParameters.passContext = &preview;
     }
 
+    // Make sure we have a valid mask: the default, all selected, is the run's own, both target and corpus
+    ImageBuffer defaultMask = {0};
+    ImageBuffer* mask = parameters->mask;
+    ImageBuffer* mask2 = parameters->mask2;
+    if (mask == NULL) {
+        defaultMask = _resynth_default_mask(state);
+        mask = &defaultMask;
+        mask2 = &defaultMask;
+    }
+
+    if (cache != NULL) {
+        _resynth_result_key(state, parameters, mask, mask2, &key);
+        packed = malloc(packedSize);
+        if (packed != NULL && lookupResult(cache, &key, packed, packedSize)) {
+            _resynth_unpack_result(packed, channels, outBuffer);
+            free(packed);
+            free(defaultMask.data);
+            if (metrics != NULL) {
+                metrics->seconds = metricsSeconds() - start;
+            }
+            return IMAGE_SYNTH_SUCCESS;
+        }
+    }
+
+    // A prepared corpus is the source of either operation: the state is only the target and its context
+    if (parameters->corpus != NULL) {
+        result = imageSynthIntoCorpus(state->imageBuffer,
+                mask,
+                outBuffer,
+                state->imageFormat,
+                &runParameters,
+                parameters->corpus->corpusContext,
+                progressCallback, progressContext, cancelFlag);
+        if (result != IMAGE_SYNTH_SUCCESS) {
+            fprintf(stderr, "Error running op from prepared corpus: err(%d)\n", result);
+        }
+    }
 
     // "Simple API" does the healing operation
-    if (parameters->op == RESYNTH_OPERATION_HEAL) {
-        printf("Running healing op\n");
-        int cancel_flag = 0;
-        TImageSynthError result = imageSynth(state->imageBuffer,
-                parameters->mask,
+    else if (parameters->op == RESYNTH_OPERATION_HEAL) {
+        result = imageSynthInto(state->imageBuffer,
+                mask,
+                NULL,
+                outBuffer,
                 state->imageFormat,
-                parameters->parameters,
-                &_resynth_progress_callback, NULL, &cancel_flag);
+                &runParameters,
+                progressCallback, progressContext, cancelFlag);
         if (result != IMAGE_SYNTH_SUCCESS) {
-            printf("Error running healing op: err(%d)\n", result);
+            fprintf(stderr, "Error running healing op: err(%d)\n", result);
         }
     }
 
     // "Full API" does everything else
-    if (parameters->op == RESYNTH_OPERATION_TEXTURE) {
-        printf("Running texture op\n");
-        int cancel_flag = 0;
-        TImageSynthError result = imageSynth2(state->imageBuffer,
-                parameters->mask,
-                parameters->mask2,
+    else if (parameters->op == RESYNTH_OPERATION_TEXTURE) {
+        result = imageSynthInto(state->imageBuffer,
+                mask,
+                mask2,
+                outBuffer,
                 state->imageFormat,
-                parameters->parameters,
-                &_resynth_progress_callback, NULL, &cancel_flag);
+                &runParameters,
+                progressCallback, progressContext, cancelFlag);
 
         if (result != IMAGE_SYNTH_SUCCESS) {
-            printf("Error running texture op: err(%d)\n", result);
+            fprintf(stderr, "Error running texture op: err(%d)\n", result);
+        }
+    }
+
+    if (packed != NULL) {
+        // Not a result cut short by the time budget: others may have the time
+        if (result == IMAGE_SYNTH_SUCCESS && ! *cancelFlag
+                && (parameters->timeBudget == 0 || _resynth_schedule_done(metrics) == 1.0)) {
+            _resynth_pack_result(outBuffer, channels, packed);
+            storeResult(cache, &key, packed, packedSize);
         }
+        free(packed);
+    }
+    free(defaultMask.data);
+
+    if (metrics != NULL) {
+        metrics->seconds = metricsSeconds() - start;
     }
+    return result;
+}
 
-    // Copy result, which is stored in the state over to a dedicated result variable
+/* A result the size and format of the state, its pixels (and sources, if the parameters keep them) not yet synthesized */
+static resynth_result_t
+_resynth_new_result(resynth_state_t state, resynth_parameters_t parameters) {
     resynth_result_t result = calloc(1, sizeof(Resynth_result));
     result->imageBuffer = calloc(1, sizeof(ImageBuffer));
-    memcpy(result->imageBuffer, state->imageBuffer, sizeof(ImageBuffer));
-    result->imageBuffer->data = calloc((state->imageBuffer->rowBytes * state->imageBuffer->height) / sizeof(uint8_t), sizeof(uint8_t));
-    memcpy(result->imageBuffer->data, state->imageBuffer->data, state->imageBuffer->rowBytes * state->imageBuffer->height);
+    result->imageBuffer->width = state->imageBuffer->width;
+    result->imageBuffer->height = state->imageBuffer->height;
+    result->imageBuffer->rowBytes = state->imageBuffer->width * _resynth_format_channels(state->imageFormat);
+    result->imageBuffer->data = calloc(result->imageBuffer->rowBytes * result->imageBuffer->height, sizeof(uint8_t));
     result->imageFormat = state->imageFormat;
-    result->valid = true;
+    result->sourceWidth = parameters->corpus != NULL ? parameters->corpus->width : state->imageBuffer->width;
+    if (parameters->isCorrespondence) {
+        result->sources = malloc(state->imageBuffer->width * state->imageBuffer->height * sizeof(guint));
+        assert(result->sources != NULL);
+    }
+    return result;
+}
+
+resynth_result_t 
+resynth_run(resynth_state_t state, resynth_parameters_t parameters) {
+    // The result is synthesized straight into a dedicated result buffer, not into the state then copied
+    resynth_result_t result = _resynth_new_result(state, parameters);
+    int cancel_flag = 0;
+
+    result->valid = _resynth_run_into_buffer(state, parameters, result->imageBuffer,
+            parameters->progress, parameters->progressUserdata, &cancel_flag, &result->metrics,
+            result->sources) == IMAGE_SYNTH_SUCCESS;
 
     return result;
 }
 
+/* Dilates a mask (nonzero selected) by radius pixels, a square: rows, then columns, each by a running count */
+static void
+_resynth_dilate(const uint8_t* mask, uint8_t* dilated, size_t width, size_t height, size_t radius) {
+    uint8_t* rows = calloc(width * height, sizeof(uint8_t));
+    assert(rows != NULL);
+
+    for (size_t y = 0; y < height; ++y) {
+        size_t count = 0;  // selected in [x - radius, x + radius]
+        for (size_t x = 0; x < width + radius; ++x) {
+            if (x < width && mask[y * width + x]) ++count;
+            if (x >= 2 * radius + 1 && mask[y * width + x - 2 * radius - 1]) --count;
+            if (x >= radius) rows[y * width + x - radius] = count > 0;
+        }
+    }
+    for (size_t x = 0; x < width; ++x) {
+        size_t count = 0;
+        for (size_t y = 0; y < height + radius; ++y) {
+            if (y < height && rows[y * width + x]) ++count;
+            if (y >= 2 * radius + 1 && rows[(y - 2 * radius - 1) * width + x]) --count;
+            if (y >= radius) dilated[(y - radius) * width + x] = count > 0;
+        }
+    }
+    free(rows);
+}
+
+resynth_result_t
+resynth_run_incremental(resynth_state_t state, resynth_parameters_t parameters, resynth_result_t previous) {
+    size_t width = state->imageBuffer->width;
+    size_t height = state->imageBuffer->height;
+    size_t size = width * height;
+    size_t channels = _resynth_format_channels(state->imageFormat);
+
+    if (parameters->op != RESYNTH_OPERATION_HEAL || parameters->mask == NULL || parameters->corpus != NULL
+            || previous == NULL || !previous->valid || previous->sources == NULL
+            || previous->imageBuffer->width != width || previous->imageBuffer->height != height
+            || previous->imageFormat != state->imageFormat) {
+        return resynth_run(state, parameters);
+    }
+
+    double start = metricsSeconds();
+    const guint* previousSources = previous->sources;
+    const ImageBuffer* newMask = parameters->mask;
+    resynth_result_t result = _resynth_new_result(state, parameters);
+    TImageSynthParameters runParameters = *parameters->parameters;
+    uint8_t* changed = malloc(size);
+    uint8_t* band = malloc(size);
+    guint* fixedSources = malloc(size * sizeof(guint));
+    ImageBuffer work = {malloc(size * channels), width, height, width * channels, 0};
+    ImageBuffer targetMask = {malloc(size), width, height, width, 0};
+    ImageBuffer corpusMask = {malloc(size), width, height, width, 0};
+    size_t patchRadius = 1;
+    size_t targetCount = 0;
+    int cancel_flag = 0;
+
+    assert(changed != NULL && band != NULL && fixedSources != NULL
+            && work.data != NULL && targetMask.data != NULL && corpusMask.data != NULL);
+    if (result->sources == NULL) {
+        // Kept regardless, for the next incremental run
+        result->sources = malloc(size * sizeof(guint));
+        assert(result->sources != NULL);
+    }
+
+    // Changed: in the target of one run but not the other (the previous target is what has sources)
+    for (size_t y = 0; y < height; ++y) {
+        for (size_t x = 0; x < width; ++x) {
+            bool isTarget = newMask->data[y * newMask->rowBytes + x] != 0;
+            changed[y * width + x] = isTarget != (previousSources[y * width + x] != IMAGE_SYNTH_NO_SOURCE);
+        }
+    }
+    // Pixels a patch away from a change may now match otherwise: the band re-synthesized with the change
+    while ((2 * patchRadius + 1) * (2 * patchRadius + 1) < (size_t)runParameters.patchSize) {
+        ++patchRadius;
+    }
+    _resynth_dilate(changed, band, width, height, patchRadius);
+
+    /* The target: of the new mask, what is new or in the band. The rest of the new mask is kept as context,
+       with its pixels and sources, the previous result's. The corpus is as for a full heal: outside the new mask. */
+    _resynth_pack_result(state->imageBuffer, channels, work.data);
+    for (size_t y = 0; y < height; ++y) {
+        for (size_t x = 0; x < width; ++x) {
+            size_t i = y * width + x;
+            bool isTarget = newMask->data[y * newMask->rowBytes + x] != 0;
+            guint source = previousSources[i];
+            // Kept only if its source is still outside the new mask: else its pixel is of what the mask now covers
+            bool isKept = isTarget && source != IMAGE_SYNTH_NO_SOURCE && !band[i]
+                    && !newMask->data[(source / width) * newMask->rowBytes + source % width];
+
+            targetMask.data[i] = (isTarget && !isKept) ? 0xFF : 0x00;
+            corpusMask.data[i] = isTarget ? 0x00 : 0xFF;
+            fixedSources[i] = isKept ? source : IMAGE_SYNTH_NO_SOURCE;
+            if (isKept) {
+                memcpy(work.data + i * channels, previous->imageBuffer->data + y * previous->imageBuffer->rowBytes
+                        + x * channels, channels);
+            }
+            targetCount += targetMask.data[i] != 0;
+        }
+    }
+
+    if (targetCount == 0) {
+        // Nothing to re-synthesize: the image as the new mask keeps it
+        memcpy(result->imageBuffer->data, work.data, size * channels);
+        memcpy(result->sources, fixedSources, size * sizeof(guint));
+        result->valid = true;
+    } else {
+        runParameters.sources = result->sources;
+        runParameters.fixedSources = fixedSources;
+        runParameters.metrics = &result->metrics;
+        if (parameters->timeBudget > 0) {
+            runParameters.deadline = start + parameters->timeBudget;
+        }
+        TImageSynthError error = imageSynthInto(&work, &targetMask, &corpusMask, result->imageBuffer,
+                state->imageFormat, &runParameters, parameters->progress, parameters->progressUserdata, &cancel_flag);
+        if (error != IMAGE_SYNTH_SUCCESS) {
+            fprintf(stderr, "Error running incremental healing op: err(%d)\n", error);
+        }
+        result->valid = error == IMAGE_SYNTH_SUCCESS;
+    }
+    result->metrics.seconds = metricsSeconds() - start;
+
+    free(changed);
+    free(band);
+    free(fixedSources);
+    free(work.data);
+    free(targetMask.data);
+    free(corpusMask.data);
+    return result;
+}
+
+bool
+resynth_run_into(resynth_state_t state, resynth_parameters_t parameters, uint8_t* pixels, size_t stride) {
+    ImageBuffer outBuffer;
+
+    assert(pixels != NULL);
+    outBuffer.data = pixels;
+    outBuffer.isFloat = 0;
+    outBuffer.width = state->imageBuffer->width;
+    outBuffer.height = state->imageBuffer->height;
+    outBuffer.rowBytes = stride ? stride : state->imageBuffer->width * _resynth_format_channels(state->imageFormat);
+    assert(outBuffer.rowBytes >= outBuffer.width * _resynth_format_channels(state->imageFormat));
+
+    int cancel_flag = 0;
+    return _resynth_run_into_buffer(state, parameters, &outBuffer,
+            parameters->progress, parameters->progressUserdata, &cancel_flag, NULL, NULL) == IMAGE_SYNTH_SUCCESS;
+}
+
+bool
+resynth_run_intof(resynth_state_t state, resynth_parameters_t parameters, float* pixels, size_t stride) {
+    ImageBuffer outBuffer;
+    size_t channels = _resynth_format_channels(state->imageFormat);
+
+    assert(pixels != NULL);
+    assert(stride == 0 || stride >= state->imageBuffer->width * channels * sizeof(float));
+    outBuffer.data = (unsigned char*)pixels;
+    outBuffer.width = state->imageBuffer->width;
+    outBuffer.height = state->imageBuffer->height;
+    outBuffer.rowBytes = stride ? stride : state->imageBuffer->width * channels * sizeof(float);
+    outBuffer.isFloat = 1;
+
+    int cancel_flag = 0;
+    return _resynth_run_into_buffer(state, parameters, &outBuffer,
+            parameters->progress, parameters->progressUserdata, &cancel_flag, NULL, NULL) == IMAGE_SYNTH_SUCCESS;
+}
+
+/* Asynchronous Runs */
+/* Runs a job to completion: as a task of the worker pool, or in the caller without threads */
+static void
+_resynth_job_task(void* taskArgs) {
+    resynth_job_t job = taskArgs;
+    TImageSynthError error = _resynth_run_into_buffer(job->state, job->parameters, job->result->imageBuffer,
+            &_resynth_job_progress_callback, job, &job->cancelFlag, &job->result->metrics, job->result->sources);
+
+#ifdef SYNTH_THREADED
+    job->result->valid = error == IMAGE_SYNTH_SUCCESS && ! __atomic_load_n(&job->cancelFlag, __ATOMIC_RELAXED);
+#else
+    job->result->valid = error == IMAGE_SYNTH_SUCCESS && ! job->cancelFlag;
+#endif
+    // Synthesis may quit early, short of the percent estimated: a job done is done
+    if (job->result->valid) {
+        _resynth_job_progress_callback(100, job);
+    }
+    if (job->callback != NULL) {
+        job->callback(job, job->userdata);
+    }
+    // After this, the job may be freed by a waiter: not touched again
+#ifdef SYNTH_THREADED
+    pthread_mutex_lock(&job->mutex);
+    job->isDone = true;
+    pthread_cond_broadcast(&job->done);
+    pthread_mutex_unlock(&job->mutex);
+#else
+    job->isDone = true;
+#endif
+}
+
+resynth_job_t
+resynth_run_async(resynth_state_t state, resynth_parameters_t parameters,
+                  resynth_job_callback_t callback, void* userdata) {
+    resynth_job_t job = calloc(1, sizeof(Resynth_job));
+
+    assert(state != NULL);
+    assert(parameters != NULL);
+    job->state = state;
+    job->parameters = parameters;
+    job->callback = callback;
+    job->userdata = userdata;
+    job->result = _resynth_new_result(state, parameters);
+
+#ifdef SYNTH_THREADED
+    pthread_mutex_init(&job->mutex, NULL);
+    pthread_cond_init(&job->done, NULL);
+    submitWorkerPoolTask(defaultWorkerPool(), &_resynth_job_task, job);
+#else
+    // No threads: the job is done on return
+    _resynth_job_task(job);
+#endif
+    return job;
+}
+
+int
+resynth_job_progress(resynth_job_t job) {
+#ifdef SYNTH_THREADED
+    return __atomic_load_n(&job->progress, __ATOMIC_RELAXED);
+#else
+    return job->progress;
+#endif
+}
+
+bool
+resynth_job_done(resynth_job_t job) {
+#ifdef SYNTH_THREADED
+    pthread_mutex_lock(&job->mutex);
+    bool isDone = job->isDone;
+    pthread_mutex_unlock(&job->mutex);
+    return isDone;
+#else
+    return job->isDone;
+#endif
+}
+
+void
+resynth_job_cancel(resynth_job_t job) {
+#ifdef SYNTH_THREADED
+    __atomic_store_n(&job->cancelFlag, 1, __ATOMIC_RELAXED);
+#else
+    job->cancelFlag = 1;
+#endif
+}
+
+/* Waits for the job to be done, callback included */
+static void
+_resynth_job_join(resynth_job_t job) {
+#ifdef SYNTH_THREADED
+    pthread_mutex_lock(&job->mutex);
+    while ( ! job->isDone) {
+        pthread_cond_wait(&job->done, &job->mutex);
+    }
+    pthread_mutex_unlock(&job->mutex);
+#endif
+}
+
+resynth_result_t
+resynth_job_wait(resynth_job_t job) {
+    _resynth_job_join(job);
+    resynth_result_t result = job->result;
+    job->result = NULL;
+    return result;
+}
+
+/* Forwards the engine's tile callbacks to the caller's */
+typedef struct {
+    resynth_tile_callback_t read_pixels;
+    resynth_tile_callback_t read_mask;
+    resynth_tile_callback_t read_finished;
+    resynth_tile_callback_t write_pixels;
+    void* userdata;
+} _Resynth_tile_callbacks;
+
+static int
+_resynth_read_pixels_tile(void* context, unsigned int x, unsigned int y, ImageBuffer* tile) {
+    _Resynth_tile_callbacks* callbacks = context;
+    return callbacks->read_pixels(callbacks->userdata, x, y, tile->width, tile->height, tile->data, tile->rowBytes);
+}
+
+static int
+_resynth_read_mask_tile(void* context, unsigned int x, unsigned int y, ImageBuffer* tile) {
+    _Resynth_tile_callbacks* callbacks = context;
+    return callbacks->read_mask(callbacks->userdata, x, y, tile->width, tile->height, tile->data, tile->rowBytes);
+}
+
+static int
+_resynth_read_finished_tile(void* context, unsigned int x, unsigned int y, ImageBuffer* tile) {
+    _Resynth_tile_callbacks* callbacks = context;
+    return callbacks->read_finished(callbacks->userdata, x, y, tile->width, tile->height, tile->data, tile->rowBytes);
+}
+
+static int
+_resynth_write_pixels_tile(void* context, unsigned int x, unsigned int y, ImageBuffer* tile) {
+    _Resynth_tile_callbacks* callbacks = context;
+    return callbacks->write_pixels(callbacks->userdata, x, y, tile->width, tile->height, tile->data, tile->rowBytes);
+}
+
+/* Corpus of a streamed run: the prepared corpus of the parameters, else the corpus state prepared, else none */
+static int
+_resynth_stream_corpus(resynth_parameters_t parameters, resynth_state_t corpus, TImageFormat format,
+                       TCorpusContext** corpusContext) {
+    if (parameters->corpus != NULL) {
+        assert(parameters->corpus->imageFormat == format);
+        *corpusContext = parameters->corpus->corpusContext;
+        return IMAGE_SYNTH_SUCCESS;
+    }
+    if (corpus != NULL) {
+        return imageSynthCorpus(corpus->imageBuffer, NULL, format, parameters->parameters, corpusContext);
+    }
+    *corpusContext = NULL;
+    return IMAGE_SYNTH_SUCCESS;
+}
+
+bool
+resynth_run_tiled(resynth_parameters_t parameters, size_t width, size_t height, size_t channels,
+                  resynth_tile_callback_t read_pixels, resynth_tile_callback_t read_mask,
+                  resynth_tile_callback_t write_pixels, void* userdata,
+                  resynth_state_t corpus, size_t tile_size, size_t halo) {
+    _Resynth_tile_callbacks callbacks = {read_pixels, read_mask, NULL, write_pixels, userdata};
+    TImageFormat format = (channels == 4) ? T_RGBA : T_RGB;
+    int cancel_flag = 0;
+
+    assert(read_pixels != NULL);
+    assert(write_pixels != NULL);
+    assert(channels >= 3);
+    assert(channels <= 4);
+    assert(corpus == NULL || corpus->imageFormat == format);
+
+    // The corpus state is prepared for this run only, a prepared corpus is shared
+    TCorpusContext* corpusContext = NULL;
+    int result = _resynth_stream_corpus(parameters, corpus, format, &corpusContext);
+    if (result != IMAGE_SYNTH_SUCCESS) {
+        fprintf(stderr, "Error preparing corpus: err(%d)\n", result);
+        return false;
+    }
+
+    result = imageSynthTiled(width, height,
+            &_resynth_read_pixels_tile,
+            read_mask ? &_resynth_read_mask_tile : NULL,
+            &_resynth_write_pixels_tile,
+            &callbacks,
+            corpusContext,
+            format,
+            tile_size, halo,
+            parameters->parameters,
+            parameters->progress, parameters->progressUserdata, &cancel_flag);
+    if (result != IMAGE_SYNTH_SUCCESS) {
+        fprintf(stderr, "Error running tiled op: err(%d)\n", result);
+    }
+    if (parameters->corpus == NULL && corpusContext != NULL) {
+        imageSynthFreeCorpus(corpusContext);
+    }
+    return result == IMAGE_SYNTH_SUCCESS;
+}
+
+bool
+resynth_run_region(resynth_parameters_t parameters, size_t width, size_t height, size_t channels,
+                   resynth_tile_callback_t read_pixels, resynth_tile_callback_t read_mask,
+                   resynth_tile_callback_t read_finished, resynth_tile_callback_t write_pixels, void* userdata,
+                   resynth_state_t corpus, size_t x, size_t y, size_t region_width, size_t region_height,
+                   size_t halo) {
+    _Resynth_tile_callbacks callbacks = {read_pixels, read_mask, read_finished, write_pixels, userdata};
+    TImageFormat format = (channels == 4) ? T_RGBA : T_RGB;
+    int cancel_flag = 0;
+
+    assert(read_pixels != NULL);
+    assert(read_finished != NULL);
+    assert(write_pixels != NULL);
+    assert(channels >= 3);
+    assert(channels <= 4);
+    assert(corpus == NULL || corpus->imageFormat == format);
+
+    TCorpusContext* corpusContext = NULL;
+    int result = _resynth_stream_corpus(parameters, corpus, format, &corpusContext);
+    if (result != IMAGE_SYNTH_SUCCESS) {
+        fprintf(stderr, "Error preparing corpus: err(%d)\n", result);
+        return false;
+    }
+
+    result = imageSynthRegion(width, height, x, y, region_width, region_height,
+            &_resynth_read_pixels_tile,
+            read_mask ? &_resynth_read_mask_tile : NULL,
+            &_resynth_read_finished_tile,
+            &_resynth_write_pixels_tile,
+            &callbacks,
+            corpusContext,
+            format,
+            halo,
+            parameters->parameters,
+            parameters->progress, parameters->progressUserdata, &cancel_flag);
+    if (result != IMAGE_SYNTH_SUCCESS) {
+        fprintf(stderr, "Error running region op: err(%d)\n", result);
+    }
+    if (parameters->corpus == NULL && corpusContext != NULL) {
+        imageSynthFreeCorpus(corpusContext);
+    }
+    return result == IMAGE_SYNTH_SUCCESS;
+}
+
 bool 
 resynth_result_valid(resynth_result_t result) {
     return result->valid;
@@ -306,9 +1487,9 @@ resynth_result_pixelsf(resynth_result_t result) {
         result->imageBufferf->height = result->imageBuffer->height;
         result->imageBufferf->rowBytes = result->imageBufferf->width * pixelel_size;
         result->imageBufferf->data = calloc(result->imageBufferf->width * result->imageBufferf->height, pixelel_size);
-        for (int i = 0; i < result->imageBuffer->height * result->imageBuffer->width * pixelel_count; ++i) {
-            ((float*)result->imageBufferf->data)[i] = ((float)result->imageBuffer->data[i]) / 255;
-        }
+        result->imageBufferf->isFloat = 1;
+        convertPixelelsToFloats(result->imageBuffer->data, (float*)result->imageBufferf->data,
+                result->imageBuffer->height * result->imageBuffer->width * pixelel_count);
     }
 
     return (float*)result->imageBufferf->data;
@@ -326,21 +1507,79 @@ resynth_result_height(resynth_result_t result) {
 
 size_t
 resynth_result_channels(resynth_result_t result) {
-    if (result->imageFormat == T_RGB)
-        return 3;
-    if (result->imageFormat == T_RGBA)
-        return 4;
-    if (result->imageFormat == T_Gray)
-        return 1;
-    if (result->imageFormat == T_GrayA)
-        return 2;
-    return 0;
+    return _resynth_format_channels(result->imageFormat);
+}
+
+resynth_metrics_t
+resynth_result_metrics(resynth_result_t result) {
+    resynth_metrics_t metrics = {0};
+
+    metrics.seconds = result->metrics.seconds;
+    metrics.pass_count = result->metrics.passCount;
+    metrics.schedule_done = _resynth_schedule_done(&result->metrics);
+    for (size_t pass = 0; pass < result->metrics.passCount; ++pass) {
+        const TPassMetrics* passMetrics = &result->metrics.passes[pass];
+        metrics.passes[pass].seconds = passMetrics->seconds;
+        metrics.passes[pass].targets = passMetrics->targets;
+        metrics.passes[pass].probes = passMetrics->probes;
+        metrics.passes[pass].early_outs = passMetrics->probes - passMetrics->betterments;
+        metrics.passes[pass].perfect_matches = passMetrics->perfectMatches;
+        metrics.passes[pass].neighbor_wins = passMetrics->neighborWins;
+        metrics.passes[pass].index_wins = passMetrics->indexWins;
+        metrics.passes[pass].random_wins = passMetrics->randomWins;
+        metrics.passes[pass].betters = passMetrics->betters;
+        metrics.passes[pass].gpu_probes = passMetrics->deviceProbes;
+        metrics.passes[pass].cascade_rejects = passMetrics->descriptorRejects;
+    }
+    return metrics;
+}
+
+const uint32_t*
+resynth_result_correspondence(resynth_result_t result) {
+    return result->valid ? result->sources : NULL;
+}
+
+bool
+resynth_result_apply(resynth_result_t result, const resynth_layer_t* layers, size_t layer_count, int scale) {
+    size_t width = result->imageBuffer->width;
+    size_t height = result->imageBuffer->height;
+    size_t sourceWidth = result->sourceWidth;
+
+    if (!result->valid || result->sources == NULL || scale < 1) {
+        return false;
+    }
+    // One pass over the sources, each into every layer: a scale x scale block of pixels per source
+    for (size_t y = 0; y < height * scale; ++y) {
+        const guint* row = result->sources + (y / scale) * width;
+        size_t dy = y % scale;
+        for (size_t x = 0; x < width * scale; ++x) {
+            guint source = row[x / scale];
+            if (source == IMAGE_SYNTH_NO_SOURCE) {
+                continue;
+            }
+            size_t sourceX = (source % sourceWidth) * scale + x % scale;
+            size_t sourceY = (source / sourceWidth) * scale + dy;
+            for (size_t i = 0; i < layer_count; ++i) {
+                const resynth_layer_t* layer = &layers[i];
+                memcpy(layer->pixels + y * layer->stride + x * layer->channels,
+                       layer->source + sourceY * layer->source_stride + sourceX * layer->channels, layer->channels);
+            }
+        }
+    }
+    return true;
 }
 
 /* Memory Management */ 
 void
 resynth_free_state(resynth_state_t state) {
-    free(state->imageBuffer->data);
+    if (!state->isBorrowed) {
+        free(state->imageBuffer->data);
+    }
+#ifndef _WIN32
+    if (state->mapping != NULL) {
+        munmap(state->mapping, state->mappingBytes);
+    }
+#endif
     free(state->imageBuffer);
     free(state);
 }
@@ -353,6 +1592,38 @@ resynth_free_parameters(resynth_parameters_t parameters) {
     free(parameters);
 }
 
+void
+resynth_free_corpus(resynth_corpus_t corpus) {
+    imageSynthFreeCorpus(corpus->corpusContext);
+    free(corpus->placements);
+    free(corpus);
+}
+
+void
+resynth_free_workspace(resynth_workspace_t workspace) {
+    freeWorkspace(workspace->workspace);
+    free(workspace);
+}
+
+void
+resynth_free_cache(resynth_cache_t cache) {
+    freeResultCache(cache->resultCache);
+    free(cache);
+}
+
+void
+resynth_free_job(resynth_job_t job) {
+    _resynth_job_join(job);
+#ifdef SYNTH_THREADED
+    pthread_mutex_destroy(&job->mutex);
+    pthread_cond_destroy(&job->done);
+#endif
+    if (job->result != NULL) {
+        resynth_free_result(job->result);
+    }
+    free(job);
+}
+
 void
 resynth_free_result(resynth_result_t result) {
     free(result->imageBuffer->data);
@@ -361,6 +1632,7 @@ resynth_free_result(resynth_result_t result) {
         free(result->imageBufferf->data);
         free(result->imageBufferf);
     }
+    free(result->sources);
     free(result);
 }
 
@@ -100,6 +100,7 @@ print_post_stats()
   g_printf("Corpus pixels tried %d\n", countSourceTries);
   /* Which part of the algorithm or heuristic found the source. */
   g_printf("Bettered by random %d\n", bettermentStats[RANDOM_CORPUS]);
+  g_printf("Bettered by index %d\n", bettermentStats[INDEXED_CORPUS]);
   g_printf("Bettered by neighbor's source %d\n", bettermentStats[NEIGHBORS_SOURCE]);
   // g_printf("Bettered by neighbor itself %d\n", bettermentStats[NEIGHBOR_ITSELF]);
   // g_printf("Bettered by prior source %d\n", bettermentStats[PRIOR_REP_SOURCE]);
@@ -0,0 +1,108 @@
+/*
+Metrics of a run: what synthesis did, pass by pass, e.g. to tune parameters.
+
+Replaces the counters of stats.h, which were global, not thread safe, and compiled only under STATS.
+Always counted: synthesize() counts in a record on its own stack (no sharing, nothing atomic),
+adds it to its thread's record of the pass when it returns, and refiner() merges threads after each pass.
+That costs a few increments per probe, so it stays on.
+Reported only if the parameters have somewhere to put it, see engineParams.h.
+
+Passes of every level of the pyramid, and of every tile of a streamed run, add up by pass index.
+*/
+
+#ifndef __SYNTH_METRICS_H__
+#define __SYNTH_METRICS_H__
+
+#include <time.h>     // clock_gettime
+
+typedef struct passMetricsStruct {
+  double seconds;         // wall time
+  guint64 targets;        // target points synthesized
+  guint64 probes;         // corpus points whose patch was compared, see computeBestFit()
+  guint64 betterments;    // probes better than the best so far: the others were short circuited
+  guint64 perfectMatches;
+  guint64 neighborWins;   // target points whose best was found by heuristic 1, from the sources of neighbors
+  guint64 indexWins;      // ... by candidates of the patch index
+  guint64 randomWins;     // ... by random probes
+  guint64 betters;        // target points given a new source, see repeatCountBetters in synthesize()
+  guint64 probeQuota;     // random probes allowed, summed over targets: fewer than maxProbeCount each nearing a deadline
+  guint64 deviceProbes;   // of probes, random probes compared on a GPU, see deviceBatch.h
+  guint64 descriptorRejects;  // of probes, rejected by descriptors before their patch, see patchDescriptor.h
+} TPassMetrics;
+
+struct synthMetricsStruct {
+  double seconds;         // wall time of the run
+  guint passCount;        // passes run, the most of any level
+  TPassMetrics passes[MAX_PASSES];
+  guint64 scheduledQuota; // probeQuota of the passes scheduled (not ended by converging), without a deadline
+};
+
+
+// Seconds on a monotonic clock, for differences only
+static inline double
+metricsSeconds(void)
+{
+  struct timespec now;
+#ifdef CLOCK_MONOTONIC
+  clock_gettime(CLOCK_MONOTONIC, &now);
+#else
+  timespec_get(&now, TIME_UTC);
+#endif
+  return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+
+static inline void
+addPassMetrics(
+  TPassMetrics* sum,          // IN/OUT
+  const TPassMetrics* more    // IN
+  )
+{
+  sum->seconds += more->seconds;
+  sum->targets += more->targets;
+  sum->probes += more->probes;
+  sum->betterments += more->betterments;
+  sum->perfectMatches += more->perfectMatches;
+  sum->neighborWins += more->neighborWins;
+  sum->indexWins += more->indexWins;
+  sum->randomWins += more->randomWins;
+  sum->betters += more->betters;
+  sum->probeQuota += more->probeQuota;
+  sum->deviceProbes += more->deviceProbes;
+  sum->descriptorRejects += more->descriptorRejects;
+}
+
+
+// Add a pass to the metrics of the run, if any
+static inline void
+recordPassMetrics(
+  TSynthMetrics* metrics,     // IN/OUT or NULL
+  guint pass,
+  const TPassMetrics* passMetrics
+  )
+{
+  if ( ! metrics ) return;
+  addPassMetrics(&metrics->passes[pass], passMetrics);
+  if (metrics->passCount < pass + 1)
+    metrics->passCount = pass + 1;
+}
+
+
+// Add passes [fromPass, toPass) of the schedule at full probes to the quota of the run, if any
+static inline void
+recordScheduledPasses(
+  TSynthMetrics* metrics,     // IN/OUT or NULL
+  TRepetionParameters repetition_params,
+  guint fromPass,
+  guint toPass,
+  guint maxProbeCount
+  )
+{
+  guint pass;
+  
+  if ( ! metrics ) return;
+  for (pass=fromPass; pass<toPass; pass++)
+    metrics->scheduledQuota += (guint64) repetition_params[pass][1] * maxProbeCount;
+}
+
+#endif /* __SYNTH_METRICS_H__ */
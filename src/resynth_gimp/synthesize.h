@@ -21,35 +21,81 @@ Innermost routines of image synthesis.
   #define __attribute__(X)
 #endif
 
+// A hint to load a cache line, before a probe reads it.  Nothing where the compiler has none.
+#if defined(__GNUC__) || defined(__clang__)
+  #define PREFETCH(address) __builtin_prefetch(address)
+#else
+  #define PREFETCH(address)
+#endif
+
+/*
+Random probes drawn and prefetched at once, see the random probes of synthesizeOfLayout().
+One with glib: its generator is opaque, so a block drawn past a perfect match can't be undrawn.
+*/
+#ifdef SYNTH_USE_GLIB
+  #define PROBE_BLOCK 1
+#else
+  #define PROBE_BLOCK IMAGE_SYNTH_PROBE_BLOCK
+#endif
+
 #ifdef VECTORIZED
 
 #include <mmintrin.h> // intrinsics for assembly language MMX op codes, for sse2 xmmintrin.h
 #endif
 
+/*
+Publication of synthesized pixels among threads.
+
+Formerly a global mutex was locked to read the color and source of every neighbor,
+and to write the color and source of every bettered target pixel.
+With many threads that lock was the main point of serialization.
+
+Now no lock: the source alone is published, atomically, as one 64-bit word.
+The color of a synthesized target pixel is always the color of its source in the corpus,
+so a reader that sees a source takes the color from the corpus, never a torn pair.
+A reader that sees no source (context, or a target pixel not yet synthesized)
+takes the color from the target, and checks the source again after, like a seqlock:
+the writer publishes the source BEFORE it writes the color.
+(Each target point is written by one thread only during a pass, so there is one writer.)
+*/
 #ifdef SYNTH_THREADED
-   /*
-   * Threaded synthesis uses mutex on read and write to certain shared data among threads.
-   * You COULD use threads without mutex.
-   * Then there is a very small chance that color will be scrambled, resulting in a color not found in corpus.
-   * Also, if integer writes are not atomic, there is a small chance that sourceOf will be scrambled,
-   * resulting in soft errors.
-   * And since mutex locking is fast in Linux, we use mutex rather than risk soft errors.
-   */
-
-  #ifdef SYNTH_USE_GLIB_THREADS
-    static GMutex mutex;
-  #else
-    // Use POSIX instead
-    #include <pthread.h>
-    pthread_mutex_t mutex;
-    // proxies for glib mutex functions are in glibProxy.c, .h
-  #endif
-
-#else   // No threads: redefine mutex functions to nil
-  #define g_mutex_lock(A)
-  #define g_mutex_unlock(A)
+  #define SYNTH_LOAD_ACQUIRE(from, to)  __atomic_load((from), (to), __ATOMIC_ACQUIRE)
+  #define SYNTH_STORE_RELAXED(to, from)  __atomic_store((to), (from), __ATOMIC_RELAXED)
+  #define SYNTH_FENCE_ACQUIRE() __atomic_thread_fence(__ATOMIC_ACQUIRE)
+  #define SYNTH_FENCE_RELEASE() __atomic_thread_fence(__ATOMIC_RELEASE)
+#else
+  #define SYNTH_LOAD_ACQUIRE(from, to)  (*(to) = *(from))
+  #define SYNTH_STORE_RELAXED(to, from)  (*(to) = *(from))
+  #define SYNTH_FENCE_ACQUIRE()
+  #define SYNTH_FENCE_RELEASE()
 #endif
 
+static inline Coordinates
+acquireSourceOf (
+  Coordinates target_point,
+  Map* sourceOfMap,
+  guint corpusWidth
+  )
+{
+  guint packed;
+  SYNTH_LOAD_ACQUIRE(intmap_index(sourceOfMap, target_point), &packed);
+  return unpackSourceOf(packed, corpusWidth);
+}
+
+/* Publish the new source of a target point.  Caller then writes the color, after the fence. */
+static inline void
+publishSourceOf (
+  Coordinates target_point,
+  Coordinates source_corpus_point,
+  Map* sourceOfMap,
+  guint corpusWidth
+  )
+{
+  guint packed = packSourceOf(source_corpus_point, corpusWidth);
+  SYNTH_STORE_RELAXED(intmap_index(sourceOfMap, target_point), &packed);
+  SYNTH_FENCE_RELEASE();
+}
+
 
 // Match result kind
 typedef enum  BettermentKindEnum 
@@ -59,6 +105,7 @@ typedef enum  BettermentKindEnum
   GENERIC_BETTERMENT,
   NEIGHBORS_SOURCE,
   RANDOM_CORPUS,
+  INDEXED_CORPUS,
   MAX_BETTERMENT_KIND
 } tBettermentKind;
 
@@ -144,40 +191,193 @@ has_source_neighbor (
 }
 
 
-/* Copy the source of a neighbor point into the neighbor array. */
+/*
+Create a neighbor.  Initialize: offset, source, and pixel.
+Consistent with writers in other threads without a lock, see publishSourceOf().
+*/
 static inline void
-set_neighbor_state (
-  guint n_neighbour,          // index in neighbors
-  Coordinates neighbor_point,  // coords in image (context or target)
+new_neighbor(
+  const guint index,
+  Coordinates offset,
+  Coordinates neighbor_point,
+  const TPixelelLayout layout,
+  Map* targetMap,
+  Map* corpusMap,
   Map* sourceOfMap,
   TNeighbor neighbors[]
-  ) 
+  )
 {
-  /* Assert neighbor point has values (we already checked that the candidate neighbor had a value.) */
-  neighbors[n_neighbour].sourceOf = getSourceOf(neighbor_point, sourceOfMap);
-}
+  TPixelelIndex k;
+  Coordinates source;
   
-/* Create a neighbor.  Initialize: offset, status, and pixel. */
+  neighbors[index].offset = offset;
+  source = acquireSourceOf(neighbor_point, sourceOfMap, corpusMap->width);
+  // Copy whole Pixel, all pixelels.  Only color pixelels are written by synthesis.
+  for (k=0; k<layout.totalBpp; k++)
+    neighbors[index].pixel[k] = pixmap_index(targetMap, neighbor_point)[k];
+  if (source.x == -1)
+  {
+    // Colors copied from target are good unless a writer published a source meanwhile
+    SYNTH_FENCE_ACQUIRE();
+    source = acquireSourceOf(neighbor_point, sourceOfMap, corpusMap->width);
+  }
+  if (source.x != -1)
+    // Color of a synthesized pixel is color of its source
+    for(k=FIRST_PIXELEL_INDEX; k<layout.colorEndBip; k++)
+      neighbors[index].pixel[k] = pixmap_index(corpusMap, source)[k];
+  neighbors[index].sourceOf = source;
+}
+
+
+/*
+Keep an offset (and its point) among the nearest found, in the order of the table (lessOffset),
+dropping the farthest if already wanted many.
+*/
 static inline void
-new_neighbor(
-  const guint index,
+keepNearestOffset(
+  Coordinates offsets[],  // IN/OUT ascending
+  Coordinates points[],   // IN/OUT
+  guint* found,           // IN/OUT
+  guint wanted,
   Coordinates offset,
-  Coordinates neighbor_point,
-  TFormatIndices* indices,
+  Coordinates point
+  )
+{
+  guint j;
+
+  if (*found == wanted && lessOffset(&offset, &offsets[*found-1]) > 0) return;
+  if (*found < wanted) (*found)++;
+  for(j=*found-1; j>0 && lessOffset(&offset, &offsets[j-1]) < 0; j--)
+  {
+    offsets[j] = offsets[j-1];
+    points[j] = points[j-1];
+  }
+  offsets[j] = offset;
+  points[j] = point;
+}
+
+
+/*
+Neighbors beyond the table of sortedOffsets (a disc, see prepareSortedOffsets()), within the span of offsets.
+Only for sparse patches, e.g. early in the first pass, when the table yields fewer than patchSize neighbors.
+
+Searches outward from the disc, keeping the nearest found in the order of the table,
+until no nearer can be found: same neighbors as if the table spanned everything.
+Searches square rings of cells of the valued grid, visiting only pixels of cells having values, see valuedGrid.h.
+Except when tiling, where offsets wrap: searches square rings of offsets, testing every pixel.
+Returns the new count of neighbors.
+*/
+static guint
+prepareFartherNeighbors(
+  Coordinates position, // IN target point
+  TImageSynthParameters *parameters, // IN
+  const TPixelelLayout layout,
   Map* targetMap,
+  Map* corpusMap,
+  Map* hasValueMap,
+  TValuedGrid* valuedGrid,
   Map* sourceOfMap,
+  pointVector sortedOffsets,
+  guint count,  // IN count of neighbors from the table
   TNeighbor neighbors[]
   )
 {
-  neighbors[index].offset = offset;
-  g_mutex_lock(&mutex);  // Read color and source atomically
-  set_neighbor_state(index, neighbor_point, sourceOfMap, neighbors);
+  gint width = (corpusMap->width < targetMap->width ? corpusMap->width : targetMap->width);
+  gint height = (corpusMap->height < targetMap->height ? corpusMap->height : targetMap->height);
+  gint tableDistance = offsetDistance(g_array_index(sortedOffsets, Coordinates, sortedOffsets->len - 1));
+  guint wanted = (guint) parameters->patchSize - count;
+  Coordinates offsets[IMAGE_SYNTH_MAX_NEIGHBORS];  // Found, ascending, at most wanted
+  Coordinates points[IMAGE_SYNTH_MAX_NEIGHBORS];
+  guint found = 0;
+  guint i;
+  gint ring;
+  
+  if ( ! parameters->isMakeSeamlesslyTileableHorizontally && ! parameters->isMakeSeamlesslyTileableVertically )
   {
-  TPixelelIndex k;
-  for (k=0; k<indices->total_bpp; k++)  // !!! Copy whole Pixel, all pixelels
-    neighbors[index].pixel[k] = pixmap_index(targetMap, neighbor_point)[k];
+    Coordinates center = {position.x >> VALUED_GRID_CELL_SHIFT, position.y >> VALUED_GRID_CELL_SHIFT};
+    gint maxRing = (gint) (valuedGrid->counts.width > valuedGrid->counts.height
+      ? valuedGrid->counts.width : valuedGrid->counts.height);
+    
+    for(ring=0; ring<=maxRing; ring++)
+    {
+      // Pixels of cells of this ring are at least this far, in some dimension
+      gint nearest = ring ? (ring - 1) * VALUED_GRID_CELL_SIZE + 1 : 0;
+      gint ci, cj;
+      
+      if (found == wanted && nearest*nearest > offsetDistance(offsets[found-1])) break;
+      for(cj=-ring; cj<=ring; cj++)
+        for(ci=-ring; ci<=ring; ci+= (cj == -ring || cj == ring || ring == 0) ? 1 : 2*ring)
+        {
+          Coordinates cell = {center.x + ci, center.y + cj};
+          gint left, top, right, bottom;
+          gint dx, dy, x, y;
+          
+          // Before the corners: a cell off the grid may be negative, which does not shift
+          if (cell.x < 0 || cell.y < 0
+            || cell.x >= (gint) valuedGrid->counts.width || cell.y >= (gint) valuedGrid->counts.height)
+            continue;
+          if ( ! valuedCount(valuedGrid, cell) ) continue;
+          left = cell.x << VALUED_GRID_CELL_SHIFT;
+          top = cell.y << VALUED_GRID_CELL_SHIFT;
+          right = left + VALUED_GRID_CELL_SIZE - 1;
+          bottom = top + VALUED_GRID_CELL_SIZE - 1;
+          // Nearest pixel of the cell
+          dx = (left > position.x) ? left - position.x : (position.x > right) ? position.x - right : 0;
+          dy = (top > position.y) ? top - position.y : (position.y > bottom) ? position.y - bottom : 0;
+          if (found == wanted && dx*dx + dy*dy > offsetDistance(offsets[found-1])) continue;
+          
+          if (right >= (gint) targetMap->width) right = targetMap->width - 1;
+          if (bottom >= (gint) targetMap->height) bottom = targetMap->height - 1;
+          for(y=top; y<=bottom; y++)
+            for(x=left; x<=right; x++)
+            {
+              Coordinates point = {x, y};
+              Coordinates offset = {x - position.x, y - position.y};
+              
+              if (offset.x <= -width || offset.x >= width || offset.y <= -height || offset.y >= height) continue;  // Beyond the span
+              if (offsetDistance(offset) <= tableDistance) continue;  // In the table
+              if ( ! getHasValue(point, hasValueMap) ) continue;
+              keepNearestOffset(offsets, points, &found, wanted, offset, point);
+            }
+        }
+    }
   }
-  g_mutex_unlock(&mutex);
+  else
+  {
+    gint maxRing = (width > height ? width : height) - 1;
+    
+    // First ring that has offsets outside the disc
+    for(ring=1; 2*ring*ring <= tableDistance; ring++);
+    
+    for(; ring<=maxRing; ring++)
+    {
+      gint x, y;
+      
+      // Rings farther than the farthest wanted can't improve
+      if (found == wanted && ring*ring > offsetDistance(offsets[found-1])) break;
+      for(y=-ring; y<=ring; y++)
+        for(x=-ring; x<=ring; x+= (y == -ring || y == ring) ? 1 : 2*ring)
+        {
+          Coordinates offset = {x, y};
+          Coordinates neighbor_point;
+          
+          if (x <= -width || x >= width || y <= -height || y >= height) continue;  // Beyond the span
+          if (offsetDistance(offset) <= tableDistance) continue;  // In the table
+          neighbor_point = add_points(position, offset);
+          if ( ! clipToTargetOrWrapIfTiled(parameters, targetMap, &neighbor_point)
+            || ! getHasValue(neighbor_point, hasValueMap) )
+            continue;
+          keepNearestOffset(offsets, points, &found, wanted, offset, neighbor_point);
+        }
+    }
+  }
+  
+  for(i=0; i<found; i++)
+  {
+    new_neighbor(count, offsets[i], points[i], layout, targetMap, corpusMap, sourceOfMap, neighbors);
+    count++;
+  }
+  return count;
 }
 
 
@@ -189,13 +389,15 @@ Neighbors array is global, used both for heuristic and in synthing every point (
 Neighbors describes a patch, a shotgun pattern in the first pass, or a contiguous patch in later passes.
 It is stored in an array, but is not necessarily a square, contiguous patch.
 */
-static guint 
+static inline guint 
 prepare_neighbors(
   Coordinates position, // IN target point
   TImageSynthParameters *parameters, // IN
-  TFormatIndices* indices,
+  const TPixelelLayout layout,
   Map* targetMap,
+  Map* corpusMap,
   Map* hasValueMap,
+  TValuedGrid* valuedGrid,
   Map* sourceOfMap,
   pointVector sortedOffsets,
   TNeighbor neighbors[]
@@ -208,7 +410,7 @@ prepare_neighbors(
   
   // Target point is always its own first neighbor, even though on startup and first pass it doesn't have a value.
   offset = g_array_index(sortedOffsets, Coordinates, 0);
-  new_neighbor(count, offset, position, indices, targetMap, sourceOfMap, neighbors);
+  new_neighbor(count, offset, position, layout, targetMap, corpusMap, sourceOfMap, neighbors);
   count++;
     
   for(j=1; j<sortedOffsets->len; j++) // !!! Start at 1
@@ -222,11 +424,15 @@ prepare_neighbors(
           // AND ( is neighbor outside target (context) OR inside target with already synthed value )
       ) 
     {
-      new_neighbor(count, offset, neighbor_point, indices, targetMap, sourceOfMap, neighbors);
+      new_neighbor(count, offset, neighbor_point, layout, targetMap, corpusMap, sourceOfMap, neighbors);
       count++;
       if (count >= (guint) parameters->patchSize) break;
     }
   }
+  if (count < (guint) parameters->patchSize)
+    count = prepareFartherNeighbors(position, parameters, layout,
+      targetMap, corpusMap, hasValueMap, valuedGrid, sourceOfMap, sortedOffsets,
+      count, neighbors);
   
   /*
   Note the neighbors are in order of distance from the target pixel.
@@ -244,6 +450,80 @@ prepare_neighbors(
 }
 
 
+// Descriptor of a patch: whether its neighbors after the target point begin with the whole ring
+static inline gboolean
+patchDescriptorOfNeighbors(
+  const TPixelelLayout layout,
+  const guint countNeighbors,
+  const TNeighbor neighbors[],
+  gint descriptor[MAX_IMAGE_SYNTH_BPP]   // OUT
+  )
+{
+  guint i;
+  TPixelelIndex j;
+
+  // Offsets are distinct: eight of them one away are the ring
+  if (countNeighbors <= PATCH_DESCRIPTOR_RING) return FALSE;
+  for (i=1; i<=PATCH_DESCRIPTOR_RING; i++)
+    if (abs(neighbors[i].offset.x) > 1 || abs(neighbors[i].offset.y) > 1)
+      return FALSE;
+  for (j=FIRST_PIXELEL_INDEX; j<layout.colorEndBip; j++)
+  {
+    descriptor[j - FIRST_PIXELEL_INDEX] = 0;
+    for (i=1; i<=PATCH_DESCRIPTOR_RING; i++)
+      descriptor[j - FIRST_PIXELEL_INDEX] += neighbors[i].pixel[j];
+  }
+  return TRUE;
+}
+
+
+/*
+Copy the patch into a structure of arrays: deltas into the guarded corpus, see guardedCorpus.h,
+and pixelels for a vectorized kernel, see patchKernel.h.
+*/
+static void
+preparePatchVectors(
+  const TPixelelLayout layout,
+  const guint countNeighbors,
+  const TNeighbor neighbors[],
+  TPatchVectors* patch      // IN/OUT kernel, metrics and guarded corpus already set
+  )
+{
+  guint i;
+  TPixelelIndex j;
+  
+  patch->count = countNeighbors;
+  patch->hasDescriptor = patch->descriptors
+    && patchDescriptorOfNeighbors(layout, countNeighbors, neighbors, patch->descriptor);
+  patch->clippedWeight = MAX_WEIGHT*(layout.colorEndBip - FIRST_PIXELEL_INDEX)
+    + patch->mapsMetric[0]*(layout.mapEndBip - layout.mapStartBip);
+  patch->isInBand = TRUE;
+  for(i=0; i<countNeighbors; i++)
+  {
+    patch->isInBand &= isInGuardBand(patch->guardedCorpus, neighbors[i].offset);
+    patch->deltas[i] = guardedDelta(patch->guardedCorpus, neighbors[i].offset);
+  }
+  
+  if ( ! patch->kernel || ! patch->isInBand ) return;
+  
+  patch->colorCount = 0;
+  for(j=FIRST_PIXELEL_INDEX; j<layout.colorEndBip; j++)
+    patch->colorBips[patch->colorCount++] = j;
+  patch->mapCount = 0;
+  for(j=layout.mapStartBip; j<layout.mapEndBip; j++)
+    patch->mapBips[patch->mapCount++] = j;
+  patch->isHighWord = (layout.colorEndBip > 4) || (patch->mapCount > 0 && layout.mapEndBip > 4);
+  
+  for(i=0; i<countNeighbors; i++)
+  {
+    for(j=0; j<patch->colorCount; j++)
+      patch->colorPixelels[j][i] = LIMIT_DOMAIN + neighbors[i].pixel[patch->colorBips[j]];
+    for(j=0; j<patch->mapCount; j++)
+      patch->mapPixelels[j][i] = LIMIT_DOMAIN + neighbors[i].pixel[patch->mapBips[j]];
+  }
+}
+
+
 
 
   
@@ -269,23 +549,71 @@ Then does it make sense to also use MAX_WEIGHT for missing neighbors?
 static inline gboolean // TODO tBettermentKind, but very subtle 
 computeBestFit(
   const Coordinates point, 
-  const TFormatIndices * const indices,
+  const TPixelelLayout layout,
   const Map * const corpusMap,
   guint * const bestPatchDiff,  // OUT
   Coordinates * const bestMatchCorpusPoint, // OUT
   const guint countNeighbors,
   const TNeighbor const neighbors[],
+  const TPatchVectors* patchVectors,
   tBettermentKind* latestBettermentKind,
   const tBettermentKind bettermentKind,
   const TPixelelMetricFunc corpusTargetMetric,  // array pointers
-  const TMapPixelelMetricFunc mapsMetric
+  const TMapPixelelMetricFunc mapsMetric,
+  TPassMetrics* const metrics   // IN/OUT
   ) 
 {
   guint sum = 0;
   guint i; 
   
-#ifdef STATS
-  countSourceTries++;
+  metrics->probes++;
+#ifndef SYMMETRIC_METRIC_TABLE
+  // Cascade rejection: surely no better, by descriptors alone, see patchDescriptor.h
+  if (patchVectors->hasDescriptor
+      && isRejectedByDescriptor(patchVectors->descriptors, patchVectors->descriptor, point, *bestPatchDiff))
+  {
+    metrics->descriptorRejects++;
+    return FALSE;
+  }
+#endif
+#if !defined(SYMMETRIC_METRIC_TABLE) && !defined(VECTORIZED)
+  if (patchVectors->isInBand)
+  {
+    /*
+    Same as the loop below, but in the guarded corpus: no clipping, and no multiplying to index a pixel.
+    Point is in the corpus, and all its neighbors in the corpus or in the band around it.
+    */
+    const Pixelel * corpus_pixels = guardedPixel(patchVectors->guardedCorpus, point);
+    
+    for(i=0; i<countNeighbors; i++)
+    {
+      const Pixelel * corpus_pixel;
+      const Pixelel * image_pixel;
+      
+      if (i == PATCH_SCALAR_PREFIX && patchVectors->kernel)
+      {
+        // Rest of a patch not short circuited so far: vectorized, same sum, see patchKernel.h
+        sum = patchVectors->kernel(patchVectors, corpus_pixels, i, sum, *bestPatchDiff);
+        break;
+      }
+      corpus_pixel = corpus_pixels + patchVectors->deltas[i];
+      image_pixel = neighbors[i].pixel;
+      if (corpus_pixel[MASK_PIXELEL_INDEX] != MASK_TOTALLY_SELECTED)  // Masked, or clipped into the band
+        sum += patchVectors->clippedWeight;
+      else
+      {
+        TPixelelIndex j;
+        if (i)  // If not the target point, see below
+          for(j=FIRST_PIXELEL_INDEX; j<layout.colorEndBip; j++)
+            sum += corpusTargetMetric[ 256u + image_pixel[j] - corpus_pixel[j] ];
+        if (layout.mapEndBip > layout.mapStartBip)
+          for(j=layout.mapStartBip; j<layout.mapEndBip; j++)
+            sum += mapsMetric[256u + image_pixel[j] - corpus_pixel[j]];
+      }
+      if (sum >= *bestPatchDiff) return FALSE;  // !!! Short circuit for neighbors
+    }
+  }
+  else
 #endif
   // Iterate over neighbors of candidate point. Sum grows as more neighbors tested.
   for(i=0; i<countNeighbors; i++)
@@ -304,9 +632,11 @@ computeBestFit(
       */
       #ifdef SYMMETRIC_METRIC_TABLE
       // mapsMetric[256] is the max
-      sum += MAX_WEIGHT*indices->img_match_bpp + mapsMetric[LIMIT_DOMAIN]*indices->map_match_bpp;
+      sum += MAX_WEIGHT*(layout.colorEndBip - FIRST_PIXELEL_INDEX)
+        + mapsMetric[LIMIT_DOMAIN]*(layout.mapEndBip - layout.mapStartBip);
       #else
-      sum += MAX_WEIGHT*indices->img_match_bpp + mapsMetric[0]*indices->map_match_bpp;
+      sum += MAX_WEIGHT*(layout.colorEndBip - FIRST_PIXELEL_INDEX)
+        + mapsMetric[0]*(layout.mapEndBip - layout.mapStartBip);
       #endif
     } 
     else  
@@ -331,7 +661,7 @@ computeBestFit(
       if (i) 
       {
         TPixelelIndex j;
-        for(j=FIRST_PIXELEL_INDEX; j<indices->colorEndBip; j++)
+        for(j=FIRST_PIXELEL_INDEX; j<layout.colorEndBip; j++)
         {
           #ifdef SYMMETRIC_METRIC_TABLE
           diff = (gshort) image_pixel[j] - (gshort) corpus_pixel[j];
@@ -342,10 +672,10 @@ computeBestFit(
           #endif
         }
       }
-      if (indices->map_match_bpp > 0) // If maps
+      if (layout.mapEndBip > layout.mapStartBip) // If maps
       {
         TPixelelIndex j;
-        for(j=indices->map_start_bip; j<indices->map_end_bip; j++)  // also sum mapped difference
+        for(j=layout.mapStartBip; j<layout.mapEndBip; j++)  // also sum mapped difference
         {
           #ifdef SYMMETRIC_METRIC_TABLE
           diff = (gshort) image_pixel[j] - (gshort) corpus_pixel[j];
@@ -384,8 +714,10 @@ computeBestFit(
     */
     if (sum >= *bestPatchDiff) return FALSE;  // !!! Short circuit for neighbors
   }
+  if (sum >= *bestPatchDiff) return FALSE;  // When kernel short circuited
 
   // Assert sum strictly < bestPatchDiff
+  metrics->betterments++;
   *bestPatchDiff = sum;
   *latestBettermentKind = bettermentKind;
   
@@ -393,9 +725,7 @@ computeBestFit(
   *bestMatchCorpusPoint = point;
   if (sum <=0) 
   {
-#ifdef STATS
-    bettermentStats[PERFECT_MATCH]+=1;
-#endif
+    metrics->perfectMatches++;
     return TRUE;  // PERFECT_MATCH
   }
   else 
@@ -403,9 +733,42 @@ computeBestFit(
 }
 
 
+/*
+Key of a patch in the patch index, see patchIndex.h: from its neighbors within the radius of descriptors.
+Not the target point itself, which has no meaningful value on the first pass.
+Returns FALSE if the patch has no such neighbors.
+*/
+static inline gboolean
+patchIndexKeyOfNeighbors(
+  const TPatchIndex* patchIndex,
+  const guint countNeighbors,
+  const TNeighbor neighbors[],
+  guint* key  // OUT
+  )
+{
+  guint sums[PATCH_INDEX_MAX_PIXELELS] = {0};
+  guint count = 0;
+  guint i;
+  TPixelelIndex k;
+
+  for(i=1; i<countNeighbors; i++)
+  {
+    if ((guint) abs(neighbors[i].offset.x) > patchIndex->radius
+      || (guint) abs(neighbors[i].offset.y) > patchIndex->radius)
+      continue;
+    for(k=0; k<patchIndex->pixelelCount; k++)
+      sums[k] += neighbors[i].pixel[FIRST_PIXELEL_INDEX + k];
+    count++;
+  }
+  if ( ! count ) return FALSE;
+  *key = patchIndexKey(sums, patchIndex->pixelelCount, count);
+  return TRUE;
+}
+
+
 static inline void
-setColor(
-  TFormatIndices* indices,
+setColorOfLayout(
+  const TPixelelLayout layout,
   Map* targetMap,
   Coordinates targetPosition,
   Map* corpusMap,
@@ -415,28 +778,98 @@ setColor(
   TPixelelIndex j;
   
   // For all color pixelels (channels)
-  for(j=FIRST_PIXELEL_INDEX; j<indices->colorEndBip; j++)
+  for(j=FIRST_PIXELEL_INDEX; j<layout.colorEndBip; j++)
     // Overwrite prior with new color
     pixmap_index(targetMap, targetPosition)[j] = 
       pixmap_index(corpusMap, corpusPosition)[j];  
 }
 
+static inline void
+setColor(
+  TFormatIndices* indices,
+  Map* targetMap,
+  Coordinates targetPosition,
+  Map* corpusMap,
+  Coordinates corpusPosition
+  )
+{
+  setColorOfLayout(pixelelLayoutOf(indices), targetMap, targetPosition, corpusMap, corpusPosition);
+}
+
+
+/*
+Random probes per target to be done by parameters->deadline, from the time per target since the last check:
+scaled from probeCount by the time left over the time the remaining targets would take.
+Between one (a target must get some source) and maxProbeCount.
+*/
+static inline guint
+probeCountForDeadline(
+  const TImageSynthParameters *parameters,
+  guint probeCount,
+  double secondsPerTarget,
+  double now,
+  guint remainingTargets
+  )
+{
+  double needed = secondsPerTarget * remainingTargets;
+  double count = (needed > 0) ? probeCount * (parameters->deadline - now) / needed : parameters->maxProbeCount;
+  
+  if (count < 1) return 1;
+  if (count > parameters->maxProbeCount) return parameters->maxProbeCount;
+  return (guint) count;
+}
+
+
+/*
+Prefetch the corpus a random probe will read first:
+the pixels of the nearest neighbors, since most probes short circuit after a few of them.
+*/
+static inline void
+prefetchProbe(
+  const TPatchVectors* patchVectors,
+  const Map* corpusMap,
+  const Coordinates point,
+  const guint countNeighbors
+  )
+{
+  guint i;
+  
+  if (patchVectors->isInBand)
+  {
+    const Pixelel* corpus_pixels = guardedPixel(patchVectors->guardedCorpus, point);
+    for (i=0; i<countNeighbors && i<IMAGE_SYNTH_PREFETCH_NEIGHBORS; i++)
+      PREFETCH(corpus_pixels + patchVectors->deltas[i]);
+  }
+  else
+    PREFETCH(pixmap_index(corpusMap, point));  // Neighbors may be clipped: the point only
+  if (patchVectors->hasDescriptor)
+    PREFETCH(patchDescriptorOfPoint(patchVectors->descriptors, point));
+}
+
 
 /*
 The heart of the algorithm.
 Called repeatedly: many passes over the data.
+Always inlined, into synthesize(), once for each layout it specializes.
 */
-static guint
-synthesize(
+__attribute__((always_inline))
+static inline guint
+synthesizeOfLayout(
   TImageSynthParameters *parameters,  // IN
   guint threadIndex,       // IN Zero if not threaded
+  guint threadCount,       // IN One if not threaded
   guint startTargetIndex,  // IN
   guint endTargetIndex,    // IN
-  TFormatIndices* indices, // IN
+  TTileSchedule* tileSchedule, // IN NULL if interleaved scheduling
+  const TPixelelLayout layout, // IN constant, where specialized
   Map * targetMap,      // IN/OUT
   Map* corpusMap,       // IN
+  TGuardedCorpus* guardedCorpus, // IN copy of corpus, for matching
+  TPatchIndex* patchIndex, // IN NULL if random probes are uniform
+  TDeterministicBatch* batch, // IN/OUT NULL unless deterministic: writes are staged, see deterministicBatch.h
   Map* recentProberMap, // IN/OUT
   Map* hasValueMap,     // IN/OUT
+  TValuedGrid* valuedGrid, // IN/OUT counts of hasValueMap
   Map* sourceOfMap,     // IN/OUT
   pointVector targetPoints, // IN
   pointVector corpusPoints, // IN
@@ -446,12 +879,15 @@ synthesize(
   TMapPixelelMetricFunc mapsMetric,
   void (*deepProgressCallback)(ProgressRecordT*),
   ProgressRecordT * progressCallbackParams,
-  int *cancelFlag
+  int *cancelFlag,
+  guint *probeCountKept,      // IN/OUT random probes per target, fewer nearing the deadline, kept call to call
+  TPassMetrics* passMetrics   // IN/OUT added to
   )
 {
   guint target_index;
   Coordinates position;
   guint repeatCountBetters = 0;
+  TTargetIterator targetIterator;
   
   tBettermentKind latestBettermentKind; // matchResult;
   gboolean isPerfectMatch = FALSE;
@@ -467,8 +903,20 @@ synthesize(
   // TODO this is large and allocated on the stack
   TNeighbor neighbors[IMAGE_SYNTH_MAX_NEIGHBORS];
   guint countNeighbors = 0;
+  // Corpus points probed for the target point by heuristic 1, when deterministic (instead of recentProberMap)
+  Coordinates probed[IMAGE_SYNTH_MAX_NEIGHBORS];
+  guint countProbed = 0;
+  // Same patch, for a vectorized kernel if the CPU has one
+  TPatchVectors patchVectors;
+  // Counted here, not in passMetrics: not shared with other threads, see synthMetrics.h
+  TPassMetrics metrics = {0};
+  // Random probes per target, fewer if needed to meet the deadline (of this pass, see refiner())
+  guint probeCount = *probeCountKept;
+  double checkedSeconds = parameters->deadline ? metricsSeconds() : 0;
+  guint checkedTargets = 0;
+  guint shareTargets = (endTargetIndex - startTargetIndex) / threadCount;  // about, of this thread
+  gboolean isPastDeadline = FALSE;
   
-  /* ALT: count progress once at start of pass countTargetTries += repetition_params[pass][1]; */
   reset_color_change();
 
 #ifdef SYNTH_THREADED2
@@ -478,29 +926,50 @@ synthesize(
         target_index += 1)
 #endif
 
-  // Each thread works on a slice of targetPoints.  Starting at the threadIndex, incremented by count of threads.
-  // If there is no threads or only one thread, starts at startTargetIndex, increments by 1
-  for(target_index=startTargetIndex + threadIndex % THREAD_LIMIT;
-      target_index<endTargetIndex;
-      target_index += THREAD_LIMIT)
+  patchVectors.kernel = selectPatchDiffKernel();
+  patchVectors.corpusTargetMetric = corpusTargetMetric;
+  patchVectors.mapsMetric = mapsMetric;
+  patchVectors.guardedCorpus = guardedCorpus;
+  patchVectors.descriptors = guardedCorpus->descriptors;
+  
+  // Each thread works on its share of the prefix of targetPoints: interleaved or tiled, see tileSchedule.h
+  initTargetIterator(&targetIterator, tileSchedule, threadIndex, threadCount, startTargetIndex, endTargetIndex);
+  while (nextTargetIndex(&targetIterator, &target_index))
   {
-#ifdef STATS
-    countTargetTries += 1;
-#endif
+    position = g_array_index(targetPoints, Coordinates, target_index);
+    // Past the deadline, refine no more: only targets without a value yet, so the target is complete
+    if (isPastDeadline && getHasValue(position, hasValueMap))
+      continue;
+    
+    metrics.targets++;
+    metrics.probeQuota += probeCount;
+    if (parameters->deadline && (metrics.targets & IMAGE_SYNTH_DEADLINE_COUNT) == 0)
+    {
+      double now = metricsSeconds();
+      guint remainingTargets = (shareTargets > metrics.targets) ? shareTargets - metrics.targets : 0;
+      
+      isPastDeadline = now >= parameters->deadline;
+      probeCount = probeCountForDeadline(parameters, probeCount,
+        (now - checkedSeconds) / (metrics.targets - checkedTargets), now, remainingTargets);
+      checkedSeconds = now;
+      checkedTargets = metrics.targets;
+    }
     
     #ifdef DEEP_PROGRESS
     // Callback to the level which calculates percent and forwards to the ultimate calling process.
-    // Modulo is the intuitive way to do this.
-    // But here, we are testing for x lower bits all 1, say 4095, 1111111111.
-    // Don't AND with an arbitrary single bit, say 4096, since one bit is often set.
-    if ((target_index&IMAGE_SYNTH_CALLBACK_COUNT) == 0)
+    if (isProgressDue(&targetIterator, target_index))
     {
       deepProgressCallback(progressCallbackParams);
       if (*cancelFlag) break; // for each target pixel
     }
     #endif
     
-    position = g_array_index(targetPoints, Coordinates, target_index);
+    if (batch)
+    {
+      // Own generator of this target point, the same whichever thread synthesizes it
+      g_rand_set_seed(prng, deterministicPointSeed(batch, target_index));
+      countProbed = 0;
+    }
      
     /*
     In the original algorithm, here we called setHasValue(&position, TRUE, hasValueMap);
@@ -511,10 +980,11 @@ synthesize(
     This is safer for threading: it eliminates a window where hasValue is set but color is uninitialized.
     */
     
-    countNeighbors = prepare_neighbors(position, parameters, indices, 
-      targetMap, hasValueMap, sourceOfMap, sortedOffsets,
+    countNeighbors = prepare_neighbors(position, parameters, layout, 
+      targetMap, corpusMap, hasValueMap, valuedGrid, sourceOfMap, sortedOffsets,
       neighbors
       );
+    preparePatchVectors(layout, countNeighbors, neighbors, &patchVectors);
     
     /*
     Repeat a pixel even if found an exact match last pass, because neighbors might have changed.
@@ -556,12 +1026,15 @@ synthesize(
         
         /* !!! Must clip corpus_point before further use, its only potentially in the corpus. */
         if (clippedOrMaskedCorpus(corpus_point, corpusMap)) continue;
-        if (*intmap_index(recentProberMap, corpus_point) == target_index) continue; // Heuristic 2
-        isPerfectMatch = computeBestFit(corpus_point, indices, corpusMap,
+        // Heuristic 2
+        if (batch ? isProbedPoint(probed, countProbed, corpus_point)
+          : *shortmap_index(recentProberMap, corpus_point) == recentProberKey(target_index))
+          continue;
+        isPerfectMatch = computeBestFit(corpus_point, layout, corpusMap,
           &bestPatchDiff, &bestMatchCorpusPoint,
-          countNeighbors, neighbors, 
+          countNeighbors, neighbors, &patchVectors,
           &latestBettermentKind, NEIGHBORS_SOURCE,
-          corpusTargetMetric, mapsMetric
+          corpusTargetMetric, mapsMetric, &metrics
           );
         // TODO stats: if bettered, is kind NEIGHBORS_SOURCE 
         // if ( matchResult == PERFECT_MATCH ) break;  // Break neighbors loop
@@ -577,7 +1050,10 @@ synthesize(
          * At most, it would reduce the value of heuristic2.
          * Different threads are probably working in different continuations and not contending.
          */
-        *intmap_index(recentProberMap, corpus_point) = target_index;
+        if (batch)
+          probed[countProbed++] = corpus_point;
+        else
+          *shortmap_index(recentProberMap, corpus_point) = recentProberKey(target_index);
       }
       // Else the neighbor is not in the target (has no source) so we can't use the heuristic 1.
     }
@@ -589,24 +1065,95 @@ synthesize(
       Match patches at random source points from the corpus.
       In later passes, many will be earlyouts.
       */
-      gint j;
-      for(j=0; j<parameters->maxProbeCount; j++)
+      guint j;
+      guint key;
+      
+      // Probe candidates from the patch index instead, if any, see patchIndex.h
+      if (patchIndex && patchIndexKeyOfNeighbors(patchIndex, countNeighbors, neighbors, &key))
       {
-        isPerfectMatch = computeBestFit(randomCorpusPoint(corpusPoints, prng), 
-          indices, corpusMap,
+        guint start, end, k;
+        queryPatchIndex(patchIndex, key, &start, &end);
+        for(k=0; k<patchIndex->candidates; k++)
+        {
+          isPerfectMatch = computeBestFit(patchIndexPoint(patchIndex, g_rand_int_range(prng, start, end)),
+            layout, corpusMap,
+            &bestPatchDiff, &bestMatchCorpusPoint,
+            countNeighbors, neighbors, &patchVectors,
+            &latestBettermentKind, INDEXED_CORPUS,
+            corpusTargetMetric, mapsMetric, &metrics
+            );
+          if ( isPerfectMatch ) break;
+        }
+      }
+      // Random probes compared on a GPU: only the best of them here, kept as the loop below would, see deviceBatch.h
+      else if (batch && batch->deviceBest)
+        isPerfectMatch = computeBestFit(batch->deviceBest[target_index - batch->start],
+          layout, corpusMap,
           &bestPatchDiff, &bestMatchCorpusPoint,
-          countNeighbors, neighbors,
+          countNeighbors, neighbors, &patchVectors,
           &latestBettermentKind, RANDOM_CORPUS,
-          corpusTargetMetric, mapsMetric
+          corpusTargetMetric, mapsMetric, &metrics
           );
-        if ( isPerfectMatch ) break;  /* Break loop over random corpus points */
-        // if ( matchResult == PERFECT_MATCH ) break;  /* Break loop over random corpus points */
-        // Not set recentProberMap(point) since heuristic rarely works for random source.
-        // TODO if bettered is kind RANDOM_CORPUS
+      else
+      /*
+      In blocks: a block of random corpus points is drawn, then its entries of corpusPoints
+      and then its patches in the corpus are prefetched, then matched in order.
+      So the cache misses of a block overlap, instead of each probe waiting on its own.
+      Same probes in the same order as drawing one at a time: a block drawn past a perfect match is undrawn.
+      */
+      for(j=0; j<probeCount && ! isPerfectMatch; j+=PROBE_BLOCK)
+      {
+        guint indexes[PROBE_BLOCK];
+        Coordinates points[PROBE_BLOCK];
+        gint count = MIN(PROBE_BLOCK, probeCount - j);
+        gint k;
+        #if PROBE_BLOCK > 1
+        GRand drawn = *prng;   // State before the block
+        #endif
+        
+        for (k=0; k<count; k++)
+        {
+          // As randomCorpusPoint()
+          indexes[k] = g_rand_int_range(prng, 0, corpusPoints->len);
+          PREFETCH(&g_array_index(corpusPoints, Coordinates, indexes[k]));
+        }
+        for (k=0; k<count; k++)
+        {
+          points[k] = g_array_index(corpusPoints, Coordinates, indexes[k]);
+          prefetchProbe(&patchVectors, corpusMap, points[k], countNeighbors);
+        }
+        for (k=0; k<count; k++)
+        {
+          isPerfectMatch = computeBestFit(points[k], 
+            layout, corpusMap,
+            &bestPatchDiff, &bestMatchCorpusPoint,
+            countNeighbors, neighbors, &patchVectors,
+            &latestBettermentKind, RANDOM_CORPUS,
+            corpusTargetMetric, mapsMetric, &metrics
+            );
+          if ( isPerfectMatch ) break;  /* Break loop over random corpus points */
+          // Not set recentProberMap(point) since heuristic rarely works for random source.
+          // TODO if bettered is kind RANDOM_CORPUS
+        }
+        #if PROBE_BLOCK > 1
+        // Perfect before the end of the block: draw again only the probes done, so later draws are as before
+        if (isPerfectMatch && k + 1 < count)
+        {
+          *prng = drawn;
+          for (; k >= 0; k--)
+            g_rand_int_range(prng, 0, corpusPoints->len);
+        }
+        #endif
       }
     }
     
     store_betterment_stats(matchResult);
+    if (latestBettermentKind == NEIGHBORS_SOURCE)
+      metrics.neighborWins++;
+    else if (latestBettermentKind == INDEXED_CORPUS)
+      metrics.indexWins++;
+    else if (latestBettermentKind == RANDOM_CORPUS)
+      metrics.randomWins++;
     /* DEBUG dump_target_resynthesis(position); */
     
     /*
@@ -623,24 +1170,147 @@ synthesize(
     if (latestBettermentKind != NO_BETTERMENT )
     {
       /* if source different from previous pass */
-      if ( ! equal_points(getSourceOf(position, sourceOfMap), bestMatchCorpusPoint) ) 
+      if ( ! equal_points(getSourceOf(position, sourceOfMap, corpusMap->width), bestMatchCorpusPoint) ) 
       {
         repeatCountBetters++;   /* feedback for termination. */
         integrate_color_change(position); // Must be before we store the new color values.
 
-        g_mutex_lock(&mutex);    // Atomic write to color and sourceOf
+        if (batch)
+        {
+          // Staged: no other point of the batch sees it, see commitDeterministicBatch()
+          batch->staged[target_index - batch->start].source = bestMatchCorpusPoint;
+          batch->staged[target_index - batch->start].isBettered = TRUE;
+          continue;
+        }
+        // Remember new source, published before the color, see new_neighbor()
+        publishSourceOf(position, bestMatchCorpusPoint, sourceOfMap, corpusMap->width);
         // Save the new color values (!!! not the alpha) for this target point
-        setColor( indices, targetMap, position, corpusMap, bestMatchCorpusPoint);
-        setSourceOf(position, bestMatchCorpusPoint, sourceOfMap); /* Remember new source */
+        setColorOfLayout(layout, targetMap, position, corpusMap, bestMatchCorpusPoint);
         // printf("Position %d %d source %d %d\n", position.x, position.y, bestMatchCorpusPoint.x, bestMatchCorpusPoint.y);
-        g_mutex_unlock(&mutex);
 
       } /* else same source for target */
     } /* else match is same or worse */
 
     // Shared, but no mutex lock because all writers are setting to the same value, TRUE
-    setHasValue(&position, TRUE, hasValueMap);
+    if ( ! batch )
+      markHasValue(position, hasValueMap, valuedGrid);
   } /* end for each target pixel */
+  metrics.betters = repeatCountBetters;
+  addPassMetrics(passMetrics, &metrics);
+  *probeCountKept = probeCount;
   return repeatCountBetters;
 }
 
+
+/*
+Synthesize, specialized for the common layouts of pixelels:
+Gray, GrayA, RGB and RGBA, each without maps, or with maps of as many colors.
+Dispatched once per call: each branch is synthesizeOfLayout() inlined with a constant layout,
+so loops over pixelels unroll and branches on maps vanish. Other layouts take the general branch.
+Patch sizes are not specialized: the count of neighbors varies from target point to target point
+(sparse patches early on), and most probes are short circuited after a few neighbors anyway.
+SYNTH_NO_SPECIALIZED_LAYOUTS compiles only the general branch, e.g. to compare.
+*/
+static guint
+synthesize(
+  TImageSynthParameters *parameters,
+  guint threadIndex,
+  guint threadCount,
+  guint startTargetIndex,
+  guint endTargetIndex,
+  TTileSchedule* tileSchedule,
+  TFormatIndices* indices,
+  Map * targetMap,
+  Map* corpusMap,
+  TGuardedCorpus* guardedCorpus,
+  TPatchIndex* patchIndex,
+  TDeterministicBatch* batch,
+  Map* recentProberMap,
+  Map* hasValueMap,
+  TValuedGrid* valuedGrid,
+  Map* sourceOfMap,
+  pointVector targetPoints,
+  pointVector corpusPoints,
+  pointVector sortedOffsets,
+  GRand *prng,
+  TPixelelMetricFunc corpusTargetMetric,
+  TMapPixelelMetricFunc mapsMetric,
+  void (*deepProgressCallback)(ProgressRecordT*),
+  ProgressRecordT * progressCallbackParams,
+  int *cancelFlag,
+  guint *probeCount,
+  TPassMetrics* passMetrics
+  )
+{
+  #define SYNTHESIZE_OF_LAYOUT(LAYOUT) \
+    synthesizeOfLayout(parameters, threadIndex, threadCount, startTargetIndex, endTargetIndex, tileSchedule, \
+      (LAYOUT), targetMap, corpusMap, guardedCorpus, patchIndex, batch, recentProberMap, hasValueMap, valuedGrid, \
+      sourceOfMap, targetPoints, corpusPoints, sortedOffsets, prng, corpusTargetMetric, mapsMetric, \
+      deepProgressCallback, progressCallbackParams, cancelFlag, probeCount, passMetrics)
+
+  // Pixelels after the mask: colors, then alpha if any, then maps
+  #define SPECIALIZED_LAYOUT(COLORS, ALPHAS, MAPS) \
+    if (layout.colorEndBip == FIRST_PIXELEL_INDEX + (COLORS) \
+      && layout.mapStartBip == FIRST_PIXELEL_INDEX + (COLORS) + (ALPHAS) \
+      && layout.mapEndBip == FIRST_PIXELEL_INDEX + (COLORS) + (ALPHAS) + (MAPS) \
+      && layout.totalBpp == layout.mapEndBip) \
+    { \
+      const TPixelelLayout constantLayout = { \
+        FIRST_PIXELEL_INDEX + (COLORS), \
+        FIRST_PIXELEL_INDEX + (COLORS) + (ALPHAS), \
+        FIRST_PIXELEL_INDEX + (COLORS) + (ALPHAS) + (MAPS), \
+        FIRST_PIXELEL_INDEX + (COLORS) + (ALPHAS) + (MAPS) }; \
+      return SYNTHESIZE_OF_LAYOUT(constantLayout); \
+    }
+
+  const TPixelelLayout layout = pixelelLayoutOf(indices);
+
+#ifndef SYNTH_NO_SPECIALIZED_LAYOUTS
+  SPECIALIZED_LAYOUT(1, 0, 0)   // Gray
+  SPECIALIZED_LAYOUT(1, 1, 0)   // GrayA
+  SPECIALIZED_LAYOUT(3, 0, 0)   // RGB
+  SPECIALIZED_LAYOUT(3, 1, 0)   // RGBA
+  SPECIALIZED_LAYOUT(1, 0, 1)   // Gray, with maps
+  SPECIALIZED_LAYOUT(1, 1, 1)
+  SPECIALIZED_LAYOUT(3, 0, 3)
+  SPECIALIZED_LAYOUT(3, 1, 3)
+#endif
+  return SYNTHESIZE_OF_LAYOUT(layout);
+
+  #undef SPECIALIZED_LAYOUT
+  #undef SYNTHESIZE_OF_LAYOUT
+}
+
+
+/*
+Commit the staged writes of a deterministic batch, after every thread is done with it, see deterministicBatch.h.
+Every point of the batch gets a value, whether or not bettered, as synthesize() gives it otherwise.
+*/
+static void
+commitDeterministicBatch(
+  const TDeterministicBatch* batch,  // IN
+  TFormatIndices* indices,
+  Map* targetMap,       // IN/OUT
+  Map* corpusMap,       // IN
+  Map* hasValueMap,     // IN/OUT
+  TValuedGrid* valuedGrid, // IN/OUT
+  Map* sourceOfMap,     // IN/OUT
+  pointVector targetPoints  // IN
+  )
+{
+  guint target_index;
+  
+  for (target_index=batch->start; target_index<batch->end; target_index++)
+  {
+    const TStagedSource* staged = &batch->staged[target_index - batch->start];
+    Coordinates position = g_array_index(targetPoints, Coordinates, target_index);
+    
+    if (staged->isBettered)
+    {
+      publishSourceOf(position, staged->source, sourceOfMap, corpusMap->width);
+      setColor(indices, targetMap, position, corpusMap, staged->source);
+    }
+    markHasValue(position, hasValueMap, valuedGrid);
+  }
+}
+
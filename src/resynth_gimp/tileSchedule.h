@@ -0,0 +1,275 @@
+/*
+Scheduling of target points among threads.
+
+Interleaved (the original):
+each thread works on a prefix of targetPoints, taking every threadCount'th point.
+Threads are interleaved pixel by pixel over the whole target,
+so they contend for the same cache lines of the target pixmap, hasValueMap, and sourceOfMap.
+
+Tiled:
+the target is divided into square tiles.
+A thread synthesizes all points of a tile (that are in the prefix for the pass) before taking another tile.
+So consecutive points of a thread are spatially coherent, and threads mostly touch disjoint memory.
+
+Within a tile, points are synthesized in the order of targetPoints (e.g. banded inward.)
+Tiles are ranked by their earliest point in targetPoints,
+and dealt round robin to threads, so every thread proceeds in roughly the order of targetPoints.
+A thread takes its own tiles from the front (earliest first.)
+When it has none left, it steals from the back of another thread's tiles.
+
+Included source, not compiled separately.
+*/
+
+#include <stdlib.h>   // calloc
+
+/*
+Per thread deal of tiles: a deque of positions in the arithmetic sequence of ranks thread, thread+threadCount, ...
+Head and tail are packed in one word, so owner and thieves update it by compare and swap.
+Head only increases and tail only decreases, so there is no ABA problem.
+Padded to a cache line so threads don't false-share their deques.
+*/
+typedef struct {
+  volatile unsigned long long headAndTail;
+  char padding[56];
+} TTileDeque;
+
+typedef struct {
+  guint tileCount;
+  guint* tileStarts;      // tileCount+1 offsets into targetIndices, tiles by rank
+  guint* tileEnds;        // offsets into targetIndices, end of each tile for the current pass
+  guint* targetIndices;   // indices into targetPoints, grouped by tile, ascending within a tile
+  guint threadCount;
+  TTileDeque* deques;     // one per thread
+} TTileSchedule;
+
+
+static void
+prepareTileSchedule(
+  TTileSchedule* schedule,  // OUT
+  pointVector targetPoints,
+  Map* targetMap,
+  guint tileSize,
+  guint threadCount
+  )
+{
+  guint tilesAcross = (targetMap->width + tileSize - 1) / tileSize;
+  guint tilesDown = (targetMap->height + tileSize - 1) / tileSize;
+  guint gridSize = tilesAcross * tilesDown;
+  guint* rankOfTile = workspaceCalloc(gridSize, sizeof(guint));    // grid tile to rank+1, 0 unranked
+  guint* cursor;
+  guint i;
+
+  schedule->tileCount = 0;
+  schedule->threadCount = threadCount;
+  schedule->targetIndices = workspaceCalloc(targetPoints->len > 0 ? targetPoints->len : 1, sizeof(guint));
+  schedule->deques = workspaceCalloc(threadCount, sizeof(TTileDeque));
+
+  // Rank tiles by earliest point, counting points per rank
+  schedule->tileStarts = workspaceCalloc(gridSize + 1, sizeof(guint));
+  for (i=0; i<targetPoints->len; i++)
+  {
+    Coordinates point = g_array_index(targetPoints, Coordinates, i);
+    guint tile = (point.y / tileSize) * tilesAcross + point.x / tileSize;
+    if (rankOfTile[tile] == 0)
+      rankOfTile[tile] = ++schedule->tileCount;
+    schedule->tileStarts[rankOfTile[tile]]++;   // Count, shifted by one for the prefix sum
+  }
+
+  // Prefix sum: counts to offsets
+  for (i=1; i<=schedule->tileCount; i++)
+    schedule->tileStarts[i] += schedule->tileStarts[i-1];
+
+  // Distribute, stable: ascending within a tile
+  cursor = workspaceCalloc(schedule->tileCount > 0 ? schedule->tileCount : 1, sizeof(guint));
+  for (i=0; i<schedule->tileCount; i++)
+    cursor[i] = schedule->tileStarts[i];
+  for (i=0; i<targetPoints->len; i++)
+  {
+    Coordinates point = g_array_index(targetPoints, Coordinates, i);
+    guint tile = (point.y / tileSize) * tilesAcross + point.x / tileSize;
+    schedule->targetIndices[cursor[rankOfTile[tile] - 1]++] = i;
+  }
+
+  schedule->tileEnds = cursor;  // Reused.  Set per pass.
+  workspaceFree(rankOfTile);
+}
+
+
+static void
+free_tile_schedule(TTileSchedule* schedule)
+{
+  workspaceFree(schedule->tileStarts);
+  workspaceFree(schedule->tileEnds);
+  workspaceFree(schedule->targetIndices);
+  workspaceFree(schedule->deques);
+}
+
+
+/*
+Prepare for a pass over the prefix [0, endTargetIndex) of targetPoints.
+A tile's points in the prefix are a prefix of the tile, since ascending within the tile.
+Tiles having no points in the prefix are still dealt, and are empty.
+*/
+static void
+prepareTileSchedulePass(
+  TTileSchedule* schedule,
+  guint endTargetIndex
+  )
+{
+  guint tile;
+  guint thread;
+
+  for (tile=0; tile<schedule->tileCount; tile++)
+  {
+    // Binary search for the end of the tile's points in the prefix
+    guint low = schedule->tileStarts[tile];
+    guint high = schedule->tileStarts[tile+1];
+    while (low < high)
+    {
+      guint middle = low + (high - low) / 2;
+      if (schedule->targetIndices[middle] < endTargetIndex)
+        low = middle + 1;
+      else
+        high = middle;
+    }
+    schedule->tileEnds[tile] = low;
+  }
+
+  for (thread=0; thread<schedule->threadCount; thread++)
+  {
+    // Count of ranks thread, thread+threadCount, ... less than tileCount
+    unsigned long long dealt = thread < schedule->tileCount
+      ? (schedule->tileCount - thread + schedule->threadCount - 1) / schedule->threadCount
+      : 0;
+    schedule->deques[thread].headAndTail = dealt;  // head 0 in high word, tail in low word
+  }
+}
+
+
+/*
+Take a tile rank from a thread's deque: owner from the front, thief from the back.
+Returns FALSE if the deque is empty.
+*/
+static inline gboolean
+takeTile(
+  TTileSchedule* schedule,
+  guint thread,
+  gboolean isFromFront,
+  guint* rank   // OUT
+  )
+{
+  TTileDeque* deque = &schedule->deques[thread];
+  while (TRUE)
+  {
+    unsigned long long old = deque->headAndTail;
+    unsigned long long head = old >> 32;
+    unsigned long long tail = old & 0xFFFFFFFFull;
+    unsigned long long taken;
+    if (head >= tail)
+      return FALSE;
+    taken = isFromFront ? head : tail - 1;
+    if (__sync_bool_compare_and_swap(&deque->headAndTail, old,
+          isFromFront ? ((head + 1) << 32) | tail : (head << 32) | (tail - 1)))
+    {
+      *rank = thread + (guint) taken * schedule->threadCount;
+      return TRUE;
+    }
+  }
+}
+
+
+/*
+Iterator over the target indices a thread synthesizes in a pass.
+Hides whether scheduling is interleaved or tiled.
+*/
+typedef struct {
+  TTileSchedule* schedule;  // NULL if interleaved
+  guint threadIndex;
+  guint threadCount;
+  guint next;       // interleaved: next target index. tiled: next offset in targetIndices
+  guint end;        // interleaved: end target index.  tiled: end offset of current tile
+  guint visited;    // count of target indices yielded
+} TTargetIterator;
+
+static inline void
+initTargetIterator(
+  TTargetIterator* iterator,
+  TTileSchedule* schedule,
+  guint threadIndex,
+  guint threadCount,
+  guint startTargetIndex,
+  guint endTargetIndex
+  )
+{
+  iterator->schedule = schedule;
+  iterator->threadIndex = threadIndex;
+  iterator->threadCount = threadCount;
+  iterator->visited = 0;
+  if (schedule)
+  {
+    iterator->next = 0;
+    iterator->end = 0;  // No current tile
+  }
+  else
+  {
+    // Each thread works on a slice of targetPoints.  Starting at the threadIndex, incremented by count of threads.
+    // If there is no threads or only one thread, starts at startTargetIndex, increments by 1
+    iterator->next = startTargetIndex + threadIndex % threadCount;
+    iterator->end = endTargetIndex;
+  }
+}
+
+static inline gboolean
+nextTargetIndex(
+  TTargetIterator* iterator,
+  guint* targetIndex  // OUT
+  )
+{
+  TTileSchedule* schedule = iterator->schedule;
+
+  if (! schedule)
+  {
+    if (iterator->next >= iterator->end)
+      return FALSE;
+    *targetIndex = iterator->next;
+    iterator->next += iterator->threadCount;
+    iterator->visited++;
+    return TRUE;
+  }
+
+  while (iterator->next >= iterator->end)
+  {
+    // Current tile done.  Take own tile, else steal one.
+    guint rank;
+    guint victim;
+    gboolean isTaken = takeTile(schedule, iterator->threadIndex, TRUE, &rank);
+    for (victim=1; ! isTaken && victim<iterator->threadCount; victim++)
+      isTaken = takeTile(schedule, (iterator->threadIndex + victim) % iterator->threadCount, FALSE, &rank);
+    if (! isTaken)
+      return FALSE;   // All tiles of the pass are taken
+    iterator->next = schedule->tileStarts[rank];
+    iterator->end = schedule->tileEnds[rank];
+  }
+  *targetIndex = schedule->targetIndices[iterator->next++];
+  iterator->visited++;
+  return TRUE;
+}
+
+/*
+Whether a deep progress callback is due before synthesizing targetIndex.
+Interleaved: when target index has lower bits all zero, so progress counts the whole pass without per-thread counts.
+Tiled: every IMAGE_SYNTH_CALLBACK_COUNT+1 points of this thread.
+*/
+static inline gboolean
+isProgressDue(
+  const TTargetIterator* iterator,
+  guint targetIndex
+  )
+{
+  // Modulo is the intuitive way to do this.
+  // But here, we are testing for x lower bits all 1, say 4095, 1111111111.
+  // Don't AND with an arbitrary single bit, say 4096, since one bit is often set.
+  if (iterator->schedule)
+    return ((iterator->visited - 1) & IMAGE_SYNTH_CALLBACK_COUNT) == 0;
+  return (targetIndex & IMAGE_SYNTH_CALLBACK_COUNT) == 0;
+}
@@ -0,0 +1,95 @@
+/*
+Valued grid: a coarse occupancy grid of the target pixmap, counting pixels with values (see hasValueMap) per cell.
+
+For sparse patches, e.g. early in the first pass with no context, when the nearest pixels with values are far.
+The search for them (see prepareFartherNeighbors()) visits only the pixels of cells that have any,
+instead of testing hasValue of every pixel out to the farthest neighbor:
+the cost is then roughly independent of how densely the target is filled.
+
+Kept current as synthesis gives pixels values, see markHasValue().
+Counts only grow: pixels never lose their values.
+*/
+
+#ifndef __SYNTH_VALUED_GRID_H__
+#define __SYNTH_VALUED_GRID_H__
+
+// Cells are squares of 16 pixels on a side
+#define VALUED_GRID_CELL_SHIFT 4
+#define VALUED_GRID_CELL_SIZE (1 << VALUED_GRID_CELL_SHIFT)
+
+typedef struct valuedGridStruct {
+  Map counts;   // Intmap: count of pixels with values, per cell
+} TValuedGrid;
+
+
+// Count the pixels already with values, e.g. the context, or seeded by a coarser level
+static void
+prepareValuedGrid(
+  Map* hasValueMap,   // IN
+  TValuedGrid* grid   // OUT
+  )
+{
+  guint x, y;
+
+  new_intmap(&grid->counts,
+    (hasValueMap->width + VALUED_GRID_CELL_SIZE - 1) >> VALUED_GRID_CELL_SHIFT,
+    (hasValueMap->height + VALUED_GRID_CELL_SIZE - 1) >> VALUED_GRID_CELL_SHIFT);
+  for (y=0; y<hasValueMap->height; y++)
+    for (x=0; x<hasValueMap->width; x++)
+    {
+      Coordinates coords = {x, y};
+      if (getHasValue(coords, hasValueMap))
+        *intmap_index(&grid->counts,
+          (Coordinates) {x >> VALUED_GRID_CELL_SHIFT, y >> VALUED_GRID_CELL_SHIFT}) += 1;
+    }
+}
+
+
+static void
+free_valued_grid(TValuedGrid* grid)
+{
+  free_map(&grid->counts);
+}
+
+
+// Count of pixels with values in a cell (coordinates of cells, not pixels)
+static inline guint
+valuedCount(
+  TValuedGrid* grid,
+  Coordinates cell
+  )
+{
+#ifdef SYNTH_THREADED
+  return __atomic_load_n(intmap_index(&grid->counts, cell), __ATOMIC_RELAXED);
+#else
+  return *intmap_index(&grid->counts, cell);
+#endif
+}
+
+
+/*
+Give a target pixel a value, and count it.
+Only the thread synthesizing a pixel gives it a value, but cells are shared by threads: add atomically.
+Readers may see a count a little stale, as they may see hasValue a little stale.
+*/
+static inline void
+markHasValue(
+  Coordinates coords,
+  Map* hasValueMap,
+  TValuedGrid* grid
+  )
+{
+  guint* count;
+
+  if (getHasValue(coords, hasValueMap)) return;  // Already counted, e.g. on a prior pass
+  setHasValue(&coords, TRUE, hasValueMap);
+  count = intmap_index(&grid->counts,
+    (Coordinates) {coords.x >> VALUED_GRID_CELL_SHIFT, coords.y >> VALUED_GRID_CELL_SHIFT});
+#ifdef SYNTH_THREADED
+  __atomic_fetch_add(count, 1, __ATOMIC_RELAXED);
+#else
+  *count += 1;
+#endif
+}
+
+#endif /* __SYNTH_VALUED_GRID_H__ */
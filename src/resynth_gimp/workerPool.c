@@ -0,0 +1,381 @@
+/*
+Persistent pool of worker threads.  See workerPool.h.
+
+Batches are queued FIFO.
+A batch stays in the queue until its last task is handed out,
+and lives (on the stack of the thread running it) until its last task completes.
+A submitted task is a batch of one on the heap, detached: freed when the task completes, nobody waits on it.
+*/
+
+#ifndef _GNU_SOURCE
+  #define _GNU_SOURCE   // sched_getaffinity(), CPU_COUNT.  Before any system header.
+#endif
+
+// Compiling switch #defines
+#include "buildSwitches.h"
+
+#ifdef SYNTH_USE_GLIB
+  #include "../config.h" // GNU buildtools local configuration
+  #include <glib.h>
+#else
+  #include "glibProxy.h"
+#endif
+
+#ifdef SYNTH_THREADED
+
+#include <stdlib.h>   // calloc
+#include <stdio.h>    // fopen, cgroup files
+#include <unistd.h>   // sysconf
+#include <pthread.h>
+#ifdef __linux__
+  #include <sched.h>
+#endif
+
+#include "workerPool.h"
+
+
+typedef struct WorkerBatchStruct {
+  TWorkerTask task;
+  char* taskArgs;
+  size_t taskArgsSize;
+  guint taskCount;
+  guint nextTask;       // index of next task to hand out
+  guint pendingTasks;   // count of tasks not yet completed
+  pthread_cond_t done;  // signaled when pendingTasks becomes zero, unless detached
+  gboolean isDetached;  // submitted, see submitWorkerPoolTask()
+  struct WorkerBatchStruct* next;
+} TWorkerBatch;
+
+struct WorkerPoolStruct {
+  pthread_mutex_t mutex;          // guards all fields, and the fields of queued batches
+  pthread_cond_t workAvailable;
+  TWorkerBatch* head;             // queue of batches having tasks not yet handed out
+  TWorkerBatch* tail;
+  pthread_t* threads;
+  guint threadCount;
+  gboolean isShuttingDown;
+};
+
+
+/*
+Hand out the next task of a queued batch.
+Caller holds the mutex.
+*/
+static inline guint
+takeTask(
+  TWorkerPool* pool,
+  TWorkerBatch* batch
+  )
+{
+  guint taskIndex = batch->nextTask++;
+
+  if (batch->nextTask == batch->taskCount)
+  {
+    // Last task handed out: dequeue.  Usually batch is the head.
+    TWorkerBatch* prior = NULL;
+    TWorkerBatch* cursor = pool->head;
+    while (cursor != batch)
+    {
+      prior = cursor;
+      cursor = cursor->next;
+    }
+    if (prior)
+      prior->next = batch->next;
+    else
+      pool->head = batch->next;
+    if (pool->tail == batch)
+      pool->tail = prior;
+  }
+  return taskIndex;
+}
+
+
+/*
+Execute a task with the mutex released.
+Caller holds the mutex, which is held again on return.
+Returns whether the task was the last of a detached batch: then the caller frees the batch.
+*/
+static inline gboolean
+executeTask(
+  TWorkerPool* pool,
+  TWorkerBatch* batch,
+  guint taskIndex
+  )
+{
+  pthread_mutex_unlock(&pool->mutex);
+  batch->task(batch->taskArgs + taskIndex * batch->taskArgsSize);
+  pthread_mutex_lock(&pool->mutex);
+
+  if (--batch->pendingTasks == 0)
+  {
+    if (batch->isDetached)
+      return TRUE;
+    pthread_cond_broadcast(&batch->done);
+  }
+  return FALSE;
+}
+
+
+static void *
+workerThread(void * uncastPool)
+{
+  TWorkerPool* pool = (TWorkerPool*) uncastPool;
+
+  pthread_mutex_lock(&pool->mutex);
+  while (TRUE)
+  {
+    TWorkerBatch* batch;
+
+    while (pool->head == NULL && ! pool->isShuttingDown)
+      pthread_cond_wait(&pool->workAvailable, &pool->mutex);
+    if (pool->head == NULL)
+      break;  // Shutting down and no work left
+
+    batch = pool->head;
+    if (executeTask(pool, batch, takeTask(pool, batch)))
+      free(batch);
+  }
+  pthread_mutex_unlock(&pool->mutex);
+  return NULL;
+}
+
+
+/*
+Start workers until the pool has threadCount.
+Caller holds the mutex, or is the only user of the pool.
+*/
+static void
+addWorkers(
+  TWorkerPool* pool,
+  guint threadCount
+  )
+{
+  pthread_t* threads;
+
+  if (threadCount <= pool->threadCount)
+    return;
+
+  threads = realloc(pool->threads, threadCount * sizeof(pthread_t));
+  if (threads == NULL)
+    return;
+  pool->threads = threads;
+
+  while (pool->threadCount < threadCount)
+  {
+    if (pthread_create(&pool->threads[pool->threadCount], NULL, workerThread, pool) != 0)
+      break;  // Run with the workers we have.  A pool with no workers still runs batches.
+    pool->threadCount++;
+  }
+}
+
+
+TWorkerPool*
+newWorkerPool(
+  guint threadCount
+  )
+{
+  TWorkerPool* pool = calloc(1, sizeof(TWorkerPool));
+
+  pthread_mutex_init(&pool->mutex, NULL);
+  pthread_cond_init(&pool->workAvailable, NULL);
+  addWorkers(pool, threadCount);
+  return pool;
+}
+
+
+void
+ensureWorkerPoolThreads(
+  TWorkerPool* pool,
+  guint threadCount
+  )
+{
+  pthread_mutex_lock(&pool->mutex);
+  addWorkers(pool, threadCount);
+  pthread_mutex_unlock(&pool->mutex);
+}
+
+
+void
+freeWorkerPool(
+  TWorkerPool* pool
+  )
+{
+  guint i;
+
+  pthread_mutex_lock(&pool->mutex);
+  pool->isShuttingDown = TRUE;
+  pthread_cond_broadcast(&pool->workAvailable);
+  pthread_mutex_unlock(&pool->mutex);
+
+  for (i=0; i<pool->threadCount; i++)
+    pthread_join(pool->threads[i], NULL);
+
+  pthread_cond_destroy(&pool->workAvailable);
+  pthread_mutex_destroy(&pool->mutex);
+  free(pool->threads);
+  free(pool);
+}
+
+
+static TWorkerPool* theDefaultPool = NULL;
+static pthread_once_t theDefaultPoolOnce = PTHREAD_ONCE_INIT;
+
+static void
+createDefaultWorkerPool(void)
+{
+  // The thread running a batch is the remaining thread
+  theDefaultPool = newWorkerPool(detectProcessorCount() - 1);
+}
+
+TWorkerPool*
+defaultWorkerPool(void)
+{
+  pthread_once(&theDefaultPoolOnce, createDefaultWorkerPool);
+  return theDefaultPool;
+}
+
+
+/*
+Read the cgroup CPU quota, as a count of processors rounded up.
+Zero if no quota or not in a cgroup.
+cgroup v2 has "quota period" or "max period" in cpu.max,
+cgroup v1 has quota and period in separate files, quota -1 means no quota.
+*/
+static guint
+cgroupProcessorQuota(void)
+{
+  long quota = -1;
+  long period = 0;
+  FILE* file;
+
+  file = fopen("/sys/fs/cgroup/cpu.max", "r");
+  if (file)
+  {
+    if (fscanf(file, "%ld %ld", &quota, &period) != 2)
+      quota = -1;   // "max": unlimited, scanf fails on it
+    fclose(file);
+  }
+  else
+  {
+    file = fopen("/sys/fs/cgroup/cpu/cpu.cfs_quota_us", "r");
+    if (file)
+    {
+      if (fscanf(file, "%ld", &quota) != 1)
+        quota = -1;
+      fclose(file);
+    }
+    file = fopen("/sys/fs/cgroup/cpu/cpu.cfs_period_us", "r");
+    if (file)
+    {
+      if (fscanf(file, "%ld", &period) != 1)
+        period = 0;
+      fclose(file);
+    }
+  }
+
+  if (quota <= 0 || period <= 0)
+    return 0;
+  return (guint) ((quota + period - 1) / period);
+}
+
+
+guint
+detectProcessorCount(void)
+{
+  long count = sysconf(_SC_NPROCESSORS_ONLN);
+  guint quota;
+
+#ifdef __linux__
+  {
+  cpu_set_t affinity;
+  if (sched_getaffinity(0, sizeof(affinity), &affinity) == 0 && CPU_COUNT(&affinity) < count)
+    count = CPU_COUNT(&affinity);
+  }
+#endif
+
+  quota = cgroupProcessorQuota();
+  if (quota > 0 && quota < count)
+    count = quota;
+
+  if (count < 1)
+    count = 1;
+  if (count > SYNTH_MAX_THREADS)
+    count = SYNTH_MAX_THREADS;
+  return (guint) count;
+}
+
+
+void
+runWorkerPoolBatch(
+  TWorkerPool* pool,
+  TWorkerTask task,
+  void* taskArgs,
+  size_t taskArgsSize,
+  guint taskCount
+  )
+{
+  TWorkerBatch batch;
+
+  if (taskCount == 0)
+    return;
+
+  batch.task = task;
+  batch.taskArgs = (char*) taskArgs;
+  batch.taskArgsSize = taskArgsSize;
+  batch.taskCount = taskCount;
+  batch.nextTask = 0;
+  batch.pendingTasks = taskCount;
+  batch.isDetached = FALSE;
+  batch.next = NULL;
+  pthread_cond_init(&batch.done, NULL);
+
+  pthread_mutex_lock(&pool->mutex);
+  if (pool->tail)
+    pool->tail->next = &batch;
+  else
+    pool->head = &batch;
+  pool->tail = &batch;
+  pthread_cond_broadcast(&pool->workAvailable);
+
+  // Help with own batch rather than idle.  Take from own batch only.  Not detached: never to free
+  while (batch.nextTask < batch.taskCount)
+    (void) executeTask(pool, &batch, takeTask(pool, &batch));
+
+  while (batch.pendingTasks > 0)
+    pthread_cond_wait(&batch.done, &pool->mutex);
+  pthread_mutex_unlock(&pool->mutex);
+
+  pthread_cond_destroy(&batch.done);
+}
+
+
+void
+submitWorkerPoolTask(
+  TWorkerPool* pool,
+  TWorkerTask task,
+  void* taskArgs
+  )
+{
+  TWorkerBatch* batch = calloc(1, sizeof(TWorkerBatch));
+
+  g_assert(batch);
+  batch->task = task;
+  batch->taskArgs = (char*) taskArgs;
+  batch->taskArgsSize = 0;
+  batch->taskCount = 1;
+  batch->pendingTasks = 1;
+  batch->isDetached = TRUE;
+
+  pthread_mutex_lock(&pool->mutex);
+  if (pool->threadCount == 0)
+    addWorkers(pool, 1);
+  if (pool->tail)
+    pool->tail->next = batch;
+  else
+    pool->head = batch;
+  pool->tail = batch;
+  pthread_cond_signal(&pool->workAvailable);
+  pthread_mutex_unlock(&pool->mutex);
+}
+
+#endif /* SYNTH_THREADED */
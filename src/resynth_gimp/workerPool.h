@@ -0,0 +1,83 @@
+/*
+Persistent pool of worker threads.
+
+Formerly refiner() created and joined a thread for every thread index, for every pass.
+Now workers are created once, sleep between batches, and are handed batches of tasks.
+
+A batch is one task function applied to an array of argument records (one record per task.)
+Running a batch returns when every task of the batch has completed:
+that is the only synchronization per pass.
+A task may also be submitted alone, without waiting for it, e.g. a whole run in the background.
+
+The thread that runs a batch also executes tasks of the batch while it waits.
+So a batch can be run from inside a task without deadlocking the pool,
+and a pool with no workers at all just runs the batch serially.
+*/
+
+#ifndef __SYNTH_WORKER_POOL_H__
+#define __SYNTH_WORKER_POOL_H__
+
+#include <stddef.h>   // size_t
+
+typedef void (*TWorkerTask)(void *taskArgs);
+
+typedef struct WorkerPoolStruct TWorkerPool;
+
+extern TWorkerPool*
+newWorkerPool(
+  guint threadCount   // count of worker threads, not counting threads that run batches
+  );
+
+extern void
+freeWorkerPool(
+  TWorkerPool* pool
+  );
+
+/*
+Start more workers, if the pool has fewer than threadCount.
+Pools never shrink.
+*/
+extern void
+ensureWorkerPoolThreads(
+  TWorkerPool* pool,
+  guint threadCount
+  );
+
+/*
+The pool owned by the library.
+Created on first use with a worker per available processor, less one for the thread running batches.
+Grown on demand and lives as long as the process.
+*/
+extern TWorkerPool*
+defaultWorkerPool(void);
+
+/*
+Count of processors this process may use.
+The least of: processors online, processors in the CPU affinity mask, and the cgroup CPU quota (rounded up.)
+Always at least 1.
+*/
+extern guint
+detectProcessorCount(void);
+
+extern void
+runWorkerPoolBatch(
+  TWorkerPool* pool,
+  TWorkerTask task,
+  void* taskArgs,       // array of taskCount records
+  size_t taskArgsSize,  // size of one record
+  guint taskCount
+  );
+
+/*
+Queue one task and return at once: a worker runs it later.
+Starts a worker if the pool has none, since no thread waits to help.
+taskArgs (not copied) must live until the task completes, e.g. the task frees them.
+*/
+extern void
+submitWorkerPoolTask(
+  TWorkerPool* pool,
+  TWorkerTask task,
+  void* taskArgs
+  );
+
+#endif /* __SYNTH_WORKER_POOL_H__ */
@@ -0,0 +1,251 @@
+/*
+Workspace.  See workspace.h.
+
+A block is a header, then the memory allocated.
+The header says where the block is from (a workspace, or the heap) and its capacity.
+Free blocks of a workspace are a list, searched for the best fit: a run holds tens of blocks, not thousands.
+*/
+
+// Compiling switch #defines
+#include "buildSwitches.h"
+
+#ifdef SYNTH_USE_GLIB
+  #include "../config.h" // GNU buildtools local configuration
+  #include <glib.h>
+#else
+  #include "glibProxy.h"
+#endif
+
+#include <stdlib.h>   // malloc
+#include <string.h>   // memset
+#ifdef SYNTH_THREADED
+  #include <pthread.h>
+#endif
+
+#include "workspace.h"
+
+// Bytes of a header: keeps memory aligned as malloc's, and on cache lines
+#define WORKSPACE_HEADER_SIZE 64
+// Least capacity of a block
+#define WORKSPACE_MIN_CAPACITY 64
+
+#if defined(_MSC_VER)
+  #define WORKSPACE_THREAD_LOCAL __declspec(thread)
+#else
+  #define WORKSPACE_THREAD_LOCAL _Thread_local
+#endif
+
+typedef struct WorkspaceBlockStruct {
+  TWorkspace* workspace;  // or NULL: from the heap
+  size_t capacity;        // bytes after the header
+  struct WorkspaceBlockStruct* next;  // in the list of free blocks
+} TWorkspaceBlock;
+
+struct WorkspaceStruct {
+#ifdef SYNTH_THREADED
+  pthread_mutex_t mutex;  // guards all fields
+#endif
+  TWorkspaceBlock* freeBlocks;
+  size_t usedCount;       // blocks not free
+  TWorkspaceStats stats;
+};
+
+#ifdef SYNTH_THREADED
+  #define LOCK_WORKSPACE(workspace) pthread_mutex_lock(&(workspace)->mutex)
+  #define UNLOCK_WORKSPACE(workspace) pthread_mutex_unlock(&(workspace)->mutex)
+#else
+  #define LOCK_WORKSPACE(workspace)
+  #define UNLOCK_WORKSPACE(workspace)
+#endif
+
+static WORKSPACE_THREAD_LOCAL TWorkspace* boundWorkspace = NULL;
+
+
+static inline void*
+blockMemory(TWorkspaceBlock* block)
+{
+  return (char*) block + WORKSPACE_HEADER_SIZE;
+}
+
+
+static inline TWorkspaceBlock*
+memoryBlock(void* memory)
+{
+  return (TWorkspaceBlock*) ((char*) memory - WORKSPACE_HEADER_SIZE);
+}
+
+
+/*
+Capacity for an allocation: rounded up to an eighth of its magnitude,
+so allocations of similar size (e.g. of images a few pixels apart) fit the same blocks.
+*/
+static size_t
+roundedCapacity(size_t bytes)
+{
+  size_t granule = WORKSPACE_MIN_CAPACITY;
+
+  while (granule * 16 <= bytes) granule *= 2;
+  return (bytes + granule - 1) / granule * granule;
+}
+
+
+TWorkspace*
+newWorkspace(void)
+{
+  TWorkspace* workspace = calloc(1, sizeof(TWorkspace));
+
+  g_assert(workspace);
+#ifdef SYNTH_THREADED
+  pthread_mutex_init(&workspace->mutex, NULL);
+#endif
+  return workspace;
+}
+
+
+void
+freeWorkspace(TWorkspace* workspace)
+{
+  g_assert(workspace->usedCount == 0);
+  while (workspace->freeBlocks)
+  {
+    TWorkspaceBlock* block = workspace->freeBlocks;
+    workspace->freeBlocks = block->next;
+    free(block);
+  }
+#ifdef SYNTH_THREADED
+  pthread_mutex_destroy(&workspace->mutex);
+#endif
+  free(workspace);
+}
+
+
+TWorkspace*
+bindWorkspace(TWorkspace* workspace)
+{
+  TWorkspace* previous = boundWorkspace;
+
+  boundWorkspace = workspace;
+  return previous;
+}
+
+
+// Take the free block fitting best, or else discard the largest block outgrown.  Caller holds the lock.
+static TWorkspaceBlock*
+takeFreeBlock(
+  TWorkspace* workspace,
+  size_t bytes
+  )
+{
+  TWorkspaceBlock** best = NULL;
+  TWorkspaceBlock** outgrown = NULL;
+  TWorkspaceBlock** link;
+  TWorkspaceBlock* block;
+
+  for (link=&workspace->freeBlocks; *link; link=&(*link)->next)
+  {
+    if ((*link)->capacity >= bytes)
+    {
+      if ( ! best || (*link)->capacity < (*best)->capacity) best = link;
+    }
+    else if ( ! outgrown || (*link)->capacity > (*outgrown)->capacity)
+      outgrown = link;
+  }
+  if (best)
+  {
+    block = *best;
+    *best = block->next;
+    return block;
+  }
+  if (outgrown)
+  {
+    block = *outgrown;
+    *outgrown = block->next;
+    workspace->stats.bytes -= block->capacity;
+    free(block);
+  }
+  return NULL;
+}
+
+
+void*
+workspaceCalloc(
+  size_t count,
+  size_t size
+  )
+{
+  TWorkspace* workspace = boundWorkspace;
+  size_t bytes = count * size;
+  TWorkspaceBlock* block;
+
+  if ( ! workspace )
+  {
+    block = calloc(1, WORKSPACE_HEADER_SIZE + bytes);
+    if ( ! block ) return NULL;
+    block->workspace = NULL;
+    block->capacity = bytes;
+    return blockMemory(block);
+  }
+
+  LOCK_WORKSPACE(workspace);
+  block = takeFreeBlock(workspace, bytes);
+  if (block)
+  {
+    workspace->stats.reuses++;
+    workspace->usedCount++;
+  }
+  UNLOCK_WORKSPACE(workspace);
+  if (block)
+  {
+    memset(blockMemory(block), 0, bytes);  // As calloc
+    return blockMemory(block);
+  }
+
+  {
+    size_t capacity = roundedCapacity(bytes);
+
+    block = calloc(1, WORKSPACE_HEADER_SIZE + capacity);
+    if ( ! block ) return NULL;
+    block->workspace = workspace;
+    block->capacity = capacity;
+    LOCK_WORKSPACE(workspace);
+    workspace->stats.allocations++;
+    workspace->stats.bytes += capacity;
+    workspace->usedCount++;
+    UNLOCK_WORKSPACE(workspace);
+  }
+  return blockMemory(block);
+}
+
+
+void
+workspaceFree(void* memory)
+{
+  TWorkspaceBlock* block;
+  TWorkspace* workspace;
+
+  if ( ! memory ) return;
+  block = memoryBlock(memory);
+  workspace = block->workspace;
+  if ( ! workspace )
+  {
+    free(block);
+    return;
+  }
+  LOCK_WORKSPACE(workspace);
+  block->next = workspace->freeBlocks;
+  workspace->freeBlocks = block;
+  workspace->usedCount--;
+  UNLOCK_WORKSPACE(workspace);
+}
+
+
+TWorkspaceStats
+workspaceStats(TWorkspace* workspace)
+{
+  TWorkspaceStats stats;
+
+  LOCK_WORKSPACE(workspace);
+  stats = workspace->stats;
+  UNLOCK_WORKSPACE(workspace);
+  return stats;
+}
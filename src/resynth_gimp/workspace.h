@@ -0,0 +1,56 @@
+/*
+Workspace: memory for the engine's allocations, recycled from run to run.
+
+Without one, every run allocates (and frees) its pixmaps, maps and vectors on the heap:
+under steady load, many large blocks churned, fragmenting the heap.
+With one, a freed block returns to the workspace, and a later allocation takes a free block large enough.
+Blocks are sized with some slack, and a block outgrown (too small for an allocation, none free fitting)
+is replaced by a larger one: the workspace grows to the largest run seen.
+Runs of similar size, one after another, then allocate nothing from the heap.
+
+Allocations are bound to a workspace per thread, for the duration of a run, see bindWorkspace(),
+so the engine allocates as before (see glibProxy.c, s_array_sized_new().)
+With no workspace bound, allocations are from the heap.
+A block is freed to where it came from, whatever thread frees it.
+
+Thread safe, but a workspace is for one run at a time: concurrent runs take blocks from each other.
+*/
+
+#ifndef __SYNTH_WORKSPACE_H__
+#define __SYNTH_WORKSPACE_H__
+
+#include <stddef.h>   // size_t
+
+typedef struct WorkspaceStruct TWorkspace;
+
+typedef struct WorkspaceStatsStruct {
+  size_t allocations; // of blocks from the heap
+  size_t reuses;      // of free blocks
+  size_t bytes;       // held in blocks, free or not
+} TWorkspaceStats;
+
+extern TWorkspace*
+newWorkspace(void);
+
+// All its blocks must have been freed
+extern void
+freeWorkspace(TWorkspace* workspace);
+
+// Bind a workspace (or NULL: the heap) to the calling thread.  Returns the previous, to restore.
+extern TWorkspace*
+bindWorkspace(TWorkspace* workspace);
+
+// As calloc(), from the workspace bound to the calling thread, if any.  Free with workspaceFree() only.
+extern void*
+workspaceCalloc(
+  size_t count,
+  size_t size
+  );
+
+extern void
+workspaceFree(void* memory);
+
+extern TWorkspaceStats
+workspaceStats(TWorkspace* workspace);
+
+#endif /* __SYNTH_WORKSPACE_H__ */
@@ -0,0 +1,79 @@
+/* resynth_parameters_deterministic(): for a seed, the result is the same whatever the count of threads,
+   for a texture and for a heal. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <resynth.h>
+
+#define WIDTH 64
+#define HEIGHT 56
+#define CHANNELS 3
+
+// A synthesis of the state with threads, deterministic: 1 if its pixels are those of expected, else 0
+static int
+is_same_result(resynth_state_t state, resynth_parameters_t parameters, int threads, const uint8_t* expected) {
+    resynth_parameters_threads(parameters, threads);
+    resynth_result_t result = resynth_run(state, parameters);
+    const uint8_t* pixels = resynth_result_pixels(result);
+    int same = pixels != NULL && memcmp(pixels, expected, WIDTH * HEIGHT * CHANNELS) == 0;
+
+    resynth_free_result(result);
+    return same;
+}
+
+static int
+check_operation(resynth_state_t state, resynth_parameters_t parameters, const char* name) {
+    static const int thread_counts[] = {2, 3, 8};
+    int failures = 0;
+
+    resynth_parameters_threads(parameters, 1);
+    resynth_result_t serial = resynth_run(state, parameters);
+    const uint8_t* expected = resynth_result_pixels(serial);
+    if (expected == NULL) {
+        fprintf(stderr, "%s failed on 1 thread\n", name);
+        resynth_free_result(serial);
+        return 1;
+    }
+    for (size_t i = 0; i < sizeof(thread_counts) / sizeof(thread_counts[0]); ++i) {
+        if (!is_same_result(state, parameters, thread_counts[i], expected)) {
+            fprintf(stderr, "%s on %d threads differs from 1 thread\n", name, thread_counts[i]);
+            ++failures;
+        }
+    }
+    resynth_free_result(serial);
+    return failures;
+}
+
+int
+main(void) {
+    static uint8_t pixels[WIDTH * HEIGHT * CHANNELS];
+    static uint8_t mask[WIDTH * HEIGHT];
+    int failures = 0;
+
+    for (size_t i = 0; i < sizeof(pixels); ++i) {
+        pixels[i] = (uint8_t) ((i * 7 + i / (WIDTH * CHANNELS) * 13) % 251);
+    }
+    for (size_t y = 18; y < 38; ++y) {
+        memset(mask + y * WIDTH + 20, 0xFF, 24);
+    }
+
+    resynth_state_t state = resynth_state_create_from_memory(pixels, WIDTH, HEIGHT, CHANNELS, 1);
+    resynth_parameters_t parameters = resynth_parameters_create();
+    resynth_parameters_random_seed(parameters, 7);
+    resynth_parameters_deterministic(parameters, true);
+
+    resynth_parameters_operation(parameters, RESYNTH_OPERATION_TEXTURE);
+    failures += check_operation(state, parameters, "texture");
+
+    resynth_parameters_operation(parameters, RESYNTH_OPERATION_HEAL);
+    resynth_parameters_mask(parameters, mask, WIDTH, HEIGHT, RESYNTH_MASK_TARGET);
+    failures += check_operation(state, parameters, "heal");
+
+    printf("%d deterministic runs differ from 1 thread\n", failures);
+
+    resynth_free_parameters(parameters);
+    resynth_free_state(state);
+    return failures != 0;
+}
@@ -0,0 +1,88 @@
+/* resynth_run_incremental(): after the mask grows over the sources of pixels kept from the previous heal,
+   those pixels are synthesized again. Every pixel of the new target has a source, outside the new mask. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <resynth.h>
+
+#define WIDTH 120
+#define HEIGHT 100
+
+static int
+is_far_from_hole(size_t x, size_t y, size_t left, size_t top, size_t right, size_t bottom, size_t margin) {
+    return x + margin < left || x >= right + margin || y + margin < top || y >= bottom + margin;
+}
+
+int
+main(void) {
+    static uint8_t pixels[WIDTH * HEIGHT * 3];
+    static uint8_t mask[WIDTH * HEIGHT];
+    const size_t left = 40, top = 30, right = 70, bottom = 60;
+    int failures = 0;
+
+    for (size_t i = 0; i < sizeof(pixels); ++i) {
+        pixels[i] = (uint8_t) ((i * 7 + i / (WIDTH * 3) * 13) % 251);
+    }
+    for (size_t y = top; y < bottom; ++y) {
+        memset(mask + y * WIDTH + left, 0xFF, right - left);
+    }
+
+    resynth_state_t state = resynth_state_create_from_memory(pixels, WIDTH, HEIGHT, 3, 1);
+    resynth_parameters_t parameters = resynth_parameters_create();
+    resynth_parameters_operation(parameters, RESYNTH_OPERATION_HEAL);
+    resynth_parameters_random_seed(parameters, 5);
+    resynth_parameters_threads(parameters, 1);
+    resynth_parameters_correspondence(parameters, true);
+    resynth_parameters_mask(parameters, mask, WIDTH, HEIGHT, RESYNTH_MASK_TARGET);
+    resynth_result_t previous = resynth_run(state, parameters);
+    const uint32_t* sources = resynth_result_correspondence(previous);
+    if (sources == NULL) {
+        fprintf(stderr, "no correspondence from the first heal\n");
+        return 1;
+    }
+
+    // Grow the mask over the sources of interior pixels, well away from the hole: no band reaches them
+    size_t covered = 0;
+    for (size_t y = top + 8; y < bottom - 8; y += 4) {
+        for (size_t x = left + 8; x < right - 8; x += 4) {
+            size_t source = sources[y * WIDTH + x];  // y * WIDTH + x of the source
+            size_t sourceX = source % WIDTH, sourceY = source / WIDTH;
+            if (!is_far_from_hole(sourceX, sourceY, left, top, right, bottom, 12)) {
+                continue;
+            }
+            mask[source] = 0xFF;
+            ++covered;
+        }
+    }
+    if (covered == 0) {
+        fprintf(stderr, "no source far from the hole to cover\n");
+        return 1;
+    }
+    resynth_parameters_mask(parameters, mask, WIDTH, HEIGHT, RESYNTH_MASK_TARGET);
+    resynth_result_t result = resynth_run_incremental(state, parameters, previous);
+    sources = resynth_result_correspondence(result);
+    if (sources == NULL) {
+        fprintf(stderr, "incremental heal failed\n");
+        return 1;
+    }
+
+    for (size_t i = 0; i < WIDTH * HEIGHT; ++i) {
+        if (!mask[i]) {
+            continue;
+        }
+        if (sources[i] == RESYNTH_NO_SOURCE) {
+            ++failures;
+        } else if (mask[sources[i]]) {
+            ++failures;
+        }
+    }
+    printf("covered %zu sources, %d target pixels without a source outside the mask\n", covered, failures);
+
+    resynth_free_result(result);
+    resynth_free_result(previous);
+    resynth_free_parameters(parameters);
+    resynth_free_state(state);
+    return failures != 0;
+}